@@ -137,8 +137,12 @@ std::string ChaCha::update(const uint8_t *in, size_t length)
 {
     std::string output;
     output.resize(length);
-    unsigned char *out = reinterpret_cast<unsigned char*>(&output[0]);
+    update(in, length, reinterpret_cast<uint8_t*>(&output[0]));
+    return output;
+}
 
+void ChaCha::update(const uint8_t *in, size_t length, uint8_t *out)
+{
     uint32_t buf_size = m_buffer.size();
     for (uint32_t delta = buf_size - m_position;
          length >= delta;
@@ -152,7 +156,6 @@ std::string ChaCha::update(const uint8_t *in, size_t length)
 
     Common::exclusive_or(m_buffer.data() + m_position, in, out, length);
     m_position += length;
-    return output;
 }
 
 std::string ChaCha::update(const std::string &input)
@@ -46,6 +46,8 @@ public:
     //encrypt (or decrypt, same process for ChaCha algorithm) a byte array.
     std::string update(const uint8_t *input, size_t length);
     std::string update(const std::string &input);
+    // output has to hold length bytes. It may be input itself
+    void update(const uint8_t *input, size_t length, uint8_t *output);
 
 private:
     std::vector<uint32_t> m_state;
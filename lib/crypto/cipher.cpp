@@ -143,18 +143,33 @@ std::string Cipher::update(const std::string &data)
 
 std::string Cipher::update(const uint8_t *data, size_t length)
 {
-    if (chacha) {
-        return chacha->update(data, length);
-    }
-    if (rc4) {
-        return rc4->update(data, length);
+    std::string out;
+    update(data, length, out);
+    return out;
+}
+
+void Cipher::update(const uint8_t *data, size_t length, std::string &out)
+{
+    const size_t offset = out.size();
+    if (chacha || rc4) {
+        out.resize(offset + length);
+        auto *dest = reinterpret_cast<uint8_t *>(&out[offset]);
+        if (chacha) {
+            chacha->update(data, length, dest);
+        } else {
+            rc4->update(data, length, dest);
+        }
+        return;
     }
     if (pipe) {
         pipe->process_msg(reinterpret_cast<const Botan::byte *>
                           (data), length);
-        SecureByteArray c = pipe->read_all(Botan::Pipe::LAST_MESSAGE);
-        return std::string(reinterpret_cast<const char *>(DataOfSecureByteArray(c)),
-                           c.size());
+        // Read straight into out rather than through a temporary vector
+        const size_t produced = pipe->remaining(Botan::Pipe::LAST_MESSAGE);
+        out.resize(offset + produced);
+        pipe->read(reinterpret_cast<Botan::byte *>(&out[offset]), produced,
+                   Botan::Pipe::LAST_MESSAGE);
+        return;
     }
     throw std::logic_error("Underlying ciphers are all uninitialised!");
 }
@@ -62,6 +62,8 @@ public:
 
     std::string update(const std::string &data);
     std::string update(const uint8_t *data, size_t length);
+    // Appends the output to out
+    void update(const uint8_t *data, size_t length, std::string &out);
 
     /**
      * @brief incrementIv Increments the current nonce by 1
@@ -123,38 +123,46 @@ std::string Encryptor::encrypt(const std::string &in)
 }
 
 std::string Encryptor::encrypt(const uint8_t *data, size_t length)
+{
+    std::string out;
+    encrypt(data, length, out);
+    return out;
+}
+
+void Encryptor::encrypt(const uint8_t *data, size_t length, std::string &out)
 {
     if (length <= 0) {
-        return std::string();
+        return;
     }
 
-    std::string header;
     if (!enCipher) {
+        std::string header;
         initEncipher(&header);
+        out += header;
     }
 
-    std::string encrypted;
 #ifdef USE_BOTAN2
     if (cipherInfo.type == Cipher::CipherType::AEAD) {
-        uint16_t inLen = length > AEAD_CHUNK_SIZE_MASK ? AEAD_CHUNK_SIZE_MASK : length;
-        std::string rawLength(AEAD_CHUNK_SIZE_LEN, static_cast<char>(0));
-        qToBigEndian(inLen, reinterpret_cast<uint8_t*>(&rawLength[0]));
-        std::string encLength = enCipher->update(rawLength); // length + tag
-        enCipher->incrementIv();
-        std::string encPayload = enCipher->update(data, inLen); // payload + tag
-        enCipher->incrementIv();
-        encrypted = encLength + encPayload;
-        if (inLen < length) {
-            // Append the remaining part recursively if there is any
-            encrypted += encrypt(data + inLen, length - inLen);
+        const size_t chunks = (length + AEAD_CHUNK_SIZE_MASK - 1) / AEAD_CHUNK_SIZE_MASK;
+        out.reserve(out.size() + length
+                    + chunks * (AEAD_CHUNK_SIZE_LEN + 2 * cipherInfo.tagLen));
+        // Every chunk is an encrypted length (+ tag) and payload (+ tag)
+        while (length > 0) {
+            const uint16_t inLen = length > AEAD_CHUNK_SIZE_MASK ? AEAD_CHUNK_SIZE_MASK
+                                                                 : static_cast<uint16_t>(length);
+            uint8_t rawLength[AEAD_CHUNK_SIZE_LEN];
+            qToBigEndian(inLen, rawLength);
+            enCipher->update(rawLength, AEAD_CHUNK_SIZE_LEN, out);
+            enCipher->incrementIv();
+            enCipher->update(data, inLen, out);
+            enCipher->incrementIv();
+            data += inLen;
+            length -= inLen;
         }
-    } else {
-#endif
-        encrypted = enCipher->update(data, length);
-#ifdef USE_BOTAN2
+        return;
     }
 #endif
-    return header + encrypted;
+    enCipher->update(data, length, out);
 }
 
 std::string Encryptor::decrypt(const std::string &data)
@@ -62,6 +62,8 @@ public:
      */
     std::string encrypt(const std::string &);
     std::string encrypt(const uint8_t *data, size_t length);
+    // Appends the salt (if it's the first call) and the frames to out
+    void encrypt(const uint8_t *data, size_t length, std::string &out);
 
     /**
      * decryptAll and encryptAll are the counterpart for UDP packets
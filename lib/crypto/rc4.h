@@ -46,6 +46,8 @@ public:
 
     std::string update(const uint8_t *data, size_t length);
     std::string update(const std::string &input);
+    // output has to hold length bytes. It may be data itself
+    void update(const uint8_t *data, size_t length, uint8_t *output);
 
 private:
     void generate();
@@ -0,0 +1,525 @@
+/*
+ * batchudpsocket.cpp - a UDP socket with batched system calls
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "batchudpsocket.h"
+#include "util/bufferpool.h"
+#include "util/nativesocket.h"
+#include <QDebug>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <netinet/in.h>
+#include <unistd.h>
+#ifdef Q_OS_LINUX
+#include <netinet/udp.h>
+#endif
+
+#ifdef Q_OS_LINUX
+// Older C libraries don't have them yet
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+namespace {
+
+#ifdef Q_OS_LINUX
+typedef mmsghdr Message;
+#else
+struct Message {
+    msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#endif
+
+// Returns the number of messages transferred, or -1 with errno set if none
+int receiveMessages(int fd, Message *messages, unsigned int count)
+{
+#ifdef Q_OS_LINUX
+    return ::recvmmsg(fd, messages, count, MSG_DONTWAIT, nullptr);
+#else
+    unsigned int i = 0;
+    for (; i < count; ++i) {
+        const ssize_t received = ::recvmsg(fd, &messages[i].msg_hdr, MSG_DONTWAIT);
+        if (received < 0) {
+            break;
+        }
+        messages[i].msg_len = static_cast<unsigned int>(received);
+    }
+    return i > 0 ? static_cast<int>(i) : -1;
+#endif
+}
+
+int sendMessages(int fd, Message *messages, unsigned int count)
+{
+#ifdef Q_OS_LINUX
+    return ::sendmmsg(fd, messages, count, MSG_DONTWAIT);
+#else
+    unsigned int i = 0;
+    for (; i < count; ++i) {
+        const ssize_t sent = ::sendmsg(fd, &messages[i].msg_hdr, MSG_DONTWAIT);
+        if (sent < 0) {
+            break;
+        }
+        messages[i].msg_len = static_cast<unsigned int>(sent);
+    }
+    return i > 0 ? static_cast<int>(i) : -1;
+#endif
+}
+
+// Receive buffers are shared by all the sockets of a thread. They're only
+// used while one batch is being handled
+struct ReceiveBatch
+{
+    ReceiveBatch() :
+        pool(QSS::BatchUdpSocket::MaxDatagramSize, QSS::BatchUdpSocket::BatchSize)
+    {
+        for (int i = 0; i < QSS::BatchUdpSocket::BatchSize; ++i) {
+            iovs[i].iov_base = pool.block(pool.acquire());
+        }
+    }
+
+    void reset()
+    {
+        std::memset(messages, 0, sizeof(messages));
+        for (int i = 0; i < QSS::BatchUdpSocket::BatchSize; ++i) {
+            iovs[i].iov_len = QSS::BatchUdpSocket::MaxDatagramSize;
+            messages[i].msg_hdr.msg_name = &addrs[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            messages[i].msg_hdr.msg_iov = &iovs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_control = controls[i].buffer;
+            messages[i].msg_hdr.msg_controllen = sizeof(controls[i].buffer);
+        }
+    }
+
+    QSS::BufferPool pool;
+    Message messages[QSS::BatchUdpSocket::BatchSize];
+    iovec iovs[QSS::BatchUdpSocket::BatchSize];
+    sockaddr_storage addrs[QSS::BatchUdpSocket::BatchSize];
+    // Room for the UDP_GRO segment size
+    union {
+        cmsghdr align;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } controls[QSS::BatchUdpSocket::BatchSize];
+};
+
+#ifdef Q_OS_LINUX
+// The size of the coalesced datagrams in a message, or 0 if it's just one
+size_t groSegmentSize(msghdr *msg)
+{
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int size = 0;
+            std::memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            return size > 0 ? static_cast<size_t>(size) : 0;
+        }
+    }
+    return 0;
+}
+#endif
+
+thread_local std::unique_ptr<ReceiveBatch> threadBatch;
+// Batches being handled in this thread. Sends are deferred while it's not 0
+thread_local int dispatchDepth = 0;
+thread_local std::vector<QSS::BatchUdpSocket *> flushList;
+
+}  // namespace
+
+namespace QSS {
+
+BatchUdpSocket::BatchUdpSocket() :
+    fd(-1),
+    family(AF_UNSPEC),
+    dead(false),
+    queued(false),
+    busy(0),
+    readBudget(BatchSize),
+    offload(false),
+    gso(false),
+    gro(false)
+{
+}
+
+BatchUdpSocket::~BatchUdpSocket()
+{
+    // This may run from a notifier's own signal
+    for (std::unique_ptr<QSocketNotifier> *notifier : { &readNotifier, &writeNotifier }) {
+        if (*notifier) {
+            (*notifier)->setEnabled(false);
+            (*notifier)->disconnect();
+            notifier->release()->deleteLater();
+        }
+    }
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
+std::shared_ptr<BatchUdpSocket> BatchUdpSocket::create()
+{
+    return std::shared_ptr<BatchUdpSocket>(new BatchUdpSocket(),
+                                           [](BatchUdpSocket *s) { s->release(); });
+}
+
+void BatchUdpSocket::release()
+{
+    dead = true;
+    datagramHandler = nullptr;
+    writtenHandler = nullptr;
+    if (queued) {
+        flushList.erase(std::find(flushList.begin(), flushList.end(), this));
+        queued = false;
+    }
+    deleteIfIdle();
+}
+
+void BatchUdpSocket::deleteIfIdle()
+{
+    if (dead && busy == 0) {
+        delete this;
+    }
+}
+
+bool BatchUdpSocket::isOpen() const
+{
+    return fd != -1;
+}
+
+void BatchUdpSocket::setDatagramHandler(DatagramHandler handler)
+{
+    datagramHandler = std::move(handler);
+}
+
+void BatchUdpSocket::setWrittenHandler(WrittenHandler handler)
+{
+    writtenHandler = std::move(handler);
+}
+
+void BatchUdpSocket::setReadBudget(int datagrams)
+{
+    readBudget = std::max(datagrams, 1);
+}
+
+void BatchUdpSocket::setOffloadEnabled(bool enabled)
+{
+    offload = enabled;
+    if (fd != -1) {
+        detectOffload();
+    }
+}
+
+void BatchUdpSocket::detectOffload()
+{
+#ifdef Q_OS_LINUX
+    const int on = offload ? 1 : 0;
+    gro = ::setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0 && offload;
+    // Sending with UDP_SEGMENT works where the option can be read
+    int size = 0;
+    socklen_t length = sizeof(size);
+    gso = offload && ::getsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, &length) == 0;
+#endif
+}
+
+bool BatchUdpSocket::open(int socketFamily, bool v6Only)
+{
+    fd = NativeSocket::createUdpSocket(socketFamily, v6Only);
+    if (fd == -1) {
+        return false;
+    }
+    family = socketFamily;
+    if (offload) {
+        detectOffload();
+    }
+    readNotifier = std::make_unique<QSocketNotifier>(fd, QSocketNotifier::Read);
+    writeNotifier = std::make_unique<QSocketNotifier>(fd, QSocketNotifier::Write);
+    writeNotifier->setEnabled(false);
+    QObject::connect(readNotifier.get(), &QSocketNotifier::activated,
+                     readNotifier.get(), [this]() { onReadable(); });
+    QObject::connect(writeNotifier.get(), &QSocketNotifier::activated,
+                     writeNotifier.get(), [this]() {
+        writeNotifier->setEnabled(false);
+        flush();
+    });
+    return true;
+}
+
+bool BatchUdpSocket::bind(const QHostAddress &addr, uint16_t port)
+{
+    // Same semantics as QUdpSocket: Any is dual-stack, AnyIPv6 is not
+    const auto protocol = addr.protocol();
+    const bool opened = protocol == QAbstractSocket::IPv4Protocol
+            ? open(AF_INET, false)
+            : open(AF_INET6, protocol == QAbstractSocket::IPv6Protocol);
+    if (!opened) {
+        return false;
+    }
+    // ShareAddress | ReuseAddressHint
+    const int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_storage ss;
+    const socklen_t len = NativeSocket::toSockaddr(addr, port, &ss);
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&ss), len) != 0) {
+        QDebug(QtMsgType::QtCriticalMsg).noquote() << "[UDP] bind failed:" << strerror(errno);
+        readNotifier.reset();
+        writeNotifier.reset();
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void BatchUdpSocket::onReadable()
+{
+    if (!threadBatch) {
+        threadBatch = std::make_unique<ReceiveBatch>();
+    }
+    ReceiveBatch &batch = *threadBatch;
+
+    ++busy;
+    ++dispatchDepth;
+    // Up to the budget per notification. The notifier fires again if more
+    // are waiting
+    for (int budget = readBudget; budget > 0 && !dead;) {
+        const int wanted = budget < BatchSize ? budget : int(BatchSize);
+        batch.reset();
+        const int count = receiveMessages(fd, batch.messages, wanted);
+        if (count < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                QDebug(QtMsgType::QtCriticalMsg).noquote() << "[UDP] socket error" << strerror(errno);
+            }
+            break;
+        }
+        for (int i = 0; i < count && !dead; ++i) {
+            const Message &message = batch.messages[i];
+            if (message.msg_hdr.msg_flags & MSG_TRUNC) {
+                qWarning("[UDP] Datagram is too large. Discarded.");
+                continue;
+            }
+            uint16_t port = 0;
+            const QHostAddress addr = NativeSocket::fromSockaddr(
+                        reinterpret_cast<const sockaddr *>(&batch.addrs[i]), &port);
+            const auto *data = static_cast<const uint8_t *>(batch.iovs[i].iov_base);
+            size_t segment = message.msg_len;
+#ifdef Q_OS_LINUX
+            if (gro) {
+                const size_t coalesced = groSegmentSize(&batch.messages[i].msg_hdr);
+                if (coalesced > 0) {
+                    segment = coalesced;
+                }
+            }
+#endif
+            // Every segment is a datagram of its own, the last one may be shorter
+            for (size_t offset = 0; offset < message.msg_len && !dead; offset += segment) {
+                if (datagramHandler) {
+                    datagramHandler(data + offset,
+                                    std::min<size_t>(segment, message.msg_len - offset),
+                                    addr, port);
+                }
+            }
+            if (message.msg_len == 0 && datagramHandler) {
+                datagramHandler(data, 0, addr, port);
+            }
+        }
+        budget -= count;
+        if (count < wanted) {
+            // Drained
+            break;
+        }
+    }
+    if (--dispatchDepth == 0) {
+        flushQueued();
+    }
+    --busy;
+    deleteIfIdle();
+}
+
+void BatchUdpSocket::send(std::string data, const QHostAddress &addr, uint16_t port)
+{
+    if (dead) {
+        return;
+    }
+    if (fd == -1) {
+        // Prefer a dual-stack socket so one association can reach both families
+        if (!open(AF_INET6, false) && !open(AF_INET, false)) {
+            QDebug(QtMsgType::QtCriticalMsg).noquote() << "[UDP] client socket error" << strerror(errno);
+            return;
+        }
+    }
+    if (family == AF_INET && addr.protocol() != QAbstractSocket::IPv4Protocol) {
+        qDebug("[UDP] Drop a packet since IPv6 is unavailable.");
+        return;
+    }
+    if (outgoing.size() >= MaxPendingSends) {
+        qDebug("[UDP] Drop a packet since the send queue is full.");
+        return;
+    }
+
+    Outgoing datagram;
+    datagram.data = std::move(data);
+    datagram.addrLength = NativeSocket::toSockaddr(addr, port, &datagram.addr,
+                                                   family == AF_INET6);
+    outgoing.push_back(std::move(datagram));
+
+    if (dispatchDepth > 0) {
+        if (!queued) {
+            queued = true;
+            flushList.push_back(this);
+        }
+    } else if (!writeNotifier->isEnabled()) {
+        flush();
+    }
+}
+
+void BatchUdpSocket::flushQueued()
+{
+    // A written handler may release any of them, which takes it off the list
+    while (!flushList.empty()) {
+        BatchUdpSocket *socket = flushList.back();
+        flushList.pop_back();
+        socket->queued = false;
+        socket->flush();
+    }
+}
+
+size_t BatchUdpSocket::segmentRun(size_t first) const
+{
+    const Outgoing &head = outgoing[first];
+    const size_t size = head.data.size();
+    size_t run = 1;
+    size_t total = size;
+    for (size_t i = first + 1; i < outgoing.size() && run < MaxSegments; ++i) {
+        const Outgoing &datagram = outgoing[i];
+        if (datagram.addrLength != head.addrLength
+                || std::memcmp(&datagram.addr, &head.addr, head.addrLength) != 0
+                || datagram.data.empty()
+                || datagram.data.size() > size
+                || total + datagram.data.size() > MaxSegmentedSize) {
+            break;
+        }
+        ++run;
+        total += datagram.data.size();
+        // Only the last segment may be shorter
+        if (datagram.data.size() < size) {
+            break;
+        }
+    }
+    return run;
+}
+
+void BatchUdpSocket::flush()
+{
+    Message messages[BatchSize];
+    size_t runs[BatchSize];     // datagrams in each message
+    iovec iovs[MaxSegments * 4];
+#ifdef Q_OS_LINUX
+    // Room for the UDP_SEGMENT size
+    union {
+        cmsghdr align;
+        char buffer[CMSG_SPACE(sizeof(uint16_t))];
+    } controls[BatchSize];
+#endif
+
+    ++busy;
+    while (!outgoing.empty() && !dead) {
+        unsigned int count = 0;
+        size_t next = 0;
+        size_t usedIovs = 0;
+        while (count < BatchSize && next < outgoing.size()) {
+            const size_t run = gso && !outgoing[next].data.empty() ? segmentRun(next) : 1;
+            if (usedIovs + run > sizeof(iovs) / sizeof(iovs[0])) {
+                break;
+            }
+            Message &message = messages[count];
+            std::memset(&message, 0, sizeof(message));
+            for (size_t i = 0; i < run; ++i) {
+                Outgoing &datagram = outgoing[next + i];
+                iovs[usedIovs + i].iov_base = &datagram.data[0];
+                iovs[usedIovs + i].iov_len = datagram.data.size();
+            }
+            message.msg_hdr.msg_name = &outgoing[next].addr;
+            message.msg_hdr.msg_namelen = outgoing[next].addrLength;
+            message.msg_hdr.msg_iov = &iovs[usedIovs];
+            message.msg_hdr.msg_iovlen = run;
+#ifdef Q_OS_LINUX
+            if (run > 1) {
+                message.msg_hdr.msg_control = controls[count].buffer;
+                message.msg_hdr.msg_controllen = sizeof(controls[count].buffer);
+                cmsghdr *cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                const auto segment = static_cast<uint16_t>(outgoing[next].data.size());
+                std::memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+            }
+#endif
+            runs[count] = run;
+            usedIovs += run;
+            next += run;
+            ++count;
+        }
+
+        const int sent = sendMessages(fd, messages, count);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                writeNotifier->setEnabled(true);
+                break;
+            }
+            if (runs[0] > 1 && (errno == EIO || errno == EINVAL || errno == EMSGSIZE)) {
+                // e.g. the device can't checksum segments, or the segments
+                // exceed the path MTU. Send them one by one from now on
+                QDebug(QtMsgType::QtDebugMsg).noquote()
+                        << "[UDP] Segmentation offload failed:" << strerror(errno)
+                        << "Disabled on this socket";
+                gso = false;
+                continue;
+            }
+            // The first datagram can't be sent at all (e.g. unreachable)
+            QDebug(QtMsgType::QtDebugMsg).noquote() << "[UDP] send failed:" << strerror(errno);
+            outgoing.pop_front();
+            continue;
+        }
+        size_t bytes = 0;
+        for (int i = 0; i < sent; ++i) {
+            bytes += messages[i].msg_len;
+            for (size_t j = 0; j < runs[i]; ++j) {
+                outgoing.pop_front();
+            }
+        }
+        if (writtenHandler) {
+            writtenHandler(bytes);
+        }
+    }
+    --busy;
+    deleteIfIdle();
+}
+
+}  // namespace QSS
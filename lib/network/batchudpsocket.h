@@ -0,0 +1,118 @@
+/*
+ * batchudpsocket.h - the header file of BatchUdpSocket class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCHUDPSOCKET_H
+#define BATCHUDPSOCKET_H
+
+#include <QSocketNotifier>
+#include <deque>
+#include <memory>
+#include <sys/socket.h>
+#include "nativeudpsocket.h"
+
+namespace QSS {
+
+/**
+ * A UDP socket that reads and writes datagrams in batches.
+ *
+ * Every read notification drains up to the read budget of datagrams, with
+ * one recvmmsg() per BatchSize of them into per-thread buffers. Datagrams sent while any batch of the
+ * thread is being handled are queued, then flushed with sendmmsg() once
+ * the batch is done, so relaying a batch costs two system calls per
+ * socket instead of two per datagram. Platforms without recvmmsg() and
+ * sendmmsg() loop over recvmsg() and sendmsg() instead.
+ *
+ * With offload enabled on Linux, the kernel coalesces the datagrams of a
+ * flow on receive (UDP_GRO), and a run of equally sized datagrams to one
+ * destination is sent as a single buffer (UDP_SEGMENT). Buffers are split
+ * into datagrams before the handler, so callers still see one datagram at
+ * a time.
+ */
+class QSS_EXPORT BatchUdpSocket : public NativeUdpSocket
+{
+public:
+    static std::shared_ptr<BatchUdpSocket> create();
+
+    bool bind(const QHostAddress &addr, uint16_t port) override;
+    void send(std::string data, const QHostAddress &addr, uint16_t port) override;
+    bool isOpen() const override;
+
+    void setDatagramHandler(DatagramHandler handler) override;
+    void setWrittenHandler(WrittenHandler handler) override;
+
+    // Whether the kernel supports it is detected when the socket is opened.
+    // It's silently off if it doesn't
+    void setOffloadEnabled(bool enabled);
+    // Datagrams read per notification, so that one busy socket can't starve
+    // the others. A coalesced (GRO) buffer counts as one
+    void setReadBudget(int datagrams);
+
+    // Datagrams read or written per system call
+    static const int BatchSize = 32;
+    static const size_t MaxDatagramSize = 65536;
+
+private:
+    BatchUdpSocket();
+    ~BatchUdpSocket() override;
+
+    // Datagrams are dropped when the socket stays unwritable this long
+    static const size_t MaxPendingSends = 1024;
+    // Limits of the kernel (UDP_MAX_SEGMENTS) and of an IPv4 UDP payload
+    static const size_t MaxSegments = 64;
+    static const size_t MaxSegmentedSize = 65507;
+
+    struct Outgoing {
+        std::string data;
+        sockaddr_storage addr;
+        socklen_t addrLength;
+    };
+
+    int fd;
+    int family;
+    bool dead;
+    bool queued;    // in the thread's list of sockets to flush
+    int busy;       // inside handlers, which may drop the last reference
+    int readBudget;
+    bool offload;
+    bool gso;
+    bool gro;
+    std::unique_ptr<QSocketNotifier> readNotifier;
+    std::unique_ptr<QSocketNotifier> writeNotifier;
+    std::deque<Outgoing> outgoing;
+    DatagramHandler datagramHandler;
+    WrittenHandler writtenHandler;
+
+    bool open(int family, bool v6Only);
+    void detectOffload();
+    // Returns the number of queued datagrams that can go in one send
+    size_t segmentRun(size_t first) const;
+    void release();
+    void deleteIfIdle();
+    void onReadable();
+    void flush();
+    // Flushes the sockets that queued datagrams during the last batch
+    static void flushQueued();
+};
+
+}
+
+#endif // BATCHUDPSOCKET_H
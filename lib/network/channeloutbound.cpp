@@ -0,0 +1,174 @@
+/*
+ * channeloutbound.cpp - the source file of ChannelOutbound class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "channeloutbound.h"
+#include "util/common.h"
+#include <QDebug>
+#include <utility>
+
+namespace QSS {
+
+ChannelOutbound::ChannelOutbound(std::shared_ptr<StreamChannel> stream,
+                                 const std::string &header,
+                                 QObject *parent) :
+    QObject(parent),
+    stream(std::move(stream)),
+    socket(new QTcpSocket())
+{
+    int headerLength = 0;
+    Common::parseHeader(header, target, headerLength);
+    if (headerLength == 0) {
+        qWarning("Can't parse the header of a stream");
+        this->stream->abort();
+        finish();
+        return;
+    }
+    QDebug(QtMsgType::QtInfoMsg).noquote() << "Connecting" << target << "(stream)";
+
+    StreamChannel *s = this->stream.get();
+    connect(s, &StreamChannel::dataReceived, this, &ChannelOutbound::onStreamData);
+    connect(s, &StreamChannel::bytesWritten, this, &ChannelOutbound::onStreamWritten);
+    connect(s, &StreamChannel::finished, this, &ChannelOutbound::onStreamFinished);
+    connect(s, &StreamChannel::aborted, this, [this]() {
+        socket->abort();
+        finish();
+    });
+
+    socket->setReadBufferSize(RecvSize);
+    connect(socket.get(), &QTcpSocket::connected, this, &ChannelOutbound::onConnected);
+    connect(socket.get(), &QTcpSocket::readyRead, this, &ChannelOutbound::onReadyRead);
+    connect(socket.get(), &QTcpSocket::bytesWritten, this, [this](qint64 bytes) {
+        emit bytesSend(bytes);
+        this->stream->consumed(bytes);
+    });
+    connect(socket.get(), &QTcpSocket::disconnected, this, [this]() {
+        if (socket->bytesAvailable() > 0) {
+            // Left in the read buffer while paused
+            const QByteArray rest = socket->readAll();
+            emit bytesRead(rest.size());
+            this->stream->write(std::string(rest.constData(), rest.size()));
+        }
+        this->stream->close();
+        finish();
+    });
+    connect(socket.get(),
+            static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
+            (&QTcpSocket::error),
+            this,
+            [this]() {
+        if (socket->error() == QAbstractSocket::RemoteHostClosedError) {
+            // Followed by disconnected()
+            return;
+        }
+        QDebug(QtMsgType::QtDebugMsg).noquote() << "Outbound socket:" << socket->errorString();
+        this->stream->abort();
+        finish();
+    });
+
+    target.lookUp([this](bool success) {
+        if (success) {
+            startTime = QTime::currentTime();
+            socket->connectToHost(target.getFirstIP(), target.getPort());
+        } else {
+            QDebug(QtMsgType::QtDebugMsg).noquote() << "Failed to lookup" << target;
+            this->stream->abort();
+            finish();
+        }
+    });
+}
+
+ChannelOutbound::~ChannelOutbound()
+{
+    socket->disconnect(this);
+    stream->disconnect(this);
+}
+
+void ChannelOutbound::onConnected()
+{
+    emit latencyAvailable(startTime.msecsTo(QTime::currentTime()));
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    if (!dataToWrite.empty()) {
+        socket->write(dataToWrite.data(), dataToWrite.size());
+        dataToWrite.clear();
+    }
+    if (finReceived) {
+        socket->disconnectFromHost();
+    }
+}
+
+void ChannelOutbound::onReadyRead()
+{
+    // The stream's window bounds how much the session sends for us
+    if (stream->pending() >= HighWatermark) {
+        readPaused = true;
+        return;
+    }
+    std::string buf;
+    buf.resize(RecvSize);
+    const int64_t readSize = socket->read(&buf[0], buf.size());
+    if (readSize <= 0) {
+        return;
+    }
+    buf.resize(readSize);
+    emit bytesRead(buf.size());
+    stream->write(buf);
+}
+
+void ChannelOutbound::onStreamData(const std::string &data)
+{
+    if (socket->state() == QAbstractSocket::ConnectedState) {
+        socket->write(data.data(), data.size());
+    } else {
+        dataToWrite += data;
+    }
+}
+
+void ChannelOutbound::onStreamWritten()
+{
+    if (readPaused && stream->pending() <= HighWatermark / 4) {
+        readPaused = false;
+        if (socket->bytesAvailable() > 0) {
+            onReadyRead();
+        }
+    }
+}
+
+void ChannelOutbound::onStreamFinished()
+{
+    finReceived = true;
+    if (socket->state() == QAbstractSocket::ConnectedState) {
+        socket->disconnectFromHost();
+    }
+}
+
+void ChannelOutbound::finish()
+{
+    if (done) {
+        return;
+    }
+    done = true;
+    // Can be called from the signals of the socket or the stream
+    deleteLater();
+}
+
+}  // namespace QSS
@@ -0,0 +1,79 @@
+/*
+ * channeloutbound.h - the header file of ChannelOutbound class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHANNELOUTBOUND_H
+#define CHANNELOUTBOUND_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QTime>
+#include <memory>
+#include "streamchannel.h"
+#include "types/address.h"
+
+namespace QSS {
+
+/**
+ * Server mode: connects a stream opened by a client (see StreamChannel) to
+ * its target and relays data between them. It deletes itself once either side is done.
+ */
+class QSS_EXPORT ChannelOutbound : public QObject
+{
+    Q_OBJECT
+public:
+    ChannelOutbound(std::shared_ptr<StreamChannel> stream,
+                    const std::string &header,
+                    QObject *parent = nullptr);
+    ~ChannelOutbound();
+
+    ChannelOutbound(const ChannelOutbound &) = delete;
+
+signals:
+    // See TcpRelay::bytesRead() and TcpRelay::latencyAvailable()
+    void bytesRead(quint64);
+    void bytesSend(quint64);
+    void latencyAvailable(int);
+
+private:
+    static const int64_t RecvSize = 65536;
+    static const int64_t HighWatermark = 4 * RecvSize;
+
+    std::shared_ptr<StreamChannel> stream;
+    std::unique_ptr<QTcpSocket> socket;
+    Address target;
+    std::string dataToWrite;   // received before the target is connected
+    QTime startTime;
+    bool readPaused = false;
+    bool finReceived = false;
+    bool done = false;
+
+    void onConnected();
+    void onReadyRead();
+    void onStreamData(const std::string &data);
+    void onStreamWritten();
+    void onStreamFinished();
+    void finish();
+};
+
+}
+
+#endif // CHANNELOUTBOUND_H
@@ -0,0 +1,191 @@
+/*
+ * connectionpool.cpp - the source file of ConnectionPool class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "connectionpool.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace QSS {
+
+ConnectionPool::ConnectionPool(Address server, int maxSize, QObject *parent) :
+    QObject(parent),
+    server(std::move(server)),
+    maxSize(maxSize)
+{
+    clock.start();
+    ticker.setInterval(TickInterval);
+    connect(&ticker, &QTimer::timeout, this, &ConnectionPool::onTick);
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    // Pooled sockets are children of this object and are deleted only after
+    // the members their signals refer to
+    for (const Entry &e : idle) {
+        e.socket->disconnect(this);
+    }
+    for (QTcpSocket *socket : connecting) {
+        socket->disconnect(this);
+    }
+}
+
+void ConnectionPool::setMaxIdleTime(int msec)
+{
+    maxIdleTime = msec;
+}
+
+int ConnectionPool::idleCount() const
+{
+    return static_cast<int>(idle.size());
+}
+
+std::unique_ptr<QTcpSocket> ConnectionPool::take()
+{
+    ++claims;
+    if (!ticker.isActive()) {
+        ticker.start();
+    }
+    std::unique_ptr<QTcpSocket> result;
+    while (!result && !idle.empty()) {
+        // The newest one is the least likely to be dropped by a middlebox
+        QTcpSocket *socket = idle.back().socket;
+        idle.pop_back();
+        socket->disconnect(this);
+        if (socket->state() != QAbstractSocket::ConnectedState
+                || socket->bytesAvailable() > 0) {
+            // The server shouldn't send anything before the client does
+            socket->deleteLater();
+            continue;
+        }
+        socket->setParent(nullptr);
+        result.reset(socket);
+    }
+    refill();
+    return result;
+}
+
+int ConnectionPool::target() const
+{
+    // A burst within the current tick counts in full
+    const double demand = std::max(rate, static_cast<double>(claims));
+    return std::min(maxSize, static_cast<int>(std::ceil(demand)));
+}
+
+void ConnectionPool::refill()
+{
+    if (clock.elapsed() < retryAt) {
+        return;
+    }
+    if (!server.isIPValid()) {
+        if (!resolving) {
+            resolving = true;
+            server.lookUp([this](bool success) {
+                resolving = false;
+                if (success) {
+                    refill();
+                } else {
+                    retryAt = clock.elapsed() + RetryInterval;
+                }
+            });
+        }
+        return;
+    }
+    const int have = static_cast<int>(idle.size() + connecting.size());
+    for (int i = have; i < target(); ++i) {
+        open();
+    }
+}
+
+void ConnectionPool::open()
+{
+    auto *socket = new QTcpSocket(this);
+    socket->setReadBufferSize(65536);
+    connecting.push_back(socket);
+    connect(socket, &QTcpSocket::connected, this, [this, socket]() {
+        onConnected(socket);
+    });
+    connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+        discard(socket);
+    });
+    connect(socket,
+            static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
+            (&QTcpSocket::error),
+            this,
+            [this, socket]() {
+        if (socket->state() != QAbstractSocket::ConnectedState) {
+            QDebug(QtMsgType::QtDebugMsg).noquote()
+                    << "Connection pool:" << socket->errorString();
+            retryAt = clock.elapsed() + RetryInterval;
+        }
+        discard(socket);
+    });
+    socket->connectToHost(server.getFirstIP(), server.getPort());
+}
+
+void ConnectionPool::onConnected(QTcpSocket *socket)
+{
+    connecting.erase(std::remove(connecting.begin(), connecting.end(), socket),
+                     connecting.end());
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    idle.push_back(Entry{socket, clock.elapsed()});
+}
+
+void ConnectionPool::discard(QTcpSocket *socket)
+{
+    connecting.erase(std::remove(connecting.begin(), connecting.end(), socket),
+                     connecting.end());
+    idle.erase(std::remove_if(idle.begin(), idle.end(), [socket](const Entry &e) {
+        return e.socket == socket;
+    }), idle.end());
+    socket->disconnect(this);
+    // Can be called from the socket's own signal
+    socket->deleteLater();
+}
+
+void ConnectionPool::onTick()
+{
+    rate = rate * 0.75 + claims * 0.25;
+    if (rate < 0.01) {
+        // Let the pool drain completely once it's quiet
+        rate = 0;
+    }
+    claims = 0;
+
+    const qint64 now = clock.elapsed();
+    while (!idle.empty() && now - idle.front().since >= maxIdleTime) {
+        discard(idle.front().socket);
+    }
+    // Shrink (oldest first) once the demand went down
+    while (static_cast<int>(idle.size()) > target()) {
+        discard(idle.front().socket);
+    }
+    refill();
+    if (rate == 0 && idle.empty() && connecting.empty() && !resolving) {
+        // Nothing to do until the next take()
+        ticker.stop();
+    }
+}
+
+}  // namespace QSS
@@ -0,0 +1,99 @@
+/*
+ * connectionpool.h - the header file of ConnectionPool class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTcpSocket>
+#include <QTimer>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "types/address.h"
+
+namespace QSS {
+
+/**
+ * A self-refilling pool of established TCP connections to the shadowsocks
+ * server, so that a new local connection doesn't wait for a handshake.
+ * Nothing is sent on a pooled connection before it's taken, which keeps the
+ * protocol unchanged. The pool size follows the recent rate of take() calls
+ * (up to maxSize) and idle connections expire after maxIdleTime. Once the
+ * demand is gone and the pool is empty, it sleeps until the next take().
+ */
+class QSS_EXPORT ConnectionPool : public QObject
+{
+    Q_OBJECT
+public:
+    ConnectionPool(Address server, int maxSize, QObject *parent = nullptr);
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool &) = delete;
+
+    /*
+     * Returns an established connection to the server, or nullptr if none is
+     * ready. The caller owns the returned socket. Every call counts as demand
+     * no matter whether a connection was available.
+     */
+    std::unique_ptr<QTcpSocket> take();
+
+    // Idle connections older than msec are closed (15 seconds by default)
+    void setMaxIdleTime(int msec);
+
+    int idleCount() const;
+
+private:
+    static const int TickInterval = 1000;
+    static const int DefaultMaxIdleTime = 15000;
+    // Don't retry for a while after a connection to the server failed
+    static const int RetryInterval = 5000;
+
+    struct Entry {
+        QTcpSocket *socket;
+        qint64 since;
+    };
+
+    Address server;
+    const int maxSize;
+    int maxIdleTime = DefaultMaxIdleTime;
+    std::deque<Entry> idle;      // oldest first
+    std::vector<QTcpSocket *> connecting;
+    QTimer ticker;
+    QElapsedTimer clock;
+    qint64 retryAt = 0;
+    bool resolving = false;
+    int claims = 0;    // take() calls since the last tick
+    double rate = 0;   // smoothed take() calls per tick
+
+    int target() const;
+    void refill();
+    void open();
+    void onTick();
+    void onConnected(QTcpSocket *socket);
+    void discard(QTcpSocket *socket);
+};
+
+}
+
+#endif // CONNECTIONPOOL_H
@@ -0,0 +1,304 @@
+/*
+ * epollengine.cpp - the source file of EpollEngine class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "epollengine.h"
+#include "util/common.h"
+#include "util/nativesocket.h"
+#include <QDebug>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace QSS {
+
+EpollEngine::EpollEngine(Settings settings, QObject *parent) :
+    FdRelayEngine(std::move(settings), parent),
+    epfd(-1),
+    listenFd(-1)
+{
+}
+
+EpollEngine::~EpollEngine()
+{
+    detach();
+}
+
+bool EpollEngine::attach(qintptr listenDescriptor)
+{
+    epfd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        qWarning("epoll_create1 failed: %s", strerror(errno));
+        return false;
+    }
+
+    // A null data pointer identifies the listening socket
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = nullptr;
+    if (::epoll_ctl(epfd, EPOLL_CTL_ADD, listenDescriptor, &ev) != 0) {
+        qWarning("Failed to watch the listening socket: %s", strerror(errno));
+        ::close(epfd);
+        epfd = -1;
+        return false;
+    }
+    listenFd = listenDescriptor;
+
+    notifier = std::make_unique<QSocketNotifier>(epfd, QSocketNotifier::Read);
+    connect(notifier.get(), &QSocketNotifier::activated,
+            this, &EpollEngine::onEpollReady);
+    // Pick up connections that were queued before we got attached
+    acceptAll();
+    return true;
+}
+
+void EpollEngine::detach()
+{
+    if (epfd == -1) {
+        return;
+    }
+    FdRelayEngine::detach();
+    notifier.reset();
+    ::close(epfd);
+    epfd = -1;
+    // The listening socket is owned by TcpServer
+    listenFd = -1;
+}
+
+void EpollEngine::onEpollReady()
+{
+    epoll_event events[MaxEvents];
+    const int n = ::epoll_wait(epfd, events, MaxEvents, 0);
+    beginBatch();
+    for (int i = 0; i < n; ++i) {
+        if (events[i].data.ptr == nullptr) {
+            acceptAll();
+        } else {
+            handleEvents(*static_cast<FdEndpoint *>(events[i].data.ptr),
+                         events[i].events);
+        }
+    }
+    endBatch();
+    // If there were more than MaxEvents, epfd is still readable and the
+    // notifier fires again in the next event loop iteration
+}
+
+void EpollEngine::acceptAll()
+{
+    for (;;) {
+        const int fd = ::accept4(listenFd, nullptr, nullptr,
+                                 SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // e.g. EMFILE. The next incoming connection triggers a retry
+                qWarning("accept4 failed: %s", strerror(errno));
+            }
+            return;
+        }
+
+        if (!settings().isLocal && settings().autoBan) {
+            sockaddr_storage ss;
+            socklen_t len = sizeof(ss);
+            uint16_t port = 0;
+            if (::getpeername(fd, reinterpret_cast<sockaddr *>(&ss), &len) == 0) {
+                QHostAddress peer = NativeSocket::fromSockaddr(
+                            reinterpret_cast<sockaddr *>(&ss), &port);
+                if (Common::isAddressBanned(peer)) {
+                    QDebug(QtMsgType::QtInfoMsg).noquote() << "A banned IP" << peer
+                                                           << "attempted to access this server";
+                    ::close(fd);
+                    continue;
+                }
+            }
+        }
+
+        NativeSocket::setNoDelay(fd);
+        NativeSocket::setKeepAlive(fd);
+        NativeSocket::setNotSentLowat(fd, settings().notSentLowat);
+        addRelay(fd);
+    }
+}
+
+bool EpollEngine::watch(FdEndpoint &ep)
+{
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = &ep;
+    if (::epoll_ctl(epfd, EPOLL_CTL_ADD, ep.fd, &ev) != 0) {
+        qWarning("epoll_ctl failed: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void EpollEngine::unwatch(FdEndpoint &ep)
+{
+    ::epoll_ctl(epfd, EPOLL_CTL_DEL, ep.fd, nullptr);
+}
+
+bool EpollEngine::connectRemote(FdEndpoint &ep, const QHostAddress &ip, uint16_t port)
+{
+    sockaddr_storage ss;
+    const socklen_t len = NativeSocket::toSockaddr(ip, port, &ss);
+    ep.fd = NativeSocket::createTcpSocket(ss.ss_family);
+    if (ep.fd == -1) {
+        return false;
+    }
+    NativeSocket::setNoDelay(ep.fd);
+    NativeSocket::setKeepAlive(ep.fd);
+
+    ep.connecting = true;
+    if (settings().fastOpen && !ep.out.empty()) {
+        const std::string &first = ep.out.front();
+        const int64_t sent = NativeSocket::connectFastOpen(ep.fd, ip, port,
+                                                           first.data() + ep.outOffset,
+                                                           first.size() - ep.outOffset);
+        if (sent >= 0 || errno == EINPROGRESS) {
+            ep.fastOpen = true;
+            if (sent > 0) {
+                consume(ep, sent);
+                ep.relay->handleWritten(static_cast<FdRelay::Side>(ep.side), sent);
+            }
+            return watch(ep);
+        }
+        // TFO is disabled in the kernel, the socket is still unconnected
+    }
+    if (::connect(ep.fd, reinterpret_cast<sockaddr *>(&ss), len) != 0
+            && errno != EINPROGRESS) {
+        return false;
+    }
+    // EPOLLOUT is reported once the connection is established (or failed)
+    return watch(ep);
+}
+
+void EpollEngine::handleEvents(FdEndpoint &ep, uint32_t events)
+{
+    FdRelay *relay = ep.relay;
+    if (relay->isClosed()) {
+        // Closed by an earlier event of this batch
+        return;
+    }
+    const auto side = static_cast<FdRelay::Side>(ep.side);
+
+    if (ep.connecting) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            return;
+        }
+        int error = 0;
+        socklen_t len = sizeof(error);
+        ::getsockopt(ep.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (error != 0) {
+            relay->handleError(side, error);
+            return;
+        }
+        relay->handleConnected();
+        if (relay->isClosed()) {
+            return;
+        }
+    } else if (events & EPOLLOUT) {
+        flush(ep);
+        if (relay->isClosed()) {
+            return;
+        }
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        drain(ep);
+    }
+}
+
+void EpollEngine::drain(FdEndpoint &ep)
+{
+    FdRelay *relay = ep.relay;
+    const auto side = static_cast<FdRelay::Side>(ep.side);
+    // Edge-triggered: keep reading until EAGAIN, unless the relay asks to
+    // pause. resume() brings us back here since no new edge will come
+    for (int reads = 0; !ep.paused && !ep.eof && !relay->isClosed(); ++reads) {
+        if (reads == settings().readBudget) {
+            // Let the other connections have their turn, and carry on in the
+            // next event loop iteration
+            requestResume(ep);
+            return;
+        }
+        const ssize_t n = ::read(ep.fd, recvBuffer.data(), RecvSize);
+        if (n > 0) {
+            relay->handleData(side, recvBuffer.data(), n);
+        } else if (n == 0) {
+            relay->handleEof(side);
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        } else {
+            relay->handleError(side, errno);
+        }
+    }
+}
+
+void EpollEngine::resume(FdEndpoint &ep)
+{
+    drain(ep);
+}
+
+void EpollEngine::flush(FdEndpoint &ep)
+{
+    FdRelay *relay = ep.relay;
+    const auto side = static_cast<FdRelay::Side>(ep.side);
+    while (!ep.out.empty() && !relay->isClosed()) {
+        iovec iov[MaxIovecs];
+        int count = 0;
+        size_t offset = ep.outOffset;
+        for (auto it = ep.out.begin(); it != ep.out.end() && count < MaxIovecs; ++it) {
+            iov[count].iov_base = &(*it)[offset];
+            iov[count].iov_len = it->size() - offset;
+            offset = 0;
+            ++count;
+        }
+
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        const ssize_t n = ::sendmsg(ep.fd, &msg, MSG_NOSIGNAL);
+        if (n >= 0) {
+            consume(ep, n);
+            relay->handleWritten(side, n);
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // Wait for EPOLLOUT
+            return;
+        } else {
+            relay->handleError(side, errno);
+            return;
+        }
+    }
+}
+
+}  // namespace QSS
@@ -0,0 +1,73 @@
+/*
+ * epollengine.h - the header file of EpollEngine class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EPOLLENGINE_H
+#define EPOLLENGINE_H
+
+#include <QSocketNotifier>
+#include "fdrelayengine.h"
+
+namespace QSS {
+
+/**
+ * Linux I/O backend using edge-triggered epoll.
+ *
+ * The epoll descriptor is watched by a single QSocketNotifier, so all the
+ * connections share one wakeup of the Qt event loop. Connections are
+ * accepted with accept4(), read into the engine's buffer that is fed to the
+ * Encryptor directly, and what is queued for a socket while handling one
+ * batch of events is written with a single sendmsg() afterwards.
+ */
+class QSS_EXPORT EpollEngine : public FdRelayEngine
+{
+    Q_OBJECT
+public:
+    explicit EpollEngine(Settings settings, QObject *parent = nullptr);
+    ~EpollEngine();
+
+    bool attach(qintptr listenDescriptor) override;
+    void detach() override;
+
+protected:
+    bool watch(FdEndpoint &ep) override;
+    bool connectRemote(FdEndpoint &ep, const QHostAddress &ip, uint16_t port) override;
+    void flush(FdEndpoint &ep) override;
+    void resume(FdEndpoint &ep) override;
+    void unwatch(FdEndpoint &ep) override;
+
+private:
+    static const int MaxEvents = 256;
+    static const int MaxIovecs = 64;
+
+    int epfd;
+    int listenFd;
+    std::unique_ptr<QSocketNotifier> notifier;
+
+    void onEpollReady();
+    void acceptAll();
+    void drain(FdEndpoint &ep);
+    void handleEvents(FdEndpoint &ep, uint32_t events);
+};
+
+}
+
+#endif // EPOLLENGINE_H
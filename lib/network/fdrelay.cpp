@@ -0,0 +1,298 @@
+/*
+ * fdrelay.cpp - the source file of FdRelay class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "fdrelay.h"
+#include "fdrelayengine.h"
+#include "muxsession.h"
+#include "stripegroup.h"
+#include "util/nativesocket.h"
+#include <QDebug>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+QHostAddress peerOf(int fd, uint16_t *port)
+{
+    sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    if (::getpeername(fd, reinterpret_cast<sockaddr *>(&ss), &len) != 0) {
+        *port = 0;
+        return QHostAddress();
+    }
+    return QSS::NativeSocket::fromSockaddr(reinterpret_cast<sockaddr *>(&ss), port);
+}
+
+QHostAddress nameOf(int fd, uint16_t *port)
+{
+    sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    if (::getsockname(fd, reinterpret_cast<sockaddr *>(&ss), &len) != 0) {
+        *port = 0;
+        return QHostAddress();
+    }
+    return QSS::NativeSocket::fromSockaddr(reinterpret_cast<sockaddr *>(&ss), port);
+}
+
+}  // namespace
+
+namespace QSS {
+
+FdRelay::FdRelay(FdRelayEngine *engine, int localFd) :
+    RelayProtocol(engine->settings().isLocal,
+                  engine->settings().autoBan,
+                  engine->settings().serverAddress,
+                  engine->settings().method,
+                  engine->settings().password),
+    engine(engine),
+    lastActive(FdRelayEngine::now()),
+    connectStarted(0)
+{
+    local.relay = this;
+    local.side = Local;
+    local.fd = localFd;
+    remote.relay = this;
+    remote.side = Remote;
+}
+
+FdRelay::~FdRelay()
+{
+    for (FdEndpoint *ep : { &local, &remote }) {
+        if (ep->fd != -1) {
+            ::close(ep->fd);
+        }
+    }
+}
+
+FdEndpoint &FdRelay::endpoint(Side side)
+{
+    return side == Local ? local : remote;
+}
+
+bool FdRelay::isClosed() const
+{
+    return stage == DESTROYED;
+}
+
+int64_t FdRelay::getLastActive() const
+{
+    return lastActive;
+}
+
+std::unique_ptr<Encryptor> FdRelay::takeEncryptor()
+{
+    return std::move(encryptor);
+}
+
+void FdRelay::close()
+{
+    if (stage == DESTROYED) {
+        return;
+    }
+    stage = DESTROYED;
+    engine->retire(this);
+}
+
+void FdRelay::handleData(Side side, const uint8_t *data, size_t length)
+{
+    if (stage == DESTROYED || length == 0) {
+        return;
+    }
+    lastActive = FdRelayEngine::now();
+    if (side == Local) {
+        handleLocalData(data, length);
+    } else {
+        emit engine->bytesRead(length);
+        handleRemoteData(data, length);
+    }
+}
+
+void FdRelay::writeLocal(std::string data)
+{
+    queue(Local, std::move(data));
+}
+
+void FdRelay::writeRemote(std::string data)
+{
+    // The remote endpoint keeps the data until it's connected
+    queue(Remote, std::move(data));
+}
+
+std::string FdRelay::takeBuffer()
+{
+    return engine->takeBuffer();
+}
+
+void FdRelay::openRemote(const std::string &header, std::string data)
+{
+    if (isLocal) {
+        data.insert(0, header);
+        sendToRemote(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+        connectTo(serverAddress);
+    } else {
+        writeRemote(std::move(data));
+        connectTo(remoteAddress);
+    }
+}
+
+bool FdRelay::startExtension(std::string &data, size_t)
+{
+    // Mux sessions and stripe groups are built on QTcpSocket
+    if (remoteAddress.getAddress() != MuxSession::Host
+            && remoteAddress.getAddress() != StripeGroup::Host) {
+        return false;
+    }
+    return engine->handOver(this, data);
+}
+
+QHostAddress FdRelay::localAddress(uint16_t &port) const
+{
+    return nameOf(local.fd, &port);
+}
+
+QHostAddress FdRelay::peerAddress(uint16_t &port) const
+{
+    return peerOf(local.fd, &port);
+}
+
+void FdRelay::connectTo(Address &addr)
+{
+    addr.lookUp([this, &addr](bool success) {
+        if (stage == DESTROYED) {
+            return;
+        }
+        if (!success) {
+            QDebug(QtMsgType::QtDebugMsg).noquote() << "Failed to lookup" << addr << ". Closing TCP connection.";
+            close();
+            return;
+        }
+        stage = CONNECTING;
+        connectStarted = FdRelayEngine::now();
+        if (!engine->connectRemote(remote, addr.getFirstIP(), addr.getPort())) {
+            QDebug(QtMsgType::QtWarningMsg).noquote() << "Remote socket:" << strerror(errno);
+            close();
+        }
+    });
+}
+
+void FdRelay::handleConnected()
+{
+    if (stage == DESTROYED) {
+        return;
+    }
+    remote.connecting = false;
+    emit engine->latencyAvailable(static_cast<int>(FdRelayEngine::now() - connectStarted));
+    if (remote.fastOpen) {
+        emit engine->fastOpenFinished(NativeSocket::fastOpenAccepted(remote.fd));
+    }
+    NativeSocket::setNotSentLowat(remote.fd, engine->settings().notSentLowat);
+    stage = STREAM;
+    lastActive = FdRelayEngine::now();
+    engine->requestFlush(remote);
+    checkShutdown();
+}
+
+void FdRelay::handleEof(Side side)
+{
+    if (stage == DESTROYED) {
+        return;
+    }
+    endpoint(side).eof = true;
+    if (stage != STREAM && stage != CONNECTING && stage != DNS) {
+        // Nothing to forward in the handshake stages
+        close();
+        return;
+    }
+    checkShutdown();
+}
+
+void FdRelay::handleError(Side side, int error)
+{
+    if (stage == DESTROYED) {
+        return;
+    }
+    //it's not an "error" if remote host closed a connection
+    const char *name = side == Local ? "Local socket:" : "Remote socket:";
+    if (error == ECONNRESET || error == EPIPE) {
+        QDebug(QtMsgType::QtDebugMsg).noquote() << name << strerror(error);
+    } else {
+        QDebug(QtMsgType::QtWarningMsg).noquote() << name << strerror(error);
+    }
+    close();
+}
+
+void FdRelay::handleWritten(Side side, size_t written)
+{
+    if (stage == DESTROYED) {
+        return;
+    }
+    lastActive = FdRelayEngine::now();
+    if (side == Remote) {
+        emit engine->bytesSend(written);
+    }
+    FdEndpoint &source = endpoint(side == Local ? Remote : Local);
+    if (source.paused && endpoint(side).pending <= engine->settings().lowWatermark) {
+        source.paused = false;
+        engine->requestResume(source);
+    }
+    checkShutdown();
+}
+
+void FdRelay::queue(Side side, std::string data)
+{
+    if (data.empty() || stage == DESTROYED) {
+        return;
+    }
+    FdEndpoint &sink = endpoint(side);
+    sink.pending += data.size();
+    sink.out.push_back(std::move(data));
+    if (sink.pending >= engine->settings().highWatermark) {
+        // Stop reading the other side until the sink drains
+        endpoint(side == Local ? Remote : Local).paused = true;
+    }
+    if (sink.fd != -1 && !sink.connecting) {
+        engine->requestFlush(sink);
+    }
+}
+
+void FdRelay::checkShutdown()
+{
+    if (stage != STREAM) {
+        return;
+    }
+    // Propagate half-close once everything read from that side is written.
+    // pending only drops once the engine completed the write
+    for (FdEndpoint *src : { &local, &remote }) {
+        FdEndpoint &dst = src == &local ? remote : local;
+        if (src->eof && !dst.shut && dst.pending == 0) {
+            ::shutdown(dst.fd, SHUT_WR);
+            dst.shut = true;
+        }
+    }
+    if (local.shut && remote.shut) {
+        close();
+    }
+}
+
+}  // namespace QSS
@@ -0,0 +1,114 @@
+/*
+ * fdrelay.h - the header file of FdRelay class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FDRELAY_H
+#define FDRELAY_H
+
+#include <deque>
+#include <memory>
+#include <string>
+#include "relayprotocol.h"
+
+namespace QSS {
+
+class FdRelay;
+class FdRelayEngine;
+
+/*
+ * One side of an FdRelay: a native descriptor plus the data queued for it
+ */
+struct FdEndpoint
+{
+    FdRelay *relay = nullptr;
+    int side = 0;
+    int fd = -1;
+
+    std::deque<std::string> out;
+    size_t outOffset = 0;   // bytes of out.front() that are already written
+    int64_t pending = 0;    // total bytes queued but not written yet
+    bool flushRequested = false; // see FdRelayEngine::requestFlush()
+
+    bool connecting = false;
+    bool fastOpen = false;  // connecting with TCP Fast Open
+    bool paused = false;    // reading is paused because of backpressure
+    bool eof = false;       // the peer won't send anything more
+    bool shut = false;      // our write side is shut down
+    int inFlight = 0;       // asynchronous operations not yet completed
+    void *backend = nullptr; // per-endpoint state of the I/O engine
+};
+
+/**
+ * A Shadowsocks TCP connection (see RelayProtocol) on native descriptors.
+ * All the actual I/O is done by the FdRelayEngine it belongs to, so that
+ * different I/O backends can drive it.
+ */
+class FdRelay : public RelayProtocol
+{
+public:
+    enum Side { Local = 0, Remote = 1 };
+
+    FdRelay(FdRelayEngine *engine, int localFd);
+    ~FdRelay();
+
+    FdRelay(const FdRelay &) = delete;
+
+    FdEndpoint &endpoint(Side side);
+    bool isClosed() const;
+    int64_t getLastActive() const;
+    // The engine hands the connection over to the Qt code path
+    std::unique_ptr<Encryptor> takeEncryptor();
+
+    // Called by the engine when data is read from either side
+    void handleData(Side side, const uint8_t *data, size_t length);
+    void handleEof(Side side);
+    void handleConnected();
+    void handleError(Side side, int error);
+    // Called by the engine after some queued bytes of side are written
+    void handleWritten(Side side, size_t written);
+
+    void close() override;
+
+protected:
+    void writeLocal(std::string data) override;
+    void writeRemote(std::string data) override;
+    std::string takeBuffer() override;
+    void openRemote(const std::string &header, std::string data) override;
+    bool startExtension(std::string &data, size_t headerLength) override;
+    QHostAddress localAddress(uint16_t &port) const override;
+    QHostAddress peerAddress(uint16_t &port) const override;
+
+private:
+    FdRelayEngine *engine;
+    FdEndpoint local;
+    FdEndpoint remote;
+    int64_t lastActive;
+    int64_t connectStarted;
+
+    void connectTo(Address &addr);
+
+    void queue(Side side, std::string data);
+    void checkShutdown();
+};
+
+}
+
+#endif // FDRELAY_H
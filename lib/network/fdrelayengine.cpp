@@ -0,0 +1,259 @@
+/*
+ * fdrelayengine.cpp - the source file of FdRelayEngine class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "fdrelayengine.h"
+#include <QDebug>
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+
+namespace QSS {
+
+FdRelayEngine::FdRelayEngine(Settings settings, QObject *parent) :
+    QObject(parent),
+    recvBuffer(RecvSize),
+    m_settings(std::move(settings))
+{
+    // Idle connections are checked at a coarse granularity
+    sweepTimer.setInterval(1000);
+    connect(&sweepTimer, &QTimer::timeout, this, &FdRelayEngine::sweep);
+}
+
+FdRelayEngine::~FdRelayEngine()
+{
+    // Backends have to call detach() in their destructors
+    retired.clear();
+    relays.clear();
+}
+
+const FdRelayEngine::Settings &FdRelayEngine::settings() const
+{
+    return m_settings;
+}
+
+size_t FdRelayEngine::connectionCount() const
+{
+    return relays.size();
+}
+
+void FdRelayEngine::setHandOver(HandOver handOver)
+{
+    m_handOver = std::move(handOver);
+}
+
+int64_t FdRelayEngine::now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FdRelayEngine::detach()
+{
+    sweepTimer.stop();
+    std::vector<FdRelay *> all;
+    all.reserve(relays.size());
+    for (const auto &r : relays) {
+        all.push_back(r.first);
+    }
+    for (FdRelay *r : all) {
+        r->close();
+    }
+    resumes.clear();
+    flushes.clear();
+    processDeferred();
+}
+
+FdRelay *FdRelayEngine::addRelay(int fd)
+{
+    std::unique_ptr<FdRelay> relay(new FdRelay(this, fd));
+    FdRelay *ptr = relay.get();
+    if (!watch(relay->endpoint(FdRelay::Local))) {
+        // The destructor closes fd
+        return nullptr;
+    }
+    relays.emplace(ptr, std::move(relay));
+    if (!sweepTimer.isActive()) {
+        sweepTimer.start();
+    }
+    return ptr;
+}
+
+void FdRelayEngine::retire(FdRelay *relay)
+{
+    auto it = relays.find(relay);
+    if (it == relays.end()) {
+        return;
+    }
+    for (FdRelay::Side side : { FdRelay::Local, FdRelay::Remote }) {
+        FdEndpoint &ep = relay->endpoint(side);
+        if (ep.fd != -1) {
+            unwatch(ep);
+        }
+    }
+    retired.push_back(std::move(it->second));
+    relays.erase(it);
+    scheduleDeferred();
+}
+
+std::string FdRelayEngine::takeBuffer()
+{
+    if (spareBuffers.empty()) {
+        return std::string();
+    }
+    std::string buffer = std::move(spareBuffers.back());
+    spareBuffers.pop_back();
+    return buffer;
+}
+
+void FdRelayEngine::consume(FdEndpoint &ep, size_t written)
+{
+    ep.pending -= written;
+    while (written > 0 && !ep.out.empty()) {
+        const size_t left = ep.out.front().size() - ep.outOffset;
+        if (written < left) {
+            ep.outOffset += written;
+            return;
+        }
+        written -= left;
+        std::string &buffer = ep.out.front();
+        if (spareBuffers.size() < MaxSpareBuffers
+                && buffer.capacity() >= MinSpareCapacity
+                && buffer.capacity() <= MaxSpareCapacity) {
+            buffer.clear();
+            spareBuffers.push_back(std::move(buffer));
+        }
+        ep.out.pop_front();
+        ep.outOffset = 0;
+    }
+}
+
+void FdRelayEngine::requestFlush(FdEndpoint &ep)
+{
+    if (batchDepth == 0) {
+        flush(ep);
+    } else if (!ep.flushRequested) {
+        ep.flushRequested = true;
+        flushes.push_back(&ep);
+    }
+}
+
+void FdRelayEngine::beginBatch()
+{
+    ++batchDepth;
+}
+
+void FdRelayEngine::endBatch()
+{
+    if (--batchDepth > 0) {
+        return;
+    }
+    // Relays closed in the batch are retired, not deleted yet
+    std::vector<FdEndpoint *> toFlush;
+    toFlush.swap(flushes);
+    for (FdEndpoint *ep : toFlush) {
+        ep->flushRequested = false;
+        if (!ep->relay->isClosed() && ep->fd != -1 && !ep->connecting) {
+            flush(*ep);
+        }
+    }
+}
+
+bool FdRelayEngine::handOver(FdRelay *relay, std::string &data)
+{
+    if (!m_handOver) {
+        return false;
+    }
+    const int fd = ::dup(relay->endpoint(FdRelay::Local).fd);
+    if (fd == -1) {
+        return false;
+    }
+    /*
+     * Clients of both extensions wait for the server to answer before they
+     * send anything else, so no data is in flight on the descriptor. The
+     * relay still closes its own copy once it's retired
+     */
+    std::unique_ptr<Encryptor> keyed = relay->takeEncryptor();
+    relay->close();
+    m_handOver(fd, std::move(keyed), data);
+    return true;
+}
+
+void FdRelayEngine::requestResume(FdEndpoint &ep)
+{
+    resumes.push_back(&ep);
+    scheduleDeferred();
+}
+
+void FdRelayEngine::scheduleDeferred()
+{
+    if (!deferredScheduled) {
+        deferredScheduled = true;
+        QTimer::singleShot(0, this, &FdRelayEngine::processDeferred);
+    }
+}
+
+void FdRelayEngine::processDeferred()
+{
+    deferredScheduled = false;
+
+    // Retired relays are still alive at this point, just closed
+    std::vector<FdEndpoint *> toResume;
+    toResume.swap(resumes);
+    beginBatch();
+    for (FdEndpoint *ep : toResume) {
+        if (!ep->relay->isClosed() && !ep->paused) {
+            resume(*ep);
+        }
+    }
+    endBatch();
+
+    retired.erase(std::remove_if(retired.begin(), retired.end(),
+                                 [](const std::unique_ptr<FdRelay> &r) {
+        return r->endpoint(FdRelay::Local).inFlight == 0
+                && r->endpoint(FdRelay::Remote).inFlight == 0;
+    }), retired.end());
+    if (!retired.empty()) {
+        // Waiting for asynchronous operations to be cancelled
+        deferredScheduled = true;
+        QTimer::singleShot(10, this, &FdRelayEngine::processDeferred);
+    }
+}
+
+void FdRelayEngine::sweep()
+{
+    const int64_t deadline = now() - m_settings.timeout;
+    std::vector<FdRelay *> expired;
+    for (const auto &r : relays) {
+        if (r.first->getLastActive() < deadline) {
+            expired.push_back(r.first);
+        }
+    }
+    for (FdRelay *r : expired) {
+        qInfo("TCP connection timeout.");
+        r->close();
+    }
+    if (relays.empty()) {
+        sweepTimer.stop();
+    }
+}
+
+}  // namespace QSS
@@ -0,0 +1,171 @@
+/*
+ * fdrelayengine.h - the header file of FdRelayEngine class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FDRELAYENGINE_H
+#define FDRELAYENGINE_H
+
+#include <QObject>
+#include <QTimer>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "fdrelay.h"
+
+namespace QSS {
+
+/**
+ * The abstract base class of native I/O backends for TcpServer.
+ *
+ * An engine takes over the listening descriptor of a TcpServer and serves
+ * the accepted connections without QTcpSocket. It lives in the thread of
+ * the Qt event loop and hooks into it through QSocketNotifier and QTimer,
+ * so the Controller API stays the same no matter which backend is used.
+ */
+class QSS_EXPORT FdRelayEngine : public QObject
+{
+    Q_OBJECT
+public:
+    struct Settings {
+        std::string method;
+        std::string password;
+        int timeout = 600000; // msec
+        bool isLocal = true;
+        bool autoBan = false;
+        Address serverAddress;
+        int64_t highWatermark = 4 * 65536;
+        int64_t lowWatermark = 65536;
+        int notSentLowat = 0;
+        bool fastOpen = false;
+        // Reads from one socket per event before yielding to the others
+        int readBudget = 16;
+    };
+
+    explicit FdRelayEngine(Settings settings, QObject *parent = nullptr);
+    ~FdRelayEngine();
+
+    FdRelayEngine(const FdRelayEngine &) = delete;
+
+    // Starts accepting connections on the listening descriptor
+    virtual bool attach(qintptr listenDescriptor) = 0;
+    // Stops accepting and closes all the connections
+    virtual void detach();
+
+    const Settings &settings() const;
+    size_t connectionCount() const;
+
+    typedef std::function<void(int fd, std::unique_ptr<Encryptor> keyed,
+                                std::string &data)> HandOver;
+    /*
+     * Server mode: connections that ask for a protocol extension (see
+     * MuxSession and StripeGroup) are passed to handOver, because those run
+     * on QTcpSocket. It takes a duplicate of the local descriptor, the
+     * encryptor of the connection, and the decrypted address header with
+     * what followed it. Without it, they are relayed like any destination
+     */
+    void setHandOver(HandOver handOver);
+
+    // Monotonic milliseconds shared by all relays for idle tracking
+    static int64_t now();
+
+signals:
+    void bytesRead(quint64);
+    void bytesSend(quint64);
+    void latencyAvailable(int);
+    // See TcpRelay::fastOpenFinished()
+    void fastOpenFinished(bool zeroRtt);
+
+protected:
+    friend class FdRelay;
+
+    // Read buffer shared by all connections since reads are processed
+    // synchronously
+    static const size_t RecvSize = 65536;
+    std::vector<uint8_t> recvBuffer;
+
+    /*
+     * Output buffers are recycled rather than reallocated for every chunk.
+     * takeBuffer() returns an empty string, which may have some capacity
+     */
+    std::string takeBuffer();
+    // Drops the written bytes from ep.out and recycles the finished buffers
+    void consume(FdEndpoint &ep, size_t written);
+
+    /*
+     * Within a batch, flushing is deferred to endBatch() so that everything
+     * queued for an endpoint while processing the batch goes out in a
+     * single sendmsg(). Outside a batch, ep is flushed right away
+     */
+    void requestFlush(FdEndpoint &ep);
+    // Backends wrap the handling of a batch of readiness events in these
+    void beginBatch();
+    void endBatch();
+
+    FdRelay *addRelay(int fd);
+    // Stops watching relay's descriptors. It's deleted once the current
+    // event is processed and no asynchronous operation refers to it
+    void retire(FdRelay *relay);
+    // Calls resume(ep) once the current event is processed, so that reading
+    // never re-enters the relay from inside its own callbacks
+    void requestResume(FdEndpoint &ep);
+    // See setHandOver(). Returns false if relay has to carry on by itself
+    bool handOver(FdRelay *relay, std::string &data);
+
+    /*
+     * I/O primitives implemented by the backends
+     */
+    // Registers a freshly accepted local descriptor
+    virtual bool watch(FdEndpoint &ep) = 0;
+    // Starts a non-blocking connect to ip:port and fills ep.fd
+    virtual bool connectRemote(FdEndpoint &ep, const QHostAddress &ip, uint16_t port) = 0;
+    // Writes as much as possible of ep.out
+    virtual void flush(FdEndpoint &ep) = 0;
+    // Resumes reading from ep after it's been paused
+    virtual void resume(FdEndpoint &ep) = 0;
+    // Stops watching ep.fd before it gets closed
+    virtual void unwatch(FdEndpoint &ep) = 0;
+
+private:
+    static const size_t MaxSpareBuffers = 64;
+    // Bigger ones were for a burst, and are left to the allocator
+    static const size_t MaxSpareCapacity = 2 * RecvSize;
+    static const size_t MinSpareCapacity = 1024;
+
+    Settings m_settings;
+    HandOver m_handOver;
+    std::unordered_map<FdRelay *, std::unique_ptr<FdRelay> > relays;
+    std::vector<std::unique_ptr<FdRelay> > retired;
+    std::vector<FdEndpoint *> resumes;
+    std::vector<FdEndpoint *> flushes;
+    std::vector<std::string> spareBuffers;
+    int batchDepth = 0;
+    bool deferredScheduled = false;
+    QTimer sweepTimer;
+
+    void scheduleDeferred();
+    void processDeferred();
+    void sweep();
+};
+
+}
+
+#endif // FDRELAYENGINE_H
@@ -0,0 +1,182 @@
+/*
+ * happyeyeballs.cpp - the source file of HappyEyeballs class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "happyeyeballs.h"
+#include <QDebug>
+#include <utility>
+
+namespace QSS {
+
+HappyEyeballs::HappyEyeballs(std::vector<QHostAddress> addresses,
+                             uint16_t port,
+                             QObject *parent) :
+    QObject(parent),
+    addresses(interleave(addresses)),
+    port(port)
+{
+    attempts.reserve(this->addresses.size());
+    delayTimer.setSingleShot(true);
+    delayTimer.setInterval(DefaultAttemptDelay);
+    connect(&delayTimer, &QTimer::timeout, this, &HappyEyeballs::startNext);
+}
+
+HappyEyeballs::~HappyEyeballs()
+{
+    for (Attempt &attempt : attempts) {
+        if (attempt.socket) {
+            attempt.socket->disconnect(this);
+            attempt.socket->abort();
+        }
+    }
+}
+
+void HappyEyeballs::setAttemptDelay(int msec)
+{
+    delayTimer.setInterval(msec);
+}
+
+void HappyEyeballs::start()
+{
+    if (addresses.empty()) {
+        finished = true;
+        emit failed(QString("No address to connect to"));
+        return;
+    }
+    startNext();
+}
+
+std::unique_ptr<QTcpSocket> HappyEyeballs::takeSocket()
+{
+    if (winner) {
+        winner->disconnect(this);
+    }
+    return std::move(winner);
+}
+
+std::vector<QHostAddress> HappyEyeballs::interleave(const std::vector<QHostAddress> &addresses)
+{
+    if (addresses.empty()) {
+        return addresses;
+    }
+    const auto preferred = addresses.front().protocol();
+    std::vector<QHostAddress> first;
+    std::vector<QHostAddress> second;
+    for (const QHostAddress &address : addresses) {
+        (address.protocol() == preferred ? first : second).push_back(address);
+    }
+    std::vector<QHostAddress> result;
+    result.reserve(addresses.size());
+    for (size_t i = 0; i < first.size() || i < second.size(); ++i) {
+        if (i < first.size()) {
+            result.push_back(first[i]);
+        }
+        if (i < second.size()) {
+            result.push_back(second[i]);
+        }
+    }
+    return result;
+}
+
+void HappyEyeballs::startNext()
+{
+    if (finished || next >= addresses.size()) {
+        return;
+    }
+    const size_t index = attempts.size();
+    attempts.push_back(Attempt());
+    Attempt &attempt = attempts.back();
+    attempt.address = addresses[next++];
+    attempt.socket = std::make_unique<QTcpSocket>();
+    QTcpSocket *socket = attempt.socket.get();
+    connect(socket, &QTcpSocket::connected, this, [this, index]() {
+        onConnected(index);
+    });
+    connect(socket,
+            static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
+            (&QTcpSocket::error),
+            this,
+            [this, index]() {
+        onError(index);
+    });
+    attempt.clock.start();
+    socket->connectToHost(attempt.address, port);
+    if (next < addresses.size()) {
+        delayTimer.start();
+    }
+}
+
+void HappyEyeballs::onConnected(size_t index)
+{
+    if (finished) {
+        return;
+    }
+    finished = true;
+    delayTimer.stop();
+    Attempt &attempt = attempts[index];
+    QDebug(QtMsgType::QtDebugMsg).noquote().nospace()
+            << "Connected to " << attempt.address.toString() << " in "
+            << attempt.clock.elapsed() << " ms (attempt " << index + 1
+            << " of " << addresses.size() << ")";
+    winner = std::move(attempt.socket);
+    for (Attempt &other : attempts) {
+        if (other.socket) {
+            QDebug(QtMsgType::QtDebugMsg).noquote().nospace()
+                    << "Cancelled connecting to " << other.address.toString()
+                    << " after " << other.clock.elapsed() << " ms";
+            other.socket->disconnect(this);
+            other.socket->abort();
+            other.socket.release()->deleteLater();
+        }
+    }
+    emit connected();
+}
+
+void HappyEyeballs::onError(size_t index)
+{
+    Attempt &attempt = attempts[index];
+    if (finished || !attempt.socket) {
+        return;
+    }
+    const QString error = attempt.socket->errorString();
+    QDebug(QtMsgType::QtDebugMsg).noquote().nospace()
+            << "Failed to connect to " << attempt.address.toString() << " in "
+            << attempt.clock.elapsed() << " ms: " << error;
+    attempt.socket->disconnect(this);
+    // Deleting the socket in its own signal isn't safe
+    attempt.socket.release()->deleteLater();
+
+    // The next attempt doesn't wait for the delay after a failure
+    if (next < addresses.size()) {
+        delayTimer.stop();
+        startNext();
+        return;
+    }
+    for (const Attempt &other : attempts) {
+        if (other.socket) {
+            return;
+        }
+    }
+    finished = true;
+    emit failed(error);
+}
+
+}  // namespace QSS
@@ -0,0 +1,97 @@
+/*
+ * happyeyeballs.h - the header file of HappyEyeballs class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HAPPYEYEBALLS_H
+#define HAPPYEYEBALLS_H
+
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QObject>
+#include <QTcpSocket>
+#include <QTimer>
+#include <memory>
+#include <vector>
+#include "util/export.h"
+
+namespace QSS {
+
+/**
+ * Connects to one of several addresses of a host (RFC 8305). The attempts
+ * are started one by one, alternating between IPv6 and IPv4, each after
+ * the previous one failed or didn't finish within the attempt delay. The
+ * first connected attempt wins and the others are aborted.
+ */
+class QSS_EXPORT HappyEyeballs : public QObject
+{
+    Q_OBJECT
+public:
+    HappyEyeballs(std::vector<QHostAddress> addresses,
+                  uint16_t port,
+                  QObject *parent = nullptr);
+    ~HappyEyeballs();
+
+    HappyEyeballs(const HappyEyeballs &) = delete;
+
+    // The delay before the next attempt starts (250 ms by default)
+    void setAttemptDelay(int msec);
+
+    void start();
+
+    // Returns the connected socket after connected(). The caller owns it
+    std::unique_ptr<QTcpSocket> takeSocket();
+
+    /*
+     * Orders addresses for the attempts: families are interleaved, starting
+     * with the family of the first address (the resolver's preference)
+     */
+    static std::vector<QHostAddress> interleave(const std::vector<QHostAddress> &addresses);
+
+signals:
+    void connected();
+    // All attempts failed. error is the error of the last one
+    void failed(const QString &error);
+
+private:
+    static const int DefaultAttemptDelay = 250;
+
+    struct Attempt {
+        QHostAddress address;
+        std::unique_ptr<QTcpSocket> socket;
+        QElapsedTimer clock;
+    };
+
+    const std::vector<QHostAddress> addresses;
+    const uint16_t port;
+    size_t next = 0;
+    std::vector<Attempt> attempts;
+    std::unique_ptr<QTcpSocket> winner;
+    QTimer delayTimer;
+    bool finished = false;
+
+    void startNext();
+    void onConnected(size_t index);
+    void onError(size_t index);
+};
+
+}
+
+#endif // HAPPYEYEBALLS_H
@@ -0,0 +1,394 @@
+/*
+ * httpconnection.cpp - the source file of HttpConnection class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpconnection.h"
+#include "httporiginpool.h"
+#include "streamchannel.h"
+#include <QDebug>
+#include <algorithm>
+
+using namespace QSS;
+
+HttpConnection::HttpConnection(QTcpSocket *socket, HttpOriginPool *pool) :
+    QObject(socket),
+    client(socket),
+    pool(pool),
+    request(HttpParser::Request),
+    response(HttpParser::Response),
+    unconsumed(0),
+    stalled(false),
+    closing(false),
+    upgraded(false),
+    closed(false)
+{
+    client->setReadBufferSize(RecvSize);
+    connect(client, &QTcpSocket::readyRead,
+            this, &HttpConnection::onClientReadyRead);
+    connect(client, &QTcpSocket::bytesWritten,
+            this, &HttpConnection::onClientBytesWritten);
+}
+
+HttpConnection::~HttpConnection()
+{
+    if (origin && pool) {
+        dropOrigin();
+    }
+}
+
+void HttpConnection::onClientReadyRead()
+{
+    if (closed || stalled || originBacklog() > HighWatermark) {
+        return;
+    }
+    in.append(client->readAll());
+    processRequests();
+}
+
+void HttpConnection::processRequests()
+{
+    if (upgraded) {
+        writeOrigin(in.constData(), in.size());
+        in.clear();
+        return;
+    }
+
+    int pos = 0;
+    while (!closed && !stalled && pos < in.size()) {
+        if (request.headComplete()) {
+            // Forward the body as it is, up to the end of the request
+            const size_t used = request.parseBody(in.constData() + pos, in.size() - pos);
+            if (request.failed()) {
+                // Part of the request has been forwarded already
+                closeClient();
+                return;
+            }
+            writeOrigin(in.constData() + pos, static_cast<qint64>(used));
+            pos += static_cast<int>(used);
+            if (!request.complete()) {
+                break;
+            }
+            request.reset();
+            continue;
+        }
+        if (closing) {
+            // Nothing after a request with Connection: close is served
+            pos = in.size();
+            break;
+        }
+
+        char *head = in.data() + pos;
+        const int length = request.parseHead(head, in.size() - pos);
+        if (length == 0) {
+            break;
+        }
+        if (length < 0) {
+            reply("400 Bad Request");
+            return;
+        }
+
+        const HttpParser::Span target = request.target();
+        if (request.isConnect()) {
+            if (!inflight.empty()) {
+                request.reset();
+                stalled = true;
+                break;
+            }
+            HttpParser::Span host;
+            uint16_t port = 0;
+            if (!HttpParser::splitAuthority(head + target.offset, target.length,
+                                            host, port, 443)) {
+                reply("400 Bad Request");
+                return;
+            }
+            const QByteArray hostName(head + host.offset, static_cast<int>(host.length));
+            const QByteArray data = in.mid(pos + length);
+            closed = true;
+            dropOrigin();
+            disconnect(client, nullptr, this, nullptr);
+            emit tunnelRequested(hostName, port, data);
+            deleteLater();
+            return;
+        }
+
+        // Absolute-form from proxy clients, otherwise the Host header
+        HttpParser::Span authority;
+        HttpParser::Span path;
+        const bool absolute = HttpParser::splitAbsoluteUri(head + target.offset, target.length,
+                                                           authority, path);
+        if (absolute) {
+            authority.offset += target.offset;
+        } else if (head[target.offset] == '/' || head[target.offset] == '*') {
+            authority = request.host();
+        } else {
+            reply("400 Bad Request");
+            return;
+        }
+        HttpParser::Span host;
+        uint16_t port = 0;
+        if (authority.length == 0
+                || !HttpParser::splitAuthority(head + authority.offset, authority.length,
+                                               host, port, 80)) {
+            reply("400 Bad Request");
+            return;
+        }
+        const QByteArray hostName(head + host.offset, static_cast<int>(host.length));
+        const QByteArray key = hostName + ':' + QByteArray::number(port);
+        if (origin && key != originKey) {
+            // Responses on the current origin come first
+            if (!inflight.empty()) {
+                request.reset();
+                stalled = true;
+                break;
+            }
+            dropOrigin();
+        }
+        if (!origin && !openOrigin(key, hostName, port)) {
+            // Parsed again once the pool has a stream to the host
+            request.reset();
+            stalled = true;
+            break;
+        }
+
+        const int begin = absolute ? request.toOriginForm(head) : 0;
+        writeOrigin(head + begin, length - begin);
+        inflight.push_back(request.isHead());
+        if (!request.keepAlive()) {
+            closing = true;
+        }
+        if (request.upgrade()) {
+            // The connection may switch protocols after the response
+            stalled = true;
+        }
+        pos += length;
+        if (request.complete()) {
+            request.reset();
+        }
+    }
+    if (!closed) {
+        in.remove(0, pos);
+    }
+}
+
+void HttpConnection::onOriginData(const std::string &data)
+{
+    if (closed) {
+        return;
+    }
+    unconsumed += data.size();
+    originIn.append(data.data(), static_cast<int>(data.size()));
+    processResponses();
+}
+
+void HttpConnection::onClientBytesWritten(qint64 bytes)
+{
+    // The origin sends more once its data is out of our buffers
+    const uint64_t written = std::min(static_cast<uint64_t>(bytes), unconsumed);
+    if (origin && written > 0) {
+        unconsumed -= written;
+        origin->consumed(written);
+    }
+}
+
+void HttpConnection::processResponses()
+{
+    int pos = 0;
+    // Dropping the origin clears originIn, which ends the loop
+    while (!closed && pos < originIn.size()) {
+        if (!response.headComplete()) {
+            if (inflight.empty()) {
+                qWarning("[HTTP] Unexpected data from the origin server");
+                dropOrigin();
+                break;
+            }
+            response.setHeadRequest(inflight.front());
+            const int length = response.parseHead(originIn.constData() + pos,
+                                                   originIn.size() - pos);
+            if (length == 0) {
+                break;
+            }
+            if (length < 0) {
+                reply("502 Bad Gateway");
+                return;
+            }
+            client->write(originIn.constData() + pos, length);
+            pos += length;
+            if (response.framing() == HttpParser::Tunnel) {
+                upgraded = true;
+                inflight.clear();
+            }
+        } else {
+            const size_t used = response.parseBody(originIn.constData() + pos,
+                                                   originIn.size() - pos);
+            if (response.failed()) {
+                closeClient();
+                return;
+            }
+            client->write(originIn.constData() + pos, static_cast<qint64>(used));
+            pos += static_cast<int>(used);
+        }
+        if (response.complete()) {
+            finishResponse();
+        }
+    }
+    if (closed) {
+        return;
+    }
+    originIn.remove(0, std::min(pos, originIn.size()));
+    if (origin && originIdle()) {
+        releaseOrigin();
+    }
+    if (stalled && inflight.empty()) {
+        stalled = false;
+        onClientReadyRead();
+    }
+}
+
+void HttpConnection::finishResponse()
+{
+    const int status = response.statusCode();
+    const bool keepAlive = response.keepAlive();
+    response.reset();
+    if (status < 200) {
+        // Interim response, the final one follows
+        return;
+    }
+    inflight.pop_front();
+    if (!keepAlive) {
+        dropOrigin();
+        // Pipelined requests or the rest of a request are lost with it
+        if (!inflight.empty() || request.headComplete()) {
+            closeClient();
+            return;
+        }
+    }
+    if (closing && inflight.empty()) {
+        closeClient();
+    }
+}
+
+bool HttpConnection::openOrigin(const QByteArray &key, const QByteArray &host, uint16_t port)
+{
+    origin = pool->acquire(key,
+                           Address(std::string(host.constData(), static_cast<size_t>(host.size())), port));
+    if (!origin) {
+        pool->wait(key, this, [this]() {
+            stalled = false;
+            onClientReadyRead();
+        });
+        return false;
+    }
+    originKey = key;
+    StreamChannel *channel = origin.get();
+    connect(channel, &StreamChannel::dataReceived, this, &HttpConnection::onOriginData);
+    // The client is read again once the origin caught up
+    connect(channel, &StreamChannel::bytesWritten, this, &HttpConnection::onClientReadyRead);
+    connect(channel, &StreamChannel::finished, this, &HttpConnection::onOriginClosed);
+    connect(channel, &StreamChannel::aborted, this, &HttpConnection::onOriginClosed);
+    return true;
+}
+
+void HttpConnection::writeOrigin(const char *data, qint64 size)
+{
+    if (size > 0 && origin) {
+        origin->write(std::string(data, static_cast<size_t>(size)));
+    }
+}
+
+bool HttpConnection::originIdle() const
+{
+    // The origin may close after a request with Connection: close
+    return inflight.empty() && !request.headComplete() && !response.headComplete()
+            && !upgraded && !closing && originIn.isEmpty();
+}
+
+void HttpConnection::releaseOrigin()
+{
+    origin->disconnect(this);
+    // Data still in the client's buffer mustn't hold back the next user
+    if (unconsumed > 0) {
+        origin->consumed(unconsumed);
+        unconsumed = 0;
+    }
+    pool->release(originKey, std::move(origin));
+    origin.reset();
+    originKey.clear();
+}
+
+qint64 HttpConnection::originBacklog() const
+{
+    return origin ? origin->pending() : 0;
+}
+
+void HttpConnection::onOriginClosed()
+{
+    if (closed || !origin) {
+        return;
+    }
+    if (upgraded || (response.headComplete()
+                     && response.framing() == HttpParser::UntilClose)) {
+        // The response ends with the connection
+        closeClient();
+    } else if (!inflight.empty() || request.headComplete()) {
+        if (response.headComplete()) {
+            closeClient();
+        } else {
+            reply("502 Bad Gateway");
+        }
+    } else {
+        // An idle keep-alive connection that the server closed
+        dropOrigin();
+    }
+}
+
+void HttpConnection::dropOrigin()
+{
+    if (origin) {
+        origin->disconnect(this);
+        // Only an idle stream ends gracefully. This may run in a signal of
+        // the stream
+        pool->drop(originKey, std::move(origin), originIdle());
+        origin.reset();
+    }
+    originKey.clear();
+    originIn.clear();
+    unconsumed = 0;
+    response.reset();
+}
+
+void HttpConnection::reply(const char *status)
+{
+    client->write(QByteArray("HTTP/1.1 ") + status
+                  + "\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+    closeClient();
+}
+
+void HttpConnection::closeClient()
+{
+    closed = true;
+    if (origin && originIdle()) {
+        releaseOrigin();
+    } else {
+        dropOrigin();
+    }
+    // Pending data is written before the connection is closed
+    client->disconnectFromHost();
+}
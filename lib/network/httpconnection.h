@@ -0,0 +1,113 @@
+/*
+ * httpconnection.h - the header file of HttpConnection class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTPCONNECTION_H
+#define HTTPCONNECTION_H
+
+#include <QByteArray>
+#include <QPointer>
+#include <QTcpSocket>
+#include <deque>
+#include <memory>
+#include "httpparser.h"
+#include "util/export.h"
+
+namespace QSS {
+
+class HttpOriginPool;
+class StreamChannel;
+
+/**
+ * A client connection of HttpProxy.
+ *
+ * Requests are parsed as they arrive and forwarded to the origin server one
+ * after another, over a stream through the shadowsocks server (see
+ * TcpServer::openChannel()), so the connection can be kept alive and requests may be
+ * pipelined. Responses are relayed back in order. Once no response is pending,
+ * the origin stream goes back to the HttpOriginPool shared with the other
+ * connections, and the next request takes one from there. A request to
+ * another host waits until the pending responses are complete.
+ */
+class QSS_EXPORT HttpConnection : public QObject
+{
+    Q_OBJECT
+public:
+    // Owned by socket. Origin streams are taken from and given back to pool
+    HttpConnection(QTcpSocket *socket, HttpOriginPool *pool);
+    // The socket is deleted when the client disconnects or fails, which may
+    // be in the middle of a response. The origin stream is dropped then
+    ~HttpConnection();
+
+    HttpConnection(const HttpConnection &) = delete;
+
+signals:
+    /*
+     * A CONNECT request. The socket isn't read anymore, data is what was
+     * read after the request
+     */
+    void tunnelRequested(const QByteArray &host, quint16 port, const QByteArray &data);
+
+private:
+    static const int RecvSize = 65536;
+    // Unsent bytes on either side before the other side isn't read anymore
+    static const qint64 HighWatermark = 4 * RecvSize;
+
+    QTcpSocket *client;
+    // Null if the pool was deleted before the socket
+    QPointer<HttpOriginPool> pool;
+    HttpParser request;
+    HttpParser response;
+    QByteArray in;                  // unprocessed client data
+    QByteArray originIn;            // unprocessed origin data
+    std::shared_ptr<StreamChannel> origin;
+    QByteArray originKey;           // host:port
+    uint64_t unconsumed;            // origin data not yet written to the client
+    std::deque<bool> inflight;      // a response is awaited, true for HEAD
+    bool stalled;                   // waiting for responses before the next request
+    bool closing;                   // the client asked to close after the last response
+    bool upgraded;                  // 101 Switching Protocols, relaying raw bytes
+    bool closed;
+
+    void processRequests();
+    void processResponses();
+    void finishResponse();
+    // Returns false if the request has to wait for the pool
+    bool openOrigin(const QByteArray &key, const QByteArray &host, uint16_t port);
+    // Whether the origin is between responses and can serve another client
+    bool originIdle() const;
+    void releaseOrigin();
+    void writeOrigin(const char *data, qint64 size);
+    qint64 originBacklog() const;
+    void dropOrigin();
+    void reply(const char *status);
+    void closeClient();
+
+private slots:
+    void onClientReadyRead();
+    void onClientBytesWritten(qint64 bytes);
+    void onOriginData(const std::string &data);
+    void onOriginClosed();
+};
+
+}
+
+#endif // HTTPCONNECTION_H
@@ -0,0 +1,290 @@
+/*
+ * httporiginpool.cpp - the source file of HttpOriginPool class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "httporiginpool.h"
+#include "streamchannel.h"
+#include <iterator>
+#include <utility>
+
+namespace QSS {
+
+HttpOriginPool::HttpOriginPool(Opener opener, QObject *parent) :
+    QObject(parent),
+    opener(std::move(opener)),
+    idleTotal(0),
+    maxIdleTime(DefaultMaxIdleTime),
+    maxIdlePerHost(DefaultMaxIdlePerHost),
+    maxIdle(DefaultMaxIdle),
+    maxActivePerHost(DefaultMaxActivePerHost),
+    reused(0),
+    deferredScheduled(false)
+{
+    clock.start();
+    ticker.setInterval(TickInterval);
+    connect(&ticker, &QTimer::timeout, this, &HttpOriginPool::onTick);
+}
+
+HttpOriginPool::~HttpOriginPool()
+{
+    for (auto &host : idle) {
+        for (Entry &e : host.second) {
+            e.stream->disconnect(this);
+            e.stream->close();
+        }
+    }
+}
+
+void HttpOriginPool::setMaxIdleTime(int msec)
+{
+    maxIdleTime = msec;
+}
+
+void HttpOriginPool::setMaxIdlePerHost(int count)
+{
+    maxIdlePerHost = count;
+}
+
+void HttpOriginPool::setMaxIdle(int count)
+{
+    maxIdle = count;
+}
+
+void HttpOriginPool::setMaxActivePerHost(int count)
+{
+    maxActivePerHost = count;
+}
+
+int HttpOriginPool::idleCount() const
+{
+    return idleTotal;
+}
+
+int HttpOriginPool::activeCount(const QByteArray &key) const
+{
+    auto it = active.find(key);
+    return it == active.end() ? 0 : it->second;
+}
+
+quint64 HttpOriginPool::reuseCount() const
+{
+    return reused;
+}
+
+std::shared_ptr<StreamChannel> HttpOriginPool::acquire(const QByteArray &key,
+                                                       const Address &destination)
+{
+    if (maxActivePerHost > 0 && activeCount(key) >= maxActivePerHost) {
+        return nullptr;
+    }
+    auto it = idle.find(key);
+    if (it != idle.end()) {
+        std::vector<Entry> &streams = it->second;
+        std::shared_ptr<StreamChannel> result;
+        while (!result && !streams.empty()) {
+            // The newest one is the least likely to be closed by the server
+            std::shared_ptr<StreamChannel> stream = std::move(streams.back().stream);
+            streams.pop_back();
+            --idleTotal;
+            stream->disconnect(this);
+            if (stream->isClosed()) {
+                discard(std::move(stream), false);
+            } else {
+                result = std::move(stream);
+            }
+        }
+        if (streams.empty()) {
+            idle.erase(it);
+        }
+        if (result) {
+            ++reused;
+            ++active[key];
+            return result;
+        }
+    }
+    std::shared_ptr<StreamChannel> stream = opener(destination);
+    if (stream) {
+        ++active[key];
+    }
+    return stream;
+}
+
+void HttpOriginPool::drop(const QByteArray &key, std::shared_ptr<StreamChannel> stream,
+                          bool graceful)
+{
+    deactivate(key);
+    discard(std::move(stream), graceful);
+}
+
+void HttpOriginPool::wait(const QByteArray &key, QObject *context, std::function<void()> ready)
+{
+    waiting[key].push_back(Waiter { context, std::move(ready) });
+    if (maxActivePerHost <= 0 || activeCount(key) < maxActivePerHost) {
+        scheduleDeferred();
+    }
+}
+
+void HttpOriginPool::release(const QByteArray &key, std::shared_ptr<StreamChannel> stream)
+{
+    deactivate(key);
+    if (stream->isClosed() || maxIdlePerHost <= 0 || maxIdle <= 0) {
+        discard(std::move(stream), true);
+        return;
+    }
+
+    auto it = idle.find(key);
+    if (it != idle.end() && static_cast<int>(it->second.size()) >= maxIdlePerHost) {
+        std::shared_ptr<StreamChannel> oldest = std::move(it->second.front().stream);
+        it->second.erase(it->second.begin());
+        --idleTotal;
+        oldest->disconnect(this);
+        discard(std::move(oldest), true);
+    } else if (idleTotal >= maxIdle) {
+        evictOldest();
+    }
+
+    // A server may close an idle connection any time, and it sends nothing
+    // unasked unless it's about to close it (e.g. 408 Request Timeout)
+    StreamChannel *raw = stream.get();
+    connect(raw, &StreamChannel::dataReceived, this, [this, raw]() {
+        evict(raw, false);
+    });
+    connect(raw, &StreamChannel::finished, this, [this, raw]() {
+        evict(raw, false);
+    });
+    connect(raw, &StreamChannel::aborted, this, [this, raw]() {
+        evict(raw, false);
+    });
+    idle[key].push_back(Entry { std::move(stream), clock.elapsed() });
+    ++idleTotal;
+    if (!ticker.isActive()) {
+        ticker.start();
+    }
+}
+
+void HttpOriginPool::evict(StreamChannel *stream, bool graceful)
+{
+    for (auto it = idle.begin(); it != idle.end(); ++it) {
+        std::vector<Entry> &streams = it->second;
+        for (auto e = streams.begin(); e != streams.end(); ++e) {
+            if (e->stream.get() == stream) {
+                std::shared_ptr<StreamChannel> evicted = std::move(e->stream);
+                streams.erase(e);
+                if (streams.empty()) {
+                    idle.erase(it);
+                }
+                --idleTotal;
+                evicted->disconnect(this);
+                discard(std::move(evicted), graceful);
+                return;
+            }
+        }
+    }
+}
+
+void HttpOriginPool::evictOldest()
+{
+    auto oldest = idle.end();
+    for (auto it = idle.begin(); it != idle.end(); ++it) {
+        if (oldest == idle.end()
+                || it->second.front().since < oldest->second.front().since) {
+            oldest = it;
+        }
+    }
+    if (oldest != idle.end()) {
+        evict(oldest->second.front().stream.get(), true);
+    }
+}
+
+void HttpOriginPool::discard(std::shared_ptr<StreamChannel> stream, bool graceful)
+{
+    if (graceful) {
+        stream->close();
+    } else {
+        stream->abort();
+    }
+    discarded.push_back(std::move(stream));
+    scheduleDeferred();
+}
+
+void HttpOriginPool::deactivate(const QByteArray &key)
+{
+    auto it = active.find(key);
+    if (it == active.end()) {
+        return;
+    }
+    if (--it->second == 0) {
+        active.erase(it);
+    }
+    if (waiting.find(key) != waiting.end()) {
+        scheduleDeferred();
+    }
+}
+
+void HttpOriginPool::scheduleDeferred()
+{
+    if (deferredScheduled) {
+        return;
+    }
+    deferredScheduled = true;
+    QTimer::singleShot(0, this, &HttpOriginPool::onDeferred);
+}
+
+void HttpOriginPool::onDeferred()
+{
+    deferredScheduled = false;
+    discarded.clear();
+    // A waiter usually acquires a stream right away, and may wait again
+    for (auto it = waiting.begin(); it != waiting.end();) {
+        const QByteArray key = it->first;
+        while (!it->second.empty()
+               && (maxActivePerHost <= 0 || activeCount(key) < maxActivePerHost)) {
+            Waiter waiter = std::move(it->second.front());
+            it->second.pop_front();
+            if (waiter.context) {
+                waiter.ready();
+            }
+            // Inserting into the map doesn't invalidate it
+        }
+        it = it->second.empty() ? waiting.erase(it) : std::next(it);
+    }
+}
+
+void HttpOriginPool::onTick()
+{
+    const qint64 deadline = clock.elapsed() - maxIdleTime;
+    for (auto it = idle.begin(); it != idle.end();) {
+        std::vector<Entry> &streams = it->second;
+        while (!streams.empty() && streams.front().since <= deadline) {
+            std::shared_ptr<StreamChannel> expired = std::move(streams.front().stream);
+            streams.erase(streams.begin());
+            --idleTotal;
+            expired->disconnect(this);
+            discard(std::move(expired), true);
+        }
+        it = streams.empty() ? idle.erase(it) : std::next(it);
+    }
+    if (idleTotal == 0) {
+        ticker.stop();
+    }
+}
+
+}
@@ -0,0 +1,156 @@
+/*
+ * httporiginpool.h - the header file of HttpOriginPool class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTPORIGINPOOL_H
+#define HTTPORIGINPOOL_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+#include "types/address.h"
+
+namespace QSS {
+
+class StreamChannel;
+
+/**
+ * Idle keep-alive streams to HTTP origin servers, shared by all client
+ * connections of HttpProxy.
+ *
+ * A stream is given back after a complete response and handed out to the
+ * next request for the same host:port. An idle stream is dropped as soon as
+ * the server closes it or sends anything, and after maxIdleTime. At most
+ * maxIdlePerHost streams per origin and maxIdle streams overall are kept,
+ * the oldest one goes first.
+ *
+ * At most maxActivePerHost streams per origin are handed out at a time.
+ * Further requests wait until one of them is given back or dropped.
+ */
+class QSS_EXPORT HttpOriginPool : public QObject
+{
+    Q_OBJECT
+public:
+    // Opens a new stream to the origin server
+    using Opener = std::function<std::shared_ptr<StreamChannel>(const Address &)>;
+
+    explicit HttpOriginPool(Opener opener, QObject *parent = nullptr);
+    ~HttpOriginPool();
+
+    HttpOriginPool(const HttpOriginPool &) = delete;
+
+    /*
+     * Returns an idle stream to key (host:port), or a new one to destination
+     * if there is none. The caller's signal connections are its own, nothing
+     * of the pool is left connected. Returns nullptr if maxActivePerHost
+     * streams to key are in use (see wait())
+     */
+    std::shared_ptr<StreamChannel> acquire(const QByteArray &key, const Address &destination);
+
+    /*
+     * Gives back a stream that is between responses. The caller must have
+     * disconnected from it and credited all received data already
+     */
+    void release(const QByteArray &key, std::shared_ptr<StreamChannel> stream);
+
+    /*
+     * Closes, or aborts the stream if it isn't graceful, instead of giving
+     * it back. The caller must have disconnected from it. It may be called
+     * in a signal of the stream, which is released later
+     */
+    void drop(const QByteArray &key, std::shared_ptr<StreamChannel> stream, bool graceful);
+
+    /*
+     * After acquire() returned nullptr: ready is invoked from the event loop
+     * once a stream to key may be acquired, unless context was deleted.
+     * Waiters are served in order
+     */
+    void wait(const QByteArray &key, QObject *context, std::function<void()> ready);
+
+    // Idle streams older than msec are closed (15 seconds by default)
+    void setMaxIdleTime(int msec);
+    void setMaxIdlePerHost(int count);
+    void setMaxIdle(int count);
+    // 0 doesn't limit the streams in use (16 by default)
+    void setMaxActivePerHost(int count);
+
+    int idleCount() const;
+    int activeCount(const QByteArray &key) const;
+    // acquire() calls served by an idle stream
+    quint64 reuseCount() const;
+
+private:
+    static const int TickInterval = 1000;
+    static const int DefaultMaxIdleTime = 15000;
+    static const int DefaultMaxIdlePerHost = 4;
+    static const int DefaultMaxIdle = 64;
+    static const int DefaultMaxActivePerHost = 16;
+
+    struct Entry {
+        std::shared_ptr<StreamChannel> stream;
+        qint64 since;
+    };
+    struct Waiter {
+        QPointer<QObject> context;
+        std::function<void()> ready;
+    };
+
+    Opener opener;
+    // Oldest first in every list
+    std::map<QByteArray, std::vector<Entry>> idle;
+    int idleTotal;
+    int maxIdleTime;
+    int maxIdlePerHost;
+    int maxIdle;
+    int maxActivePerHost;
+    quint64 reused;
+    // Streams handed out, per key
+    std::map<QByteArray, int> active;
+    std::map<QByteArray, std::deque<Waiter>> waiting;
+    // Discarded streams, kept until the event loop is back (see discard())
+    std::vector<std::shared_ptr<StreamChannel>> discarded;
+    bool deferredScheduled;
+    QTimer ticker;
+    QElapsedTimer clock;
+
+    void evict(StreamChannel *stream, bool graceful);
+    void evictOldest();
+    // Closes, or aborts the stream if it isn't graceful. It may be called in
+    // a signal of the stream, so the last reference is released later
+    void discard(std::shared_ptr<StreamChannel> stream, bool graceful);
+    // A stream to key isn't in use anymore
+    void deactivate(const QByteArray &key);
+    void scheduleDeferred();
+    // Releases the discarded streams and serves the waiters
+    void onDeferred();
+    void onTick();
+};
+
+}
+
+#endif // HTTPORIGINPOOL_H
@@ -0,0 +1,630 @@
+/*
+ * httpparser.cpp - the source file of HttpParser class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpparser.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace QSS;
+
+namespace {
+
+char toLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool equalsIgnoreCase(const char *data, size_t size, const char *literal)
+{
+    const size_t length = std::strlen(literal);
+    if (size != length) {
+        return false;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        if (toLower(data[i]) != literal[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// RFC 7230 tchar
+bool isTokenChar(char c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        return true;
+    }
+    return c != '\0' && std::strchr("!#$%&'*+-.^_`|~", c) != nullptr;
+}
+
+bool isToken(const char *data, size_t size)
+{
+    return size > 0 && std::all_of(data, data + size, isTokenChar);
+}
+
+bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+int hexValue(char c)
+{
+    if (isDigit(c)) {
+        return c - '0';
+    }
+    c = toLower(c);
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+// "HTTP/1.x"
+bool parseVersion(const char *data, size_t size, int &minor)
+{
+    if (size != 8 || std::memcmp(data, "HTTP/1.", 7) != 0 || !isDigit(data[7])) {
+        return false;
+    }
+    minor = data[7] - '0';
+    return true;
+}
+
+bool parseNumber(const char *data, size_t size, uint64_t &value)
+{
+    // 18 digits can't overflow
+    if (size == 0 || size > 18 || !std::all_of(data, data + size, isDigit)) {
+        return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < size; ++i) {
+        value = value * 10 + static_cast<uint64_t>(data[i] - '0');
+    }
+    return true;
+}
+
+void trim(const char *data, size_t &begin, size_t &end)
+{
+    while (begin < end && (data[begin] == ' ' || data[begin] == '\t')) {
+        ++begin;
+    }
+    while (end > begin && (data[end - 1] == ' ' || data[end - 1] == '\t')) {
+        --end;
+    }
+}
+
+// Calls function with every element of a comma-separated list
+template<typename Function>
+void forEachToken(const char *data, size_t size, Function function)
+{
+    size_t begin = 0;
+    while (begin <= size) {
+        const void *comma = std::memchr(data + begin, ',', size - begin);
+        size_t end = comma ? static_cast<const char *>(comma) - data : size;
+        const size_t next = end + 1;
+        trim(data, begin, end);
+        if (end > begin) {
+            function(data + begin, end - begin);
+        }
+        begin = next;
+    }
+}
+
+HttpParser::Span span(size_t offset, size_t length)
+{
+    return { static_cast<uint32_t>(offset), static_cast<uint32_t>(length) };
+}
+
+}  // namespace
+
+HttpParser::HttpParser(Type type) : type(type)
+{
+    reset();
+}
+
+void HttpParser::reset()
+{
+    headRequest = false;
+    scanned = 0;
+    startLineSeen = false;
+    m_headComplete = false;
+    m_failed = false;
+    m_versionMinor = 1;
+    m_statusCode = 0;
+    m_method = m_target = m_host = span(0, 0);
+    m_isConnect = false;
+    m_isHead = false;
+    m_headers.clear();
+    m_framing = NoBody;
+    m_contentLength = 0;
+    remaining = 0;
+    chunkDigits = 0;
+    bodyState = BodyDone;
+    m_keepAlive = false;
+    m_upgrade = false;
+}
+
+int HttpParser::parseHead(const char *data, size_t size)
+{
+    if (m_failed) {
+        return -1;
+    }
+    if (m_headComplete) {
+        return static_cast<int>(scanned);
+    }
+    while (scanned < size) {
+        const void *newline = std::memchr(data + scanned, '\n', size - scanned);
+        if (!newline) {
+            break;
+        }
+        const size_t begin = scanned;
+        size_t end = static_cast<const char *>(newline) - data;
+        scanned = end + 1;
+        if (scanned > static_cast<size_t>(MaxHeadSize)) {
+            return fail();
+        }
+        if (end > begin && data[end - 1] == '\r') {
+            --end;
+        }
+        if (begin == end) {
+            // Empty lines before the start line are ignored (RFC 7230 3.5)
+            if (!startLineSeen) {
+                continue;
+            }
+            if (!finishHead(data)) {
+                return fail();
+            }
+            m_headComplete = true;
+            return static_cast<int>(scanned);
+        }
+        const bool parsed = startLineSeen ? parseHeaderLine(data, begin, end)
+                                          : parseStartLine(data, begin, end);
+        if (!parsed) {
+            return fail();
+        }
+        startLineSeen = true;
+    }
+    if (size > static_cast<size_t>(MaxHeadSize)) {
+        return fail();
+    }
+    return 0;
+}
+
+bool HttpParser::parseStartLine(const char *data, size_t begin, size_t end)
+{
+    const char *line = data + begin;
+    const size_t size = end - begin;
+    if (type == Request) {
+        // method SP request-target SP HTTP-version
+        const char *space = static_cast<const char *>(std::memchr(line, ' ', size));
+        if (!space || !isToken(line, space - line)) {
+            return false;
+        }
+        const char *target = space + 1;
+        space = static_cast<const char *>(std::memchr(target, ' ', line + size - target));
+        if (!space || space == target) {
+            return false;
+        }
+        if (std::any_of(target, space, [](char c) {
+                return static_cast<unsigned char>(c) <= ' ' || c == '\x7f';
+            })) {
+            return false;
+        }
+        m_method = span(begin, target - 1 - line);
+        m_isConnect = m_method.length == 7 && std::memcmp(line, "CONNECT", 7) == 0;
+        m_isHead = m_method.length == 4 && std::memcmp(line, "HEAD", 4) == 0;
+        m_target = span(target - data, space - target);
+        return parseVersion(space + 1, line + size - space - 1, m_versionMinor);
+    }
+
+    // HTTP-version SP status-code SP reason-phrase
+    if (size < 12 || !parseVersion(line, 8, m_versionMinor) || line[8] != ' '
+            || !std::all_of(line + 9, line + 12, isDigit)
+            || (size > 12 && line[12] != ' ')) {
+        return false;
+    }
+    m_statusCode = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+    return true;
+}
+
+bool HttpParser::parseHeaderLine(const char *data, size_t begin, size_t end)
+{
+    // Obsolete line folding is rejected (RFC 7230 3.2.4)
+    if (data[begin] == ' ' || data[begin] == '\t') {
+        return false;
+    }
+    const void *colon = std::memchr(data + begin, ':', end - begin);
+    if (!colon) {
+        return false;
+    }
+    const size_t nameEnd = static_cast<const char *>(colon) - data;
+    if (!isToken(data + begin, nameEnd - begin)) {
+        return false;
+    }
+    size_t valueBegin = nameEnd + 1;
+    size_t valueEnd = end;
+    trim(data, valueBegin, valueEnd);
+    m_headers.push_back({ span(begin, nameEnd - begin),
+                          span(valueBegin, valueEnd - valueBegin) });
+    return true;
+}
+
+bool HttpParser::finishHead(const char *data)
+{
+    bool hasLength = false;
+    bool hasTransferEncoding = false;
+    bool chunked = false;
+    bool close = false;
+    bool keepAliveToken = false;
+    for (const Header &header : m_headers) {
+        const char *name = data + header.name.offset;
+        const char *value = data + header.value.offset;
+        const size_t nameSize = header.name.length;
+        const size_t valueSize = header.value.length;
+        if (equalsIgnoreCase(name, nameSize, "content-length")) {
+            uint64_t length = 0;
+            if (!parseNumber(value, valueSize, length)
+                    || (hasLength && length != m_contentLength)) {
+                return false;
+            }
+            hasLength = true;
+            m_contentLength = length;
+        } else if (equalsIgnoreCase(name, nameSize, "transfer-encoding")) {
+            // Only the final coding decides the framing
+            hasTransferEncoding = true;
+            forEachToken(value, valueSize, [&chunked](const char *token, size_t size) {
+                chunked = equalsIgnoreCase(token, size, "chunked");
+            });
+        } else if (equalsIgnoreCase(name, nameSize, "connection")
+                   || (type == Request && equalsIgnoreCase(name, nameSize, "proxy-connection"))) {
+            forEachToken(value, valueSize, [&](const char *token, size_t size) {
+                close = close || equalsIgnoreCase(token, size, "close");
+                keepAliveToken = keepAliveToken || equalsIgnoreCase(token, size, "keep-alive");
+                m_upgrade = m_upgrade || equalsIgnoreCase(token, size, "upgrade");
+            });
+        } else if (type == Request && m_host.length == 0
+                   && equalsIgnoreCase(name, nameSize, "host")) {
+            m_host = header.value;
+        }
+    }
+    m_keepAlive = !close && (m_versionMinor >= 1 || keepAliveToken);
+
+    if (type == Request) {
+        if (isConnect()) {
+            m_framing = Tunnel;
+        } else if (hasTransferEncoding) {
+            // Both would let a request be smuggled past us (RFC 7230 3.3.3)
+            if (!chunked || hasLength) {
+                return false;
+            }
+            m_framing = Chunked;
+        } else {
+            m_framing = m_contentLength > 0 ? ContentLength : NoBody;
+        }
+    } else if (m_statusCode == 101) {
+        m_framing = Tunnel;
+    } else if (headRequest || m_statusCode < 200 || m_statusCode == 204
+               || m_statusCode == 304) {
+        m_framing = NoBody;
+    } else if (hasTransferEncoding) {
+        m_framing = chunked ? Chunked : UntilClose;
+        m_keepAlive = m_keepAlive && chunked && !hasLength;
+    } else if (hasLength) {
+        m_framing = m_contentLength > 0 ? ContentLength : NoBody;
+    } else {
+        m_framing = UntilClose;
+        m_keepAlive = false;
+    }
+
+    switch (m_framing) {
+    case NoBody:
+        bodyState = BodyDone;
+        break;
+    case ContentLength:
+        remaining = m_contentLength;
+        bodyState = ChunkData;
+        break;
+    case Chunked:
+        bodyState = ChunkSize;
+        break;
+    case UntilClose:
+    case Tunnel:
+        bodyState = Unbounded;
+        break;
+    }
+    return true;
+}
+
+size_t HttpParser::parseBody(const char *data, size_t size)
+{
+    if (!m_headComplete || m_failed) {
+        return 0;
+    }
+    if (bodyState == Unbounded) {
+        return size;
+    }
+    size_t pos = 0;
+    while (pos < size && bodyState != BodyDone) {
+        const char c = data[pos];
+        switch (bodyState) {
+        case ChunkData: {
+            const size_t length = static_cast<size_t>(
+                        std::min<uint64_t>(remaining, size - pos));
+            pos += length;
+            remaining -= length;
+            if (remaining == 0) {
+                bodyState = m_framing == Chunked ? ChunkDataCR : BodyDone;
+            }
+            continue;
+        }
+        case ChunkSize: {
+            const int value = hexValue(c);
+            if (value >= 0) {
+                // 15 digits can't overflow
+                if (++chunkDigits > 15) {
+                    fail();
+                    return pos;
+                }
+                remaining = remaining * 16 + static_cast<uint64_t>(value);
+                break;
+            }
+            if (chunkDigits == 0) {
+                fail();
+                return pos;
+            }
+            if (c == ';' || c == ' ' || c == '\t') {
+                bodyState = ChunkExtension;
+            } else if (c == '\r') {
+                bodyState = ChunkSizeLF;
+            } else if (c == '\n') {
+                bodyState = remaining > 0 ? ChunkData : TrailerLineStart;
+            } else {
+                fail();
+                return pos;
+            }
+            break;
+        }
+        case ChunkExtension:
+            if (c == '\r') {
+                bodyState = ChunkSizeLF;
+            } else if (c == '\n') {
+                bodyState = remaining > 0 ? ChunkData : TrailerLineStart;
+            }
+            break;
+        case ChunkSizeLF:
+            if (c != '\n') {
+                fail();
+                return pos;
+            }
+            bodyState = remaining > 0 ? ChunkData : TrailerLineStart;
+            break;
+        case ChunkDataCR:
+            if (c == '\r') {
+                bodyState = ChunkDataLF;
+            } else if (c == '\n') {
+                chunkDigits = 0;
+                bodyState = ChunkSize;
+            } else {
+                fail();
+                return pos;
+            }
+            break;
+        case ChunkDataLF:
+            if (c != '\n') {
+                fail();
+                return pos;
+            }
+            chunkDigits = 0;
+            bodyState = ChunkSize;
+            break;
+        case TrailerLineStart:
+            bodyState = c == '\r' ? TrailerLF : (c == '\n' ? BodyDone : TrailerLine);
+            break;
+        case TrailerLine:
+            if (c == '\n') {
+                bodyState = TrailerLineStart;
+            }
+            break;
+        case TrailerLF:
+            if (c != '\n') {
+                fail();
+                return pos;
+            }
+            bodyState = BodyDone;
+            break;
+        case BodyDone:
+        case Unbounded:
+            break;
+        }
+        ++pos;
+    }
+    return pos;
+}
+
+int HttpParser::fail()
+{
+    m_failed = true;
+    return -1;
+}
+
+bool HttpParser::headComplete() const
+{
+    return m_headComplete;
+}
+
+bool HttpParser::complete() const
+{
+    return m_headComplete && bodyState == BodyDone;
+}
+
+bool HttpParser::failed() const
+{
+    return m_failed;
+}
+
+HttpParser::Framing HttpParser::framing() const
+{
+    return m_framing;
+}
+
+uint64_t HttpParser::contentLength() const
+{
+    return m_contentLength;
+}
+
+bool HttpParser::keepAlive() const
+{
+    return m_keepAlive;
+}
+
+int HttpParser::versionMinor() const
+{
+    return m_versionMinor;
+}
+
+const std::vector<HttpParser::Header> &HttpParser::headers() const
+{
+    return m_headers;
+}
+
+HttpParser::Span HttpParser::method() const
+{
+    return m_method;
+}
+
+HttpParser::Span HttpParser::target() const
+{
+    return m_target;
+}
+
+HttpParser::Span HttpParser::host() const
+{
+    return m_host;
+}
+
+bool HttpParser::isConnect() const
+{
+    return m_isConnect;
+}
+
+bool HttpParser::isHead() const
+{
+    return m_isHead;
+}
+
+bool HttpParser::upgrade() const
+{
+    return m_upgrade;
+}
+
+void HttpParser::setHeadRequest(bool head)
+{
+    headRequest = head;
+}
+
+int HttpParser::statusCode() const
+{
+    return m_statusCode;
+}
+
+bool HttpParser::splitAuthority(const char *data, size_t size, Span &host,
+                                uint16_t &port, uint16_t defaultPort)
+{
+    size_t begin = 0;
+    for (size_t i = size; i > 0; --i) {
+        if (data[i - 1] == '@') {
+            begin = i;
+            break;
+        }
+    }
+    size_t hostEnd;
+    size_t portBegin;
+    if (begin < size && data[begin] == '[') {
+        const void *close = std::memchr(data + begin, ']', size - begin);
+        if (!close) {
+            return false;
+        }
+        hostEnd = static_cast<const char *>(close) - data;
+        host = span(begin + 1, hostEnd - begin - 1);
+        portBegin = hostEnd + 1;
+    } else {
+        const void *colon = std::memchr(data + begin, ':', size - begin);
+        hostEnd = colon ? static_cast<const char *>(colon) - data : size;
+        host = span(begin, hostEnd - begin);
+        portBegin = hostEnd;
+    }
+    if (host.length == 0) {
+        return false;
+    }
+    port = defaultPort;
+    if (portBegin == size) {
+        return true;
+    }
+    uint64_t value = 0;
+    if (data[portBegin] != ':') {
+        return false;
+    }
+    // An empty port means the default one (RFC 3986 3.2.3)
+    if (portBegin + 1 == size) {
+        return true;
+    }
+    if (!parseNumber(data + portBegin + 1, size - portBegin - 1, value)
+            || value == 0 || value > 65535) {
+        return false;
+    }
+    port = static_cast<uint16_t>(value);
+    return true;
+}
+
+bool HttpParser::splitAbsoluteUri(const char *data, size_t size,
+                                  Span &authority, Span &path)
+{
+    static const size_t schemeLength = 7;
+    if (size <= schemeLength || !equalsIgnoreCase(data, schemeLength, "http://")) {
+        return false;
+    }
+    const char *end = std::find_if(data + schemeLength, data + size, [](char c) {
+        return c == '/' || c == '?' || c == '#';
+    });
+    authority = span(schemeLength, end - data - schemeLength);
+    path = span(end - data, data + size - end);
+    return authority.length > 0;
+}
+
+int HttpParser::toOriginForm(char *head)
+{
+    Span authority;
+    Span path;
+    if (type != Request || !m_headComplete
+            || !splitAbsoluteUri(head + m_target.offset, m_target.length, authority, path)) {
+        return -1;
+    }
+    size_t pathBegin = m_target.offset + path.offset;
+    size_t pathLength = path.length;
+    // The authority is never empty, so there is room for the slash
+    if (pathLength == 0 || head[pathBegin] != '/') {
+        head[--pathBegin] = '/';
+        ++pathLength;
+    }
+    const size_t begin = pathBegin - m_method.length - 1;
+    head[pathBegin - 1] = ' ';
+    std::memmove(head + begin, head + m_method.offset, m_method.length);
+    m_method = span(begin, m_method.length);
+    m_target = span(pathBegin, pathLength);
+    return static_cast<int>(begin);
+}
@@ -0,0 +1,171 @@
+/*
+ * httpparser.h - the header file of HttpParser class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTPPARSER_H
+#define HTTPPARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "util/export.h"
+
+namespace QSS {
+
+/**
+ * Incremental HTTP/1.x message parser for proxying.
+ *
+ * It doesn't copy anything: parseHead() records the fields as spans of the
+ * buffer it's given, and parseBody() only tells how many bytes of the input
+ * belong to the message, so that they can be forwarded as they are. The
+ * buffer may grow between calls, but its beginning must stay the same until
+ * the head is complete.
+ */
+class QSS_EXPORT HttpParser
+{
+public:
+    enum Type { Request, Response };
+
+    // How the body after the head is delimited
+    enum Framing {
+        NoBody,
+        ContentLength,
+        Chunked,
+        UntilClose,     // response ends when the connection is closed
+        Tunnel          // CONNECT or 101 Switching Protocols
+    };
+
+    struct Span {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Header {
+        Span name;
+        Span value;
+    };
+
+    static const int MaxHeadSize = 65536;
+
+    explicit HttpParser(Type type);
+
+    /*
+     * Returns the length of the head at the beginning of data once the empty
+     * line has arrived, 0 if more data is needed, or -1 if it's malformed or
+     * longer than MaxHeadSize. Only the data that wasn't seen in the previous
+     * call is scanned
+     */
+    int parseHead(const char *data, size_t size);
+    // Returns how many bytes at the beginning of data belong to the body.
+    // The message is complete if it's fewer than size, or once complete()
+    size_t parseBody(const char *data, size_t size);
+    // Prepares for the next message on the same connection
+    void reset();
+
+    bool headComplete() const;
+    bool complete() const;
+    bool failed() const;
+
+    Framing framing() const;
+    uint64_t contentLength() const;
+    bool keepAlive() const;
+    int versionMinor() const;
+    const std::vector<Header> &headers() const;
+
+    // Request
+    Span method() const;
+    Span target() const;
+    // Value of the Host header, empty if there is none
+    Span host() const;
+    bool isConnect() const;
+    bool isHead() const;
+    // Connection: upgrade, the protocol may be switched after the response
+    bool upgrade() const;
+
+    // Response. Set before parsing the response to a HEAD request
+    void setHeadRequest(bool head);
+    int statusCode() const;
+
+    // Splits "host[:port]" or "[ipv6][:port]", dropping any userinfo
+    static bool splitAuthority(const char *data, size_t size, Span &host,
+                               uint16_t &port, uint16_t defaultPort);
+    // Splits an absolute-form http target into its authority and the path
+    // (which may be empty). Spans are relative to data
+    static bool splitAbsoluteUri(const char *data, size_t size,
+                                 Span &authority, Span &path);
+
+    /*
+     * Turns the absolute-form target of the parsed request line into the
+     * origin-form an origin server expects, by moving the method forward
+     * over the scheme and authority. head is the buffer given to
+     * parseHead(). Returns the offset where the rewritten head now starts,
+     * or -1 if the target isn't an absolute http URI
+     */
+    int toOriginForm(char *head);
+
+private:
+    enum BodyState {
+        ChunkSize,
+        ChunkExtension,
+        ChunkSizeLF,
+        ChunkData,
+        ChunkDataCR,
+        ChunkDataLF,
+        TrailerLineStart,
+        TrailerLine,
+        TrailerLF,
+        BodyDone,
+        Unbounded
+    };
+
+    const Type type;
+    bool headRequest;
+    // Head
+    size_t scanned;
+    bool startLineSeen;
+    bool m_headComplete;
+    bool m_failed;
+    int m_versionMinor;
+    int m_statusCode;
+    Span m_method;
+    Span m_target;
+    Span m_host;
+    bool m_isConnect;
+    bool m_isHead;
+    std::vector<Header> m_headers;
+    // Body
+    Framing m_framing;
+    uint64_t m_contentLength;
+    uint64_t remaining;
+    int chunkDigits;
+    BodyState bodyState;
+    bool m_keepAlive;
+    bool m_upgrade;
+
+    bool parseStartLine(const char *data, size_t begin, size_t end);
+    bool parseHeaderLine(const char *data, size_t begin, size_t end);
+    bool finishHead(const char *data);
+    int fail();
+};
+
+}
+
+#endif // HTTPPARSER_H
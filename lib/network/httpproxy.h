@@ -2,7 +2,7 @@
  * httpproxy.h - the header file of HttpProxy class
  *
  * This class enables transparent HTTP proxy that handles data transfer
- * and send/recv them via upper-level SOCKS5 proxy
+ * and relays it through a local mode TcpServer inside this process
  *
  * Copyright (C) 2015-2016 Symeon Huang <hzwhuang@gmail.com>
  *
@@ -27,11 +27,14 @@
 #define HTTPPROXY_H
 
 #include <QTcpServer>
-#include <QNetworkProxy>
+#include <QTcpSocket>
 #include "util/export.h"
 
 namespace QSS {
 
+class HttpOriginPool;
+class TcpServer;
+
 class QSS_EXPORT HttpProxy : public QTcpServer
 {
     Q_OBJECT
@@ -42,25 +45,27 @@ public:
 
     /*
      * DO NOT use listen() function, use httpListen instead
-     * The socks_port is local socks proxy server port
+     * Requests are relayed inside this process by relays, a local mode
+     * TcpServer that doesn't need to listen (see TcpServer::prepare())
      */
     bool httpListen(const QHostAddress &http_addr,
                     uint16_t http_port,
-                    uint16_t socks_port);
+                    TcpServer *relays);
 
 protected:
     void incomingConnection(qintptr handle);
 
 private:
-    QNetworkProxy upstreamProxy;
+    TcpServer *relays;
+    // Keep-alive streams to origin servers, shared by all connections
+    HttpOriginPool *origins;
+
+    // Hands a CONNECT request over to a relay. data was read after the request
+    void openTunnel(QTcpSocket *socket, const QByteArray &host, uint16_t port,
+                    const QByteArray &data);
 
 private slots:
     void onSocketError(QAbstractSocket::SocketError);
-    void onSocketReadyRead();
-    void onProxySocketConnected();
-    //this function is used for HTTPS transparent proxy
-    void onProxySocketConnectedHttps();
-    void onProxySocketReadyRead();
 };
 
 }
@@ -0,0 +1,225 @@
+/*
+ * muxclient.cpp - the source file of MuxClient class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "muxclient.h"
+#include "util/common.h"
+#include <QDebug>
+#include <algorithm>
+#include <utility>
+
+namespace QSS {
+
+MuxClient::MuxClient(Address server,
+                     std::string method,
+                     std::string password,
+                     int maxSessions,
+                     QObject *parent) :
+    QObject(parent),
+    server(std::move(server)),
+    method(std::move(method)),
+    password(std::move(password)),
+    maxSessions(static_cast<size_t>(std::max(maxSessions, 1)))
+{
+    clock.start();
+    ticker.setInterval(1000);
+    connect(&ticker, &QTimer::timeout, this, &MuxClient::onTick);
+    ticker.start();
+}
+
+MuxClient::~MuxClient()
+{
+    for (auto &c : connections) {
+        c->socket->disconnect(this);
+        c->session->abortAll();
+    }
+}
+
+bool MuxClient::Connection::rejected() const
+{
+    return headerSent && !session->isEstablished();
+}
+
+std::shared_ptr<MuxStream> MuxClient::openStream(const std::string &header)
+{
+    Connection *best = nullptr;
+    bool negotiating = false;
+    for (auto &c : connections) {
+        if (!c->session->isEstablished()) {
+            negotiating = true;
+        } else if (!best || c->session->streamCount() < best->session->streamCount()) {
+            best = c.get();
+        }
+    }
+    const bool busy = !best || best->session->streamCount() >= StreamsPerSession;
+    if (busy && !negotiating && connections.size() < maxSessions && clock.elapsed() >= retryAt) {
+        startConnection();
+    }
+    if (!best || best->session->streamCount() >= MuxSession::MaxStreams) {
+        return nullptr;
+    }
+    best->lastActive = clock.elapsed();
+    return best->session->openStream(header);
+}
+
+void MuxClient::startConnection()
+{
+    auto c = std::make_unique<Connection>();
+    Connection *conn = c.get();
+    c->socket = std::make_unique<QTcpSocket>();
+    c->encryptor = std::make_unique<Encryptor>(method, password);
+    c->session = std::make_unique<MuxSession>(MuxSession::Client);
+    c->started = c->lastActive = clock.elapsed();
+    c->socket->setReadBufferSize(65536);
+    connections.push_back(std::move(c));
+
+    QTcpSocket *socket = conn->socket.get();
+    connect(socket, &QTcpSocket::connected, this, [this, conn]() {
+        onConnected(conn);
+    });
+    connect(socket, &QTcpSocket::readyRead, this, [this, conn]() {
+        onReadyRead(conn);
+    });
+    connect(socket, &QTcpSocket::bytesWritten, this, [this, conn](qint64 bytes) {
+        emit bytesSend(bytes);
+        flush(conn);
+    });
+    connect(socket, &QTcpSocket::disconnected, this, [this, conn]() {
+        drop(conn, conn->rejected());
+    });
+    connect(socket,
+            static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
+            (&QTcpSocket::error),
+            this,
+            [this, conn]() {
+        QDebug(QtMsgType::QtDebugMsg).noquote() << "Mux connection:" << conn->socket->errorString();
+        drop(conn, conn->rejected());
+    });
+    connect(conn->session.get(), &MuxSession::outputReady, this, [this, conn]() {
+        flush(conn);
+    });
+
+    server.lookUp([this, conn](bool success) {
+        auto it = std::find_if(connections.begin(), connections.end(),
+                               [conn](const std::unique_ptr<Connection> &c) {
+            return c.get() == conn;
+        });
+        if (it == connections.end()) {
+            return;
+        }
+        if (success) {
+            conn->socket->connectToHost(server.getFirstIP(), server.getPort());
+        } else {
+            drop(conn, false);
+        }
+    });
+}
+
+void MuxClient::onConnected(Connection *c)
+{
+    c->socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    c->socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    const std::string header = Common::packAddress(Address(MuxSession::Host, 0));
+    const std::string data = c->encryptor->encrypt(header);
+    c->socket->write(data.data(), data.size());
+    c->headerSent = true;
+}
+
+void MuxClient::onReadyRead(Connection *c)
+{
+    const QByteArray buf = c->socket->readAll();
+    if (buf.isEmpty()) {
+        return;
+    }
+    emit bytesRead(buf.size());
+    c->lastActive = clock.elapsed();
+    std::string data;
+    try {
+        data = c->encryptor->decrypt(std::string(buf.constData(), buf.size()));
+    } catch (const std::exception &e) {
+        QDebug(QtMsgType::QtCriticalMsg) << "Mux connection:" << e.what();
+        drop(c, false);
+        return;
+    }
+    if (!c->session->feed(data)) {
+        qWarning("Mux connection: protocol error");
+        drop(c, false);
+    }
+}
+
+void MuxClient::flush(Connection *c)
+{
+    if (c->socket->state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+    while (c->socket->bytesToWrite() < HighWatermark) {
+        const std::string frames = c->session->takeFrames(65536);
+        if (frames.empty()) {
+            break;
+        }
+        c->lastActive = clock.elapsed();
+        const std::string data = c->encryptor->encrypt(frames);
+        c->socket->write(data.data(), data.size());
+    }
+}
+
+void MuxClient::drop(Connection *c, bool negotiationFailed)
+{
+    auto it = std::find_if(connections.begin(), connections.end(),
+                           [c](const std::unique_ptr<Connection> &p) {
+        return p.get() == c;
+    });
+    if (it == connections.end()) {
+        return;
+    }
+    std::unique_ptr<Connection> conn = std::move(*it);
+    connections.erase(it);
+    if (negotiationFailed) {
+        qInfo("The server doesn't support mux. Using plain connections");
+        retryAt = clock.elapsed() + RetryInterval;
+    }
+    conn->socket->disconnect(this);
+    conn->socket->abort();
+    // Can be called from the socket's own signal
+    conn->socket.release()->deleteLater();
+    conn->session->abortAll();
+    conn->session.release()->deleteLater();
+}
+
+void MuxClient::onTick()
+{
+    const qint64 now = clock.elapsed();
+    std::vector<Connection *> expired;
+    for (auto &c : connections) {
+        if (!c->session->isEstablished()) {
+            if (now - c->started >= HelloTimeout) {
+                expired.push_back(c.get());
+            }
+        } else if (c->session->streamCount() == 0 && now - c->lastActive >= IdleTimeout) {
+            expired.push_back(c.get());
+        }
+    }
+    for (Connection *c : expired) {
+        drop(c, c->rejected());
+    }
+}
+
+}  // namespace QSS
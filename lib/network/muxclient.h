@@ -0,0 +1,111 @@
+/*
+ * muxclient.h - the header file of MuxClient class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUXCLIENT_H
+#define MUXCLIENT_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTcpSocket>
+#include <QTimer>
+#include <memory>
+#include <vector>
+#include "crypto/encryptor.h"
+#include "muxsession.h"
+#include "types/address.h"
+
+namespace QSS {
+
+/**
+ * Local mode: keeps a few multiplexed connections (MuxSession) to the
+ * server and opens streams on them. If the server doesn't accept the
+ * session, mux isn't tried again for a while and the callers connect as
+ * usual.
+ */
+class QSS_EXPORT MuxClient : public QObject
+{
+    Q_OBJECT
+public:
+    MuxClient(Address server,
+              std::string method,
+              std::string password,
+              int maxSessions,
+              QObject *parent = nullptr);
+    ~MuxClient();
+
+    MuxClient(const MuxClient &) = delete;
+
+    /*
+     * Opens a stream to the target in header (the shadowsocks address header)
+     * on the least loaded session. Returns nullptr if no session is ready, in
+     * which case the caller should connect to the server directly. New
+     * sessions are negotiated in the background as needed.
+     */
+    std::shared_ptr<MuxStream> openStream(const std::string &header);
+
+signals:
+    // Traffic of the underlying connections, see TcpRelay::bytesRead()
+    void bytesRead(quint64);
+    void bytesSend(quint64);
+
+private:
+    // Soft limit before another session is opened
+    static const size_t StreamsPerSession = 32;
+    static const int HelloTimeout = 5000;
+    // Sessions without streams are closed after this long
+    static const int IdleTimeout = 60000;
+    // How long to stick to plain connections after a failed negotiation
+    static const int RetryInterval = 300000;
+    static const int64_t HighWatermark = 4 * 65536;
+
+    struct Connection {
+        std::unique_ptr<QTcpSocket> socket;
+        std::unique_ptr<Encryptor> encryptor;
+        std::unique_ptr<MuxSession> session;
+        qint64 started = 0;
+        qint64 lastActive = 0;
+        bool headerSent = false;
+
+        // Closed by the server before it accepted the session
+        bool rejected() const;
+    };
+
+    Address server;
+    const std::string method;
+    const std::string password;
+    const size_t maxSessions;
+    std::vector<std::unique_ptr<Connection> > connections;
+    QTimer ticker;
+    QElapsedTimer clock;
+    qint64 retryAt = 0;
+
+    void startConnection();
+    void onConnected(Connection *c);
+    void onReadyRead(Connection *c);
+    void flush(Connection *c);
+    void drop(Connection *c, bool negotiationFailed);
+    void onTick();
+};
+
+}
+
+#endif // MUXCLIENT_H
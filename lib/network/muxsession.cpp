@@ -0,0 +1,347 @@
+/*
+ * muxsession.cpp - the source file of MuxSession and MuxStream classes
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "muxsession.h"
+#include <QTimer>
+#include <QtEndian>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace QSS {
+
+const char MuxSession::Host[] = "mux.qss.invalid";
+
+MuxStream::MuxStream(MuxSession *session, uint32_t id) :
+    session(session),
+    m_id(id),
+    sendWindow(MuxSession::InitialWindow),
+    recvWindow(MuxSession::InitialWindow)
+{
+}
+
+uint32_t MuxStream::id() const
+{
+    return m_id;
+}
+
+void MuxStream::write(const std::string &data)
+{
+    if (isClosed() || data.empty()) {
+        return;
+    }
+    out += data;
+    session->schedule(this);
+}
+
+void MuxStream::close()
+{
+    if (isClosed()) {
+        return;
+    }
+    finQueued = true;
+    session->schedule(this);
+}
+
+void MuxStream::abort()
+{
+    if (reset || !session) {
+        return;
+    }
+    reset = true;
+    out.clear();
+    // The session may hold the last reference
+    MuxSession *s = session;
+    const uint32_t id = m_id;
+    s->queueControl(MuxSession::Rst, id);
+    s->removeIfDone(id);
+}
+
+void MuxStream::consumed(uint64_t bytes)
+{
+    if (reset || !session) {
+        return;
+    }
+    unacked += bytes;
+    if (unacked >= static_cast<uint64_t>(MuxSession::InitialWindow / 4)) {
+        std::string increment(4, '\0');
+        qToBigEndian(static_cast<quint32>(unacked), reinterpret_cast<uchar *>(&increment[0]));
+        recvWindow += unacked;
+        unacked = 0;
+        session->queueControl(MuxSession::Window, m_id, increment);
+    }
+}
+
+int64_t MuxStream::pending() const
+{
+    return static_cast<int64_t>(out.size());
+}
+
+bool MuxStream::isClosed() const
+{
+    return finQueued || reset || !session;
+}
+
+MuxSession::MuxSession(Role role, QObject *parent) :
+    QObject(parent),
+    role(role),
+    m_established(role == Server)
+{
+    if (role == Server) {
+        queueControl(Hello, 0);
+    }
+}
+
+MuxSession::~MuxSession()
+{
+    for (auto &s : streams) {
+        s.second->session = nullptr;
+    }
+}
+
+std::shared_ptr<MuxStream> MuxSession::openStream(const std::string &header)
+{
+    if (role != Client || !m_established) {
+        return nullptr;
+    }
+    const uint32_t id = nextId++;
+    auto stream = std::make_shared<MuxStream>(this, id);
+    streams[id] = stream;
+    queueControl(Syn, id, header);
+    return stream;
+}
+
+bool MuxSession::feed(const std::string &data)
+{
+    in += data;
+    size_t pos = 0;
+    while (in.size() - pos >= FrameHeaderSize) {
+        const auto *header = reinterpret_cast<const uchar *>(in.data() + pos);
+        const auto type = static_cast<Type>(header[0]);
+        const uint32_t id = qFromBigEndian<quint32>(header + 1);
+        const size_t length = qFromBigEndian<quint16>(header + 5);
+        if (in.size() - pos - FrameHeaderSize < length) {
+            break;
+        }
+        if (!handleFrame(type, id, in.data() + pos + FrameHeaderSize, length)
+                || control.size() > MaxControlBytes) {
+            in.clear();
+            return false;
+        }
+        pos += FrameHeaderSize + length;
+    }
+    in.erase(0, pos);
+    return true;
+}
+
+bool MuxSession::handleFrame(Type type, uint32_t id, const char *payload, size_t length)
+{
+    if (type == Hello) {
+        if (role != Client) {
+            return false;
+        }
+        if (!m_established) {
+            m_established = true;
+            emit established();
+        }
+        return true;
+    }
+    if (type == Syn) {
+        if (role != Server || id == 0 || streams.count(id)) {
+            return false;
+        }
+        if (streams.size() >= MaxStreams) {
+            // Frames of the stream that are already on the way are ignored
+            queueControl(Rst, id);
+            return true;
+        }
+        auto stream = std::make_shared<MuxStream>(this, id);
+        streams[id] = stream;
+        emit newStream(stream, std::string(payload, length));
+        return true;
+    }
+
+    auto it = streams.find(id);
+    if (it == streams.end()) {
+        // Already closed or reset on our side
+        return type <= Window;
+    }
+    // Signal handlers may close the stream
+    std::shared_ptr<MuxStream> stream = it->second;
+    switch (type) {
+    case Data:
+        if (stream->finReceived || static_cast<int64_t>(length) > stream->recvWindow) {
+            return false;
+        }
+        stream->recvWindow -= length;
+        emit stream->dataReceived(std::string(payload, length));
+        break;
+    case Fin:
+        stream->finReceived = true;
+        removeIfDone(id);
+        emit stream->finished();
+        break;
+    case Rst:
+        stream->reset = true;
+        stream->out.clear();
+        removeIfDone(id);
+        emit stream->aborted();
+        break;
+    case Window:
+        if (length != 4) {
+            return false;
+        }
+        stream->sendWindow += qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(payload));
+        schedule(stream.get());
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+std::string MuxSession::takeFrames(size_t maxBytes)
+{
+    std::string frames;
+    frames.swap(control);
+    std::vector<std::pair<std::shared_ptr<MuxStream>, qint64> > written;
+    while (frames.size() + FrameHeaderSize < maxBytes && !ready.empty()) {
+        const uint32_t id = ready.front();
+        ready.pop_front();
+        auto it = streams.find(id);
+        if (it == streams.end()) {
+            continue;
+        }
+        std::shared_ptr<MuxStream> stream = it->second;
+        stream->scheduled = false;
+        const size_t length = std::min({ stream->out.size(),
+                                         static_cast<size_t>(std::max<int64_t>(stream->sendWindow, 0)),
+                                         MaxFramePayload,
+                                         maxBytes - frames.size() - FrameHeaderSize });
+        if (length > 0) {
+            appendFrame(frames, Data, id, stream->out.data(), length);
+            stream->out.erase(0, length);
+            stream->sendWindow -= length;
+            written.emplace_back(stream, static_cast<qint64>(length));
+        }
+        if (stream->out.empty() && stream->finQueued && !stream->finSent
+                && frames.size() + FrameHeaderSize <= maxBytes) {
+            appendFrame(frames, Fin, id, nullptr, 0);
+            stream->finSent = true;
+            removeIfDone(id);
+        }
+        // Back to the end of the queue if there is more to send
+        schedule(stream.get());
+    }
+    for (const auto &w : written) {
+        emit w.first->bytesWritten(w.second);
+    }
+    return frames;
+}
+
+bool MuxSession::isEstablished() const
+{
+    return m_established;
+}
+
+size_t MuxSession::streamCount() const
+{
+    return streams.size();
+}
+
+void MuxSession::abortAll()
+{
+    auto aborted = std::move(streams);
+    streams.clear();
+    ready.clear();
+    control.clear();
+    for (auto &s : aborted) {
+        s.second->session = nullptr;
+        s.second->reset = true;
+        s.second->out.clear();
+    }
+    for (auto &s : aborted) {
+        emit s.second->aborted();
+    }
+}
+
+void MuxSession::appendFrame(std::string &buf, Type type, uint32_t id,
+                             const char *payload, size_t length)
+{
+    uchar header[FrameHeaderSize];
+    header[0] = type;
+    qToBigEndian(static_cast<quint32>(id), header + 1);
+    qToBigEndian(static_cast<quint16>(length), header + 5);
+    buf.append(reinterpret_cast<const char *>(header), FrameHeaderSize);
+    if (length > 0) {
+        buf.append(payload, length);
+    }
+}
+
+void MuxSession::queueControl(Type type, uint32_t id, const std::string &payload)
+{
+    appendFrame(control, type, id, payload.data(), payload.size());
+    notifyOutput();
+}
+
+void MuxSession::schedule(MuxStream *stream)
+{
+    if (stream->scheduled || stream->reset || !stream->session) {
+        return;
+    }
+    const bool sendData = !stream->out.empty() && stream->sendWindow > 0;
+    const bool sendFin = stream->out.empty() && stream->finQueued && !stream->finSent;
+    if (!sendData && !sendFin) {
+        return;
+    }
+    stream->scheduled = true;
+    ready.push_back(stream->id());
+    notifyOutput();
+}
+
+void MuxSession::notifyOutput()
+{
+    // Coalesce the writes of an event loop iteration into fewer frames
+    if (outputScheduled) {
+        return;
+    }
+    outputScheduled = true;
+    QTimer::singleShot(0, this, [this]() {
+        outputScheduled = false;
+        emit outputReady();
+    });
+}
+
+void MuxSession::removeIfDone(uint32_t id)
+{
+    auto it = streams.find(id);
+    if (it == streams.end()) {
+        return;
+    }
+    MuxStream *stream = it->second.get();
+    if (stream->reset || (stream->finSent && stream->finReceived)) {
+        stream->session = nullptr;
+        streams.erase(it);
+    }
+}
+
+}  // namespace QSS
@@ -0,0 +1,166 @@
+/*
+ * muxsession.h - the header file of MuxSession and MuxStream classes
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MUXSESSION_H
+#define MUXSESSION_H
+
+#include <QObject>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include "streamchannel.h"
+
+namespace QSS {
+
+class MuxSession;
+
+/**
+ * A logical stream multiplexed over a MuxSession. Data is queued by write()
+ * and sent by the session as far as the peer's window allows.
+ */
+class QSS_EXPORT MuxStream : public StreamChannel
+{
+    Q_OBJECT
+public:
+    MuxStream(MuxSession *session, uint32_t id);
+
+    MuxStream(const MuxStream &) = delete;
+
+    uint32_t id() const;
+
+    void write(const std::string &data) override;
+    // Sends FIN once the queued data is sent
+    void close() override;
+    // Resets the stream
+    void abort() override;
+    void consumed(uint64_t bytes) override;
+
+    int64_t pending() const override;
+    bool isClosed() const override;
+
+private:
+    friend class MuxSession;
+
+    MuxSession *session;
+    const uint32_t m_id;
+    std::string out;
+    int64_t sendWindow;
+    int64_t recvWindow;
+    uint64_t unacked = 0;
+    bool scheduled = false;
+    bool finQueued = false;
+    bool finSent = false;
+    bool finReceived = false;
+    bool reset = false;
+};
+
+/**
+ * The stream multiplexing extension of the shadowsocks TCP protocol.
+ *
+ * A client negotiates a session by connecting to the address Host (which
+ * can't be resolved, so a plain server simply drops the connection). The
+ * server answers with a HELLO frame and then both sides exchange frames of
+ * type (1 byte), stream id (4 bytes) and payload length (2 bytes) followed
+ * by the payload, all inside the regular encrypted stream.
+ *
+ * MuxSession only does the framing, flow control and scheduling. The owner
+ * feeds it the decrypted bytes received and sends what takeFrames()
+ * returns whenever outputReady() is emitted.
+ */
+class QSS_EXPORT MuxSession : public QObject
+{
+    Q_OBJECT
+public:
+    enum Role { Client, Server };
+
+    explicit MuxSession(Role role, QObject *parent = nullptr);
+    ~MuxSession();
+
+    MuxSession(const MuxSession &) = delete;
+
+    static const char Host[];
+    // Per-stream window of each direction
+    static const int64_t InitialWindow = 256 * 1024;
+    static const size_t MaxFramePayload = 16384;
+    // Open streams of a session. The server resets the streams above it
+    static const size_t MaxStreams = 256;
+
+    // Client only. header is the shadowsocks address header of the target
+    std::shared_ptr<MuxStream> openStream(const std::string &header);
+
+    /*
+     * Returns false on a protocol error, after which the session is useless.
+     * That includes a peer which keeps sending frames that need an answer
+     * (e.g. SYN above MaxStreams) but doesn't read the answers
+     */
+    bool feed(const std::string &data);
+
+    /*
+     * Returns frames of maxBytes at most (plus pending control frames). The queued data of the
+     * streams is taken in a round-robin fashion, one frame at a time, so a
+     * bulk stream doesn't starve the others.
+     */
+    std::string takeFrames(size_t maxBytes);
+
+    // Client: whether the server accepted the session
+    bool isEstablished() const;
+    size_t streamCount() const;
+
+    // Aborts all streams, e.g. when the underlying connection is gone
+    void abortAll();
+
+signals:
+    void outputReady();
+    void established();
+    // Server only. A stream to the target in header was opened by the peer
+    void newStream(std::shared_ptr<MuxStream> stream, const std::string &header);
+
+private:
+    friend class MuxStream;
+
+    enum Type : uint8_t { Hello = 0, Syn = 1, Data = 2, Fin = 3, Rst = 4, Window = 5 };
+    static const size_t FrameHeaderSize = 7;
+    // Control frames that may wait for takeFrames()
+    static const size_t MaxControlBytes = 65536;
+
+    const Role role;
+    bool m_established;
+    bool outputScheduled = false;
+    uint32_t nextId = 1;
+    std::map<uint32_t, std::shared_ptr<MuxStream> > streams;
+    std::deque<uint32_t> ready;
+    std::string control;   // frames sent ahead of any data
+    std::string in;
+
+    static void appendFrame(std::string &buf, Type type, uint32_t id,
+                            const char *payload, size_t length);
+    bool handleFrame(Type type, uint32_t id, const char *payload, size_t length);
+    void queueControl(Type type, uint32_t id, const std::string &payload = std::string());
+    void schedule(MuxStream *stream);
+    void notifyOutput();
+    void removeIfDone(uint32_t id);
+};
+
+}
+
+#endif // MUXSESSION_H
@@ -0,0 +1,65 @@
+/*
+ * nativeudpsocket.h - the header file of NativeUdpSocket class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NATIVEUDPSOCKET_H
+#define NATIVEUDPSOCKET_H
+
+#include <QHostAddress>
+#include <functional>
+#include <string>
+#include "util/export.h"
+
+namespace QSS {
+
+/**
+ * The interface of the UDP sockets that bypass QUdpSocket.
+ *
+ * Implementations are handed out as shared pointers whose deleter may defer
+ * the destruction, so a handler is allowed to drop the last reference.
+ */
+class QSS_EXPORT NativeUdpSocket
+{
+public:
+    using DatagramHandler = std::function<void(const uint8_t *data,
+                                               size_t length,
+                                               const QHostAddress &addr,
+                                               uint16_t port)>;
+    using WrittenHandler = std::function<void(size_t bytes)>;
+
+    NativeUdpSocket() = default;
+    NativeUdpSocket(const NativeUdpSocket &) = delete;
+
+    virtual bool bind(const QHostAddress &addr, uint16_t port) = 0;
+    // An unbound socket is opened by its first send
+    virtual void send(std::string data, const QHostAddress &addr, uint16_t port) = 0;
+    virtual bool isOpen() const = 0;
+
+    virtual void setDatagramHandler(DatagramHandler handler) = 0;
+    virtual void setWrittenHandler(WrittenHandler handler) = 0;
+
+protected:
+    virtual ~NativeUdpSocket() = default;
+};
+
+}
+
+#endif // NATIVEUDPSOCKET_H
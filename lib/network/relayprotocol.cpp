@@ -0,0 +1,214 @@
+/*
+ * relayprotocol.cpp - the source file of RelayProtocol class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "relayprotocol.h"
+#include "util/common.h"
+#include <QDebug>
+#include <utility>
+
+namespace QSS {
+
+RelayProtocol::RelayProtocol(bool isLocal,
+                             bool autoBan,
+                             Address serverAddress,
+                             const std::string &method,
+                             const std::string &password) :
+    isLocal(isLocal),
+    autoBan(autoBan),
+    stage(INIT),
+    serverAddress(std::move(serverAddress)),
+    encryptor(new Encryptor(method, password))
+{
+}
+
+RelayProtocol::~RelayProtocol() = default;
+
+std::string RelayProtocol::takeBuffer()
+{
+    return std::string();
+}
+
+bool RelayProtocol::startExtension(std::string &, size_t)
+{
+    return false;
+}
+
+void RelayProtocol::handleLocalData(const uint8_t *data, size_t length)
+{
+    if (isLocal) {
+        if (stage == STREAM || stage == CONNECTING || stage == DNS) {
+            // Data sent during DNS and CONNECTING is kept by writeRemote()
+            sendToRemote(data, length);
+        } else if (stage == INIT) {
+            handleGreeting(data, length);
+        } else if (stage == ADDR) {
+            handleRequest(data, length);
+        } else if (stage != UDP_ASSOC) {
+            qCritical("Local unknown stage.");
+        }
+        return;
+    }
+
+    std::string plain;
+    try {
+        plain = encryptor->decrypt(data, length);
+    } catch (const std::exception &e) {
+        QDebug(QtMsgType::QtCriticalMsg) << "Local:" << e.what();
+        close();
+        return;
+    }
+    if (plain.empty()) {
+        // Not a complete AEAD chunk yet
+        return;
+    }
+    if (stage == STREAM || stage == CONNECTING || stage == DNS) {
+        writeRemote(std::move(plain));
+    } else if (stage == INIT) {
+        handleHeader(plain);
+    } else {
+        qCritical("Local unknown stage.");
+    }
+}
+
+void RelayProtocol::handleRemoteData(const uint8_t *data, size_t length)
+{
+    std::string out;
+    try {
+        if (isLocal) {
+            out = encryptor->decrypt(data, length);
+        } else {
+            out = takeBuffer();
+            encryptor->encrypt(data, length, out);
+        }
+    } catch (const std::exception &e) {
+        QDebug(QtMsgType::QtCriticalMsg) << "Remote:" << e.what();
+        close();
+        return;
+    }
+    if (!out.empty()) {
+        writeLocal(std::move(out));
+    }
+}
+
+void RelayProtocol::sendToRemote(const uint8_t *data, size_t length)
+{
+    if (!isLocal || plainRemote) {
+        writeRemote(std::string(reinterpret_cast<const char *>(data), length));
+        return;
+    }
+    std::string out = takeBuffer();
+    encryptor->encrypt(data, length, out);
+    writeRemote(std::move(out));
+}
+
+void RelayProtocol::handleGreeting(const uint8_t *data, size_t)
+{
+    static const char reject_data [] = { 0, 91 };
+    static const char accept_data [] = { 5, 0 };
+    if (data[0] != 5) {
+        qCritical("An invalid socket connection was rejected. "
+                  "Please make sure the connection type is SOCKS5.");
+        writeLocal(std::string(reject_data, 2));
+    } else {
+        writeLocal(std::string(accept_data, 2));
+    }
+    stage = ADDR;
+}
+
+void RelayProtocol::handleRequest(const uint8_t *data, size_t length)
+{
+    if (length < 3) {
+        qCritical("Incomplete SOCKS5 request");
+        close();
+        return;
+    }
+
+    const int cmd = static_cast<int>(data[1]);
+    if (cmd == 3) {//CMD_UDP_ASSOCIATE
+        qDebug("UDP associate");
+        static const char header_data [] = { 5, 0, 0 };
+        uint16_t port = 0;
+        const QHostAddress addr = localAddress(port);
+        writeLocal(std::string(header_data, 3) + Common::packAddress(addr, port));
+        stage = UDP_ASSOC;
+        return;
+    } if (cmd != 1) {//CMD_CONNECT
+        qCritical("Unknown command %d", cmd);
+        close();
+        return;
+    }
+
+    // The address header follows VER, CMD and RSV
+    const char *request = reinterpret_cast<const char *>(data) + 3;
+    const Common::AddressHeader header = Common::parseHeader(request, length - 3);
+    if (header.length == 0) {
+        qCritical("Can't parse header. Wrong encryption method or password?");
+        close();
+        return;
+    }
+    header.toAddress(remoteAddress);
+
+    uint16_t peerPort = 0;
+    const QHostAddress peer = peerAddress(peerPort);
+    QDebug(QtMsgType::QtInfoMsg).noquote().nospace()
+            << "Connecting " << remoteAddress << " from "
+            << peer.toString() << ":" << peerPort;
+
+    static const char res [] = { 5, 0, 0, 1, 0, 0, 0, 0, 16, 16 };
+    writeLocal(std::string(res, 10));
+
+    stage = DNS;
+    openRemote(std::string(request, header.length),
+               std::string(request + header.length, length - 3 - header.length));
+}
+
+void RelayProtocol::handleHeader(std::string &data)
+{
+    const Common::AddressHeader header = Common::parseHeader(data.data(), data.size());
+    uint16_t peerPort = 0;
+    const QHostAddress peer = peerAddress(peerPort);
+    if (header.length == 0) {
+        qCritical("Can't parse header. Wrong encryption method or password?");
+        if (autoBan) {
+            Common::banAddress(peer);
+        }
+        close();
+        return;
+    }
+    header.toAddress(remoteAddress);
+
+    if (startExtension(data, header.length)) {
+        return;
+    }
+
+    QDebug(QtMsgType::QtInfoMsg).noquote().nospace()
+            << "Connecting " << remoteAddress << " from "
+            << peer.toString() << ":" << peerPort;
+
+    stage = DNS;
+    const std::string packed = data.substr(0, header.length);
+    // What follows the header is all that is left of data
+    data.erase(0, header.length);
+    openRemote(packed, std::move(data));
+}
+
+}  // namespace QSS
@@ -0,0 +1,109 @@
+/*
+ * relayprotocol.h - the header file of RelayProtocol class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RELAYPROTOCOL_H
+#define RELAYPROTOCOL_H
+
+#include <QHostAddress>
+#include <memory>
+#include <string>
+#include "types/address.h"
+#include "crypto/encryptor.h"
+
+namespace QSS {
+
+/**
+ * The Shadowsocks TCP protocol of a relayed connection, apart from its
+ * sockets: the SOCKS5 handshake in local mode, the address header in server
+ * mode and the encryption of the stream in between.
+ *
+ * TcpRelay (QTcpSocket) and FdRelay (native descriptors) feed it what they
+ * read from either side, and do the I/O it asks for through the virtual
+ * functions below.
+ */
+class QSS_EXPORT RelayProtocol
+{
+public:
+    enum STAGE { INIT, ADDR, UDP_ASSOC, DNS, CONNECTING, STREAM, DESTROYED };
+
+    virtual ~RelayProtocol();
+
+    RelayProtocol(const RelayProtocol &) = delete;
+
+protected:
+    RelayProtocol(bool isLocal,
+                  bool autoBan,
+                  Address serverAddress,
+                  const std::string &method,
+                  const std::string &password);
+
+    const bool isLocal;
+    // Server mode: ban clients that send an invalid address header
+    const bool autoBan;
+    STAGE stage;
+    Address remoteAddress;
+    Address serverAddress;
+    std::unique_ptr<Encryptor> encryptor;
+    // Local mode: the remote side is a StreamChannel that takes plain data
+    bool plainRemote = false;
+
+    // Everything read from the local socket goes through here
+    void handleLocalData(const uint8_t *data, size_t length);
+    // Everything read from the remote socket goes through here
+    void handleRemoteData(const uint8_t *data, size_t length);
+    // Passes data to writeRemote(), encrypted unless in server mode or
+    // plainRemote is set
+    void sendToRemote(const uint8_t *data, size_t length);
+    // Server mode: the decrypted address header and what follows it
+    void handleHeader(std::string &data);
+
+    virtual void writeLocal(std::string data) = 0;
+    // Writes data to the remote side, or keeps it until that is connected
+    virtual void writeRemote(std::string data) = 0;
+    // An empty string to encrypt into. It may have some capacity already
+    virtual std::string takeBuffer();
+    /*
+     * Connects to remoteAddress, through the server in local mode. header
+     * is the packed address, and data what the client sent after it. The
+     * stage is DNS at this point
+     */
+    virtual void openRemote(const std::string &header, std::string data) = 0;
+    /*
+     * Server mode: remoteAddress may be one of the hosts of the protocol
+     * extensions (see MuxSession and StripeGroup). Returns true if the
+     * connection was taken over, otherwise remoteAddress is connected to.
+     * data starts with the address header of headerLength bytes
+     */
+    virtual bool startExtension(std::string &data, size_t headerLength);
+    // The address reported to a SOCKS5 UDP ASSOCIATE request
+    virtual QHostAddress localAddress(uint16_t &port) const = 0;
+    virtual QHostAddress peerAddress(uint16_t &port) const = 0;
+    virtual void close() = 0;
+
+private:
+    void handleGreeting(const uint8_t *data, size_t length);
+    void handleRequest(const uint8_t *data, size_t length);
+};
+
+}
+
+#endif // RELAYPROTOCOL_H
@@ -0,0 +1,240 @@
+/*
+ * serverchannel.cpp - the source file of ServerChannel class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "serverchannel.h"
+#include "connectionpool.h"
+#include <QDebug>
+#include <algorithm>
+#include <utility>
+
+namespace QSS {
+
+ServerChannel::ServerChannel(Address server,
+                             const std::string &method,
+                             const std::string &password,
+                             std::string header,
+                             QObject *parent) :
+    StreamChannel(parent),
+    server(std::move(server)),
+    encryptor(new Encryptor(method, password)),
+    socket(new QTcpSocket()),
+    proxy(QNetworkProxy::NoProxy),
+    header(std::move(header))
+{
+}
+
+ServerChannel::~ServerChannel()
+{
+    socket->disconnect(this);
+}
+
+void ServerChannel::setProxy(const QNetworkProxy &proxy)
+{
+    this->proxy = proxy;
+}
+
+void ServerChannel::start(ConnectionPool *pool)
+{
+    startTime = QTime::currentTime();
+    if (pool && proxy.type() == QNetworkProxy::NoProxy) {
+        std::unique_ptr<QTcpSocket> pooled = pool->take();
+        if (pooled) {
+            socket = std::move(pooled);
+            setupSocket();
+            onConnected();
+            return;
+        }
+    }
+    setupSocket();
+    if (proxy.type() != QNetworkProxy::NoProxy) {
+        // The proxy looks the server up
+        socket->setProxy(proxy);
+        socket->connectToHost(QString::fromStdString(server.getAddress()), server.getPort());
+        return;
+    }
+    server.lookUp([this](bool success) {
+        if (success) {
+            socket->connectToHost(server.getFirstIP(), server.getPort());
+        } else {
+            QDebug(QtMsgType::QtDebugMsg).noquote() << "Failed to lookup server address.";
+            fail();
+        }
+    });
+}
+
+void ServerChannel::setupSocket()
+{
+    socket->setReadBufferSize(RecvSize);
+    connect(socket.get(), &QTcpSocket::connected, this, &ServerChannel::onConnected);
+    connect(socket.get(), &QTcpSocket::readyRead, this, &ServerChannel::onReadyRead);
+    connect(socket.get(), &QTcpSocket::bytesWritten, this, [this](qint64 bytes) {
+        emit bytesSend(bytes);
+        emit bytesWritten(bytes);
+    });
+    connect(socket.get(), &QTcpSocket::disconnected, this, &ServerChannel::onDisconnected);
+    connect(socket.get(),
+            static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
+            (&QTcpSocket::error),
+            this,
+            [this]() {
+        if (socket->error() == QAbstractSocket::RemoteHostClosedError) {
+            // Followed by disconnected()
+            return;
+        }
+        QDebug(QtMsgType::QtDebugMsg).noquote() << "Server socket:" << socket->errorString();
+        fail();
+    });
+}
+
+void ServerChannel::onConnected()
+{
+    emit latencyAvailable(startTime.msecsTo(QTime::currentTime()));
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    if (!dataToWrite.empty()) {
+        socket->write(dataToWrite.data(), dataToWrite.size());
+        dataToWrite.clear();
+    }
+    if (closeQueued) {
+        socket->disconnectFromHost();
+    } else if (socket->bytesAvailable() > 0) {
+        onReadyRead();
+    }
+}
+
+void ServerChannel::write(const std::string &data)
+{
+    if (isClosed() || data.empty()) {
+        return;
+    }
+    std::string encrypted;
+    if (header.empty()) {
+        encrypted = encryptor->encrypt(data);
+    } else {
+        encrypted = encryptor->encrypt(header + data);
+        header.clear();
+    }
+    if (socket->state() == QAbstractSocket::ConnectedState) {
+        socket->write(encrypted.data(), encrypted.size());
+    } else {
+        dataToWrite += encrypted;
+    }
+}
+
+void ServerChannel::close()
+{
+    if (isClosed()) {
+        return;
+    }
+    closeQueued = true;
+    if (socket->state() == QAbstractSocket::ConnectedState) {
+        socket->disconnectFromHost();
+    }
+}
+
+void ServerChannel::abort()
+{
+    if (dead) {
+        return;
+    }
+    dead = true;
+    dataToWrite.clear();
+    socket->disconnect(this);
+    socket->abort();
+}
+
+void ServerChannel::consumed(uint64_t bytes)
+{
+    unconsumed -= std::min(static_cast<int64_t>(bytes), unconsumed);
+    if (readPaused && unconsumed <= HighWatermark / 4) {
+        readPaused = false;
+        if (socket->bytesAvailable() > 0) {
+            onReadyRead();
+        }
+    }
+}
+
+int64_t ServerChannel::pending() const
+{
+    return static_cast<int64_t>(dataToWrite.size()) + socket->bytesToWrite();
+}
+
+bool ServerChannel::isClosed() const
+{
+    return closeQueued || dead;
+}
+
+void ServerChannel::onReadyRead()
+{
+    if (dead) {
+        return;
+    }
+    if (unconsumed >= HighWatermark) {
+        readPaused = true;
+        return;
+    }
+    std::string buf;
+    buf.resize(RecvSize);
+    const int64_t readSize = socket->read(&buf[0], buf.size());
+    if (readSize <= 0) {
+        return;
+    }
+    buf.resize(readSize);
+    emit bytesRead(buf.size());
+    std::string data;
+    try {
+        data = encryptor->decrypt(buf);
+    } catch (const std::exception &e) {
+        QDebug(QtMsgType::QtCriticalMsg) << "Server:" << e.what();
+        fail();
+        return;
+    }
+    if (!data.empty()) {
+        unconsumed += static_cast<int64_t>(data.size());
+        emit dataReceived(data);
+    }
+}
+
+void ServerChannel::onDisconnected()
+{
+    // Whatever is left in the read buffer is delivered regardless of the
+    // consumer's backlog
+    while (!dead && socket->bytesAvailable() > 0) {
+        unconsumed = 0;
+        onReadyRead();
+    }
+    if (!dead) {
+        dead = true;
+        emit finished();
+    }
+}
+
+void ServerChannel::fail()
+{
+    if (dead) {
+        return;
+    }
+    abort();
+    emit aborted();
+}
+
+}  // namespace QSS
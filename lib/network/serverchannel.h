@@ -0,0 +1,102 @@
+/*
+ * serverchannel.h - the header file of ServerChannel class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVERCHANNEL_H
+#define SERVERCHANNEL_H
+
+#include <QNetworkProxy>
+#include <QTcpSocket>
+#include <QTime>
+#include <memory>
+#include "crypto/encryptor.h"
+#include "streamchannel.h"
+#include "types/address.h"
+
+namespace QSS {
+
+class ConnectionPool;
+
+/**
+ * Local mode: a stream to a target over a connection of its own to the
+ * server, for clients inside this process (see TcpServer::openChannel()).
+ * The address header of the target is sent along with the first data.
+ * Since QTcpSocket can't half-close, close() closes the connection once
+ * the queued data is written.
+ */
+class QSS_EXPORT ServerChannel : public StreamChannel
+{
+    Q_OBJECT
+public:
+    ServerChannel(Address server,
+                  const std::string &method,
+                  const std::string &password,
+                  std::string header,
+                  QObject *parent = nullptr);
+    ~ServerChannel();
+
+    ServerChannel(const ServerChannel &) = delete;
+
+    // Must be called before start()
+    void setProxy(const QNetworkProxy &proxy);
+    // Takes a connection from pool if one is ready, otherwise connects
+    void start(ConnectionPool *pool = nullptr);
+
+    void write(const std::string &data) override;
+    void close() override;
+    void abort() override;
+    void consumed(uint64_t bytes) override;
+    int64_t pending() const override;
+    bool isClosed() const override;
+
+signals:
+    // See TcpRelay::bytesRead() and TcpRelay::latencyAvailable()
+    void bytesRead(quint64);
+    void bytesSend(quint64);
+    void latencyAvailable(int);
+
+private:
+    static const int64_t RecvSize = 65536;
+    // Received but not consumed bytes before the socket isn't read anymore
+    static const int64_t HighWatermark = 4 * RecvSize;
+
+    Address server;
+    std::unique_ptr<Encryptor> encryptor;
+    std::unique_ptr<QTcpSocket> socket;
+    QNetworkProxy proxy;
+    std::string header;         // sent with the first data
+    std::string dataToWrite;    // encrypted, until connected
+    QTime startTime;
+    int64_t unconsumed = 0;
+    bool readPaused = false;
+    bool closeQueued = false;
+    bool dead = false;
+
+    void setupSocket();
+    void onConnected();
+    void onReadyRead();
+    void onDisconnected();
+    void fail();
+};
+
+}
+
+#endif // SERVERCHANNEL_H
@@ -0,0 +1,69 @@
+/*
+ * streamchannel.h - the header file of StreamChannel class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAMCHANNEL_H
+#define STREAMCHANNEL_H
+
+#include <QObject>
+#include <string>
+#include "util/export.h"
+
+namespace QSS {
+
+/**
+ * The interface of a logical byte stream to the other shadowsocks instance
+ * that isn't a single socket, such as a multiplexed or a striped stream.
+ */
+class QSS_EXPORT StreamChannel : public QObject
+{
+    Q_OBJECT
+public:
+    explicit StreamChannel(QObject *parent = nullptr);
+    virtual ~StreamChannel();
+
+    // Queues data to be sent. Ignored once the channel is closed
+    virtual void write(const std::string &data) = 0;
+    // Half-closes once the queued data is sent
+    virtual void close() = 0;
+    // Tears the channel down. Nothing else is sent or received afterwards
+    virtual void abort() = 0;
+    // Must be called once received data is consumed (i.e. written to the
+    // other socket) to let the peer send more
+    virtual void consumed(uint64_t bytes) = 0;
+
+    // Bytes queued but not sent yet
+    virtual int64_t pending() const = 0;
+    virtual bool isClosed() const = 0;
+
+signals:
+    void dataReceived(const std::string &data);
+    // Queued data was handed over to the transport
+    void bytesWritten(qint64);
+    // The peer won't send anything more
+    void finished();
+    // Reset by the peer, or the transport is gone
+    void aborted();
+};
+
+}
+
+#endif // STREAMCHANNEL_H
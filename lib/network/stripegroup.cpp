@@ -0,0 +1,450 @@
+/*
+ * stripegroup.cpp - the source file of StripeGroup and StripeRegistry classes
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "stripegroup.h"
+#include <QDebug>
+#include <QTimer>
+#include <QtEndian>
+#include <algorithm>
+
+namespace QSS {
+
+const char StripeGroup::Host[] = "stripe.qss.invalid";
+// Passed by reference to std::min
+const int StripeGroup::MaxPaths;
+const size_t StripeGroup::ChunkSize;
+
+StripeGroup::StripeGroup(Role role, int pathCount, QObject *parent) :
+    StreamChannel(parent),
+    role(role),
+    paths(static_cast<size_t>(std::min(std::max(pathCount, 1), MaxPaths))),
+    m_established(role == Server)
+{
+    if (role == Client) {
+        QTimer::singleShot(HelloTimeout, this, [this]() {
+            if (!m_established && !dead) {
+                auto self = shared_from_this();
+                dead = true;
+                releasePaths(false);
+                emit rejected();
+            }
+        });
+    }
+}
+
+StripeGroup::~StripeGroup()
+{
+    for (Path &p : paths) {
+        if (p.socket) {
+            p.socket->disconnect(this);
+        }
+    }
+}
+
+std::string StripeGroup::hello(const std::string &groupId, int index, int count,
+                               const std::string &header)
+{
+    std::string data = groupId;
+    data.resize(GroupIdLength);
+    data.push_back(static_cast<char>(index));
+    data.push_back(static_cast<char>(count));
+    uchar length[2];
+    qToBigEndian(static_cast<quint16>(header.size()), length);
+    data.append(reinterpret_cast<const char *>(length), 2);
+    return data + header;
+}
+
+size_t StripeGroup::parseHello(const std::string &data, std::string &groupId,
+                               int &index, int &count, std::string &header)
+{
+    static const size_t FixedLength = GroupIdLength + 4;
+    if (data.size() < FixedLength) {
+        return 0;
+    }
+    const auto *p = reinterpret_cast<const uchar *>(data.data());
+    const size_t headerLength = qFromBigEndian<quint16>(p + GroupIdLength + 2);
+    if (data.size() < FixedLength + headerLength) {
+        return 0;
+    }
+    index = p[GroupIdLength];
+    count = p[GroupIdLength + 1];
+    if (count == 0 || count > MaxPaths || index >= count || headerLength == 0) {
+        return 0;
+    }
+    groupId = data.substr(0, GroupIdLength);
+    header = data.substr(FixedLength, headerLength);
+    return FixedLength + headerLength;
+}
+
+bool StripeGroup::addPath(int index, QTcpSocket *socket, Encryptor *encryptor,
+                          const std::string &data)
+{
+    if (dead || done || index < 0 || index >= static_cast<int>(paths.size())
+            || paths[index].added) {
+        return false;
+    }
+    Path &path = paths[index];
+    path.socket = socket;
+    path.encryptor = encryptor;
+    path.added = true;
+    path.in = data;
+
+    connect(socket, &QTcpSocket::readyRead, this, [this, index]() {
+        onReadyRead(index);
+    });
+    connect(socket, &QTcpSocket::bytesWritten, this, [this](qint64 bytes) {
+        emit bytesSend(bytes);
+        schedule();
+    });
+    connect(socket, &QTcpSocket::disconnected, this, [this, index]() {
+        onPathClosed(index);
+    });
+    connect(socket,
+            static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
+            (&QTcpSocket::error),
+            this,
+            [this, index]() {
+        if (paths[index].socket->error() != QAbstractSocket::RemoteHostClosedError) {
+            QDebug(QtMsgType::QtDebugMsg).noquote()
+                    << "Stripe path:" << paths[index].socket->errorString();
+            onPathClosed(index);
+        }
+    });
+
+    if (role == Server) {
+        path.active = true;
+        sendFrame(path, AckSeq, nullptr, 0);
+        if (!path.in.empty() && !parseFrames(path)) {
+            fail();
+            return true;
+        }
+        deliver();
+        if (socket->bytesAvailable() > 0) {
+            onReadyRead(index);
+        }
+        schedule();
+    }
+    return true;
+}
+
+void StripeGroup::write(const std::string &data)
+{
+    if (isClosed() || data.empty()) {
+        return;
+    }
+    out += data;
+    schedule();
+}
+
+void StripeGroup::close()
+{
+    if (isClosed()) {
+        return;
+    }
+    finQueued = true;
+    schedule();
+}
+
+void StripeGroup::abort()
+{
+    if (dead) {
+        return;
+    }
+    dead = true;
+    out.clear();
+    releasePaths(false);
+}
+
+void StripeGroup::consumed(uint64_t bytes)
+{
+    unconsumed -= std::min(static_cast<int64_t>(bytes), unconsumed);
+    resumePaths();
+}
+
+int64_t StripeGroup::pending() const
+{
+    return static_cast<int64_t>(out.size());
+}
+
+bool StripeGroup::isClosed() const
+{
+    return finQueued || dead || done;
+}
+
+std::string StripeGroup::takePending()
+{
+    std::string data;
+    data.swap(out);
+    return data;
+}
+
+void StripeGroup::schedule()
+{
+    if (dead || done) {
+        return;
+    }
+    qint64 written = 0;
+    while (!out.empty() || (finQueued && !finSent)) {
+        // The least loaded path drains fastest. This paces each path at the
+        // rate its own congestion window allows
+        Path *best = nullptr;
+        for (Path &p : paths) {
+            if (!p.active || p.closed || !p.socket
+                    || p.socket->bytesToWrite() >= PathHighWatermark) {
+                continue;
+            }
+            if (!best || p.socket->bytesToWrite() < best->socket->bytesToWrite()) {
+                best = &p;
+            }
+        }
+        if (!best) {
+            break;
+        }
+        if (out.empty()) {
+            sendFrame(*best, nextSendSeq++, nullptr, 0);
+            finSent = true;
+            break;
+        }
+        const size_t length = std::min(out.size(), ChunkSize);
+        sendFrame(*best, nextSendSeq++, out.data(), length);
+        out.erase(0, length);
+        written += length;
+    }
+    if (written > 0) {
+        emit bytesWritten(written);
+    }
+    checkDone();
+}
+
+void StripeGroup::sendFrame(Path &path, uint32_t seq, const char *data, size_t length)
+{
+    uchar header[FrameHeaderSize];
+    qToBigEndian(static_cast<quint32>(seq), header);
+    qToBigEndian(static_cast<quint16>(length), header + 4);
+    std::string frame(reinterpret_cast<const char *>(header), FrameHeaderSize);
+    if (length > 0) {
+        frame.append(data, length);
+    }
+    frame = path.encryptor->encrypt(frame);
+    path.socket->write(frame.data(), frame.size());
+}
+
+void StripeGroup::onReadyRead(int index)
+{
+    Path &path = paths[index];
+    if (dead || !path.socket) {
+        return;
+    }
+    if (shouldPause(path)) {
+        path.paused = true;
+        return;
+    }
+    const QByteArray buf = path.socket->read(RecvSize);
+    if (buf.isEmpty()) {
+        return;
+    }
+    emit bytesRead(buf.size());
+    try {
+        path.in += path.encryptor->decrypt(std::string(buf.constData(), buf.size()));
+    } catch (const std::exception &e) {
+        QDebug(QtMsgType::QtCriticalMsg) << "Stripe path:" << e.what();
+        fail();
+        return;
+    }
+    // Handlers of the signals below may drop the last reference
+    auto self = shared_from_this();
+    if (!parseFrames(path)) {
+        qWarning("Stripe path: protocol error");
+        fail();
+        return;
+    }
+    deliver();
+    schedule();
+}
+
+bool StripeGroup::parseFrames(Path &path)
+{
+    size_t pos = 0;
+    while (path.in.size() - pos >= FrameHeaderSize) {
+        const auto *header = reinterpret_cast<const uchar *>(path.in.data() + pos);
+        const uint32_t seq = qFromBigEndian<quint32>(header);
+        const size_t length = qFromBigEndian<quint16>(header + 4);
+        if (path.in.size() - pos - FrameHeaderSize < length) {
+            break;
+        }
+        if (seq == AckSeq) {
+            if (role != Client || length != 0) {
+                return false;
+            }
+            path.active = true;
+            if (!m_established) {
+                m_established = true;
+                emit established();
+            }
+        } else {
+            // Each path carries increasing sequence numbers
+            if (seq < nextRecvSeq || static_cast<int64_t>(seq) <= path.lastSeq
+                    || reorder.count(seq) || finReceived) {
+                return false;
+            }
+            path.lastSeq = seq;
+            reorder[seq] = path.in.substr(pos + FrameHeaderSize, length);
+            reorderBytes += length;
+        }
+        pos += FrameHeaderSize + length;
+    }
+    path.in.erase(0, pos);
+    return true;
+}
+
+void StripeGroup::deliver()
+{
+    auto self = shared_from_this();
+    while (!dead) {
+        auto it = reorder.find(nextRecvSeq);
+        if (it == reorder.end()) {
+            break;
+        }
+        std::string data = std::move(it->second);
+        reorder.erase(it);
+        reorderBytes -= data.size();
+        ++nextRecvSeq;
+        if (data.empty()) {
+            finReceived = true;
+            emit finished();
+            checkDone();
+            break;
+        }
+        unconsumed += data.size();
+        emit dataReceived(data);
+    }
+    resumePaths();
+}
+
+bool StripeGroup::shouldPause(const Path &path) const
+{
+    if (unconsumed >= MaxUnconsumed) {
+        return true;
+    }
+    // A path that is ahead of the missing chunk can't carry it anymore
+    return reorderBytes >= MaxReorderBytes
+            && path.lastSeq > static_cast<int64_t>(nextRecvSeq);
+}
+
+void StripeGroup::resumePaths()
+{
+    for (int i = 0; i < static_cast<int>(paths.size()) && !dead; ++i) {
+        Path &path = paths[i];
+        if (path.paused && path.socket && !shouldPause(path)) {
+            path.paused = false;
+            if (path.socket->bytesAvailable() > 0) {
+                onReadyRead(i);
+            }
+        }
+    }
+}
+
+void StripeGroup::onPathClosed(int index)
+{
+    Path &path = paths[index];
+    if (path.closed) {
+        return;
+    }
+    path.closed = true;
+    if (path.socket) {
+        path.socket->disconnect(this);
+    }
+    if (dead || done) {
+        return;
+    }
+    auto self = shared_from_this();
+    if (!m_established) {
+        const bool allClosed = std::all_of(paths.begin(), paths.end(), [](const Path &p) {
+            return !p.added || p.closed;
+        });
+        if (allClosed) {
+            dead = true;
+            emit rejected();
+        }
+        return;
+    }
+    // The chunks on this path are lost
+    fail();
+}
+
+void StripeGroup::checkDone()
+{
+    if (done || !finSent || !finReceived) {
+        return;
+    }
+    done = true;
+    releasePaths(true);
+}
+
+void StripeGroup::fail()
+{
+    if (dead) {
+        return;
+    }
+    auto self = shared_from_this();
+    dead = true;
+    out.clear();
+    releasePaths(false);
+    emit aborted();
+}
+
+void StripeGroup::releasePaths(bool graceful)
+{
+    for (Path &p : paths) {
+        if (!p.socket || p.closed) {
+            continue;
+        }
+        p.closed = true;
+        p.socket->disconnect(this);
+        if (graceful) {
+            p.socket->disconnectFromHost();
+        } else {
+            p.socket->abort();
+        }
+    }
+}
+
+std::shared_ptr<StripeGroup> StripeRegistry::join(const std::string &groupId, int count,
+                                                  bool &created)
+{
+    for (auto it = groups.begin(); it != groups.end();) {
+        if (it->second.expired()) {
+            it = groups.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    std::shared_ptr<StripeGroup> group = groups[groupId].lock();
+    created = !group;
+    if (created) {
+        group = std::make_shared<StripeGroup>(StripeGroup::Server, count);
+        groups[groupId] = group;
+    }
+    return group;
+}
+
+}  // namespace QSS
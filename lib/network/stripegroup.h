@@ -0,0 +1,168 @@
+/*
+ * stripegroup.h - the header file of StripeGroup and StripeRegistry classes
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STRIPEGROUP_H
+#define STRIPEGROUP_H
+
+#include <QPointer>
+#include <QTcpSocket>
+#include <map>
+#include <memory>
+#include <vector>
+#include "crypto/encryptor.h"
+#include "streamchannel.h"
+
+namespace QSS {
+
+/**
+ * One logical stream striped across several encrypted connections (paths)
+ * to raise the throughput of a single large transfer on lossy long-haul
+ * links.
+ *
+ * Each path connects to the address Host (a plain server drops it) and
+ * sends hello() right after the address header. The server answers with an
+ * ACK frame on every path it accepts. Afterwards both directions are split
+ * into chunks of (sequence number (4 bytes), length (2 bytes), payload),
+ * and an empty chunk marks the end of the stream. Every chunk goes to the
+ * path with the least data queued, which paces each path at its own rate,
+ * and the receiver puts the chunks back in order.
+ */
+class QSS_EXPORT StripeGroup : public StreamChannel,
+                               public std::enable_shared_from_this<StripeGroup>
+{
+    Q_OBJECT
+public:
+    enum Role { Client, Server };
+
+    StripeGroup(Role role, int pathCount, QObject *parent = nullptr);
+    ~StripeGroup();
+
+    StripeGroup(const StripeGroup &) = delete;
+
+    static const char Host[];
+    static const int MaxPaths = 16;
+    static const size_t GroupIdLength = 8;
+
+    // The handshake of a path. header is the address header of the target
+    static std::string hello(const std::string &groupId, int index, int count,
+                             const std::string &header);
+    // Returns the length of the hello at the beginning of data, or 0 if it's
+    // incomplete or invalid
+    static size_t parseHello(const std::string &data, std::string &groupId,
+                             int &index, int &count, std::string &header);
+
+    /*
+     * Adds path index on socket, which must be connected (server) or be
+     * connecting to the server (client). The group reads and writes the
+     * socket from now on. data is what was already read and decrypted after
+     * the hello. Returns false if index is invalid or already taken.
+     */
+    bool addPath(int index, QTcpSocket *socket, Encryptor *encryptor,
+                 const std::string &data = std::string());
+
+    void write(const std::string &data) override;
+    void close() override;
+    void abort() override;
+    void consumed(uint64_t bytes) override;
+    int64_t pending() const override;
+    bool isClosed() const override;
+
+    // Client: takes back the data that wasn't sent, e.g. to fall back to a
+    // plain connection after rejected()
+    std::string takePending();
+
+signals:
+    // Client: the server accepted the first path
+    void established();
+    // Client: the server didn't accept any path
+    void rejected();
+    // Traffic of the paths, see TcpRelay::bytesRead()
+    void bytesRead(quint64);
+    void bytesSend(quint64);
+
+private:
+    static const uint32_t AckSeq = 0xFFFFFFFF;
+    static const size_t FrameHeaderSize = 6;
+    static const size_t ChunkSize = 16384;
+    static const int64_t RecvSize = 65536;
+    static const int64_t PathHighWatermark = 2 * RecvSize;
+    // Out-of-order chunks buffered before paths that are ahead get paused
+    static const int64_t MaxReorderBytes = 4 * 1024 * 1024;
+    // Delivered but not yet consumed bytes before all paths get paused
+    static const int64_t MaxUnconsumed = 4 * RecvSize;
+    static const int HelloTimeout = 5000;
+
+    struct Path {
+        QPointer<QTcpSocket> socket;
+        Encryptor *encryptor = nullptr;
+        std::string in;
+        int64_t lastSeq = -1;
+        bool added = false;
+        bool active = false;    // may carry data
+        bool paused = false;    // reading paused
+        bool closed = false;
+    };
+
+    const Role role;
+    std::vector<Path> paths;
+    bool m_established;
+    bool finQueued = false;
+    bool finSent = false;
+    bool finReceived = false;
+    bool done = false;   // both directions finished
+    bool dead = false;   // aborted or rejected
+    std::string out;
+    uint32_t nextSendSeq = 0;
+    uint32_t nextRecvSeq = 0;
+    std::map<uint32_t, std::string> reorder;
+    int64_t reorderBytes = 0;
+    int64_t unconsumed = 0;
+
+    void schedule();
+    void sendFrame(Path &path, uint32_t seq, const char *data, size_t length);
+    void onReadyRead(int index);
+    bool parseFrames(Path &path);
+    void deliver();
+    bool shouldPause(const Path &path) const;
+    void resumePaths();
+    void onPathClosed(int index);
+    void checkDone();
+    void fail();
+    void releasePaths(bool graceful);
+};
+
+/**
+ * Server mode: finds the StripeGroup a new path belongs to
+ */
+class QSS_EXPORT StripeRegistry
+{
+public:
+    // Returns the group of groupId, creating it if it doesn't exist
+    std::shared_ptr<StripeGroup> join(const std::string &groupId, int count, bool &created);
+
+private:
+    std::map<std::string, std::weak_ptr<StripeGroup> > groups;
+};
+
+}
+
+#endif // STRIPEGROUP_H
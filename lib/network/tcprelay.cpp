@@ -22,25 +22,35 @@
 
 #include "tcprelay.h"
 #include "util/common.h"
+#include "util/nativesocket.h"
 #include <QDebug>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <utility>
 
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 namespace QSS {
 
 TcpRelay::TcpRelay(QTcpSocket *localSocket,
                    int timeout,
                    Address server_addr,
                    const std::string &method,
-                   const std::string &password) :
-    stage(INIT),
-    serverAddress(std::move(server_addr)),
-    encryptor(new Encryptor(method, password)),
+                   const std::string &password,
+                   bool isLocal,
+                   bool autoBan) :
+    RelayProtocol(isLocal, autoBan, std::move(server_addr), method, password),
     local(localSocket),
     remote(new QTcpSocket()),
-    timer(new QTimer())
+    idleWheel(IdleWheel::forThread()),
+    idleTimeout(timeout)
 {
-    timer->setInterval(timeout);
-    connect(timer.get(), &QTimer::timeout, this, &TcpRelay::onTimeout);
+    scheduleIdleCheck(idleTimeout);
+    markActive();
 
     connect(local.get(),
             static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
@@ -50,9 +60,23 @@ TcpRelay::TcpRelay(QTcpSocket *localSocket,
     connect(local.get(), &QTcpSocket::disconnected, this, &TcpRelay::close);
     connect(local.get(), &QTcpSocket::readyRead,
             this, &TcpRelay::onLocalTcpSocketReadyRead);
-    connect(local.get(), &QTcpSocket::readyRead,
-            timer.get(), static_cast<void (QTimer::*)()> (&QTimer::start));
+    connect(local.get(), &QTcpSocket::bytesWritten,
+            this, &TcpRelay::onLocalBytesWritten);
 
+    local->setReadBufferSize(RemoteRecvSize);
+    local->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    local->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+
+    setupRemote();
+}
+
+TcpRelay::~TcpRelay()
+{
+    stopIdleTimer();
+}
+
+void TcpRelay::setupRemote()
+{
     connect(remote.get(), &QTcpSocket::connected, this, &TcpRelay::onRemoteConnected);
     connect(remote.get(),
             static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
@@ -61,19 +85,27 @@ TcpRelay::TcpRelay(QTcpSocket *localSocket,
     connect(remote.get(), &QTcpSocket::disconnected, this, &TcpRelay::close);
     connect(remote.get(), &QTcpSocket::readyRead,
             this, &TcpRelay::onRemoteTcpSocketReadyRead);
-    connect(remote.get(), &QTcpSocket::readyRead,
-            timer.get(), static_cast<void (QTimer::*)()> (&QTimer::start));
     connect(remote.get(), &QTcpSocket::bytesWritten, this, &TcpRelay::bytesSend);
-
-    local->setReadBufferSize(RemoteRecvSize);
-    local->setSocketOption(QAbstractSocket::LowDelayOption, 1);
-    local->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    connect(remote.get(), &QTcpSocket::bytesWritten,
+            this, &TcpRelay::onRemoteBytesWritten);
 
     remote->setReadBufferSize(RemoteRecvSize);
     remote->setSocketOption(QAbstractSocket::LowDelayOption, 1);
     remote->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
 }
 
+void TcpRelay::adoptRemote(std::unique_ptr<QTcpSocket> socket)
+{
+    remote = std::move(socket);
+    setupRemote();
+    stage = CONNECTING;
+    startTime = QTime::currentTime();
+    onRemoteConnected();
+    if (remote->bytesAvailable() > 0) {
+        onRemoteTcpSocketReadyRead();
+    }
+}
+
 void TcpRelay::setProxy(int proxyType, std::string& proxyServerAddress, uint16_t& port) {
     if (static_cast<TcpRelay::PROXY>(proxyType) == TcpRelay::Http) {
         proxy.setType(QNetworkProxy::HttpProxy);
@@ -87,12 +119,42 @@ void TcpRelay::setProxy(int proxyType, std::string& proxyServerAddress, uint16_t
     remote->setProxy(proxy);
 }
 
+void TcpRelay::setWatermarks(int64_t high, int64_t low)
+{
+    highWatermark = high;
+    lowWatermark = std::min(low, high);
+}
+
+void TcpRelay::setNotSentLowat(int bytes)
+{
+    notSentLowat = bytes;
+    NativeSocket::setNotSentLowat(local->socketDescriptor(), notSentLowat);
+}
+
+void TcpRelay::setFastOpen(bool enabled)
+{
+    fastOpen = enabled;
+}
+
 void TcpRelay::close()
 {
     if (stage == DESTROYED) {
         return;
     }
 
+#ifdef Q_OS_UNIX
+    if (fastOpenNotifier) {
+        ::close(fastOpenNotifier->socket());
+        fastOpenNotifier->setEnabled(false);
+        fastOpenNotifier.release()->deleteLater();
+    }
+#endif
+    if (eyeballs) {
+        // close() may be called from a signal of eyeballs
+        eyeballs->disconnect(this);
+        eyeballs.release()->deleteLater();
+    }
+    stopIdleTimer();
     local->close();
     remote->close();
     stage = DESTROYED;
@@ -115,9 +177,114 @@ bool TcpRelay::writeToRemote(const char *data, size_t length)
     return remote->write(data, length) != -1;
 }
 
+int64_t TcpRelay::pendingToRemote() const
+{
+    // dataToWrite holds what arrived during the DNS and CONNECTING stages
+    return remote->bytesToWrite() + static_cast<int64_t>(dataToWrite.size());
+}
+
+void TcpRelay::connectToRemote(const QHostAddress &ip, uint16_t port)
+{
+    stage = CONNECTING;
+    startTime = QTime::currentTime();
+    if (fastOpen && proxy.type() == QNetworkProxy::NoProxy
+            && !dataToWrite.empty() && connectFastOpen(ip, port)) {
+        return;
+    }
+    remote->connectToHost(ip, port);
+}
+
+void TcpRelay::connectToRemote(const Address &address)
+{
+    const std::vector<QHostAddress> &ips = address.getIPList();
+    if (ips.size() < 2 || proxy.type() != QNetworkProxy::NoProxy) {
+        connectToRemote(address.getFirstIP(), address.getPort());
+        return;
+    }
+    stage = CONNECTING;
+    startTime = QTime::currentTime();
+    eyeballs = std::make_unique<HappyEyeballs>(ips, address.getPort());
+    connect(eyeballs.get(), &HappyEyeballs::connected, this, [this]() {
+        remote = eyeballs->takeSocket();
+        eyeballs.release()->deleteLater();
+        setupRemote();
+        onRemoteConnected();
+    });
+    connect(eyeballs.get(), &HappyEyeballs::failed, this, [this](const QString &error) {
+        QDebug(QtMsgType::QtWarningMsg).noquote() << "Remote socket:" << error;
+        close();
+    });
+    eyeballs->start();
+}
+
+bool TcpRelay::connectFastOpen(const QHostAddress &ip, uint16_t port)
+{
+#ifdef Q_OS_UNIX
+    const int fd = NativeSocket::createTcpSocket(
+                ip.protocol() == QAbstractSocket::IPv6Protocol ? AF_INET6 : AF_INET);
+    if (fd == -1) {
+        return false;
+    }
+    const int64_t sent = NativeSocket::connectFastOpen(fd, ip, port,
+                                                       dataToWrite.data(),
+                                                       dataToWrite.size());
+    if (sent == -1 && errno != EINPROGRESS) {
+        // TFO is disabled in the kernel or not supported by the platform
+        QDebug(QtMsgType::QtDebugMsg).noquote()
+                << "TCP Fast Open unavailable:" << std::strerror(errno);
+        ::close(fd);
+        fastOpen = false;
+        return false;
+    }
+    if (sent > 0) {
+        // The rest (if any) is written once the handshake completes
+        dataToWrite.erase(0, sent);
+        emit bytesSend(sent);
+    }
+    NativeSocket::setNoDelay(fd);
+    NativeSocket::setKeepAlive(fd);
+    fastOpenNotifier.reset(new QSocketNotifier(fd, QSocketNotifier::Write));
+    connect(fastOpenNotifier.get(), &QSocketNotifier::activated,
+            this, &TcpRelay::onFastOpenConnected);
+    return true;
+#else
+    Q_UNUSED(ip)
+    Q_UNUSED(port)
+    return false;
+#endif
+}
+
+void TcpRelay::onFastOpenConnected()
+{
+#ifdef Q_OS_UNIX
+    const int fd = static_cast<int>(fastOpenNotifier->socket());
+    // Can't delete the notifier inside its own signal
+    fastOpenNotifier->setEnabled(false);
+    fastOpenNotifier.release()->deleteLater();
+
+    const int error = NativeSocket::takeError(fd);
+    if (error != 0) {
+        QDebug(QtMsgType::QtWarningMsg).noquote()
+                << "Remote socket:" << std::strerror(error);
+        ::close(fd);
+        close();
+        return;
+    }
+    emit fastOpenFinished(NativeSocket::fastOpenAccepted(fd));
+    if (!remote->setSocketDescriptor(fd)) {
+        QDebug(QtMsgType::QtWarningMsg).noquote() << "Remote socket:" << remote->errorString();
+        ::close(fd);
+        close();
+        return;
+    }
+    onRemoteConnected();
+#endif
+}
+
 void TcpRelay::onRemoteConnected()
 {
     emit latencyAvailable(startTime.msecsTo(QTime::currentTime()));
+    NativeSocket::setNotSentLowat(remote->socketDescriptor(), notSentLowat);
     stage = STREAM;
     if (!dataToWrite.empty()) {
         writeToRemote(dataToWrite.data(), dataToWrite.size());
@@ -138,6 +305,17 @@ void TcpRelay::onRemoteTcpSocketError()
 
 void TcpRelay::onLocalTcpSocketReadyRead()
 {
+    markActive();
+    /*
+     * Leave the data in local's read buffer if remote can't keep up. Once the
+     * (limited) read buffer is full, Qt stops reading from the kernel and the
+     * TCP receive window closes towards the sender.
+     */
+    if (pendingToRemote() >= highWatermark) {
+        localReadPaused = true;
+        return;
+    }
+
     std::string data;
     data.resize(RemoteRecvSize);
     int64_t readSize = local->read(&data[0], data.size());
@@ -153,11 +331,17 @@ void TcpRelay::onLocalTcpSocketReadyRead()
         close();
         return;
     }
-    handleLocalTcpData(data);
+    handleLocalData(reinterpret_cast<const uint8_t *>(data.data()), data.size());
 }
 
 void TcpRelay::onRemoteTcpSocketReadyRead()
 {
+    markActive();
+    if (local->bytesToWrite() >= highWatermark) {
+        remoteReadPaused = true;
+        return;
+    }
+
     std::string buf;
     buf.resize(RemoteRecvSize);
     int64_t readSize = remote->read(&buf[0], buf.size());
@@ -174,18 +358,84 @@ void TcpRelay::onRemoteTcpSocketReadyRead()
         return;
     }
     emit bytesRead(buf.size());
-    try {
-        handleRemoteTcpData(buf);
-    } catch (const std::exception &e) {
-        QDebug(QtMsgType::QtCriticalMsg) << "Remote:" << e.what();
-        close();
-        return;
+    handleRemoteData(reinterpret_cast<const uint8_t *>(buf.data()), buf.size());
+}
+
+void TcpRelay::onLocalBytesWritten()
+{
+    if (remoteReadPaused && local->bytesToWrite() <= lowWatermark) {
+        remoteReadPaused = false;
+        if (remote->bytesAvailable() > 0) {
+            onRemoteTcpSocketReadyRead();
+        }
+    }
+}
+
+void TcpRelay::onRemoteBytesWritten()
+{
+    if (localReadPaused && pendingToRemote() <= lowWatermark) {
+        localReadPaused = false;
+        if (local->bytesAvailable() > 0) {
+            onLocalTcpSocketReadyRead();
+        }
     }
-    local->write(buf.data(), buf.size());
 }
 
-void TcpRelay::onTimeout()
+void TcpRelay::writeLocal(std::string data)
 {
+    local->write(data.data(), data.size());
+}
+
+void TcpRelay::writeRemote(std::string data)
+{
+    if (stage == STREAM) {
+        writeToRemote(data.data(), data.size());
+    } else {
+        // take DNS into account, otherwise some data will get lost
+        dataToWrite += data;
+    }
+}
+
+QHostAddress TcpRelay::localAddress(uint16_t &port) const
+{
+    port = local->localPort();
+    return local->localAddress();
+}
+
+QHostAddress TcpRelay::peerAddress(uint16_t &port) const
+{
+    port = local->peerPort();
+    return local->peerAddress();
+}
+
+void TcpRelay::markActive()
+{
+    lastActive = idleWheel->now();
+}
+
+void TcpRelay::stopIdleTimer()
+{
+    if (idleTimer != 0) {
+        idleWheel->cancel(idleTimer);
+        idleTimer = 0;
+    }
+}
+
+void TcpRelay::scheduleIdleCheck(int64_t delay)
+{
+    idleTimer = idleWheel->schedule(delay, [this]() {
+        onIdleCheck();
+    });
+}
+
+void TcpRelay::onIdleCheck()
+{
+    idleTimer = 0;
+    const int64_t idle = idleWheel->now() - lastActive;
+    if (idle < idleTimeout) {
+        scheduleIdleCheck(idleTimeout - idle);
+        return;
+    }
     qInfo("TCP connection timeout.");
     close();
 }
@@ -24,19 +24,21 @@
 #define TCPRELAY_H
 
 #include <QObject>
+#include <QSocketNotifier>
 #include <QTcpSocket>
-#include <QTimer>
 #include <QTime>
 #include <QtNetwork/QNetworkProxy>
-#include "types/address.h"
-#include "crypto/encryptor.h"
+#include "util/idlewheel.h"
+#include "happyeyeballs.h"
+#include "relayprotocol.h"
 
 namespace QSS {
 
 /**
- * The abstract base class representing a Shadowsocks TCP connection
+ * The abstract base class representing a Shadowsocks TCP connection on
+ * QTcpSocket. The protocol itself is done by RelayProtocol
  */
-class QSS_EXPORT TcpRelay : public QObject
+class QSS_EXPORT TcpRelay : public QObject, public RelayProtocol
 {
     Q_OBJECT
 public:
@@ -44,16 +46,39 @@ public:
              int timeout,
              Address server_addr,
              const std::string& method,
-             const std::string& password);
+             const std::string& password,
+             bool isLocal,
+             bool autoBan = false);
 
     TcpRelay(const TcpRelay &) = delete;
-
-    enum STAGE { INIT, ADDR, UDP_ASSOC, DNS, CONNECTING, STREAM, DESTROYED };
+    ~TcpRelay();
 
     enum PROXY { Http, Socks5 };
 
     void setProxy(int proxyType, std::string& proxyServerAddress, uint16_t& port);
 
+    /*
+     * Reading from one socket is paused when the other socket has more than
+     * high bytes pending to be written, and resumed once the pending bytes
+     * drop to low or below. Each direction is throttled independently.
+     */
+    void setWatermarks(int64_t high, int64_t low);
+
+    /*
+     * Latency mode: set TCP_NOTSENT_LOWAT on both sockets so that unsent data
+     * is kept in our (bounded) buffers instead of the kernel's.
+     * 0 disables it. This is a no-op on platforms without TCP_NOTSENT_LOWAT.
+     */
+    void setNotSentLowat(int bytes);
+
+    /*
+     * TCP Fast Open for the remote socket. The first flight buffered in
+     * dataToWrite is carried in the SYN if the kernel has a cookie of the
+     * remote host, otherwise it's written after the handshake as usual.
+     * It's ignored when a proxy is set or the platform doesn't support it.
+     */
+    void setFastOpen(bool enabled);
+
 signals:
     /*
      * Count only remote socket's traffic
@@ -65,37 +90,84 @@ signals:
 
     //time used for remote to connect to the host (msec)
     void latencyAvailable(int);
+    // Emitted when a TFO connection is established. zeroRtt is true if the
+    // remote host accepted the data sent in the SYN
+    void fastOpenFinished(bool zeroRtt);
     void finished();
 
 protected:
     static const int64_t RemoteRecvSize = 65536;
+    static const int64_t DefaultHighWatermark = 4 * RemoteRecvSize;
+    static const int64_t DefaultLowWatermark = RemoteRecvSize;
 
-    STAGE stage;
-    Address remoteAddress;
-    Address serverAddress;
     std::string dataToWrite;
 
-    std::unique_ptr<Encryptor> encryptor;
     std::unique_ptr<QTcpSocket> local;
     std::unique_ptr<QTcpSocket> remote;
-    std::unique_ptr<QTimer> timer;
     QTime startTime;
     QNetworkProxy proxy = QNetworkProxy(QNetworkProxy::NoProxy);
 
+    int64_t highWatermark = DefaultHighWatermark;
+    int64_t lowWatermark = DefaultLowWatermark;
+    int notSentLowat = 0;
+    bool localReadPaused = false;
+    bool remoteReadPaused = false;
+    bool fastOpen = false;
+    // Watches the native socket of a TFO connect until it's established
+    std::unique_ptr<QSocketNotifier> fastOpenNotifier;
+    // Races the addresses of a dual-stack host
+    std::unique_ptr<HappyEyeballs> eyeballs;
+
+    /*
+     * Reads only stamp lastActive. The one timer on the wheel of the thread
+     * checks the stamp when it expires and moves itself if there was traffic
+     * in between.
+     */
+    std::shared_ptr<IdleWheel> idleWheel;
+    TimerWheel::TimerId idleTimer = 0;
+    int64_t idleTimeout;
+    int64_t lastActive = 0;
+
+    void markActive();
+    // No more timeout, e.g. when another object took over the sockets
+    void stopIdleTimer();
+
     bool writeToRemote(const char *data, size_t length);
 
-    virtual void handleStageAddr(std::string &data) = 0;
-    virtual void handleLocalTcpData(std::string &data) = 0;
-    virtual void handleRemoteTcpData(std::string &data) = 0;
+    // Makes an already connected socket the remote one and starts streaming
+    void adoptRemote(std::unique_ptr<QTcpSocket> socket);
+
+    // Connects remote to ip:port, using TFO if it's enabled
+    void connectToRemote(const QHostAddress &ip, uint16_t port);
+    // Connects remote to any of the IP addresses of address (see
+    // HappyEyeballs). TFO is only used if there is a single address
+    void connectToRemote(const Address &address);
+    bool connectFastOpen(const QHostAddress &ip, uint16_t port);
+    // Wires up the signals and options of remote
+    void setupRemote();
+
+    // Bytes read from local that are not yet handed over to the kernel
+    virtual int64_t pendingToRemote() const;
+
+    void writeLocal(std::string data) override;
+    void writeRemote(std::string data) override;
+    QHostAddress localAddress(uint16_t &port) const override;
+    QHostAddress peerAddress(uint16_t &port) const override;
 
 protected slots:
     void onRemoteConnected();
+    void onFastOpenConnected();
     void onRemoteTcpSocketError();
     void onLocalTcpSocketError();
     void onLocalTcpSocketReadyRead();
     void onRemoteTcpSocketReadyRead();
-    void onTimeout();
-    void close();
+    void onLocalBytesWritten();
+    void onRemoteBytesWritten();
+    void close() override;
+
+private:
+    void scheduleIdleCheck(int64_t delay);
+    void onIdleCheck();
 };
 
 }
@@ -21,110 +21,205 @@
  */
 
 #include "tcprelayclient.h"
+#include "connectionpool.h"
+#include "muxclient.h"
+#include "stripegroup.h"
+#include "crypto/cipher.h"
 #include "util/common.h"
+#include <QDateTime>
 #include <QDebug>
+#include <atomic>
 #include <utility>
 
 namespace QSS {
 
+namespace {
+// Shared by all clients: when to try striping again after a server refused it
+std::atomic<qint64> stripeRetryAt(0);
+}
+
 TcpRelayClient::TcpRelayClient(QTcpSocket *localSocket,
                                int timeout,
                                Address server_addr,
                                const std::string& method,
                                const std::string& password)
-    : TcpRelay(localSocket, timeout, server_addr, method, password)
+    : TcpRelay(localSocket, timeout, server_addr, method, password, true)
+    , method(method)
+    , password(password)
 {
 }
 
-void TcpRelayClient::handleStageAddr(std::string &data)
+void TcpRelayClient::setConnectionPool(std::shared_ptr<ConnectionPool> pool)
 {
-    auto cmd = static_cast<int>(data.at(1));
-    if (cmd == 3) {//CMD_UDP_ASSOCIATE
-        qDebug("UDP associate");
-        static const char header_data [] = { 5, 0, 0 };
-        QHostAddress addr = local->localAddress();
-        uint16_t port = local->localPort();
-        std::string toWrite = std::string(header_data, 3) + Common::packAddress(addr, port);
-        local->write(toWrite.data(), toWrite.length());
-        stage = UDP_ASSOC;
-        return;
-    } if (cmd == 1) {//CMD_CONNECT
-        data = data.substr(3);
-    } else {
-        qCritical("Unknown command %d", cmd);
-        close();
-        return;
-    }
+    this->pool = std::move(pool);
+}
 
-    int header_length = 0;
-    Common::parseHeader(data, remoteAddress, header_length);
-    if (header_length == 0) {
-        qCritical("Can't parse header. Wrong encryption method or password?");
-        close();
-        return;
-    }
+void TcpRelayClient::setMuxClient(std::shared_ptr<MuxClient> mux)
+{
+    this->mux = std::move(mux);
+}
+
+void TcpRelayClient::setStripePaths(int paths)
+{
+    stripePaths = std::min(paths, StripeGroup::MaxPaths);
+}
 
+void TcpRelayClient::relayTo(const Address &destination, const std::string &data)
+{
+    remoteAddress = destination;
     QDebug(QtMsgType::QtInfoMsg).noquote().nospace()
             << "Connecting " << remoteAddress << " from "
-            << local->peerAddress().toString() << ":" << local->peerPort();
+            << local->peerAddress().toString() << ":" << local->peerPort()
+            << " (HTTP)";
+    openRemote(destination.packed(), data);
+}
 
+void TcpRelayClient::openRemote(const std::string &header, std::string data)
+{
     stage = DNS;
-    static const char res [] = { 5, 0, 0, 1, 0, 0, 0, 0, 16, 16 };
-    static const QByteArray response(res, 10);
-    local->write(response);
-    std::string toWrite = encryptor->encrypt(data);
-    dataToWrite += toWrite;
+    if (mux) {
+        channel = mux->openStream(header);
+        if (channel) {
+            startChannel(data);
+            return;
+        }
+    }
+    if (stripePaths > 1 && proxy.type() == QNetworkProxy::NoProxy
+            && QDateTime::currentMSecsSinceEpoch() >= stripeRetryAt) {
+        startStripe(header, data);
+        return;
+    }
+
+    data.insert(0, header);
+    sendToRemote(reinterpret_cast<const uint8_t *>(data.data()), data.size());
 
     if (proxy.type() == QNetworkProxy::HttpProxy || proxy.type() == QNetworkProxy::Socks5Proxy) {
         // if proxy is set, then the proxy will lookup for dns.
         stage = CONNECTING;
         startTime = QTime::currentTime();
         remote->connectToHost(serverAddress.getAddress().c_str(), serverAddress.getPort());
+    } else if (pool) {
+        // The pool adapts its size to the rate of take() calls
+        std::unique_ptr<QTcpSocket> socket = pool->take();
+        if (socket) {
+            adoptRemote(std::move(socket));
+        } else {
+            connectToServer();
+        }
     } else {
-        serverAddress.lookUp([this](bool success) {
-            if (success) {
-                stage = CONNECTING;
-                startTime = QTime::currentTime();
-                remote->connectToHost(serverAddress.getFirstIP(), serverAddress.getPort());
-            } else {
-                QDebug(QtMsgType::QtDebugMsg).noquote() << "Failed to lookup server address. Closing TCP connection.";
-                close();
-            }
-        });
+        connectToServer();
     }
 }
 
-void TcpRelayClient::handleLocalTcpData(std::string &data)
+void TcpRelayClient::connectToServer()
 {
-    if (stage == STREAM) {
-        data = encryptor->encrypt(data);
-        writeToRemote(data.data(), data.size());
-    } else if (stage == INIT) {
-        static const char reject_data [] = { 0, 91 };
-        static const char accept_data [] = { 5, 0 };
-        static const QByteArray reject(reject_data, 2);
-        static const QByteArray accept(accept_data, 2);
-        if (data[0] != char(5)) {
-            qCritical("An invalid socket connection was rejected. "
-                      "Please make sure the connection type is SOCKS5.");
-            local->write(reject);
+    serverAddress.lookUp([this](bool success) {
+        if (success) {
+            connectToRemote(serverAddress);
         } else {
-            local->write(accept);
+            QDebug(QtMsgType::QtDebugMsg).noquote() << "Failed to lookup server address. Closing TCP connection.";
+            close();
         }
-        stage = ADDR;
-    } else if (stage == CONNECTING || stage == DNS) {
-        // take DNS into account, otherwise some data will get lost
-        dataToWrite += encryptor->encrypt(data);
-    } else if (stage == ADDR) {
-        handleStageAddr(data);
-    } else {
-        qCritical("Local unknown stage.");
-    }
+    });
+}
+
+void TcpRelayClient::startChannel(const std::string &initialData)
+{
+    StreamChannel *stream = channel.get();
+    // The channel encrypts on its own
+    plainRemote = true;
+    connect(stream, &StreamChannel::dataReceived, this, [this](const std::string &data) {
+        markActive();
+        local->write(data.data(), data.size());
+    });
+    connect(stream, &StreamChannel::bytesWritten, this, &TcpRelayClient::onRemoteBytesWritten);
+    // Closes once the local socket has written everything
+    connect(stream, &StreamChannel::finished, local.get(), &QTcpSocket::disconnectFromHost);
+    connect(stream, &StreamChannel::aborted, this, &TcpRelayClient::close);
+    // The peer may only send more once the data is out of our buffers
+    connect(local.get(), &QTcpSocket::bytesWritten, this, [this](qint64 bytes) {
+        if (channel) {
+            channel->consumed(bytes);
+        }
+    });
+    connect(this, &TcpRelay::finished, stream, &StreamChannel::close);
+
+    stage = STREAM;
+    channel->write(initialData);
+}
+
+void TcpRelayClient::startStripe(const std::string &header, const std::string &initialData)
+{
+    auto group = std::make_shared<StripeGroup>(StripeGroup::Client, stripePaths);
+    channel = group;
+    stripeHeader = header;
+    startTime = QTime::currentTime();
+    connect(group.get(), &StripeGroup::bytesRead, this, &TcpRelay::bytesRead);
+    connect(group.get(), &StripeGroup::bytesSend, this, &TcpRelay::bytesSend);
+    connect(group.get(), &StripeGroup::established, this, [this]() {
+        emit latencyAvailable(startTime.msecsTo(QTime::currentTime()));
+    });
+    connect(group.get(), &StripeGroup::rejected, this, &TcpRelayClient::onStripeRejected);
+    // Data is queued in the group until the first path is accepted
+    startChannel(initialData);
+
+    serverAddress.lookUp([this, group](bool success) {
+        if (channel != group) {
+            return;
+        }
+        if (!success) {
+            QDebug(QtMsgType::QtDebugMsg).noquote() << "Failed to lookup server address. Closing TCP connection.";
+            close();
+            return;
+        }
+        const std::string groupId = Cipher::randomIv(static_cast<int>(StripeGroup::GroupIdLength));
+        const std::string address = Common::packAddress(Address(StripeGroup::Host, 0));
+        for (int i = 0; i < stripePaths; ++i) {
+            stripeSockets.emplace_back(new QTcpSocket());
+            stripeEncryptors.emplace_back(new Encryptor(method, password));
+            QTcpSocket *socket = stripeSockets.back().get();
+            Encryptor *pathEncryptor = stripeEncryptors.back().get();
+            socket->setReadBufferSize(RemoteRecvSize);
+            connect(socket, &QTcpSocket::connected, this, [=]() {
+                socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+                const std::string hello = pathEncryptor->encrypt(
+                            address + StripeGroup::hello(groupId, i, stripePaths, stripeHeader));
+                socket->write(hello.data(), hello.size());
+            });
+            group->addPath(i, socket, pathEncryptor);
+            socket->connectToHost(serverAddress.getFirstIP(), serverAddress.getPort());
+        }
+    });
+}
+
+void TcpRelayClient::onStripeRejected()
+{
+    qWarning("The server doesn't support striping. Falling back to a single connection.");
+    stripeRetryAt = QDateTime::currentMSecsSinceEpoch() + StripeRetryInterval;
+    auto group = std::static_pointer_cast<StripeGroup>(channel);
+    group->disconnect(this);
+    disconnect(group.get());
+    channel.reset();
+    plainRemote = false;
+
+    stage = DNS;
+    const std::string pending = stripeHeader + group->takePending();
+    sendToRemote(reinterpret_cast<const uint8_t *>(pending.data()), pending.size());
+    connectToServer();
+}
+
+int64_t TcpRelayClient::pendingToRemote() const
+{
+    return TcpRelay::pendingToRemote() + (channel ? channel->pending() : 0);
 }
 
-void TcpRelayClient::handleRemoteTcpData(std::string &data)
+void TcpRelayClient::writeRemote(std::string data)
 {
-    data = encryptor->decrypt(data);
+    if (channel) {
+        channel->write(data);
+    } else {
+        TcpRelay::writeRemote(std::move(data));
+    }
 }
 
 }  // namespace QSS
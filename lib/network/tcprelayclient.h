@@ -24,9 +24,15 @@
 #define TCPRELAYCLIENT_H
 
 #include "tcprelay.h"
+#include <vector>
 
 namespace QSS {
 
+class ConnectionPool;
+class MuxClient;
+class StreamChannel;
+class StripeGroup;
+
 class QSS_EXPORT TcpRelayClient : public TcpRelay
 {
     Q_OBJECT
@@ -37,10 +43,51 @@ public:
                    const std::string& method,
                    const std::string& password);
 
+    // Takes an established connection to the server from pool if possible
+    void setConnectionPool(std::shared_ptr<ConnectionPool> pool);
+
+    // Relays over a multiplexed stream of mux if it has a session ready
+    void setMuxClient(std::shared_ptr<MuxClient> mux);
+
+    /*
+     * Stripes the connection across paths connections to the server (see
+     * StripeGroup) if paths is larger than 1. It falls back to a single
+     * connection for a while if the server doesn't support it.
+     */
+    void setStripePaths(int paths);
+
+    /*
+     * Skips the SOCKS5 handshake for a client inside this process (see
+     * TcpServer::relay()) that already knows the destination. data is sent
+     * to it right after the address header
+     */
+    void relayTo(const Address &destination, const std::string &data);
+
 protected:
-    void handleStageAddr(std::string &data) final;
-    void handleLocalTcpData(std::string &data) final;
-    void handleRemoteTcpData(std::string &data) final;
+    int64_t pendingToRemote() const final;
+    void writeRemote(std::string data) final;
+    // Connects to the target in header, through a mux stream, a stripe
+    // group or a connection of its own
+    void openRemote(const std::string &header, std::string data) final;
+
+private:
+    static const qint64 StripeRetryInterval = 300000;
+
+    const std::string method;
+    const std::string password;
+    std::shared_ptr<ConnectionPool> pool;
+    std::shared_ptr<MuxClient> mux;
+    int stripePaths = 0;
+    std::vector<std::unique_ptr<QTcpSocket> > stripeSockets;
+    std::vector<std::unique_ptr<Encryptor> > stripeEncryptors;
+    // A mux stream or a stripe group, replacing remote
+    std::shared_ptr<StreamChannel> channel;
+    std::string stripeHeader;
+
+    void connectToServer();
+    void startChannel(const std::string &initialData);
+    void startStripe(const std::string &header, const std::string &initialData);
+    void onStripeRejected();
 };
 
 }
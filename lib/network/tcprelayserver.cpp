@@ -21,6 +21,7 @@
  */
 
 #include "tcprelayserver.h"
+#include "channeloutbound.h"
 #include "util/common.h"
 #include <QDebug>
 #include <utility>
@@ -33,37 +34,44 @@ TcpRelayServer::TcpRelayServer(QTcpSocket *localSocket,
                                const std::string& method,
                                const std::string& password,
                                bool autoBan)
-    : TcpRelay(localSocket, timeout, server_addr, method, password)
-    , autoBan(autoBan)
+    : TcpRelay(localSocket, timeout, server_addr, method, password, false, autoBan)
 {}
 
-void TcpRelayServer::handleStageAddr(std::string &data)
+void TcpRelayServer::setMuxEnabled(bool enabled)
 {
-    int header_length = 0;
-    Common::parseHeader(data, remoteAddress, header_length);
-    if (header_length == 0) {
-        qCritical("Can't parse header. Wrong encryption method or password?");
-        if (autoBan) {
-            Common::banAddress(local->peerAddress());
-        }
-        close();
-        return;
-    }
+    muxEnabled = enabled;
+}
 
-    QDebug(QtMsgType::QtInfoMsg).noquote().nospace()
-            << "Connecting " << remoteAddress << " from "
-            << local->peerAddress().toString() << ":" << local->peerPort();
+void TcpRelayServer::setStripeRegistry(std::shared_ptr<StripeRegistry> registry)
+{
+    stripeRegistry = std::move(registry);
+}
+
+void TcpRelayServer::takeOver(std::unique_ptr<Encryptor> keyed, std::string &data)
+{
+    encryptor = std::move(keyed);
+    handleHeader(data);
+}
 
-    stage = DNS;
-    if (data.size() > header_length) {
-        data = data.substr(header_length);
-        dataToWrite += data;
+bool TcpRelayServer::startExtension(std::string &data, size_t headerLength)
+{
+    if (muxEnabled && remoteAddress.getAddress() == MuxSession::Host) {
+        startMuxSession(data.substr(headerLength));
+        return true;
     }
+    if (stripeRegistry && remoteAddress.getAddress() == StripeGroup::Host) {
+        joinStripe(data.substr(headerLength));
+        return true;
+    }
+    return false;
+}
+
+void TcpRelayServer::openRemote(const std::string &, std::string data)
+{
+    writeRemote(std::move(data));
     remoteAddress.lookUp([this](bool success) {
         if (success) {
-            stage = CONNECTING;
-            startTime = QTime::currentTime();
-            remote->connectToHost(remoteAddress.getFirstIP(), remoteAddress.getPort());
+            connectToRemote(remoteAddress);
         } else {
             QDebug(QtMsgType::QtDebugMsg).noquote() << "Failed to lookup remote address. Closing TCP connection.";
             close();
@@ -71,36 +79,86 @@ void TcpRelayServer::handleStageAddr(std::string &data)
     });
 }
 
-void TcpRelayServer::handleLocalTcpData(std::string &data)
+void TcpRelayServer::writeRemote(std::string data)
 {
-    try {
-        data = encryptor->decrypt(data);
-    } catch (const std::exception &e) {
-        QDebug(QtMsgType::QtCriticalMsg) << "Local:" << e.what();
+    if (!muxSession) {
+        TcpRelay::writeRemote(std::move(data));
+    } else if (!muxSession->feed(data)) {
+        qWarning("Mux session: protocol error");
         close();
-        return;
     }
+}
 
-    if (data.empty()) {
-        qWarning("Data is empty after decryption.");
-        return;
+void TcpRelayServer::startMuxSession(const std::string &data)
+{
+    QDebug(QtMsgType::QtInfoMsg).noquote().nospace()
+            << "Mux session from " << local->peerAddress().toString() << ":" << local->peerPort();
+    stage = STREAM;
+    muxSession = std::make_unique<MuxSession>(MuxSession::Server);
+    connect(muxSession.get(), &MuxSession::outputReady, this, &TcpRelayServer::flushMux);
+    connect(muxSession.get(), &MuxSession::newStream, this, &TcpRelayServer::onStream);
+    connect(local.get(), &QTcpSocket::bytesWritten, this, &TcpRelayServer::flushMux);
+    if (!data.empty() && !muxSession->feed(data)) {
+        qWarning("Mux session: protocol error");
+        close();
     }
+}
 
-    if (stage == STREAM) {
-        writeToRemote(data.data(), data.size());
-    } else if (stage == CONNECTING || stage == DNS) {
-        // take DNS into account, otherwise some data will get lost
-        dataToWrite += data;
-    } else if (stage == INIT) {
-        handleStageAddr(data);
-    } else {
-        qCritical("Local unknown stage.");
+void TcpRelayServer::flushMux()
+{
+    // Frames stay queued in the session (bounded by the stream windows)
+    // while the client is slow
+    while (muxSession && local->bytesToWrite() < highWatermark) {
+        std::string frames = muxSession->takeFrames(RemoteRecvSize);
+        if (frames.empty()) {
+            break;
+        }
+        frames = encryptor->encrypt(frames);
+        local->write(frames.data(), frames.size());
     }
 }
 
-void TcpRelayServer::handleRemoteTcpData(std::string &data)
+void TcpRelayServer::onStream(std::shared_ptr<StreamChannel> stream, const std::string &header)
+{
+    auto *outbound = new ChannelOutbound(std::move(stream), header, this);
+    connect(outbound, &ChannelOutbound::bytesRead, this, &TcpRelay::bytesRead);
+    connect(outbound, &ChannelOutbound::bytesSend, this, &TcpRelay::bytesSend);
+    connect(outbound, &ChannelOutbound::latencyAvailable, this, &TcpRelay::latencyAvailable);
+}
+
+void TcpRelayServer::joinStripe(const std::string &data)
 {
-    data = encryptor->encrypt(data);
+    std::string groupId;
+    std::string header;
+    int index = 0;
+    int count = 0;
+    // The hello is sent in one piece right after the address header
+    const size_t length = StripeGroup::parseHello(data, groupId, index, count, header);
+    if (length == 0) {
+        qWarning("Stripe path: invalid hello");
+        close();
+        return;
+    }
+
+    bool created = false;
+    stripe = stripeRegistry->join(groupId, count, created);
+    // The group reads and writes local from now on
+    local->disconnect(this);
+    stopIdleTimer();
+    stage = STREAM;
+    connect(local.get(), &QTcpSocket::disconnected, this, &TcpRelayServer::close);
+    connect(stripe.get(), &StripeGroup::aborted, this, &TcpRelayServer::close);
+    if (!stripe->addPath(index, local.get(), encryptor.get(), data.substr(length))) {
+        qWarning("Stripe path: invalid index");
+        close();
+        return;
+    }
+    if (created) {
+        QDebug(QtMsgType::QtInfoMsg).noquote().nospace()
+                << "Stripe group of " << count << " paths from "
+                << local->peerAddress().toString() << ":" << local->peerPort();
+        onStream(stripe, header);
+    }
 }
 
 }  // namespace QSS
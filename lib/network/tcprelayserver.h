@@ -24,6 +24,8 @@
 #define TCPRELAYSERVER_H
 
 #include "tcprelay.h"
+#include "muxsession.h"
+#include "stripegroup.h"
 
 namespace QSS {
 
@@ -38,12 +40,35 @@ public:
                    const std::string& password,
                    bool autoBan);
 
+    // Accepts mux sessions (see MuxSession) from clients
+    void setMuxEnabled(bool enabled);
+
+    // Accepts the paths of stripe groups (see StripeGroup) from clients if
+    // registry is set
+    void setStripeRegistry(std::shared_ptr<StripeRegistry> registry);
+
+    /*
+     * Continues a connection that a native I/O backend started (see
+     * FdRelayEngine::setHandOver()). keyed is its encryptor, and data the
+     * decrypted address header and what followed it
+     */
+    void takeOver(std::unique_ptr<Encryptor> keyed, std::string &data);
+
 protected:
-    const bool autoBan;
+    bool muxEnabled = false;
+    std::unique_ptr<MuxSession> muxSession;
+    std::shared_ptr<StripeRegistry> stripeRegistry;
+    std::shared_ptr<StripeGroup> stripe;
+
+    void writeRemote(std::string data) final;
+    void openRemote(const std::string &header, std::string data) final;
+    bool startExtension(std::string &data, size_t headerLength) final;
 
-    void handleStageAddr(std::string &data) final;
-    void handleLocalTcpData(std::string &data) final;
-    void handleRemoteTcpData(std::string &data) final;
+private:
+    void startMuxSession(const std::string &data);
+    void flushMux();
+    void onStream(std::shared_ptr<StreamChannel> stream, const std::string &header);
+    void joinStripe(const std::string &data);
 };
 
 }
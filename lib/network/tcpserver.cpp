@@ -23,12 +23,30 @@
  */
 
 
+#include "connectionpool.h"
+#include "muxclient.h"
+#include "serverchannel.h"
+#include "stripegroup.h"
 #include "tcprelayclient.h"
 #include "tcprelayserver.h"
 #include "tcpserver.h"
 #include "util/common.h"
+#include "util/nativesocket.h"
+#ifdef Q_OS_UNIX
+#include "fdrelayengine.h"
+#endif
+#ifdef Q_OS_LINUX
+#include "epollengine.h"
+#endif
+#ifdef USE_IO_URING
+#include "uringengine.h"
+#endif
 #include <QDebug>
+#include <algorithm>
 #include <utility>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
 
 namespace QSS {
 
@@ -54,6 +72,123 @@ TcpServer::~TcpServer()
     }
 }
 
+void TcpServer::setServerAddress(Address address)
+{
+    serverAddress = std::move(address);
+}
+
+void TcpServer::setBackend(Backend backend)
+{
+    m_backend = backend;
+}
+
+bool TcpServer::listen(const QHostAddress &address, uint16_t port)
+{
+    if (!QTcpServer::listen(address, port)) {
+        return false;
+    }
+    if (m_fastOpen) {
+        NativeSocket::setFastOpen(socketDescriptor(), FastOpenQueueLength);
+    }
+
+#ifdef Q_OS_LINUX
+    if (m_backend != QtBackend && isLocal
+            && (m_connectionPoolSize > 0 || m_muxSessions > 0 || m_stripePaths > 1)) {
+        // The client side of the extensions and the pool runs on QTcpSocket
+        qWarning("The native I/O backend doesn't support the connection pool, "
+                 "multiplexing or striping in local mode. Using QTcpSocket");
+    } else if (m_backend != QtBackend && m_proxyType == -1) {
+        FdRelayEngine::Settings settings;
+        settings.method = method;
+        settings.password = password;
+        settings.timeout = timeout * 1000;
+        settings.isLocal = isLocal;
+        settings.autoBan = autoBan;
+        settings.serverAddress = serverAddress;
+        if (m_highWatermark > 0) {
+            settings.highWatermark = m_highWatermark;
+            settings.lowWatermark = m_lowWatermark;
+        }
+        settings.notSentLowat = m_notSentLowat;
+        if (m_readBudget > 0) {
+            settings.readBudget = m_readBudget;
+        }
+        settings.fastOpen = m_fastOpen;
+
+#ifdef USE_IO_URING
+        if (m_backend == IoUringBackend) {
+            engine = std::make_unique<UringEngine>(settings);
+            if (!engine->attach(socketDescriptor())) {
+                qWarning("io_uring is unavailable. Falling back to epoll");
+                engine.reset();
+            }
+        }
+#endif
+        if (!engine) {
+            engine = std::make_unique<EpollEngine>(std::move(settings));
+            if (!engine->attach(socketDescriptor())) {
+                engine.reset();
+            }
+        }
+        if (engine) {
+            // The engine accepts connections itself from now on
+            pauseAccepting();
+            connect(engine.get(), &FdRelayEngine::bytesRead, this, &TcpServer::bytesRead);
+            connect(engine.get(), &FdRelayEngine::bytesSend, this, &TcpServer::bytesSend);
+            connect(engine.get(), &FdRelayEngine::latencyAvailable,
+                    this, &TcpServer::latencyAvailable);
+            connect(engine.get(), &FdRelayEngine::fastOpenFinished,
+                    this, &TcpServer::fastOpenFinished);
+            if (!isLocal && (m_muxSessions > 0 || m_stripePaths > 1)) {
+                engine->setHandOver([this](int fd,
+                                           std::unique_ptr<Encryptor> keyed,
+                                           std::string &data) {
+                    auto localSocket = std::make_unique<QTcpSocket>();
+                    if (!localSocket->setSocketDescriptor(fd)) {
+                        ::close(fd);
+                        return;
+                    }
+                    std::shared_ptr<TcpRelayServer> server = createServer(localSocket.release());
+                    addConnection(server);
+                    server->takeOver(std::move(keyed), data);
+                });
+            }
+        } else {
+            qWarning("Failed to set up the native I/O backend. Falling back to QTcpSocket");
+        }
+    }
+#endif
+    prepare();
+    return true;
+}
+
+void TcpServer::prepare()
+{
+    if (isLocal && m_connectionPoolSize > 0 && m_proxyType == -1) {
+        pool = std::make_shared<ConnectionPool>(serverAddress, m_connectionPoolSize);
+    }
+    if (isLocal && m_muxSessions > 0 && m_proxyType == -1) {
+        mux = std::make_shared<MuxClient>(serverAddress, method, password, m_muxSessions);
+        connect(mux.get(), &MuxClient::bytesRead, this, &TcpServer::bytesRead);
+        connect(mux.get(), &MuxClient::bytesSend, this, &TcpServer::bytesSend);
+    }
+    if (!isLocal && m_stripePaths > 1) {
+        stripeRegistry = std::make_shared<StripeRegistry>();
+    }
+}
+
+void TcpServer::close()
+{
+#ifdef Q_OS_UNIX
+    // Connections of the engine are closed before the listening socket
+    engine.reset();
+#endif
+    pool.reset();
+    mux.reset();
+    stripeRegistry.reset();
+    QTcpServer::close();
+}
+
 void TcpServer::incomingConnection(qintptr socketDescriptor)
 {
     auto localSocket = std::make_unique<QTcpSocket>();
@@ -65,28 +200,91 @@ void TcpServer::incomingConnection(qintptr socketDescriptor)
         return;
     }
 
-    //timeout * 1000: convert sec to msec
     std::shared_ptr<TcpRelay> con;
     if (isLocal) {
-        con = std::make_shared<TcpRelayClient>(localSocket.release(),
-                                               timeout * 1000,
-                                               serverAddress,
-                                               method,
-                                               password);
-        con->setProxy(m_proxyType, m_proxyServerAddress, m_proxyPort);
+        con = createClient(localSocket.release());
     } else {
-        con = std::make_shared<TcpRelayServer>(localSocket.release(),
-                                               timeout * 1000,
-                                               serverAddress,
-                                               method,
-                                               password,
-                                               autoBan);
+        con = createServer(localSocket.release());
+    }
+    addConnection(std::move(con));
+}
+
+void TcpServer::relay(QTcpSocket *socket, const Address &destination, const std::string &data)
+{
+    std::shared_ptr<TcpRelayClient> client = createClient(socket);
+    addConnection(client);
+    client->relayTo(destination, data);
+}
+
+std::shared_ptr<StreamChannel> TcpServer::openChannel(const Address &destination)
+{
+    const std::string &header = destination.packed();
+    if (mux) {
+        std::shared_ptr<StreamChannel> stream = mux->openStream(header);
+        if (stream) {
+            return stream;
+        }
+    }
+    auto channel = std::make_shared<ServerChannel>(serverAddress, method, password, header);
+    if (m_proxyType != -1) {
+        channel->setProxy(QNetworkProxy(m_proxyType == TcpRelay::Http
+                                        ? QNetworkProxy::HttpProxy
+                                        : QNetworkProxy::Socks5Proxy,
+                                        QString::fromStdString(m_proxyServerAddress),
+                                        m_proxyPort));
+    }
+    connect(channel.get(), &ServerChannel::bytesRead, this, &TcpServer::bytesRead);
+    connect(channel.get(), &ServerChannel::bytesSend, this, &TcpServer::bytesSend);
+    connect(channel.get(), &ServerChannel::latencyAvailable,
+            this, &TcpServer::latencyAvailable);
+    channel->start(pool.get());
+    return channel;
+}
+
+std::shared_ptr<TcpRelayClient> TcpServer::createClient(QTcpSocket *socket)
+{
+    //timeout * 1000: convert sec to msec
+    auto client = std::make_shared<TcpRelayClient>(socket,
+                                                   timeout * 1000,
+                                                   serverAddress,
+                                                   method,
+                                                   password);
+    client->setProxy(m_proxyType, m_proxyServerAddress, m_proxyPort);
+    client->setConnectionPool(pool);
+    client->setMuxClient(mux);
+    client->setStripePaths(m_stripePaths);
+    return client;
+}
+
+std::shared_ptr<TcpRelayServer> TcpServer::createServer(QTcpSocket *socket)
+{
+    auto server = std::make_shared<TcpRelayServer>(socket,
+                                                   timeout * 1000,
+                                                   serverAddress,
+                                                   method,
+                                                   password,
+                                                   autoBan);
+    server->setMuxEnabled(m_muxSessions > 0);
+    server->setStripeRegistry(stripeRegistry);
+    return server;
+}
+
+void TcpServer::addConnection(std::shared_ptr<TcpRelay> con)
+{
+    if (m_highWatermark > 0) {
+        con->setWatermarks(m_highWatermark, m_lowWatermark);
     }
+    if (m_notSentLowat > 0) {
+        con->setNotSentLowat(m_notSentLowat);
+    }
+    con->setFastOpen(m_fastOpen);
     conList.push_back(con);
     connect(con.get(), &TcpRelay::bytesRead, this, &TcpServer::bytesRead);
     connect(con.get(), &TcpRelay::bytesSend, this, &TcpServer::bytesSend);
     connect(con.get(), &TcpRelay::latencyAvailable,
             this, &TcpServer::latencyAvailable);
+    connect(con.get(), &TcpRelay::fastOpenFinished,
+            this, &TcpServer::fastOpenFinished);
     connect(con.get(), &TcpRelay::finished, this, [con, this]() {
         conList.remove(con);
     });
@@ -98,4 +296,40 @@ void TcpServer::setProxy(int proxyType, const std::string& proxyServerAddress, c
     m_proxyPort = proxyPort;
 }
 
+void TcpServer::setWatermarks(int64_t high, int64_t low)
+{
+    m_highWatermark = high;
+    m_lowWatermark = std::min(low, high);
+}
+
+void TcpServer::setNotSentLowat(int bytes)
+{
+    m_notSentLowat = bytes;
+}
+
+void TcpServer::setReadBudget(int reads)
+{
+    m_readBudget = reads;
+}
+
+void TcpServer::setFastOpen(bool enabled)
+{
+    m_fastOpen = enabled;
+}
+
+void TcpServer::setConnectionPoolSize(int size)
+{
+    m_connectionPoolSize = size;
+}
+
+void TcpServer::setMuxSessions(int sessions)
+{
+    m_muxSessions = sessions;
+}
+
+void TcpServer::setStripePaths(int paths)
+{
+    m_stripePaths = paths;
+}
+
 }  // namespace QSS
@@ -31,7 +31,14 @@
 
 namespace QSS {
 
+class ConnectionPool;
+class FdRelayEngine;
+class MuxClient;
+class StreamChannel;
+class StripeRegistry;
 class TcpRelay;
+class TcpRelayClient;
+class TcpRelayServer;
 
 class QSS_EXPORT TcpServer : public QTcpServer
 {
@@ -47,12 +54,98 @@ public:
 
     TcpServer(const TcpServer &) = delete;
 
+    // Replaces the server address, e.g. once it's looked up. Must be called
+    // before listen() or prepare()
+    void setServerAddress(Address address);
+
+    enum Backend {
+        QtBackend,  // QTcpSocket per connection (default)
+        EpollBackend,  // Native sockets driven by epoll (Linux only)
+        IoUringBackend  // Native sockets driven by io_uring, or epoll if
+                        // the kernel doesn't support it (Linux only)
+    };
+
+    // Must be called before listen(). Falls back to QtBackend if the
+    // backend is unavailable or a proxy is set
+    void setBackend(Backend backend);
+
+    // Hides QTcpServer::listen() and QTcpServer::close() so the I/O engine
+    // can take over the listening socket
+    bool listen(const QHostAddress &address, uint16_t port);
+    void close();
+
+    /*
+     * Sets up what the relays share, such as the connection pool and the mux
+     * sessions. listen() calls it. Call it instead of listen() to serve only
+     * clients inside this process (see relay() and openChannel())
+     */
+    void prepare();
+
+    /*
+     * Local mode: relays socket to destination without the SOCKS5 handshake,
+     * for a client inside this process that has already parsed the request.
+     * The server takes ownership of socket. data is sent after the address
+     * header
+     */
+    void relay(QTcpSocket *socket, const Address &destination, const std::string &data);
+
+    /*
+     * Local mode: opens a stream to destination through the server, on a mux
+     * session if one is ready, otherwise on a connection of its own
+     */
+    std::shared_ptr<StreamChannel> openChannel(const Address &destination);
+
     void setProxy(int proxyType, const std::string& proxyServerAddress, const uint16_t& port);
 
+    // See TcpRelay::setWatermarks() and TcpRelay::setNotSentLowat()
+    void setWatermarks(int64_t high, int64_t low);
+    void setNotSentLowat(int bytes);
+    // Native backends: reads from one connection before the others are
+    // served. QTcpSocket reads at most one buffered chunk per readyRead
+    void setReadBudget(int reads);
+
+    /*
+     * TCP Fast Open. Must be called before listen(). It's enabled on the
+     * listening socket to accept data in the SYN, and on outgoing remote
+     * connections (see TcpRelay::setFastOpen()). The io_uring backend only
+     * supports the former.
+     */
+    void setFastOpen(bool enabled);
+
+    /*
+     * Local mode only: keep up to size established connections to the
+     * server ready for new SOCKS5 connections (see ConnectionPool).
+     * Must be called before listen(). 0 disables it. It isn't used with
+     * a proxy, and a native I/O backend isn't used with it.
+     */
+    void setConnectionPoolSize(int size);
+
+    /*
+     * Stream multiplexing (see MuxSession). Must be called before listen().
+     * In local mode, up to sessions connections to the server carry all the
+     * TCP connections if the server supports it. In server mode, any positive
+     * value lets clients open mux sessions, and a native I/O backend hands
+     * them over to QTcpSocket. 0 disables it. Like the pool, it isn't used
+     * with a proxy.
+     */
+    void setMuxSessions(int sessions);
+
+    /*
+     * Striping (see StripeGroup). Must be called before listen(). In local
+     * mode, each TCP connection is split across paths connections to the
+     * server if the server supports it. In server mode, any value larger
+     * than 1 lets clients open stripe groups, and a native I/O backend hands
+     * them over to QTcpSocket like mux sessions. Multiplexing takes
+     * precedence, and like the pool, it isn't used with a proxy.
+     */
+    void setStripePaths(int paths);
+
 signals:
     void bytesRead(quint64);
     void bytesSend(quint64);
     void latencyAvailable(int);
+    // See TcpRelay::fastOpenFinished()
+    void fastOpenFinished(bool zeroRtt);
 
 protected:
     void incomingConnection(qintptr socketDescriptor) Q_DECL_OVERRIDE;
@@ -62,7 +155,7 @@ private:
     const std::string password;
     const bool isLocal;
     const bool autoBan;
-    const Address serverAddress;
+    Address serverAddress;
     const int timeout;
 
     int m_proxyType = -1;
@@ -71,7 +164,31 @@ private:
     std::string m_proxyUsername = "";
     std::string m_proxyPassword = "";
 
+    int64_t m_highWatermark = 0;
+    int64_t m_lowWatermark = 0;
+    int m_notSentLowat = 0;
+    int m_readBudget = 0;
+    bool m_fastOpen = false;
+    int m_connectionPoolSize = 0;
+    int m_muxSessions = 0;
+    int m_stripePaths = 0;
+    // Maximum pending TFO requests on the listening socket
+    static const int FastOpenQueueLength = 256;
+
+    Backend m_backend = QtBackend;
+#ifdef Q_OS_UNIX
+    std::unique_ptr<FdRelayEngine> engine;
+#endif
+
+    std::shared_ptr<ConnectionPool> pool;
+    std::shared_ptr<MuxClient> mux;
+    std::shared_ptr<StripeRegistry> stripeRegistry;
+
     std::list<std::shared_ptr<TcpRelay> > conList;
+
+    std::shared_ptr<TcpRelayClient> createClient(QTcpSocket *socket);
+    std::shared_ptr<TcpRelayServer> createServer(QTcpSocket *socket);
+    void addConnection(std::shared_ptr<TcpRelay> con);
 };
 
 }
@@ -22,7 +22,15 @@
 
 #include "udprelay.h"
 #include "util/common.h"
+#include "util/dnscache.h"
+#ifdef Q_OS_UNIX
+#include "batchudpsocket.h"
+#endif
+#ifdef USE_IO_URING
+#include "uringudpsocket.h"
+#endif
 #include <QDebug>
+#include <algorithm>
 #include <utility>
 
 namespace QSS {
@@ -35,7 +43,8 @@ UdpRelay::UdpRelay(const std::string &method,
     serverAddress(std::move(serverAddress)),
     isLocal(is_local),
     autoBan(auto_ban),
-    encryptor(new Encryptor(method, password))
+    encryptor(new Encryptor(method, password)),
+    expiryWheel(ExpiryTick, ExpirySlots)
 {
     listenSocket.setReadBufferSize(RemoteRecvSize);
     listenSocket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
@@ -51,26 +60,216 @@ UdpRelay::UdpRelay(const std::string &method,
             &UdpRelay::onSocketError);
     connect(&listenSocket, &QUdpSocket::bytesWritten,
             this, &UdpRelay::bytesSend);
+
+    clock.start();
+    wheelTimer.setInterval(ExpiryTick);
+    connect(&wheelTimer, &QTimer::timeout, this, [this]() {
+        expiryWheel.advance(clock.elapsed());
+    });
+}
+
+void UdpRelay::setBackend(Backend backend)
+{
+    m_backend = backend;
+}
+
+void UdpRelay::setOffloadEnabled(bool enabled)
+{
+    offload = enabled;
+}
+
+void UdpRelay::setServerAddress(Address address)
+{
+    serverAddress = std::move(address);
+}
+
+void UdpRelay::setReadBudget(int datagrams)
+{
+    readBudget = std::max(datagrams, 1);
+}
+
+void UdpRelay::setSharedOutboundSockets(int count)
+{
+    sharedSocketCount = std::max(count, 0);
+}
+
+void UdpRelay::setNatReuseDelay(int msec)
+{
+    natReuseDelay = msec;
 }
 
 bool UdpRelay::isListening() const
 {
+#ifdef Q_OS_UNIX
+    if (nativeListenSocket) {
+        return nativeListenSocket->isOpen();
+    }
+#endif
     return listenSocket.isOpen();
 }
 
+void UdpRelay::setIdleTimeout(int sec)
+{
+    idleTimeout = static_cast<int64_t>(std::max(sec, 1)) * 1000;
+}
+
+void UdpRelay::setMaxAssociations(size_t max)
+{
+    maxAssociations = std::max<size_t>(max, 1);
+}
+
+size_t UdpRelay::associationCount() const
+{
+    return m_cache.size();
+}
+
+quint64 UdpRelay::expiredAssociations() const
+{
+    return m_expiredAssociations;
+}
+
+quint64 UdpRelay::evictedAssociations() const
+{
+    return m_evictedAssociations;
+}
+
 bool UdpRelay::listen(const QHostAddress& addr, uint16_t port)
 {
-    return listenSocket.bind(
-              addr,
-              port,
-              QAbstractSocket::ShareAddress | QAbstractSocket::ReuseAddressHint
-              );
+    wheelTimer.start();
+#ifdef Q_OS_UNIX
+    if (m_backend != QtBackend) {
+        nativeListenSocket = createNativeSocket();
+        nativeListenSocket->setDatagramHandler([this](const uint8_t *data,
+                                                      size_t length,
+                                                      const QHostAddress &r_addr,
+                                                      uint16_t r_port) {
+            if (length > RemoteRecvSize) {
+                qWarning("[UDP] Datagram is too large. discarded.");
+                return;
+            }
+            emit bytesRead(length);
+            handleLocalDatagram(std::string(reinterpret_cast<const char *>(data), length),
+                                r_addr, r_port);
+        });
+        nativeListenSocket->setWrittenHandler([this](size_t bytes) {
+            emit bytesSend(bytes);
+        });
+        if (nativeListenSocket->bind(addr, port)) {
+            openSharedSockets();
+            return true;
+        }
+        nativeListenSocket.reset();
+        return false;
+    }
+#endif
+    if (!listenSocket.bind(
+                addr,
+                port,
+                QAbstractSocket::ShareAddress | QAbstractSocket::ReuseAddressHint
+                )) {
+        return false;
+    }
+    openSharedSockets();
+    return true;
 }
 
+UdpRelay::Outbound UdpRelay::openOutbound(OutboundHandler handler)
+{
+    Outbound out;
+#ifdef Q_OS_UNIX
+    if (nativeListenSocket) {
+        out.native = createNativeSocket();
+        out.native->setDatagramHandler([handler](const uint8_t *data,
+                                                 size_t length,
+                                                 const QHostAddress &r_addr,
+                                                 uint16_t r_port) {
+            if (length > RemoteRecvSize) {
+                qWarning("[UDP] Datagram is too large. Discarded.");
+                return;
+            }
+            handler(std::string(reinterpret_cast<const char *>(data), length), r_addr, r_port);
+        });
+        return out;
+    }
+#endif
+    out.socket = std::make_shared<QUdpSocket>();
+    out.socket->setReadBufferSize(RemoteRecvSize);
+    out.socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    QUdpSocket *sock = out.socket.get();
+    connect(sock, &QUdpSocket::readyRead, [this, sock, handler]() {
+        for (int i = 0; i < readBudget && sock->hasPendingDatagrams(); ++i) {
+            const size_t packetSize = sock->pendingDatagramSize();
+            if (packetSize > RemoteRecvSize) {
+                qWarning("[UDP] Datagram is too large. Discarded.");
+                sock->readDatagram(nullptr, 0);
+                continue;
+            }
+
+            std::string data;
+            data.resize(packetSize);
+            QHostAddress r_addr;
+            uint16_t r_port;
+            sock->readDatagram(&data[0], packetSize, &r_addr, &r_port);
+            handler(std::move(data), r_addr, r_port);
+        }
+    });
+    return out;
+}
+
+void UdpRelay::openSharedSockets()
+{
+    if (isLocal || sharedSocketCount == 0) {
+        return;
+    }
+    for (int i = 0; i < sharedSocketCount; ++i) {
+        const auto index = static_cast<uint32_t>(i);
+        sharedSockets.push_back(openOutbound([this, index](std::string data,
+                                                           const QHostAddress &r_addr,
+                                                           uint16_t r_port) {
+            NatBinding *binding = natInbound.find(NatKey{Endpoint(r_addr, r_port), index});
+            if (binding == nullptr) {
+                qDebug("[UDP] Drop a packet from somewhere else we know.");
+                return;
+            }
+            binding->lastActive = clock.elapsed();
+            // Copied, as handling it may change the table
+            const Endpoint client = binding->client;
+            handleRemoteDatagram(client, std::move(data), r_addr, r_port);
+        }));
+    }
+}
+
+#ifdef Q_OS_UNIX
+std::shared_ptr<NativeUdpSocket> UdpRelay::createNativeSocket()
+{
+#ifdef USE_IO_URING
+    if (m_backend == IoUringBackend) {
+        std::shared_ptr<IoUring> ring = IoUring::forThread();
+        if (ring) {
+            return UringUdpSocket::create(std::move(ring));
+        }
+        qWarning("[UDP] io_uring is unavailable. Falling back to batched sockets");
+        m_backend = BatchedBackend;
+    }
+#endif
+    std::shared_ptr<BatchUdpSocket> socket = BatchUdpSocket::create();
+    socket->setOffloadEnabled(offload);
+    socket->setReadBudget(readBudget);
+    return socket;
+}
+#endif
+
 void UdpRelay::close()
 {
     listenSocket.close();
+    nativeListenSocket.reset();
+    sharedSockets.clear();
+    natInbound.clear();
+    natOutbound.clear();
     encryptor->reset();
+    wheelTimer.stop();
+    expiryWheel.clear();
+    lru.clear();
     m_cache.clear();
 }
 
@@ -95,28 +294,42 @@ void UdpRelay::onListenStateChanged(QAbstractSocket::SocketState s)
 
 void UdpRelay::onServerUdpSocketReadyRead()
 {
-    const size_t packetSize = listenSocket.pendingDatagramSize();
-    if (packetSize > RemoteRecvSize) {
-        qWarning("[UDP] Datagram is too large. discarded.");
-        return;
-    }
+    // A bounded batch per notification. readyRead is emitted again if more
+    // datagrams are waiting
+    for (int i = 0; i < readBudget && listenSocket.hasPendingDatagrams(); ++i) {
+        const size_t packetSize = listenSocket.pendingDatagramSize();
+        if (packetSize > RemoteRecvSize) {
+            qWarning("[UDP] Datagram is too large. discarded.");
+            listenSocket.readDatagram(nullptr, 0);
+            continue;
+        }
 
-    std::string data;
-    data.resize(packetSize);
-    QHostAddress r_addr;
-    uint16_t r_port;
-    int64_t readSize = listenSocket.readDatagram(&data[0],
-                                                 packetSize,
-                                                 &r_addr,
-                                                 &r_port);
-    emit bytesRead(readSize);
+        std::string data;
+        data.resize(packetSize);
+        QHostAddress r_addr;
+        uint16_t r_port;
+        int64_t readSize = listenSocket.readDatagram(&data[0],
+                                                     packetSize,
+                                                     &r_addr,
+                                                     &r_port);
+        emit bytesRead(readSize);
+        handleLocalDatagram(std::move(data), r_addr, r_port);
+    }
+}
 
+void UdpRelay::handleLocalDatagram(std::string data, const QHostAddress &r_addr, uint16_t r_port)
+{
+    // The address header starts after RSV and FRAG of a SOCKS5 UDP request
+    size_t offset = 0;
     if (isLocal) {
+        if (data.size() < 3) {
+            return;
+        }
         if (static_cast<int>(data[2]) != 0) {
             qWarning("[UDP] Drop a message since frag is not 0");
             return;
         }
-        data = data.substr(3);
+        offset = 3;
     } else {
         if (autoBan && Common::isAddressBanned(r_addr)) {
             QDebug(QtMsgType::QtInfoMsg).noquote() << "[UDP] A banned IP" << r_addr
@@ -126,90 +339,305 @@ void UdpRelay::onServerUdpSocketReadyRead()
         data = encryptor->decryptAll(data);
     }
 
-    Address destAddr, remoteAddr(r_addr, r_port);//remote == client
-    int header_length = 0;
-    Common::parseHeader(data, destAddr, header_length);
-    if (header_length == 0) {
+    Address destAddr;
+    const Endpoint remoteAddr(r_addr, r_port);//remote == client
+    const Common::AddressHeader header = Common::parseHeader(data.data() + offset,
+                                                             data.size() - offset);
+    if (header.length == 0) {
         qCritical("[UDP] Can't parse header. Wrong encryption method or password?");
         if (!isLocal && autoBan) {
             Common::banAddress(r_addr);
         }
         return;
     }
+    // The client sends everything to the server, the address is just logged
+    if (!isLocal) {
+        header.toAddress(destAddr);
+    }
 
-    auto clientIt = m_cache.find(remoteAddr);
-    if (clientIt == m_cache.end()) {
-        std::shared_ptr<QUdpSocket> client(new QUdpSocket());
-        client->setReadBufferSize(RemoteRecvSize);
-        client->setSocketOption(QAbstractSocket::LowDelayOption, 1);
-        clientIt = m_cache.insert(clientIt, std::make_pair(remoteAddr, client));
-        connect(client.get(), &QUdpSocket::readyRead,
-                [remoteAddr, this]() {
-            std::shared_ptr<QUdpSocket> sock = m_cache.at(remoteAddr);
-            const size_t packetSize = sock->pendingDatagramSize();
-            if (packetSize > RemoteRecvSize) {
-                qWarning("[UDP] Datagram is too large. Discarded.");
-                return;
+    Association *assoc = m_cache.find(remoteAddr);
+    if (assoc == nullptr) {
+        while (m_cache.size() >= maxAssociations && !lru.empty()) {
+            const Endpoint victim = lru.back();
+            ++m_evictedAssociations;
+            QDebug(QtMsgType::QtDebugMsg).noquote()
+                    << "[UDP] Too many associations. Evicted the least recently active"
+                    << victim;
+            removeAssociation(victim);
+        }
+        Association created;
+        if (sharedSockets.empty()) {
+            created.out = openOutbound([this, remoteAddr](std::string data,
+                                                          const QHostAddress &r_addr,
+                                                          uint16_t r_port) {
+                handleRemoteDatagram(remoteAddr, std::move(data), r_addr, r_port);
+            });
+            if (created.out.socket) {
+                connect(created.out.socket.get(), &QUdpSocket::disconnected,
+                        [remoteAddr, this]() {
+                    removeAssociation(remoteAddr);
+                    qDebug("[UDP] A client connection is disconnected and destroyed.");
+                });
             }
+        }
+        created.client = r_addr;
+        lru.push_front(remoteAddr);
+        created.lruPos = lru.begin();
+        created.lastActive = clock.elapsed();
+        assoc = m_cache.insert(remoteAddr, std::move(created)).first;
+        scheduleExpiry(remoteAddr, idleTimeout);
+        if (isLocal) {
+            header.toAddress(destAddr);
+        }
+        QDebug(QtMsgType::QtDebugMsg).noquote() << "[UDP] cache miss:" << destAddr << "<->" << remoteAddr;
+    } else {
+        // Not logged, as formatting both addresses costs more than relaying
+        touch(*assoc);
+    }
 
-            std::string data;
-            data.resize(packetSize);
-            QHostAddress r_addr;
-            uint16_t r_port;
-            sock->readDatagram(&data[0], packetSize, &r_addr, &r_port);
+    if (isLocal) {
+        data = encryptor->encryptAll(reinterpret_cast<const uint8_t *>(data.data()) + offset,
+                                     data.size() - offset);
+        destAddr = serverAddress;
+    } else {
+        data.erase(0, header.length);
+    }
 
-            std::string response;
-            if (isLocal) {
-                data = encryptor->decryptAll(data);
-                Address destAddr;
-                int header_length = 0;
-
-                Common::parseHeader(data, destAddr, header_length);
-                if (header_length == 0) {
-                    qCritical("[UDP] Can't parse header. "
-                              "Wrong encryption method or password?");
-                    return;
-                }
-                response = std::string(3, static_cast<char>(0)) + data;
-            } else {
-                data = Common::packAddress(r_addr, r_port) + data;
-                response = encryptor->encryptAll(data);
-            }
+    if (!destAddr.isIPValid()) {
+        queueDatagram(remoteAddr, destAddr, std::move(data));
+        return;
+    }
+    sendDatagram(remoteAddr, *assoc, std::move(data), destAddr.getFirstIP(), destAddr.getPort());
+}
+
+void UdpRelay::sendDatagram(const Endpoint &remoteAddr, Association &assoc, std::string data,
+                            const QHostAddress &ip, uint16_t port)
+{
+    Outbound *out = &assoc.out;
+    if (!sharedSockets.empty()) {
+        const int index = bindSharedSocket(remoteAddr, assoc, Endpoint(ip, port));
+        if (index < 0) {
+            ++assoc.dropped;
+            ++m_droppedDatagrams;
+            return;
+        }
+        out = &sharedSockets[index];
+    }
+#ifdef Q_OS_UNIX
+    if (out->native) {
+        out->native->send(std::move(data), ip, port);
+        return;
+    }
+#endif
+    out->socket->writeDatagram(data.data(), data.size(), ip, port);
+}
+
+int UdpRelay::bindSharedSocket(const Endpoint &remoteAddr, Association &assoc,
+                               const Endpoint &destination)
+{
+    const qint64 now = clock.elapsed();
+    const FlowKey flow{remoteAddr, destination};
+    if (const uint32_t *bound = natOutbound.find(flow)) {
+        natInbound.find(NatKey{destination, *bound})->lastActive = now;
+        return static_cast<int>(*bound);
+    }
+
+    // Start somewhere that depends on the client, so that the clients of a
+    // popular destination spread over the sockets
+    const size_t count = sharedSockets.size();
+    const size_t start = EndpointHash()(remoteAddr) % count;
+    int chosen = -1;
+    for (size_t i = 0; i < count && chosen < 0; ++i) {
+        const auto index = static_cast<uint32_t>((start + i) % count);
+        NatBinding *binding = natInbound.find(NatKey{destination, index});
+        if (binding == nullptr) {
+            chosen = static_cast<int>(index);
+        } else if (now - binding->lastActive >= natReuseDelay) {
+            // The other client's replies would come to us from now on
+            natOutbound.erase(FlowKey{binding->client, destination});
+            natInbound.erase(NatKey{destination, index});
+            chosen = static_cast<int>(index);
+        }
+    }
+    if (chosen < 0) {
+        QDebug(QtMsgType::QtDebugMsg).noquote()
+                << "[UDP] No shared socket is free for" << destination
+                << "Dropped a datagram of" << remoteAddr;
+        return -1;
+    }
+
+    NatBinding binding;
+    binding.client = remoteAddr;
+    binding.lastActive = now;
+    natInbound.insert(NatKey{destination, static_cast<uint32_t>(chosen)}, binding);
+    natOutbound.insert(flow, static_cast<uint32_t>(chosen));
+    if (std::find(assoc.destinations.begin(), assoc.destinations.end(), destination)
+            == assoc.destinations.end()) {
+        assoc.destinations.push_back(destination);
+    }
+    return chosen;
+}
+
+void UdpRelay::unbindSharedSockets(const Endpoint &remoteAddr, const Association &assoc)
+{
+    for (const Endpoint &destination : assoc.destinations) {
+        const FlowKey flow{remoteAddr, destination};
+        const uint32_t *bound = natOutbound.find(flow);
+        if (bound == nullptr) {
+            // Taken over by another client
+            continue;
+        }
+        natInbound.erase(NatKey{destination, *bound});
+        natOutbound.erase(flow);
+    }
+}
+
+void UdpRelay::queueDatagram(const Endpoint &remoteAddr, const Address &destAddr, std::string data)
+{
+    Association &assoc = *m_cache.find(remoteAddr);
+    if (assoc.pending.size() >= MaxPendingDatagrams) {
+        ++assoc.dropped;
+        ++m_droppedDatagrams;
+        QDebug(QtMsgType::QtDebugMsg).noquote()
+                << "[UDP] Too many datagrams waiting for DNS. Dropped" << assoc.dropped
+                << "datagrams of" << remoteAddr << "so far";
+        return;
+    }
+    assoc.pending.push_back(PendingDatagram{destAddr.getAddress(), destAddr.getPort(),
+                                            std::move(data)});
+    if (assoc.pending.size() == 1) {
+        resolvePending(remoteAddr);
+    }
+}
 
-            if (remoteAddr.getPort() != 0) {
-                listenSocket.writeDatagram(response.data(),
-                                           response.size(),
-                                           remoteAddr.getFirstIP(),
-                                           remoteAddr.getPort());
+void UdpRelay::resolvePending(const Endpoint &remoteAddr)
+{
+    Association *assoc = m_cache.find(remoteAddr);
+    if (assoc == nullptr || assoc->pending.empty()) {
+        return;
+    }
+    // One lookup at a time per association keeps its datagrams in order.
+    // Cached names are answered right away
+    const std::string host = assoc->pending.front().host;
+    DnsCache::instance().lookUp(host, this, [this, remoteAddr, host](
+                                const std::vector<QHostAddress> &ips) {
+        Association *found = m_cache.find(remoteAddr);
+        if (found == nullptr) {
+            // The association is gone, and its queue with it
+            return;
+        }
+        Association &assoc = *found;
+        if (ips.empty()) {
+            QDebug(QtMsgType::QtDebugMsg).noquote().nospace()
+                    << "[UDP] Failed to look up " << QString::fromStdString(host)
+                    << ". Dropping its datagrams from " << remoteAddr;
+        }
+        while (!assoc.pending.empty() && assoc.pending.front().host == host) {
+            PendingDatagram datagram = std::move(assoc.pending.front());
+            assoc.pending.pop_front();
+            if (ips.empty()) {
+                ++assoc.dropped;
+                ++m_droppedDatagrams;
             } else {
-                qDebug("[UDP] Drop a packet from somewhere else we know.");
+                sendDatagram(remoteAddr, assoc, std::move(datagram.data), ips.front(), datagram.port);
             }
-        });
-        connect(client.get(), &QUdpSocket::disconnected,
-                [remoteAddr, this]() {
-            m_cache.erase(remoteAddr);
-            qDebug("[UDP] A client connection is disconnected and destroyed.");
-        });
-        QDebug(QtMsgType::QtDebugMsg).noquote() << "[UDP] cache miss:" << destAddr << "<->" << remoteAddr;
-    } else {
-        QDebug(QtMsgType::QtDebugMsg).noquote() << "[UDP] cache hit:" << destAddr << "<->" << remoteAddr;
+        }
+        resolvePending(remoteAddr);
+    });
+}
+
+quint64 UdpRelay::droppedDatagrams() const
+{
+    return m_droppedDatagrams;
+}
+
+void UdpRelay::touch(Association &assoc)
+{
+    assoc.lastActive = clock.elapsed();
+    lru.splice(lru.begin(), lru, assoc.lruPos);
+}
+
+void UdpRelay::scheduleExpiry(const Endpoint &remoteAddr, int64_t delay)
+{
+    m_cache.find(remoteAddr)->expiry = expiryWheel.schedule(
+                clock.elapsed(), delay, [this, remoteAddr]() {
+        onExpiry(remoteAddr);
+    });
+}
+
+void UdpRelay::onExpiry(const Endpoint &remoteAddr)
+{
+    Association *assoc = m_cache.find(remoteAddr);
+    if (assoc == nullptr) {
+        return;
+    }
+    // Activity only stamps the association. The timer is moved lazily here,
+    // which keeps the per-datagram cost to a list splice
+    const int64_t idle = clock.elapsed() - assoc->lastActive;
+    if (idle < idleTimeout) {
+        scheduleExpiry(remoteAddr, idleTimeout - idle);
+        return;
     }
+    ++m_expiredAssociations;
+    QDebug(QtMsgType::QtDebugMsg).noquote() << "[UDP] Association" << remoteAddr
+                                            << "expired after being idle";
+    assoc->expiry = 0;
+    removeAssociation(remoteAddr);
+}
+
+void UdpRelay::removeAssociation(const Endpoint &remoteAddr)
+{
+    Association *assoc = m_cache.find(remoteAddr);
+    if (assoc == nullptr) {
+        return;
+    }
+    if (assoc->expiry != 0) {
+        expiryWheel.cancel(assoc->expiry);
+    }
+    unbindSharedSockets(remoteAddr, *assoc);
+    lru.erase(assoc->lruPos);
+    m_cache.erase(remoteAddr);
+}
 
+void UdpRelay::handleRemoteDatagram(const Endpoint &remoteAddr, std::string data,
+                                    const QHostAddress &r_addr, uint16_t r_port)
+{
+    Association *assoc = m_cache.find(remoteAddr);
+    if (assoc == nullptr) {
+        return;
+    }
+    touch(*assoc);
+    std::string response;
     if (isLocal) {
-        data = encryptor->encryptAll(data);
-        destAddr = serverAddress;
+        data = encryptor->decryptAll(data);
+        // Only validated, the client takes the header as it is
+        if (Common::parseHeader(data.data(), data.size()).length == 0) {
+            qCritical("[UDP] Can't parse header. "
+                      "Wrong encryption method or password?");
+            return;
+        }
+        response = std::string(3, static_cast<char>(0)) + data;
     } else {
-        data = data.substr(header_length);
+        data = Common::packAddress(r_addr, r_port) + data;
+        response = encryptor->encryptAll(data);
     }
 
-    if (!destAddr.isIPValid()) {// TODO(symeon): async dns
-        if (!destAddr.blockingLookUp()) {
-            qDebug("[UDP] Failed to look up destination address. Closing this connection");
-            close();
-        }
+    if (remoteAddr.port == 0) {
+        qDebug("[UDP] Drop a packet from somewhere else we know.");
+        return;
+    }
+#ifdef Q_OS_UNIX
+    if (nativeListenSocket) {
+        nativeListenSocket->send(std::move(response),
+                                 assoc->client,
+                                 remoteAddr.port);
+        return;
     }
-    clientIt->second->writeDatagram(data.data(), data.size(),
-                                    destAddr.getFirstIP(), destAddr.getPort());
+#endif
+    listenSocket.writeDatagram(response.data(),
+                               response.size(),
+                               assoc->client,
+                               remoteAddr.port);
 }
 
 }  // namespace QSS
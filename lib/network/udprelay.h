@@ -26,12 +26,22 @@
 #include <QObject>
 #include <QUdpSocket>
 #include <QHostAddress>
-#include <map>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <deque>
+#include <functional>
+#include <list>
+#include <vector>
 #include "types/address.h"
+#include "types/endpoint.h"
 #include "crypto/encryptor.h"
+#include "util/flathashmap.h"
+#include "util/timerwheel.h"
 
 namespace QSS {
 
+class NativeUdpSocket;
+
 class QSS_EXPORT UdpRelay : public QObject
 {
     Q_OBJECT
@@ -44,8 +54,54 @@ public:
 
     UdpRelay(const UdpRelay &) = delete;
 
+    // Replaces the server address, e.g. once it's looked up. Must be called
+    // before listen()
+    void setServerAddress(Address address);
+
+    enum Backend {
+        QtBackend,  // QUdpSocket (default)
+        BatchedBackend,  // Native sockets read and written with recvmmsg and
+                         // sendmmsg where available (Unix only)
+        IoUringBackend  // Native sockets driven by io_uring (Linux only)
+    };
+
+    // Must be called before listen(). IoUringBackend falls back to
+    // BatchedBackend if io_uring is unavailable. Both fall back to QtBackend
+    // off Unix
+    void setBackend(Backend backend);
+    // GSO/GRO on the sockets of BatchedBackend. See BatchUdpSocket
+    void setOffloadEnabled(bool enabled);
+    // Datagrams read from one socket before the other sockets are served.
+    // Must be called before listen()
+    void setReadBudget(int datagrams);
+
     bool isListening() const;
 
+    // An association (a client endpoint and its outbound socket) is closed
+    // after it has neither sent nor received for sec seconds
+    void setIdleTimeout(int sec);
+    // The least recently active association is evicted to make room
+    void setMaxAssociations(size_t max);
+    /*
+     * Server mode only. Must be called before listen(). If count is
+     * positive, all the associations share count outbound sockets instead
+     * of opening one each, and a NAT table maps the replies back. A client
+     * can only reach a destination while one of the sockets isn't bound to
+     * that destination for another client
+     */
+    void setSharedOutboundSockets(int count);
+    // A NAT binding can be taken over by another client after it's been
+    // idle for msec (30 seconds by default)
+    void setNatReuseDelay(int msec);
+
+    size_t associationCount() const;
+    quint64 expiredAssociations() const;
+    quint64 evictedAssociations() const;
+
+    // Datagrams dropped because their destination couldn't be looked up,
+    // too many were waiting for lookups, or no shared socket was free
+    quint64 droppedDatagrams() const;
+
 public slots:
     bool listen(const QHostAddress& addr, uint16_t port);
     void close();
@@ -61,14 +117,124 @@ signals:
 private:
     //64KB, same as shadowsocks-python (udprelay)
     static const int64_t RemoteRecvSize = 65536;
+    // Per association, while the destination host names are looked up
+    static const size_t MaxPendingDatagrams = 64;
+    static const int DefaultReadBudget = 64;
+    // Idle associations are closed within a second of their timeout
+    static const int64_t ExpiryTick = 1000;
+    static const size_t ExpirySlots = 64;
+    static const int64_t DefaultNatReuseDelay = 30000;
 
-    const Address serverAddress;
+    Address serverAddress;
     const bool isLocal;
     const bool autoBan;
     QUdpSocket listenSocket;
     std::unique_ptr<Encryptor> encryptor;
 
-    std::map<Address, std::shared_ptr<QUdpSocket> > m_cache;
+    struct PendingDatagram {
+        std::string host;
+        uint16_t port;
+        std::string data;
+    };
+
+    struct Outbound {
+        // Only one of them is set, depending on the backend
+        std::shared_ptr<QUdpSocket> socket;
+        std::shared_ptr<NativeUdpSocket> native;
+    };
+    typedef std::function<void(std::string data, const QHostAddress &addr, uint16_t port)>
+            OutboundHandler;
+
+    struct Association {
+        // Not opened if the outbound sockets are shared
+        Outbound out;
+        // Destinations bound in the NAT table, if the sockets are shared
+        std::vector<Endpoint> destinations;
+        // Where the replies go
+        QHostAddress client;
+        // Datagrams to host names, in order. The front one is being looked up
+        std::deque<PendingDatagram> pending;
+        quint64 dropped = 0;
+        std::list<Endpoint>::iterator lruPos;
+        TimerWheel::TimerId expiry = 0;
+        qint64 lastActive = 0;
+    };
+
+    Backend m_backend = QtBackend;
+    bool offload = false;
+    int readBudget = DefaultReadBudget;
+    std::shared_ptr<NativeUdpSocket> nativeListenSocket;
+    FlatHashMap<Endpoint, Association, EndpointHash> m_cache;
+    // Most recently active first
+    std::list<Endpoint> lru;
+    QElapsedTimer clock;
+    TimerWheel expiryWheel;
+    QTimer wheelTimer;
+    int64_t idleTimeout = 600000;   // msec, same as shadowsocks-python
+    size_t maxAssociations = 1024;
+    quint64 m_droppedDatagrams = 0;
+    quint64 m_expiredAssociations = 0;
+    quint64 m_evictedAssociations = 0;
+
+    // A destination as seen from one of the shared sockets
+    struct NatKey {
+        Endpoint destination;
+        uint32_t socket = 0;
+
+        bool operator== (const NatKey &o) const {
+            return socket == o.socket && destination == o.destination;
+        }
+    };
+    struct NatKeyHash {
+        size_t operator()(const NatKey &key) const {
+            return EndpointHash()(key.destination) ^ (key.socket * 0x9e3779b9u);
+        }
+    };
+    struct NatBinding {
+        Endpoint client;
+        qint64 lastActive = 0;
+    };
+    struct FlowKey {
+        Endpoint client;
+        Endpoint destination;
+
+        bool operator== (const FlowKey &o) const {
+            return client == o.client && destination == o.destination;
+        }
+    };
+    struct FlowKeyHash {
+        size_t operator()(const FlowKey &key) const {
+            return EndpointHash()(key.client) * 31 ^ EndpointHash()(key.destination);
+        }
+    };
+
+    int sharedSocketCount = 0;
+    int64_t natReuseDelay = DefaultNatReuseDelay;
+    std::vector<Outbound> sharedSockets;
+    // Replies: (destination, shared socket) -> client
+    FlatHashMap<NatKey, NatBinding, NatKeyHash> natInbound;
+    // Requests: (client, destination) -> shared socket
+    FlatHashMap<FlowKey, uint32_t, FlowKeyHash> natOutbound;
+
+    void handleLocalDatagram(std::string data, const QHostAddress &r_addr, uint16_t r_port);
+    void handleRemoteDatagram(const Endpoint &remoteAddr, std::string data,
+                              const QHostAddress &r_addr, uint16_t r_port);
+    void sendDatagram(const Endpoint &remoteAddr, Association &assoc, std::string data,
+                      const QHostAddress &ip, uint16_t port);
+    Outbound openOutbound(OutboundHandler handler);
+    void openSharedSockets();
+    // Returns the shared socket for the flow, or -1 if none is free
+    int bindSharedSocket(const Endpoint &remoteAddr, Association &assoc,
+                         const Endpoint &destination);
+    void unbindSharedSockets(const Endpoint &remoteAddr, const Association &assoc);
+    // Sends data to destAddr once its host name is looked up
+    void queueDatagram(const Endpoint &remoteAddr, const Address &destAddr, std::string data);
+    void resolvePending(const Endpoint &remoteAddr);
+    std::shared_ptr<NativeUdpSocket> createNativeSocket();
+    void touch(Association &assoc);
+    void scheduleExpiry(const Endpoint &remoteAddr, int64_t delay);
+    void onExpiry(const Endpoint &remoteAddr);
+    void removeAssociation(const Endpoint &remoteAddr);
 
 private slots:
     void onSocketError();
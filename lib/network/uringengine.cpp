@@ -0,0 +1,362 @@
+/*
+ * uringengine.cpp - the source file of UringEngine class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "uringengine.h"
+#include "util/common.h"
+#include "util/nativesocket.h"
+#include <QDebug>
+#include <QTimer>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace QSS {
+
+/*
+ * The io_uring state of an FdEndpoint. It outlives the endpoint's relay
+ * being closed until all of its operations have completed.
+ */
+class UringEngine::Slot : public IoUring::Target
+{
+public:
+    static const int MaxIovecs = 64;
+
+    Slot(UringEngine *engine, FdEndpoint *ep) :
+        engine(engine),
+        ep(ep)
+    {
+        std::memset(&msg, 0, sizeof(msg));
+        std::memset(&addr, 0, sizeof(addr));
+    }
+
+    void complete(unsigned op, int32_t res, uint32_t flags) override
+    {
+        engine->handleCompletion(*this, op, res, flags);
+    }
+
+    UringEngine *engine;
+    FdEndpoint *ep;
+    bool recvArmed = false;
+    bool sending = false;
+    bool dead = false;  // unwatched, waiting for the cancellations
+    bool busy = false;  // inside handleCompletion()
+
+    // Have to stay valid until the kernel has consumed them
+    iovec iov[MaxIovecs];
+    msghdr msg;
+    sockaddr_storage addr;
+};
+
+UringEngine::UringEngine(Settings settings, QObject *parent) :
+    FdRelayEngine(std::move(settings), parent),
+    listenFd(-1),
+    acceptArmed(false),
+    multishotAccept(true),
+    slotCount(0)
+{
+}
+
+UringEngine::~UringEngine()
+{
+    detach();
+}
+
+bool UringEngine::attach(qintptr listenDescriptor)
+{
+    ring = IoUring::forThread();
+    if (!ring) {
+        return false;
+    }
+    listenFd = listenDescriptor;
+    armAccept();
+    return true;
+}
+
+void UringEngine::detach()
+{
+    if (!ring) {
+        return;
+    }
+    // Closing the relays cancels their operations
+    FdRelayEngine::detach();
+    listenFd = -1;
+    if (acceptArmed) {
+        ring->cancel(this, OpAccept);
+    }
+    // No completion may arrive after this engine is gone
+    if (!ring->waitFor([this]() { return slotCount == 0 && !acceptArmed; }, 1000)) {
+        qWarning("Timed out waiting for io_uring operations to be cancelled");
+    }
+    ring.reset();
+}
+
+void UringEngine::armAccept()
+{
+    if (listenFd == -1 || acceptArmed) {
+        return;
+    }
+    io_uring_sqe *sqe = ring->prepare(this, OpAccept);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    if (multishotAccept) {
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
+    acceptArmed = true;
+}
+
+void UringEngine::complete(unsigned op, int32_t res, uint32_t flags)
+{
+    Q_UNUSED(op)
+    if (!(flags & IORING_CQE_F_MORE)) {
+        acceptArmed = false;
+    }
+    if (res >= 0) {
+        onAccepted(res);
+        armAccept();
+    } else if (res == -EINVAL && multishotAccept) {
+        multishotAccept = false;
+        armAccept();
+    } else if (res != -ECANCELED) {
+        // e.g. EMFILE. Back off instead of spinning on the error
+        qWarning("accept failed: %s", strerror(-res));
+        if (!acceptArmed) {
+            QTimer::singleShot(100, this, &UringEngine::armAccept);
+        }
+    }
+}
+
+void UringEngine::onAccepted(int fd)
+{
+    if (listenFd == -1) {
+        ::close(fd);
+        return;
+    }
+    if (!settings().isLocal && settings().autoBan) {
+        sockaddr_storage ss;
+        socklen_t len = sizeof(ss);
+        uint16_t port = 0;
+        if (::getpeername(fd, reinterpret_cast<sockaddr *>(&ss), &len) == 0) {
+            QHostAddress peer = NativeSocket::fromSockaddr(
+                        reinterpret_cast<sockaddr *>(&ss), &port);
+            if (Common::isAddressBanned(peer)) {
+                QDebug(QtMsgType::QtInfoMsg).noquote() << "A banned IP" << peer
+                                                       << "attempted to access this server";
+                ::close(fd);
+                return;
+            }
+        }
+    }
+    NativeSocket::setNoDelay(fd);
+    NativeSocket::setKeepAlive(fd);
+    NativeSocket::setNotSentLowat(fd, settings().notSentLowat);
+    addRelay(fd);
+}
+
+UringEngine::Slot *UringEngine::createSlot(FdEndpoint &ep)
+{
+    auto *slot = new Slot(this, &ep);
+    ep.backend = slot;
+    ++slotCount;
+    return slot;
+}
+
+bool UringEngine::watch(FdEndpoint &ep)
+{
+    armRecv(*createSlot(ep));
+    return true;
+}
+
+bool UringEngine::connectRemote(FdEndpoint &ep, const QHostAddress &ip, uint16_t port)
+{
+    sockaddr_storage ss;
+    const socklen_t len = NativeSocket::toSockaddr(ip, port, &ss);
+    ep.fd = NativeSocket::createTcpSocket(ss.ss_family);
+    if (ep.fd == -1) {
+        return false;
+    }
+    NativeSocket::setNoDelay(ep.fd);
+    NativeSocket::setKeepAlive(ep.fd);
+
+    Slot *slot = createSlot(ep);
+    slot->addr = ss;
+    io_uring_sqe *sqe = ring->prepare(slot, OpConnect);
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = ep.fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(&slot->addr);
+    sqe->off = len;
+    ep.connecting = true;
+    ++ep.inFlight;
+    return true;
+}
+
+void UringEngine::unwatch(FdEndpoint &ep)
+{
+    auto *slot = static_cast<Slot *>(ep.backend);
+    if (slot == nullptr) {
+        return;
+    }
+    ep.backend = nullptr;
+    slot->dead = true;
+    if (ep.inFlight > 0) {
+        ring->cancelFd(ep.fd);
+    } else if (!slot->busy) {
+        delete slot;
+        --slotCount;
+    }
+}
+
+void UringEngine::armRecv(Slot &slot)
+{
+    FdEndpoint &ep = *slot.ep;
+    if (slot.dead || slot.recvArmed || ep.paused || ep.eof || ep.connecting) {
+        return;
+    }
+    io_uring_sqe *sqe = ring->prepare(&slot, OpRecv);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = ep.fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IoUring::BufferGroup;
+    if (ring->multishotRecv()) {
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    }
+    slot.recvArmed = true;
+    ++ep.inFlight;
+}
+
+void UringEngine::resume(FdEndpoint &ep)
+{
+    auto *slot = static_cast<Slot *>(ep.backend);
+    if (slot != nullptr) {
+        armRecv(*slot);
+    }
+}
+
+void UringEngine::flush(FdEndpoint &ep)
+{
+    auto *slot = static_cast<Slot *>(ep.backend);
+    // A running send picks up the rest once it completes
+    if (slot == nullptr || slot->dead || slot->sending || ep.connecting || ep.out.empty()) {
+        return;
+    }
+
+    int count = 0;
+    size_t offset = ep.outOffset;
+    for (auto it = ep.out.begin(); it != ep.out.end() && count < Slot::MaxIovecs; ++it) {
+        slot->iov[count].iov_base = &(*it)[offset];
+        slot->iov[count].iov_len = it->size() - offset;
+        offset = 0;
+        ++count;
+    }
+    std::memset(&slot->msg, 0, sizeof(msghdr));
+    slot->msg.msg_iov = slot->iov;
+    slot->msg.msg_iovlen = count;
+
+    io_uring_sqe *sqe = ring->prepare(slot, OpSend);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = ep.fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(&slot->msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    slot->sending = true;
+    ++ep.inFlight;
+}
+
+void UringEngine::handleCompletion(Slot &slot, unsigned op, int32_t res, uint32_t flags)
+{
+    FdEndpoint &ep = *slot.ep;
+    FdRelay *relay = ep.relay;
+    const auto side = static_cast<FdRelay::Side>(ep.side);
+    const bool more = flags & IORING_CQE_F_MORE;
+    if (!more) {
+        --ep.inFlight;
+    }
+    slot.busy = true;
+
+    switch (op) {
+    case OpRecv:
+        if (!more) {
+            slot.recvArmed = false;
+        }
+        if (flags & IORING_CQE_F_BUFFER) {
+            const auto bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            if (res > 0 && !slot.dead) {
+                relay->handleData(side, ring->buffer(bid), res);
+            }
+            // The data is encrypted into the other side's queue by now
+            ring->recycleBuffer(bid);
+        }
+        if (slot.dead) {
+            break;
+        }
+        if (res == 0) {
+            relay->handleEof(side);
+        } else if (res == -EINVAL && ring->multishotRecv()) {
+            ring->disableMultishotRecv();
+        } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+            relay->handleError(side, -res);
+        }
+        if (!slot.dead && ep.paused && slot.recvArmed) {
+            // Backpressure from handleData(). resume() re-arms the receive
+            ring->cancel(&slot, OpRecv);
+        } else if (!slot.dead) {
+            armRecv(slot);
+        }
+        break;
+    case OpSend:
+        slot.sending = false;
+        if (slot.dead) {
+            break;
+        }
+        if (res >= 0) {
+            consume(ep, res);
+            relay->handleWritten(side, res);
+            flush(ep);
+        } else if (res != -ECANCELED) {
+            relay->handleError(side, -res);
+        }
+        break;
+    case OpConnect:
+        if (slot.dead) {
+            break;
+        }
+        if (res < 0) {
+            relay->handleError(side, -res);
+        } else {
+            relay->handleConnected();
+            armRecv(slot);
+        }
+        break;
+    default:
+        break;
+    }
+
+    slot.busy = false;
+    if (slot.dead && ep.inFlight == 0) {
+        delete &slot;
+        --slotCount;
+    }
+}
+
+}  // namespace QSS
@@ -0,0 +1,79 @@
+/*
+ * uringengine.h - the header file of UringEngine class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URINGENGINE_H
+#define URINGENGINE_H
+
+#include "fdrelayengine.h"
+#include "util/iouring.h"
+
+namespace QSS {
+
+/**
+ * Linux I/O backend using io_uring.
+ *
+ * The listening socket gets a multishot accept and every connection a
+ * multishot recv selecting buffers from the ring's provided buffers. Queued
+ * output is sent with one sendmsg per iovec batch. All the SQEs of an event
+ * loop iteration share a single io_uring_enter(), see IoUring.
+ */
+class QSS_EXPORT UringEngine : public FdRelayEngine, private IoUring::Target
+{
+    Q_OBJECT
+public:
+    explicit UringEngine(Settings settings, QObject *parent = nullptr);
+    ~UringEngine();
+
+    bool attach(qintptr listenDescriptor) override;
+    void detach() override;
+
+protected:
+    bool watch(FdEndpoint &ep) override;
+    bool connectRemote(FdEndpoint &ep, const QHostAddress &ip, uint16_t port) override;
+    void flush(FdEndpoint &ep) override;
+    void resume(FdEndpoint &ep) override;
+    void unwatch(FdEndpoint &ep) override;
+
+private:
+    enum Op { OpAccept, OpRecv, OpSend, OpConnect };
+    class Slot;
+    friend class Slot;
+
+    std::shared_ptr<IoUring> ring;
+    int listenFd;
+    bool acceptArmed;
+    bool multishotAccept;
+    int slotCount;
+
+    // Completions of the listening socket
+    void complete(unsigned op, int32_t res, uint32_t flags) override;
+    void armAccept();
+    void onAccepted(int fd);
+
+    Slot *createSlot(FdEndpoint &ep);
+    void armRecv(Slot &slot);
+    void handleCompletion(Slot &slot, unsigned op, int32_t res, uint32_t flags);
+};
+
+}
+
+#endif // URINGENGINE_H
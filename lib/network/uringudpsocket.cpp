@@ -0,0 +1,299 @@
+/*
+ * uringudpsocket.cpp - the source file of UringUdpSocket class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "uringudpsocket.h"
+#include "util/nativesocket.h"
+#include <QDebug>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <unistd.h>
+
+namespace QSS {
+
+class UringUdpSocket::SendOp : public IoUring::Target
+{
+public:
+    SendOp(UringUdpSocket *owner, std::string &&payload) :
+        owner(owner),
+        data(std::move(payload))
+    {
+        std::memset(&msg, 0, sizeof(msg));
+        iov.iov_base = &data[0];
+        iov.iov_len = data.size();
+        msg.msg_name = &addr;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+    }
+
+    void complete(unsigned op, int32_t res, uint32_t flags) override
+    {
+        Q_UNUSED(op)
+        Q_UNUSED(flags)
+        UringUdpSocket *socket = owner;
+        delete this;
+        socket->onSent(res);
+    }
+
+    UringUdpSocket *owner;
+    std::string data;
+    sockaddr_storage addr;
+    iovec iov;
+    msghdr msg;
+};
+
+UringUdpSocket::UringUdpSocket(std::shared_ptr<IoUring> ring) :
+    ring(std::move(ring)),
+    fd(-1),
+    family(AF_UNSPEC),
+    recvArmed(false),
+    dead(false),
+    busy(false),
+    inFlight(0),
+    pendingSends(0)
+{
+    std::memset(&recvMsg, 0, sizeof(recvMsg));
+    std::memset(&recvAddr, 0, sizeof(recvAddr));
+    recvIov.iov_base = nullptr;
+    recvIov.iov_len = 0;
+}
+
+UringUdpSocket::~UringUdpSocket()
+{
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
+std::shared_ptr<UringUdpSocket> UringUdpSocket::create(std::shared_ptr<IoUring> ring)
+{
+    return std::shared_ptr<UringUdpSocket>(new UringUdpSocket(std::move(ring)),
+                                           [](UringUdpSocket *s) { s->release(); });
+}
+
+void UringUdpSocket::release()
+{
+    dead = true;
+    datagramHandler = nullptr;
+    writtenHandler = nullptr;
+    if (inFlight > 0) {
+        ring->cancelFd(fd);
+    } else if (!busy) {
+        delete this;
+    }
+}
+
+void UringUdpSocket::deleteIfIdle()
+{
+    if (dead && !busy && inFlight == 0) {
+        delete this;
+    }
+}
+
+bool UringUdpSocket::isOpen() const
+{
+    return fd != -1;
+}
+
+void UringUdpSocket::setDatagramHandler(DatagramHandler handler)
+{
+    datagramHandler = std::move(handler);
+}
+
+void UringUdpSocket::setWrittenHandler(WrittenHandler handler)
+{
+    writtenHandler = std::move(handler);
+}
+
+bool UringUdpSocket::open(int socketFamily, bool v6Only)
+{
+    fd = NativeSocket::createUdpSocket(socketFamily, v6Only);
+    if (fd == -1) {
+        return false;
+    }
+    family = socketFamily;
+    return true;
+}
+
+bool UringUdpSocket::bind(const QHostAddress &addr, uint16_t port)
+{
+    // Same semantics as QUdpSocket: Any is dual-stack, AnyIPv6 is not
+    const auto protocol = addr.protocol();
+    const bool opened = protocol == QAbstractSocket::IPv4Protocol
+            ? open(AF_INET, false)
+            : open(AF_INET6, protocol == QAbstractSocket::IPv6Protocol);
+    if (!opened) {
+        return false;
+    }
+    // ShareAddress | ReuseAddressHint
+    const int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_storage ss;
+    const socklen_t len = NativeSocket::toSockaddr(addr, port, &ss);
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&ss), len) != 0) {
+        QDebug(QtMsgType::QtCriticalMsg).noquote() << "[UDP] bind failed:" << strerror(errno);
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    armRecv();
+    return true;
+}
+
+void UringUdpSocket::armRecv()
+{
+    if (dead || recvArmed || fd == -1) {
+        return;
+    }
+    std::memset(&recvMsg, 0, sizeof(recvMsg));
+    if (ring->multishotRecv()) {
+        // The kernel writes io_uring_recvmsg_out, then the source address,
+        // then the payload into each buffer
+        recvMsg.msg_namelen = sizeof(sockaddr_storage);
+    } else {
+        recvMsg.msg_name = &recvAddr;
+        recvMsg.msg_namelen = sizeof(recvAddr);
+        // The length of the selected buffer is used
+        recvIov.iov_base = nullptr;
+        recvIov.iov_len = 0;
+        recvMsg.msg_iov = &recvIov;
+        recvMsg.msg_iovlen = 1;
+    }
+    io_uring_sqe *sqe = ring->prepare(this, 0);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(&recvMsg);
+    sqe->len = 1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IoUring::BufferGroup;
+    if (ring->multishotRecv()) {
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    }
+    recvArmed = true;
+    ++inFlight;
+}
+
+void UringUdpSocket::complete(unsigned op, int32_t res, uint32_t flags)
+{
+    Q_UNUSED(op)
+    if (!(flags & IORING_CQE_F_MORE)) {
+        recvArmed = false;
+        --inFlight;
+    }
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        const auto bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        const uint8_t *buf = ring->buffer(bid);
+        const uint8_t *payload = buf;
+        size_t length = res > 0 ? static_cast<size_t>(res) : 0;
+        bool truncated = false;
+        sockaddr_storage from;
+        std::memset(&from, 0, sizeof(from));
+
+        if (recvMsg.msg_iov == nullptr && length >= sizeof(io_uring_recvmsg_out)) {
+            io_uring_recvmsg_out out;
+            std::memcpy(&out, buf, sizeof(out));
+            const size_t offset = sizeof(out) + recvMsg.msg_namelen + recvMsg.msg_controllen;
+            std::memcpy(&from, buf + sizeof(out),
+                        std::min<size_t>(out.namelen, sizeof(from)));
+            payload = buf + offset;
+            length = length > offset ? std::min<size_t>(out.payloadlen, length - offset) : 0;
+            truncated = out.flags & MSG_TRUNC;
+        } else if (recvMsg.msg_iov != nullptr) {
+            from = recvAddr;
+            truncated = recvMsg.msg_flags & MSG_TRUNC;
+        }
+
+        if (truncated) {
+            qWarning("[UDP] Datagram is too large. Discarded.");
+        } else if (res > 0 && !dead && datagramHandler) {
+            uint16_t port = 0;
+            const QHostAddress addr = NativeSocket::fromSockaddr(
+                        reinterpret_cast<sockaddr *>(&from), &port);
+            busy = true;
+            datagramHandler(payload, length, addr, port);
+            busy = false;
+        }
+        ring->recycleBuffer(bid);
+    }
+
+    if (res == -EINVAL && ring->multishotRecv()) {
+        ring->disableMultishotRecv();
+    } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED && !dead) {
+        QDebug(QtMsgType::QtCriticalMsg).noquote() << "[UDP] socket error" << strerror(-res);
+    }
+    armRecv();
+    deleteIfIdle();
+}
+
+void UringUdpSocket::send(std::string data, const QHostAddress &addr, uint16_t port)
+{
+    if (dead) {
+        return;
+    }
+    if (fd == -1) {
+        // Prefer a dual-stack socket so one association can reach both families
+        if (!open(AF_INET6, false) && !open(AF_INET, false)) {
+            QDebug(QtMsgType::QtCriticalMsg).noquote() << "[UDP] client socket error" << strerror(errno);
+            return;
+        }
+        armRecv();
+    }
+    if (family == AF_INET && addr.protocol() != QAbstractSocket::IPv4Protocol) {
+        qDebug("[UDP] Drop a packet since IPv6 is unavailable.");
+        return;
+    }
+    if (pendingSends >= MaxPendingSends) {
+        qDebug("[UDP] Drop a packet since the send queue is full.");
+        return;
+    }
+
+    auto *op = new SendOp(this, std::move(data));
+    op->msg.msg_namelen = NativeSocket::toSockaddr(addr, port, &op->addr, family == AF_INET6);
+    io_uring_sqe *sqe = ring->prepare(op, 0);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(&op->msg);
+    sqe->len = 1;
+    ++pendingSends;
+    ++inFlight;
+}
+
+void UringUdpSocket::onSent(int32_t res)
+{
+    --pendingSends;
+    --inFlight;
+    if (res >= 0) {
+        if (!dead && writtenHandler) {
+            busy = true;
+            writtenHandler(res);
+            busy = false;
+        }
+    } else if (res != -ECANCELED && !dead) {
+        QDebug(QtMsgType::QtDebugMsg).noquote() << "[UDP] send failed:" << strerror(-res);
+    }
+    deleteIfIdle();
+}
+
+}  // namespace QSS
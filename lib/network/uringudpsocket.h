@@ -0,0 +1,90 @@
+/*
+ * uringudpsocket.h - the header file of UringUdpSocket class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URINGUDPSOCKET_H
+#define URINGUDPSOCKET_H
+
+#include <memory>
+#include <sys/socket.h>
+#include "nativeudpsocket.h"
+#include "util/iouring.h"
+
+namespace QSS {
+
+/**
+ * A UDP socket whose datagrams go through IoUring.
+ *
+ * A multishot recvmsg delivers the datagrams in provided buffers, and every
+ * send is a sendmsg SQE batched with the rest of the event loop iteration.
+ * Instances are only handed out as shared pointers, whose deleter keeps the
+ * memory alive until the kernel has finished with it.
+ */
+class QSS_EXPORT UringUdpSocket : public NativeUdpSocket, public IoUring::Target
+{
+public:
+    static std::shared_ptr<UringUdpSocket> create(std::shared_ptr<IoUring> ring);
+
+    UringUdpSocket(const UringUdpSocket &) = delete;
+
+    bool bind(const QHostAddress &addr, uint16_t port) override;
+    void send(std::string data, const QHostAddress &addr, uint16_t port) override;
+    bool isOpen() const override;
+
+    void setDatagramHandler(DatagramHandler handler) override;
+    void setWrittenHandler(WrittenHandler handler) override;
+
+private:
+    explicit UringUdpSocket(std::shared_ptr<IoUring> ring);
+    ~UringUdpSocket() override;
+
+    class SendOp;
+
+    // Datagrams are dropped when the kernel falls this far behind
+    static const int MaxPendingSends = 1024;
+
+    std::shared_ptr<IoUring> ring;
+    int fd;
+    int family;
+    bool recvArmed;
+    bool dead;
+    bool busy;  // inside a handler, which may drop the last reference
+    int inFlight;
+    int pendingSends;
+    DatagramHandler datagramHandler;
+    WrittenHandler writtenHandler;
+
+    // Referenced by the recvmsg SQE while it's armed
+    msghdr recvMsg;
+    iovec recvIov;
+    sockaddr_storage recvAddr;
+
+    bool open(int family, bool v6Only);
+    void armRecv();
+    void release();
+    void complete(unsigned op, int32_t res, uint32_t flags) override;
+    void onSent(int32_t res);
+    void deleteIfIdle();
+};
+
+}
+
+#endif // URINGUDPSOCKET_H
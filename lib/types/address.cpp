@@ -24,9 +24,41 @@
 
 #include "address.h"
 #include "util/common.h"
+#include "util/dnscache.h"
+#include <cstdio>
+#include <cstring>
 
 namespace  QSS {
 
+namespace {
+
+// Strict dotted-decimal, the only IPv4 form clients and configurations use
+bool parseIPv4(const std::string &text, uint8_t *bytes)
+{
+    int part = 0;
+    int value = -1;
+    for (const char c : text) {
+        if (c >= '0' && c <= '9') {
+            value = (value < 0 ? 0 : value * 10) + (c - '0');
+            if (value > 255) {
+                return false;
+            }
+        } else if (c == '.' && value >= 0 && part < 3) {
+            bytes[part++] = static_cast<uint8_t>(value);
+            value = -1;
+        } else {
+            return false;
+        }
+    }
+    if (part != 3 || value < 0) {
+        return false;
+    }
+    bytes[3] = static_cast<uint8_t>(value);
+    return true;
+}
+
+}
+
 void DnsLookup::lookup(const QString& hostname)
 {
     QHostInfo::lookupHost(hostname, this, SLOT(lookedUp(QHostInfo)));
@@ -47,18 +79,51 @@ void DnsLookup::lookedUp(const QHostInfo &info)
     emit finished();
 }
 
-Address::Address(const std::string &a, uint16_t p)
+Address::Address(const std::string &a, uint16_t p) :
+    type(HOST),
+    ipBytes()
 {
     data.second = p;
     setAddress(a);
 }
 
-Address::Address(const QHostAddress &ip, uint16_t p)
+Address::Address(const QHostAddress &ip, uint16_t p) :
+    type(HOST),
+    ipBytes()
 {
     data.second = p;
     setIPAddress(ip);
 }
 
+Address::Address(const Address &o) :
+    data(o.data),
+    type(o.type),
+    ipBytes(o.ipBytes),
+    ipAddrList(o.ipAddrList),
+    packedCache(o.packedCache)
+{
+}
+
+Address::Address(Address &&o) :
+    data(std::move(o.data)),
+    type(o.type),
+    ipBytes(o.ipBytes),
+    ipAddrList(std::move(o.ipAddrList)),
+    packedCache(std::move(o.packedCache))
+{
+}
+
+Address& Address::operator=(const Address &o)
+{
+    data = o.data;
+    type = o.type;
+    ipBytes = o.ipBytes;
+    ipAddrList = o.ipAddrList;
+    packedCache = o.packedCache;
+    lookupContext.reset();
+    return *this;
+}
+
 const std::string& Address::getAddress() const
 {
     return data.first;
@@ -77,6 +142,11 @@ QHostAddress Address::getFirstIP() const
     return ipAddrList.empty() ? QHostAddress() : ipAddrList.front();
 }
 
+const std::vector<QHostAddress> &Address::getIPList() const
+{
+    return ipAddrList;
+}
+
 bool Address::isIPValid() const
 {
     return !ipAddrList.empty();
@@ -93,18 +163,14 @@ void Address::lookUp(Address::LookUpCallback cb)
         return cb(true);
     }
 
-    if (dns) {
-        // DNS lookup is in-progress
-        return;
+    if (!lookupContext) {
+        lookupContext = std::make_unique<QObject>();
     }
-
-    dns = std::make_shared<DnsLookup>();
-    QObject::connect(dns.get(), &DnsLookup::finished, [cb, this]() {
-        ipAddrList = dns->iplist().toVector().toStdVector();
+    DnsCache::instance().lookUp(data.first, lookupContext.get(),
+                                [cb, this](const std::vector<QHostAddress> &addresses) {
+        ipAddrList = addresses;
         cb(!ipAddrList.empty());
-        dns.reset();
     });
-    dns->lookup(QString::fromStdString(data.first));
 }
 
 bool Address::blockingLookUp()
@@ -122,11 +188,36 @@ bool Address::blockingLookUp()
 
 void Address::setAddress(const std::string &a)
 {
-    data.first = QString::fromStdString(a).trimmed().toStdString();
+    static const char *const whitespace = " \t\n\v\f\r";
+    const size_t begin = a.find_first_not_of(whitespace);
+    if (begin == std::string::npos) {
+        data.first.clear();
+    } else {
+        data.first = a.substr(begin, a.find_last_not_of(whitespace) - begin + 1);
+    }
     ipAddrList.clear();
-    QHostAddress ipAddress(QString::fromStdString(a));
-    if (!ipAddress.isNull()) {
-        ipAddrList.push_back(ipAddress);
+    packedCache.clear();
+    // The result of a pending lookup would be for the old name
+    lookupContext.reset();
+
+    //it's a domain if it can't be parsed
+    type = HOST;
+    if (parseIPv4(data.first, ipBytes.data())) {
+        type = IPV4;
+        ipAddrList.push_back(QHostAddress(static_cast<quint32>(ipBytes[0]) << 24
+                                          | static_cast<quint32>(ipBytes[1]) << 16
+                                          | static_cast<quint32>(ipBytes[2]) << 8
+                                          | ipBytes[3]));
+    } else if (data.first.find(':') != std::string::npos) {
+        // IPv6 literals are rare enough to leave them to Qt
+        QHostAddress ipAddress(QString::fromLatin1(data.first.data(),
+                                                   static_cast<int>(data.first.size())));
+        if (ipAddress.protocol() == QAbstractSocket::IPv6Protocol) {
+            type = IPV6;
+            const Q_IPV6ADDR ipv6Address = ipAddress.toIPv6Address();
+            memcpy(ipBytes.data(), ipv6Address.c, 16);
+            ipAddrList.push_back(ipAddress);
+        }
     }
 }
 
@@ -134,23 +225,56 @@ void Address::setIPAddress(const QHostAddress &ip)
 {
     ipAddrList.clear();
     ipAddrList.push_back(ip);
-    data.first = ip.toString().toStdString();
+    packedCache.clear();
+    if (ip.protocol() == QAbstractSocket::IPv4Protocol) {
+        type = IPV4;
+        const quint32 ipv4Address = ip.toIPv4Address();
+        for (int i = 0; i < 4; ++i) {
+            ipBytes[i] = static_cast<uint8_t>(ipv4Address >> (24 - 8 * i));
+        }
+        char text[16];
+        snprintf(text, sizeof(text), "%u.%u.%u.%u",
+                 ipBytes[0], ipBytes[1], ipBytes[2], ipBytes[3]);
+        data.first = text;
+    } else if (ip.protocol() == QAbstractSocket::IPv6Protocol) {
+        type = IPV6;
+        const Q_IPV6ADDR ipv6Address = ip.toIPv6Address();
+        memcpy(ipBytes.data(), ipv6Address.c, 16);
+        data.first = ip.toString().toStdString();
+    } else {
+        type = HOST;
+        data.first = ip.toString().toStdString();
+    }
 }
 
 void Address::setPort(uint16_t p)
 {
     data.second = p;
+    packedCache.clear();
 }
 
 Address::ATYP Address::addressType() const
 {
-    QHostAddress ipAddress(QString::fromStdString(data.first));
-    if (ipAddress.isNull()) {//it's a domain if it can't be parsed
-        return HOST;
-    } if (ipAddress.protocol() == QAbstractSocket::IPv4Protocol) {
-        return IPV4;
+    return type;
+}
+
+const std::string &Address::packed() const
+{
+    if (packedCache.empty()) {
+        packedCache.reserve(data.first.size() + 4);
+        packedCache.push_back(static_cast<char>(type));
+        if (type == HOST) {
+            //can't be longer than 255
+            packedCache.push_back(static_cast<char>(data.first.length()));
+            packedCache.append(data.first);
+        } else {
+            packedCache.append(reinterpret_cast<const char *>(ipBytes.data()),
+                               type == IPV4 ? 4 : 16);
+        }
+        packedCache.push_back(static_cast<char>(data.second >> 8));
+        packedCache.push_back(static_cast<char>(data.second & 0xff));
     }
-    return IPV6;
+    return packedCache;
 }
 
 std::string Address::toString() const
@@ -29,6 +29,7 @@
 #include <QHostAddress>
 #include <QHostInfo>
 
+#include <array>
 #include <functional>
 #include <memory>
 #include <vector>
@@ -63,10 +64,11 @@ public:
     Address(const QHostAddress &ip,
             uint16_t p);
 
-    Address(const Address &) = default;
-    Address(Address &&) = default;
+    // A lookup in progress isn't copied (or moved)
+    Address(const Address &o);
+    Address(Address &&o);
 
-    Address& operator=(const Address&) = default;
+    Address& operator=(const Address &o);
 
     const std::string &getAddress() const;
 
@@ -87,6 +89,9 @@ public:
      */
     QHostAddress getFirstIP() const;
 
+    // All the IP addresses in the order the resolver returned them
+    const std::vector<QHostAddress> &getIPList() const;
+
     bool isIPValid() const;
     uint16_t getPort() const;
 
@@ -98,7 +103,9 @@ public:
 
     /*
      * Looks up the network address if the address is a domain name.
-     * The callback is invoked whenever the operation is finished.
+     * The callback is invoked whenever the operation is finished, which may
+     * be before lookUp() returns (see DnsCache). It's never invoked after
+     * this Address is destroyed.
      */
     void lookUp(LookUpCallback);
 
@@ -114,8 +121,16 @@ public:
 
     enum ATYP { IPV4 = 1, IPV6 = 4, HOST = 3 };
 
+    // Decided when the address is set. A domain name stays HOST after lookUp()
     ATYP addressType() const;
 
+    /*
+     * The address in the shadowsocks header format, i.e. ATYP, DST.ADDR and
+     * DST.PORT of a SOCKS5 request. It's built on the first call and kept
+     * until the address or the port changes
+     */
+    const std::string &packed() const;
+
     std::string toString() const;
 
     inline bool operator< (const Address &o) const {
@@ -137,8 +152,13 @@ public:
 
 private:
     std::pair<std::string, uint16_t> data;//first: address string; second: port
+    ATYP type;
+    // Network byte order, only the first 4 bytes are used by an IPv4 address
+    std::array<uint8_t, 16> ipBytes;
     std::vector<QHostAddress> ipAddrList;
-    std::shared_ptr<DnsLookup> dns;
+    mutable std::string packedCache;
+    // Callbacks of pending lookups are dropped with it
+    std::unique_ptr<QObject> lookupContext;
 };
 
 }
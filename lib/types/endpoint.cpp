@@ -0,0 +1,93 @@
+/*
+ * endpoint.cpp - a compact IP endpoint key
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "endpoint.h"
+#include <cstring>
+
+namespace QSS {
+
+Endpoint::Endpoint(const QHostAddress &addr, uint16_t port) :
+    port(port)
+{
+    switch (addr.protocol()) {
+    case QAbstractSocket::IPv4Protocol: {
+        const quint32 v4 = addr.toIPv4Address();
+        family = IPv4;
+        ip[0] = static_cast<uint8_t>(v4 >> 24);
+        ip[1] = static_cast<uint8_t>(v4 >> 16);
+        ip[2] = static_cast<uint8_t>(v4 >> 8);
+        ip[3] = static_cast<uint8_t>(v4);
+        break;
+    }
+    case QAbstractSocket::IPv6Protocol: {
+        const Q_IPV6ADDR v6 = addr.toIPv6Address();
+        family = IPv6;
+        std::memcpy(ip, v6.c, sizeof(ip));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+QHostAddress Endpoint::address() const
+{
+    switch (family) {
+    case IPv4:
+        return QHostAddress(static_cast<quint32>(ip[0]) << 24
+                            | static_cast<quint32>(ip[1]) << 16
+                            | static_cast<quint32>(ip[2]) << 8
+                            | static_cast<quint32>(ip[3]));
+    case IPv6:
+        return QHostAddress(ip);
+    default:
+        return QHostAddress();
+    }
+}
+
+std::string Endpoint::toString() const
+{
+    const std::string host = address().toString().toStdString();
+    if (family == IPv6) {
+        return "[" + host + "]:" + std::to_string(port);
+    }
+    return host + ":" + std::to_string(port);
+}
+
+size_t EndpointHash::operator()(const Endpoint &e) const
+{
+    // Two multiply-xorshift rounds over the address words. Good enough to
+    // spread consecutive ports and addresses over a power-of-two table
+    uint64_t hi, lo;
+    std::memcpy(&hi, e.ip, sizeof(hi));
+    std::memcpy(&lo, e.ip + sizeof(hi), sizeof(lo));
+    uint64_t h = (static_cast<uint64_t>(e.family) << 16 | e.port) * 0x9e3779b97f4a7c15ULL;
+    h ^= hi;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h ^= lo;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+}
+
+}  // namespace QSS
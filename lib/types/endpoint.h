@@ -0,0 +1,77 @@
+/*
+ * endpoint.h - the header file of Endpoint class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include <QDebug>
+#include <QHostAddress>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include "util/export.h"
+
+namespace QSS {
+
+/**
+ * A numeric IP address and port, for hashing datagram sources.
+ *
+ * Unlike Address, it never holds a host name, so it's trivially copyable
+ * and building one from QUdpSocket::readDatagram() output doesn't allocate.
+ */
+struct QSS_EXPORT Endpoint
+{
+    enum Family : uint8_t { None = 0, IPv4 = 4, IPv6 = 6 };
+
+    Endpoint() = default;
+    Endpoint(const QHostAddress &addr, uint16_t port);
+
+    QHostAddress address() const;
+    std::string toString() const;
+
+    inline bool operator== (const Endpoint &o) const {
+        return family == o.family && port == o.port
+                && std::equal(ip, ip + sizeof(ip), o.ip);
+    }
+
+    inline bool operator!= (const Endpoint &o) const {
+        return !(*this == o);
+    }
+
+    friend inline QDebug& operator<< (QDebug &os, const Endpoint &e) {
+        return os << QString::fromStdString(e.toString());
+    }
+
+    Family family = None;
+    uint16_t port = 0;
+    // In network byte order. An IPv4 address only uses the first 4 bytes
+    uint8_t ip[16] = {};
+};
+
+struct QSS_EXPORT EndpointHash
+{
+    size_t operator()(const Endpoint &e) const;
+};
+
+}
+
+#endif // ENDPOINT_H
@@ -9,6 +9,19 @@ struct ProfilePrivate {
     bool debug = false;
     std::string pluginExec;
     std::string pluginOpts;
+    int tcpNotSentLowat = 0;
+    int tcpHighWatermark = 0;
+    int tcpLowWatermark = 0;
+    std::string ioBackend;
+    bool fastOpen = false;
+    int connectionPoolSize = 0;
+    int muxSessions = 0;
+    int stripePaths = 0;
+    bool udpOffload = false;
+    int udpSharedSockets = 0;
+    int tcpReadBudget = 0;
+    int udpReadBudget = 0;
+    int socksPort = 0;
 };
 
 Profile::Profile() :
@@ -156,6 +169,71 @@ const std::string& Profile::proxyPassword() const {
     return d_proxyPassword;
 }
 
+int Profile::tcpNotSentLowat() const
+{
+    return d_private->tcpNotSentLowat;
+}
+
+int Profile::tcpHighWatermark() const
+{
+    return d_private->tcpHighWatermark;
+}
+
+int Profile::tcpLowWatermark() const
+{
+    return d_private->tcpLowWatermark;
+}
+
+const std::string& Profile::ioBackend() const
+{
+    return d_private->ioBackend;
+}
+
+bool Profile::fastOpen() const
+{
+    return d_private->fastOpen;
+}
+
+int Profile::connectionPoolSize() const
+{
+    return d_private->connectionPoolSize;
+}
+
+int Profile::muxSessions() const
+{
+    return d_private->muxSessions;
+}
+
+int Profile::stripePaths() const
+{
+    return d_private->stripePaths;
+}
+
+bool Profile::udpOffload() const
+{
+    return d_private->udpOffload;
+}
+
+int Profile::udpSharedSockets() const
+{
+    return d_private->udpSharedSockets;
+}
+
+int Profile::tcpReadBudget() const
+{
+    return d_private->tcpReadBudget;
+}
+
+int Profile::udpReadBudget() const
+{
+    return d_private->udpReadBudget;
+}
+
+int Profile::socksPort() const
+{
+    return d_private->socksPort;
+}
+
 void Profile::setName(const std::string& name)
 {
     d_name = name;
@@ -225,6 +303,67 @@ void Profile::setProxyPassword(const std::string& password) {
     d_proxyPassword = password;
 }
 
+void Profile::setTcpNotSentLowat(int bytes)
+{
+    d_private->tcpNotSentLowat = bytes;
+}
+
+void Profile::setTcpWatermarks(int high, int low)
+{
+    d_private->tcpHighWatermark = high;
+    d_private->tcpLowWatermark = low;
+}
+
+void Profile::setIoBackend(const std::string& backend)
+{
+    d_private->ioBackend = backend;
+}
+
+void Profile::setFastOpen(bool enabled)
+{
+    d_private->fastOpen = enabled;
+}
+
+void Profile::setConnectionPoolSize(int size)
+{
+    d_private->connectionPoolSize = size;
+}
+
+void Profile::setMuxSessions(int sessions)
+{
+    d_private->muxSessions = sessions;
+}
+
+void Profile::setStripePaths(int paths)
+{
+    d_private->stripePaths = paths;
+}
+
+void Profile::setUdpOffload(bool enabled)
+{
+    d_private->udpOffload = enabled;
+}
+
+void Profile::setUdpSharedSockets(int count)
+{
+    d_private->udpSharedSockets = count;
+}
+
+void Profile::setTcpReadBudget(int reads)
+{
+    d_private->tcpReadBudget = reads;
+}
+
+void Profile::setUdpReadBudget(int datagrams)
+{
+    d_private->udpReadBudget = datagrams;
+}
+
+void Profile::setSocksPort(int port)
+{
+    d_private->socksPort = port;
+}
+
 void Profile::enableDebug()
 {
     d_private->debug = true;
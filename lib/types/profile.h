@@ -58,6 +58,19 @@ public:
     uint16_t proxyPort() const;
     const std::string& proxyUsername() const;
     const std::string& proxyPassword() const;
+    int tcpNotSentLowat() const;
+    int tcpHighWatermark() const;
+    int tcpLowWatermark() const;
+    const std::string& ioBackend() const;
+    bool fastOpen() const;
+    int connectionPoolSize() const;
+    int muxSessions() const;
+    int stripePaths() const;
+    bool udpOffload() const;
+    int udpSharedSockets() const;
+    int tcpReadBudget() const;
+    int udpReadBudget() const;
+    int socksPort() const;
 
     /**
      * @brief isValid Whether this profile has essential information.
@@ -85,6 +98,42 @@ public:
     void setProxyPort(uint16_t port);
     void setProxyUsername(const std::string& username);
     void setProxyPassword(const std::string& password);
+    // Enables the TCP latency mode (TCP_NOTSENT_LOWAT) if bytes is positive
+    void setTcpNotSentLowat(int bytes);
+    // TCP backpressure: stop reading from one side of a connection while
+    // more than high bytes wait to be written to the other side, resume at
+    // low. 0 uses the defaults (256 KiB and 64 KiB)
+    void setTcpWatermarks(int high, int low);
+    // "epoll" relays TCP connections on native sockets (Linux only), and UDP
+    // datagrams in batches on native sockets (Unix)
+    // "io_uring" does the same for TCP and UDP with io_uring (Linux 6.0+)
+    // Empty or any other value uses the default QTcpSocket code path
+    void setIoBackend(const std::string& backend);
+    // TCP Fast Open on the listening socket and remote connections
+    void setFastOpen(bool enabled);
+    // Local mode: maximum number of pre-connected sockets to the server
+    // kept ready for new connections. 0 disables the pool
+    void setConnectionPoolSize(int size);
+    // Stream multiplexing. Local mode: maximum number of mux connections to
+    // the server. Server mode: accept mux sessions if positive
+    void setMuxSessions(int sessions);
+    // Striping. Local mode: number of connections to the server each TCP
+    // connection is split across. Server mode: accept stripes if larger than 1
+    void setStripePaths(int paths);
+    // UDP segmentation and receive offload (GSO/GRO) for the "epoll"
+    // io backend, if the kernel supports it (Linux 5.0+)
+    void setUdpOffload(bool enabled);
+    // Server mode: relay UDP through this many shared outbound sockets and
+    // a NAT table, instead of a socket per client. 0 disables it
+    void setUdpSharedSockets(int count);
+    // 64 KiB reads from one TCP connection per event before the others are
+    // served, on the native io backends. 0 uses the default (16)
+    void setTcpReadBudget(int reads);
+    // Datagrams read from one UDP socket per event. 0 uses the default (64)
+    void setUdpReadBudget(int datagrams);
+    // HTTP proxy mode: also serve SOCKS5 on this port. HTTP requests don't
+    // need it, 0 (the default) doesn't listen
+    void setSocksPort(int port);
     void enableDebug();
     void disableDebug();
     void setPlugin(std::string exec, std::string opts = std::string());
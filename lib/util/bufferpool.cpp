@@ -0,0 +1,76 @@
+/*
+ * bufferpool.cpp - the source file of BufferPool class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "bufferpool.h"
+#include <cassert>
+
+namespace QSS {
+
+BufferPool::BufferPool(size_t blockSize, size_t blockCount) :
+    m_blockSize(blockSize),
+    arena(blockSize * blockCount)
+{
+    freeList.reserve(blockCount);
+    // Hand out low indexes first
+    for (size_t i = blockCount; i > 0; --i) {
+        freeList.push_back(static_cast<int>(i - 1));
+    }
+}
+
+size_t BufferPool::blockSize() const
+{
+    return m_blockSize;
+}
+
+size_t BufferPool::blockCount() const
+{
+    return arena.size() / m_blockSize;
+}
+
+size_t BufferPool::available() const
+{
+    return freeList.size();
+}
+
+uint8_t *BufferPool::block(size_t index)
+{
+    assert(index < blockCount());
+    return arena.data() + index * m_blockSize;
+}
+
+int BufferPool::acquire()
+{
+    if (freeList.empty()) {
+        return -1;
+    }
+    const int index = freeList.back();
+    freeList.pop_back();
+    return index;
+}
+
+void BufferPool::release(int index)
+{
+    assert(index >= 0 && static_cast<size_t>(index) < blockCount());
+    freeList.push_back(index);
+}
+
+}  // namespace QSS
@@ -0,0 +1,66 @@
+/*
+ * bufferpool.h - the header file of BufferPool class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "export.h"
+
+namespace QSS {
+
+/**
+ * A fixed number of equally sized blocks carved out of one allocation.
+ *
+ * Blocks are referred to by their index so that they can be handed to the
+ * kernel (e.g. as io_uring provided buffers) and identified again when the
+ * kernel returns them.
+ */
+class QSS_EXPORT BufferPool
+{
+public:
+    BufferPool(size_t blockSize, size_t blockCount);
+
+    BufferPool(const BufferPool &) = delete;
+
+    size_t blockSize() const;
+    size_t blockCount() const;
+    // Number of blocks that are not acquired
+    size_t available() const;
+
+    uint8_t *block(size_t index);
+
+    // Returns the index of a free block, or -1 if all blocks are in use
+    int acquire();
+    void release(int index);
+
+private:
+    const size_t m_blockSize;
+    std::vector<uint8_t> arena;
+    std::vector<int> freeList;
+};
+
+}
+
+#endif // BUFFERPOOL_H
@@ -26,6 +26,7 @@
 #include <QHostInfo>
 #include <QtEndian>
 
+#include <cstring>
 #include <mutex>
 #include <random>
 #include <sstream>
@@ -48,26 +49,7 @@ const char* Common::version()
 //pack a shadowsocks header
 std::string Common::packAddress(const Address &addr)
 {
-    std::string portNs(2, '\0');
-    qToBigEndian(addr.getPort(), reinterpret_cast<uchar*>(&portNs[0]));
-
-    std::string addrBin;
-    const Address::ATYP type = addr.addressType();
-    if (type == Address::HOST) {
-        const std::string& addressString = addr.getAddress();
-        //can't be longer than 255
-        addrBin = static_cast<char>(addressString.length()) + addressString;
-    } else if (type == Address::IPV4) {
-        uint32_t ipv4Address = qToBigEndian(addr.getFirstIP().toIPv4Address());
-        addrBin = std::string(reinterpret_cast<char*>(&ipv4Address), 4);
-    } else {
-        //Q_IPV6ADDR is a 16-unsigned-char struct (big endian)
-        Q_IPV6ADDR ipv6Address = addr.getFirstIP().toIPv6Address();
-        addrBin = std::string(reinterpret_cast<char*>(ipv6Address.c), 16);
-    }
-
-    char typeChar = static_cast<char>(type);
-    return typeChar + addrBin + portNs;
+    return addr.packed();
 }
 
 std::string Common::packAddress(const QHostAddress &addr,
@@ -89,52 +71,69 @@ std::string Common::packAddress(const QHostAddress &addr,
     return typeChar + addrBin + portNs;
 }
 
+Common::AddressHeader Common::parseHeader(const char *data, size_t size)
+{
+    AddressHeader header{};
+    if (size == 0) {
+        return header;
+    }
+    // The other bits were for the one-time authentication
+    header.type = static_cast<uint8_t>(data[0]) & ADDRESS_MASK;
+    size_t addressOffset = 1;
+    if (header.type == Address::IPV4) {
+        header.addressLength = 4;
+    } else if (header.type == Address::IPV6) {
+        header.addressLength = 16;
+    } else if (header.type == Address::HOST) {
+        if (size < 2) {
+            return header;
+        }
+        header.addressLength = static_cast<uint8_t>(data[1]);
+        addressOffset = 2;
+        if (header.addressLength == 0) {
+            return header;
+        }
+    } else {
+        return header;
+    }
+
+    const size_t length = addressOffset + header.addressLength + 2;
+    if (size < length) {
+        return header;
+    }
+    header.address = data + addressOffset;
+    const auto *port = reinterpret_cast<const uint8_t *>(data + length - 2);
+    header.port = static_cast<uint16_t>(port[0] << 8 | port[1]);
+    header.length = length;
+    return header;
+}
+
+void Common::AddressHeader::toAddress(Address &dest) const
+{
+    if (type == Address::IPV4) {
+        quint32 ipv4Address;
+        memcpy(&ipv4Address, address, 4);
+        dest.setIPAddress(QHostAddress(qFromBigEndian(ipv4Address)));
+    } else if (type == Address::IPV6) {
+        //Q_IPV6ADDR is a 16-unsigned-char struct (big endian)
+        Q_IPV6ADDR ipv6Address;
+        memcpy(ipv6Address.c, address, 16);
+        dest.setIPAddress(QHostAddress(ipv6Address));
+    } else {
+        dest.setAddress(std::string(address, addressLength));
+    }
+    dest.setPort(port);
+}
+
 void Common::parseHeader(const std::string &data,
                          Address &dest,
                          int &header_length)
 {
-    char atyp = data[0];
-    int addrtype = static_cast<int>(atyp & ADDRESS_MASK);
-    header_length = 0;
-
-    if (addrtype == Address::HOST) {
-        if (data.length() > 2) {
-            uint8_t addrlen = static_cast<uint8_t>(data[1]);
-            if (data.size() >= 2 + addrlen) {
-                dest.setPort(qFromBigEndian(*reinterpret_cast<const uint16_t *>
-                                            (data.data() + 2 + addrlen))
-                             );
-                dest.setAddress(data.substr(2, addrlen));
-                header_length = 4 + addrlen;
-            }
-        }
-    } else if (addrtype == Address::IPV4) {
-        if (data.length() >= 7) {
-            QHostAddress addr(qFromBigEndian(*reinterpret_cast<const uint32_t *>
-                                             (data.data() + 1))
-                              );
-            if (!addr.isNull()) {
-                header_length = 7;
-                dest.setIPAddress(addr);
-                dest.setPort(qFromBigEndian(*reinterpret_cast<const uint16_t *>
-                                            (data.data() + 5))
-                             );
-            }
-        }
-    } else if (addrtype == Address::IPV6) {
-        if (data.length() >= 19) {
-            Q_IPV6ADDR ipv6_addr;
-            memcpy(ipv6_addr.c, data.data() + 1, 16);
-            QHostAddress addr(ipv6_addr);
-            if (!addr.isNull()) {
-                header_length = 19;
-                dest.setIPAddress(addr);
-                dest.setPort(qFromBigEndian(*reinterpret_cast<const uint16_t *>
-                                            (data.data() + 17))
-                             );
-            }
-        }
+    const AddressHeader header = parseHeader(data.data(), data.size());
+    if (header.length > 0) {
+        header.toAddress(dest);
     }
+    header_length = static_cast<int>(header.length);
 }
 
 int Common::randomNumber(int max, int min)
@@ -151,10 +150,10 @@ void Common::exclusive_or(unsigned char *ks,
                           uint32_t length)
 {
     unsigned char *end_ks = ks + length;
-    do {
+    while (ks < end_ks) {
         *out = *in ^ *ks;
         ++out; ++in; ++ks;
-    } while (ks < end_ks);
+    }
 }
 
 void Common::banAddress(const QHostAddress &addr)
@@ -37,6 +37,29 @@ QSS_EXPORT std::string packAddress(const Address &addr);
 //this will never use ADDRTYPE_HOST because addr is an IP address
 QSS_EXPORT std::string packAddress(const QHostAddress &addr,
                                    const uint16_t &port);
+
+/*
+ * The address header (ATYP, DST.ADDR and DST.PORT) at the start of a
+ * shadowsocks request, parsed in place
+ */
+struct QSS_EXPORT AddressHeader
+{
+    uint8_t type;           // Address::ATYP
+    // Points into the parsed data: 4 or 16 bytes of an IP address, or the
+    // host name, which isn't NUL-terminated
+    const char *address;
+    size_t addressLength;
+    uint16_t port;
+    // Bytes taken by the header. 0 if the data doesn't start with a complete,
+    // valid header, in which case the other members are meaningless
+    size_t length;
+
+    // Sets dest to the address, which copies the host name
+    void toAddress(Address &dest) const;
+};
+// Copies nothing and reads no byte beyond size
+QSS_EXPORT AddressHeader parseHeader(const char *data, size_t size);
+// length is 0 if data doesn't start with a valid header
 QSS_EXPORT void parseHeader(const std::string &data,
                             Address &addr,
                             int &length);
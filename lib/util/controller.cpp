@@ -40,6 +40,8 @@ Controller::Controller(Profile _profile,
     QObject(parent),
     bytesReceived(0),
     bytesSent(0),
+    fastOpenAttempts(0),
+    fastOpenZeroRtt(0),
     profile(std::move(_profile)),
     isLocal(is_local),
     autoBan(auto_ban)
@@ -61,13 +63,8 @@ Controller::Controller(Profile _profile,
     if (profile.serverAddress() == "::") {
         serverAddress = Address(QHostAddress::Any, profile.serverPort());
     } else {
+        // Looked up by start(), without blocking the event loop
         serverAddress = Address(profile.serverAddress(), profile.serverPort());
-        if (!serverAddress.blockingLookUp()) {
-            QDebug(QtMsgType::QtCriticalMsg).noquote().nospace()
-                    << "Cannot look up the host records of server address "
-                    << serverAddress << ". Please make sure your Internet "
-                    << "connection is good and the configuration is correct";
-        }
     }
 
     tcpServer = std::make_unique<QSS::TcpServer>(profile.method(),
@@ -80,6 +77,27 @@ Controller::Controller(Profile _profile,
         qInfo() << "Set proxy: " << profile.proxyServerAddress().c_str() << ":" << profile.proxyPort();
         tcpServer->setProxy(profile.proxyType(), profile.proxyServerAddress(), profile.proxyPort());
     }
+    if (profile.tcpNotSentLowat() > 0) {
+        tcpServer->setNotSentLowat(profile.tcpNotSentLowat());
+    }
+    if (profile.tcpHighWatermark() > 0) {
+        // Without a low watermark, resume once a quarter is left
+        tcpServer->setWatermarks(profile.tcpHighWatermark(),
+                                 profile.tcpLowWatermark() > 0
+                                 ? profile.tcpLowWatermark()
+                                 : profile.tcpHighWatermark() / 4);
+    }
+    if (profile.ioBackend() == "epoll") {
+        tcpServer->setBackend(TcpServer::EpollBackend);
+    } else if (profile.ioBackend() == "io_uring") {
+        tcpServer->setBackend(TcpServer::IoUringBackend);
+    }
+    tcpServer->setFastOpen(profile.fastOpen());
+    tcpServer->setMuxSessions(profile.muxSessions());
+    tcpServer->setStripePaths(profile.stripePaths());
+    if (isLocal) {
+        tcpServer->setConnectionPoolSize(profile.connectionPoolSize());
+    }
     //FD_SETSIZE which is the maximum value on *nix platforms. (1024 by default)
     tcpServer->setMaxPendingConnections(FD_SETSIZE);
     udpRelay = std::make_unique<QSS::UdpRelay>(profile.method(),
@@ -87,6 +105,22 @@ Controller::Controller(Profile _profile,
                                 isLocal,
                                 autoBan,
                                 serverAddress);
+    udpRelay->setIdleTimeout(profile.timeout());
+    udpRelay->setOffloadEnabled(profile.udpOffload());
+    if (!isLocal) {
+        udpRelay->setSharedOutboundSockets(profile.udpSharedSockets());
+    }
+    if (profile.tcpReadBudget() > 0) {
+        tcpServer->setReadBudget(profile.tcpReadBudget());
+    }
+    if (profile.udpReadBudget() > 0) {
+        udpRelay->setReadBudget(profile.udpReadBudget());
+    }
+    if (profile.ioBackend() == "epoll") {
+        udpRelay->setBackend(UdpRelay::BatchedBackend);
+    } else if (profile.ioBackend() == "io_uring") {
+        udpRelay->setBackend(UdpRelay::IoUringBackend);
+    }
 
     connect(tcpServer.get(), &TcpServer::acceptError,
             this, &Controller::onTcpServerError);
@@ -94,6 +128,8 @@ Controller::Controller(Profile _profile,
     connect(tcpServer.get(), &TcpServer::bytesSend, this, &Controller::onBytesSend);
     connect(tcpServer.get(), &TcpServer::latencyAvailable,
             this, &Controller::tcpLatencyAvailable);
+    connect(tcpServer.get(), &TcpServer::fastOpenFinished,
+            this, &Controller::onFastOpenFinished);
 
     connect(udpRelay.get(), &UdpRelay::bytesRead, this, &Controller::onBytesRead);
     connect(udpRelay.get(), &UdpRelay::bytesSend, this, &Controller::onBytesSend);
@@ -101,12 +137,43 @@ Controller::Controller(Profile _profile,
 
 Controller::~Controller()
 {
-    if (tcpServer->isListening()) {
+    if (tcpServer->isListening() || (httpProxy && httpProxy->isListening())) {
         stop();
     }
 }
 
 bool Controller::start()
+{
+    if (serverAddress.isIPValid()) {
+        return listen();
+    }
+
+    /*
+     * Looked up once, without blocking the event loop. The relays get the
+     * IP addresses, so that they don't look the server up for every
+     * connection or datagram. A server listens on them
+     */
+    lookupPending = true;
+    serverAddress.lookUp([this](bool success) {
+        if (!lookupPending) {
+            return;
+        }
+        lookupPending = false;
+        if (!success) {
+            reportLookupFailure();
+            emit runningStateChanged(false);
+            return;
+        }
+        tcpServer->setServerAddress(serverAddress);
+        udpRelay->setServerAddress(serverAddress);
+        if (!listen()) {
+            emit runningStateChanged(false);
+        }
+    });
+    return true;
+}
+
+bool Controller::listen()
 {
     bool listen_ret = false;
 
@@ -115,18 +182,26 @@ bool Controller::start()
         QHostAddress localAddress = profile.httpProxy()
             ? QHostAddress::LocalHost
             : getLocalAddr();
-        listen_ret = tcpServer->listen(
-                    localAddress,
-                    profile.httpProxy() ? 0 : profile.localPort());
+        if (!profile.httpProxy()) {
+            listen_ret = tcpServer->listen(localAddress, profile.localPort());
+        } else if (profile.socksPort() > 0) {
+            listen_ret = tcpServer->listen(getLocalAddr(), profile.socksPort());
+        } else {
+            // HTTP requests are relayed without the SOCKS5 server listening
+            tcpServer->prepare();
+            listen_ret = true;
+        }
         if (listen_ret) {
             listen_ret = udpRelay->listen(localAddress, profile.localPort());
             if (profile.httpProxy() && listen_ret) {
-                QDebug(QtMsgType::QtInfoMsg) << "SOCKS5 port is"
-                                             << tcpServer->serverPort();
+                if (tcpServer->isListening()) {
+                    QDebug(QtMsgType::QtInfoMsg) << "SOCKS5 port is"
+                                                 << tcpServer->serverPort();
+                }
                 httpProxy = std::make_unique<QSS::HttpProxy>();
                 if (httpProxy->httpListen(getLocalAddr(),
                                           profile.localPort(),
-                                          tcpServer->serverPort())) {
+                                          tcpServer.get())) {
                     qInfo("Running as a HTTP proxy server");
                 } else {
                     qCritical("HTTP proxy server listen failed.");
@@ -159,6 +234,7 @@ bool Controller::start()
 
 void Controller::stop()
 {
+    lookupPending = false;
     if (httpProxy) {
         httpProxy->close();
     }
@@ -168,6 +244,14 @@ void Controller::stop()
     qInfo("Stopped.");
 }
 
+void Controller::reportLookupFailure()
+{
+    QDebug(QtMsgType::QtCriticalMsg).noquote().nospace()
+            << "Cannot look up the host records of server address "
+            << serverAddress << ". Please make sure your Internet "
+            << "connection is good and the configuration is correct";
+}
+
 QHostAddress Controller::getLocalAddr()
 {
     QHostAddress addr(QString::fromStdString(profile.localAddress()));
@@ -208,4 +292,13 @@ void Controller::onBytesSend(quint64 s)
     }
 }
 
+void Controller::onFastOpenFinished(bool zeroRtt)
+{
+    ++fastOpenAttempts;
+    if (zeroRtt) {
+        ++fastOpenZeroRtt;
+    }
+    emit tcpFastOpenStatsChanged(fastOpenAttempts, fastOpenZeroRtt);
+}
+
 } // namespace QSS
@@ -73,8 +73,20 @@ signals:
      */
     void tcpLatencyAvailable(int);
 
+    /*
+     * Accumulated TCP Fast Open statistics: connections attempted with TFO
+     * and how many of them had the data in the SYN accepted (0-RTT).
+     * Attempts without a cached cookie fall back to a normal handshake.
+     */
+    void tcpFastOpenStatsChanged(quint64 attempts, quint64 zeroRtt);
+
 public slots:
-    bool start(); // Return true if start successfully, otherwise return false
+    /*
+     * Return true if start successfully, otherwise return false.
+     * A host name as the server address is looked up first. start()
+     * returns true then, and runningStateChanged() tells whether it started.
+     */
+    bool start();
     void stop();
 
 private:
@@ -87,6 +99,8 @@ protected:
     // The total bytes recevied or sent by/from all TCP and UDP connections.
     uint64_t bytesReceived;
     uint64_t bytesSent;
+    uint64_t fastOpenAttempts;
+    uint64_t fastOpenZeroRtt;
 
     Profile profile;
     Address serverAddress;
@@ -96,16 +110,21 @@ protected:
      * (only used when it's a server)
      */
     const bool autoBan;
+    // start() waits for the lookup of serverAddress
+    bool lookupPending = false;
     std::unique_ptr<TcpServer> tcpServer;
     std::unique_ptr<UdpRelay> udpRelay;
     std::unique_ptr<HttpProxy> httpProxy;
 
     QHostAddress getLocalAddr();
+    bool listen();
+    void reportLookupFailure();
 
 protected slots:
     void onTcpServerError(QAbstractSocket::SocketError err);
     void onBytesRead(quint64);
     void onBytesSend(quint64);
+    void onFastOpenFinished(bool zeroRtt);
 };
 
 }
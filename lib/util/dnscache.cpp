@@ -0,0 +1,208 @@
+/*
+ * dnscache.cpp - the source file of DnsCache class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "dnscache.h"
+#include "dnsresolver.h"
+#include "types/address.h"
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+
+namespace QSS {
+
+// Passed by reference to std::min
+const qint64 DnsCache::MaxTtl;
+
+DnsCache::DnsCache()
+{
+    clock.start();
+}
+
+DnsCache &DnsCache::instance()
+{
+    static DnsCache cache;
+    return cache;
+}
+
+void DnsCache::lookUp(const std::string &hostname, QObject *context, Callback callback)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    const qint64 now = clock.elapsed();
+    auto it = entries.find(hostname);
+    if (it != entries.end() && it->second.expiresAt > now) {
+        Entry &entry = it->second;
+        ++counters.hits;
+        ++entry.hits;
+        if (!entry.addresses.empty() && entry.hits >= PrefetchHits
+                && (entry.expiresAt - now) * PrefetchRatio <= entry.ttl
+                && pending.find(hostname) == pending.end()) {
+            ++counters.prefetches;
+            startLookup(hostname);
+        }
+        const std::vector<QHostAddress> addresses = entry.addresses;
+        lock.unlock();
+        callback(addresses);
+        return;
+    }
+    if (it != entries.end()) {
+        entries.erase(it);
+    }
+
+    ++counters.misses;
+    auto p = pending.find(hostname);
+    if (p != pending.end()) {
+        ++counters.coalesced;
+        p->second.waiters.push_back(Waiter{context, std::move(callback)});
+        return;
+    }
+    startLookup(hostname);
+    pending[hostname].waiters.push_back(Waiter{context, std::move(callback)});
+}
+
+void DnsCache::insert(const std::string &hostname,
+                      const std::vector<QHostAddress> &addresses,
+                      int ttl)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    qint64 msec = addresses.empty() ? negativeTtl : positiveTtl;
+    if (ttl > 0) {
+        msec = static_cast<qint64>(ttl) * 1000;
+    }
+    store(hostname, addresses, msec);
+}
+
+void DnsCache::setTtl(int positive, int negative)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    positiveTtl = static_cast<qint64>(positive) * 1000;
+    negativeTtl = static_cast<qint64>(negative) * 1000;
+}
+
+DnsCache::Stats DnsCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats result = counters;
+    result.size = entries.size();
+    return result;
+}
+
+void DnsCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+}
+
+void DnsCache::startLookup(const std::string &hostname)
+{
+    ++counters.lookups;
+    pending[hostname].startedAt = clock.elapsed();
+    DnsResolver *resolver = DnsResolver::forCurrentThread();
+    if (resolver) {
+        // The callback is never invoked before resolve() returns
+        resolver->resolve(hostname, [this, hostname](const std::vector<QHostAddress> &addresses,
+                                                     int ttl) {
+            onFinished(hostname, addresses, ttl);
+        });
+        return;
+    }
+    // The lookup lives in the calling thread, whose event loop delivers the
+    // result
+    auto *dns = new DnsLookup();
+    QObject::connect(dns, &DnsLookup::finished, dns, [this, hostname, dns]() {
+        onFinished(hostname, dns->iplist().toVector().toStdVector(), 0);
+        dns->deleteLater();
+    });
+    dns->lookup(QString::fromStdString(hostname));
+}
+
+void DnsCache::store(const std::string &hostname,
+                     const std::vector<QHostAddress> &addresses,
+                     qint64 ttl)
+{
+    const qint64 now = clock.elapsed();
+    if (entries.size() >= MaxEntries && entries.find(hostname) == entries.end()) {
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it->second.expiresAt <= now) {
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (entries.size() >= MaxEntries) {
+            entries.erase(std::min_element(entries.begin(), entries.end(),
+                                           [](const std::pair<const std::string, Entry> &a,
+                                              const std::pair<const std::string, Entry> &b) {
+                return a.second.expiresAt < b.second.expiresAt;
+            }));
+        }
+    }
+    Entry &entry = entries[hostname];
+    entry.addresses = addresses;
+    entry.ttl = ttl;
+    entry.expiresAt = now + ttl;
+    // Only names that keep being hit are refreshed again
+    entry.hits = 0;
+}
+
+void DnsCache::onFinished(const std::string &hostname,
+                          const std::vector<QHostAddress> &addresses,
+                          int ttl)
+{
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = pending.find(hostname);
+        if (it != pending.end()) {
+            counters.lookupTime += static_cast<quint64>(clock.elapsed() - it->second.startedAt);
+            waiters = std::move(it->second.waiters);
+            pending.erase(it);
+        }
+        if (addresses.empty()) {
+            ++counters.failures;
+            // A failed refresh keeps the addresses until they expire
+            auto entry = entries.find(hostname);
+            if (entry == entries.end() || entry->second.expiresAt <= clock.elapsed()) {
+                store(hostname, addresses, negativeTtl);
+            }
+        } else if (ttl > 0) {
+            store(hostname, addresses, std::min(static_cast<qint64>(ttl) * 1000, MaxTtl));
+        } else {
+            store(hostname, addresses, positiveTtl);
+        }
+    }
+
+    for (Waiter &waiter : waiters) {
+        if (!waiter.context) {
+            continue;
+        }
+        if (waiter.context->thread() == QThread::currentThread()) {
+            waiter.callback(addresses);
+        } else {
+            Callback callback = std::move(waiter.callback);
+            QTimer::singleShot(0, waiter.context.data(), [callback, addresses]() {
+                callback(addresses);
+            });
+        }
+    }
+}
+
+}  // namespace QSS
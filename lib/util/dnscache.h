@@ -0,0 +1,135 @@
+/*
+ * dnscache.h - the header file of DnsCache class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QObject>
+#include <QPointer>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "export.h"
+
+namespace QSS {
+
+/**
+ * The process-wide cache of host name lookups. Names are looked up with
+ * DnsResolver if a name server is configured, or QHostInfo otherwise.
+ * Concurrent lookups of the same name share one query, failures are cached for a short while, and
+ * names that are looked up often are refreshed in the background before
+ * they expire. It's thread-safe.
+ */
+class QSS_EXPORT DnsCache
+{
+public:
+    // An empty list means the lookup failed
+    typedef std::function<void(const std::vector<QHostAddress>&)> Callback;
+
+    struct Stats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        // Misses that joined a lookup in progress
+        quint64 coalesced = 0;
+        quint64 lookups = 0;
+        quint64 failures = 0;
+        quint64 prefetches = 0;
+        // Total time spent in lookups (msec)
+        quint64 lookupTime = 0;
+        size_t size = 0;
+    };
+
+    static DnsCache &instance();
+
+    DnsCache(const DnsCache &) = delete;
+
+    /*
+     * Looks up hostname. On a hit, callback is invoked before lookUp()
+     * returns. Otherwise it's invoked in the thread of context once the
+     * lookup is finished, unless context was deleted in the meantime.
+     */
+    void lookUp(const std::string &hostname, QObject *context, Callback callback);
+
+    // Stores a lookup result. ttl is in seconds, 0 uses the default TTL
+    void insert(const std::string &hostname,
+                const std::vector<QHostAddress> &addresses,
+                int ttl = 0);
+
+    // Seconds to keep successful and failed results whose TTL is unknown
+    // (60 and 10 by default)
+    void setTtl(int positive, int negative);
+
+    Stats stats() const;
+    void clear();
+
+private:
+    DnsCache();
+
+    static const size_t MaxEntries = 10000;
+    // Caps the TTL of records (msec)
+    static const qint64 MaxTtl = 3600000;
+    // A hit within the last PrefetchRatio of the TTL of an entry that has
+    // been hit PrefetchHits times starts a refresh
+    static const int PrefetchRatio = 10;
+    static const unsigned PrefetchHits = 2;
+
+    struct Entry {
+        std::vector<QHostAddress> addresses;
+        qint64 expiresAt = 0;
+        qint64 ttl = 0;
+        unsigned hits = 0;
+    };
+    struct Waiter {
+        QPointer<QObject> context;
+        Callback callback;
+    };
+    struct Pending {
+        std::vector<Waiter> waiters;
+        qint64 startedAt = 0;
+    };
+
+    mutable std::mutex mutex;
+    QElapsedTimer clock;
+    std::map<std::string, Entry> entries;
+    std::map<std::string, Pending> pending;
+    Stats counters;
+    qint64 positiveTtl = 60000;
+    qint64 negativeTtl = 10000;
+
+    // Must be called with mutex locked
+    void startLookup(const std::string &hostname);
+    void store(const std::string &hostname,
+               const std::vector<QHostAddress> &addresses,
+               qint64 ttl);
+    // ttl is in seconds, 0 if it's unknown
+    void onFinished(const std::string &hostname,
+                    const std::vector<QHostAddress> &addresses,
+                    int ttl);
+};
+
+}
+
+#endif // DNSCACHE_H
@@ -0,0 +1,559 @@
+/*
+ * dnsresolver.cpp - the source file of DnsResolver class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "dnsresolver.h"
+#include "common.h"
+#include <QDebug>
+#include <QFile>
+#include <QNetworkInterface>
+#include <QThreadStorage>
+#include <QtEndian>
+#include <algorithm>
+#include <climits>
+
+namespace QSS {
+
+namespace {
+
+const size_t HeaderSize = 12;
+const uint16_t ClassIN = 1;
+
+// Reads the (possibly compressed) name at pos into name and moves pos past
+// it. Returns false if it's malformed
+bool readName(const std::string &data, size_t &pos, std::string &name)
+{
+    size_t cursor = pos;
+    bool jumped = false;
+    // Bounds pointer loops
+    for (int hops = 0; hops < 64; ++hops) {
+        if (cursor >= data.size()) {
+            return false;
+        }
+        const auto length = static_cast<uint8_t>(data[cursor]);
+        if ((length & 0xC0) == 0xC0) {
+            if (cursor + 1 >= data.size()) {
+                return false;
+            }
+            if (!jumped) {
+                pos = cursor + 2;
+                jumped = true;
+            }
+            cursor = ((length & 0x3F) << 8) | static_cast<uint8_t>(data[cursor + 1]);
+        } else if (length == 0) {
+            if (!jumped) {
+                pos = cursor + 1;
+            }
+            return true;
+        } else if (length > 63 || cursor + 1 + length > data.size()) {
+            return false;
+        } else {
+            if (!name.empty()) {
+                name.push_back('.');
+            }
+            name.append(data, cursor + 1, length);
+            cursor += 1 + length;
+        }
+    }
+    return false;
+}
+
+std::string normalise(const std::string &name)
+{
+    std::string result = QString::fromStdString(name).trimmed().toLower().toStdString();
+    if (!result.empty() && result.back() == '.') {
+        result.pop_back();
+    }
+    return result;
+}
+
+}
+
+DnsResolver::DnsResolver(QObject *parent) :
+    QObject(parent),
+    ipv6Enabled(hasGlobalIPv6())
+{
+    readResolvConf(QStringLiteral("/etc/resolv.conf"), m_servers, timeout, attempts);
+    hosts = readHosts(QStringLiteral("/etc/hosts"));
+}
+
+DnsResolver::~DnsResolver() = default;
+
+DnsResolver *DnsResolver::forCurrentThread()
+{
+    static QThreadStorage<DnsResolver *> resolvers;
+    if (!resolvers.hasLocalData()) {
+        resolvers.setLocalData(new DnsResolver());
+    }
+    DnsResolver *resolver = resolvers.localData();
+    return resolver->servers().empty() ? nullptr : resolver;
+}
+
+void DnsResolver::setServers(const std::vector<Address> &servers)
+{
+    m_servers = servers;
+}
+
+const std::vector<Address> &DnsResolver::servers() const
+{
+    return m_servers;
+}
+
+void DnsResolver::setTimeout(int msec)
+{
+    timeout = msec;
+}
+
+void DnsResolver::setAttempts(int attempts)
+{
+    this->attempts = std::max(attempts, 1);
+}
+
+void DnsResolver::setHosts(const std::map<std::string, std::vector<QHostAddress> > &hosts)
+{
+    this->hosts = hosts;
+}
+
+void DnsResolver::setIPv6Enabled(bool enabled)
+{
+    ipv6Enabled = enabled;
+}
+
+void DnsResolver::resolve(const std::string &hostname, Callback callback)
+{
+    const std::string name = normalise(hostname);
+    std::vector<QHostAddress> immediate;
+    const QHostAddress ip(QString::fromStdString(name));
+    auto hostIt = hosts.find(name);
+    if (!ip.isNull()) {
+        immediate.push_back(ip);
+    } else if (hostIt != hosts.end()) {
+        immediate = hostIt->second;
+    }
+    if (!immediate.empty() || m_servers.empty() || buildQuery(0, name, A).empty()) {
+        QTimer::singleShot(0, this, [callback, immediate]() {
+            callback(immediate, 0);
+        });
+        return;
+    }
+
+    requests.emplace_back(new Request());
+    Request *request = requests.back().get();
+    request->callback = std::move(callback);
+    std::vector<RecordType> types;
+    if (ipv6Enabled) {
+        types.push_back(AAAA);
+    }
+    types.push_back(A);
+    for (RecordType type : types) {
+        request->queries.emplace_back(new Query());
+        Query &query = *request->queries.back();
+        query.request = request;
+        query.type = type;
+        query.name = name;
+        query.id = static_cast<uint16_t>(Common::randomNumber(65536));
+        query.timer = std::make_unique<QTimer>();
+        query.timer->setSingleShot(true);
+        Query *q = &query;
+        connect(query.timer.get(), &QTimer::timeout, this, [this, q]() {
+            retry(*q);
+        });
+    }
+    // Sent after setting up both, as a query may finish the request
+    for (size_t i = 0; i < types.size(); ++i) {
+        send(*request->queries[i]);
+    }
+}
+
+void DnsResolver::send(Query &query)
+{
+    if (query.udp) {
+        query.udp->disconnect(this);
+        query.udp.release()->deleteLater();
+    }
+    if (query.tcp) {
+        query.tcp->disconnect(this);
+        query.tcp.release()->deleteLater();
+    }
+    query.server = m_servers[static_cast<size_t>(query.tries) % m_servers.size()];
+    const std::string message = buildQuery(query.id, query.name, query.type);
+
+    // A new socket per try gets a new random source port
+    query.udp = std::make_unique<QUdpSocket>();
+    Query *q = &query;
+    connect(query.udp.get(), &QUdpSocket::readyRead, this, [this, q]() {
+        onUdpReadyRead(*q);
+    });
+    query.timer->start(timeout);
+    if (query.udp->writeDatagram(message.data(), message.size(),
+                                 query.server.getFirstIP(), query.server.getPort()) == -1) {
+        // Tries the next server right away
+        query.timer->start(0);
+    }
+}
+
+void DnsResolver::sendTcp(Query &query)
+{
+    query.udp->disconnect(this);
+    query.udp.release()->deleteLater();
+    query.tcpBuffer.clear();
+    query.tcp = std::make_unique<QTcpSocket>();
+    Query *q = &query;
+    connect(query.tcp.get(), &QTcpSocket::connected, this, [q]() {
+        const std::string message = buildQuery(q->id, q->name, q->type);
+        uchar length[2];
+        qToBigEndian(static_cast<quint16>(message.size()), length);
+        q->tcp->write(reinterpret_cast<const char *>(length), 2);
+        q->tcp->write(message.data(), message.size());
+    });
+    connect(query.tcp.get(), &QTcpSocket::readyRead, this, [this, q]() {
+        onTcpReadyRead(*q);
+    });
+    connect(query.tcp.get(),
+            static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>
+            (&QTcpSocket::error),
+            this,
+            [this, q]() {
+        retry(*q);
+    });
+    query.timer->start(timeout);
+    query.tcp->connectToHost(query.server.getFirstIP(), query.server.getPort());
+}
+
+void DnsResolver::onUdpReadyRead(Query &query)
+{
+    while (query.udp && query.udp->hasPendingDatagrams()) {
+        std::string data;
+        data.resize(static_cast<size_t>(std::max<qint64>(query.udp->pendingDatagramSize(), 0)));
+        QHostAddress sender;
+        quint16 port = 0;
+        const qint64 size = query.udp->readDatagram(&data[0], data.size(), &sender, &port);
+        if (size < 0) {
+            continue;
+        }
+        data.resize(static_cast<size_t>(size));
+        bool isIPv4 = false;
+        const quint32 ipv4 = sender.toIPv4Address(&isIPv4);
+        if (isIPv4) {
+            sender = QHostAddress(ipv4);
+        }
+        // Answers from anywhere else are spoofed or stray
+        if (sender != query.server.getFirstIP() || port != query.server.getPort()) {
+            continue;
+        }
+        if (handleResponse(query, data)) {
+            return;
+        }
+    }
+}
+
+void DnsResolver::onTcpReadyRead(Query &query)
+{
+    const QByteArray buf = query.tcp->readAll();
+    query.tcpBuffer.append(buf.constData(), buf.size());
+    if (query.tcpBuffer.size() < 2) {
+        return;
+    }
+    const size_t length = qFromBigEndian<quint16>(
+                reinterpret_cast<const uchar *>(query.tcpBuffer.data()));
+    if (query.tcpBuffer.size() < 2 + length) {
+        return;
+    }
+    if (!handleResponse(query, query.tcpBuffer.substr(2, length))) {
+        retry(query);
+    }
+}
+
+bool DnsResolver::handleResponse(Query &query, const std::string &data)
+{
+    std::vector<QHostAddress> addresses;
+    quint32 ttl = 0;
+    const Status status = parseResponse(data, query.id, query.name, query.type, addresses, ttl);
+    switch (status) {
+    case Invalid:
+        return false;
+    case Truncated:
+        if (query.tcp) {
+            return false;
+        }
+        sendTcp(query);
+        return true;
+    case ServerFailure:
+        query.status = ServerFailure;
+        retry(query);
+        return true;
+    case Ok:
+    case NameError:
+        query.addresses = std::move(addresses);
+        query.ttl = ttl;
+        finish(query, status);
+        return true;
+    }
+    return false;
+}
+
+void DnsResolver::retry(Query &query)
+{
+    ++query.tries;
+    if (query.tries >= attempts * static_cast<int>(m_servers.size())) {
+        QDebug(QtMsgType::QtDebugMsg).noquote().nospace()
+                << "DNS query for " << QString::fromStdString(query.name)
+                << (query.type == A ? " (A)" : " (AAAA)") << " failed";
+        finish(query, query.status);
+    } else {
+        send(query);
+    }
+}
+
+void DnsResolver::finish(Query &query, Status status)
+{
+    query.done = true;
+    query.status = status;
+    release(query);
+
+    Request *request = query.request;
+    for (const auto &q : request->queries) {
+        if (!q->done) {
+            return;
+        }
+    }
+    std::vector<QHostAddress> addresses;
+    quint32 ttl = 0;
+    for (const auto &q : request->queries) {
+        if (q->status == Ok && !q->addresses.empty()) {
+            addresses.insert(addresses.end(), q->addresses.begin(), q->addresses.end());
+            ttl = ttl == 0 ? q->ttl : std::min(ttl, q->ttl);
+        }
+    }
+    Callback callback = std::move(request->callback);
+    auto it = std::find_if(requests.begin(), requests.end(),
+                           [request](const std::unique_ptr<Request> &r) {
+        return r.get() == request;
+    });
+    requests.erase(it);
+    callback(addresses, static_cast<int>(std::min<quint32>(ttl, INT_MAX)));
+}
+
+void DnsResolver::release(Query &query)
+{
+    // This may be called from a signal of any of them
+    if (query.timer) {
+        query.timer->stop();
+        query.timer->disconnect(this);
+        query.timer.release()->deleteLater();
+    }
+    if (query.udp) {
+        query.udp->disconnect(this);
+        query.udp.release()->deleteLater();
+    }
+    if (query.tcp) {
+        query.tcp->disconnect(this);
+        query.tcp->abort();
+        query.tcp.release()->deleteLater();
+    }
+}
+
+void DnsResolver::readResolvConf(const QString &path,
+                                 std::vector<Address> &servers,
+                                 int &timeout,
+                                 int &attempts)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return;
+    }
+    while (!file.atEnd()) {
+        const QString line = QString::fromLocal8Bit(file.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith('#') || line.startsWith(';')) {
+            continue;
+        }
+        const QStringList fields = line.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+        if (fields.size() >= 2 && fields[0] == QLatin1String("nameserver")) {
+            const QHostAddress ip(fields[1]);
+            if (!ip.isNull()) {
+                servers.push_back(Address(ip, 53));
+            }
+        } else if (fields[0] == QLatin1String("options")) {
+            for (const QString &option : fields.mid(1)) {
+                bool ok = false;
+                if (option.startsWith(QLatin1String("timeout:"))) {
+                    const int seconds = option.mid(8).toInt(&ok);
+                    if (ok && seconds > 0) {
+                        timeout = seconds * 1000;
+                    }
+                } else if (option.startsWith(QLatin1String("attempts:"))) {
+                    const int n = option.mid(9).toInt(&ok);
+                    if (ok && n > 0) {
+                        attempts = n;
+                    }
+                }
+            }
+        }
+    }
+}
+
+std::map<std::string, std::vector<QHostAddress> > DnsResolver::readHosts(const QString &path)
+{
+    std::map<std::string, std::vector<QHostAddress> > result;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return result;
+    }
+    while (!file.atEnd()) {
+        const QString line = QString::fromLocal8Bit(file.readLine()).section('#', 0, 0);
+        const QStringList fields = line.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+        if (fields.size() < 2) {
+            continue;
+        }
+        const QHostAddress ip(fields[0]);
+        if (ip.isNull()) {
+            continue;
+        }
+        for (const QString &name : fields.mid(1)) {
+            result[normalise(name.toStdString())].push_back(ip);
+        }
+    }
+    return result;
+}
+
+std::string DnsResolver::buildQuery(uint16_t id, const std::string &name, RecordType type)
+{
+    if (name.empty() || name.size() > 253) {
+        return std::string();
+    }
+    std::string message(HeaderSize, '\0');
+    auto *header = reinterpret_cast<uchar *>(&message[0]);
+    qToBigEndian(id, header);
+    header[2] = 0x01;   // RD
+    qToBigEndian(static_cast<quint16>(1), header + 4);   // QDCOUNT
+
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t end = name.find('.', start);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        const size_t length = end - start;
+        if (length == 0 || length > 63) {
+            return std::string();
+        }
+        message.push_back(static_cast<char>(length));
+        message.append(name, start, length);
+        start = end + 1;
+    }
+    message.push_back('\0');
+    uchar tail[4];
+    qToBigEndian(static_cast<quint16>(type), tail);
+    qToBigEndian(ClassIN, tail + 2);
+    message.append(reinterpret_cast<const char *>(tail), 4);
+    return message;
+}
+
+DnsResolver::Status DnsResolver::parseResponse(const std::string &data,
+                                               uint16_t id,
+                                               const std::string &name,
+                                               RecordType type,
+                                               std::vector<QHostAddress> &addresses,
+                                               quint32 &ttl)
+{
+    if (data.size() < HeaderSize) {
+        return Invalid;
+    }
+    const auto *p = reinterpret_cast<const uchar *>(data.data());
+    const uint16_t flags = qFromBigEndian<quint16>(p + 2);
+    const uint16_t questions = qFromBigEndian<quint16>(p + 4);
+    const uint16_t answers = qFromBigEndian<quint16>(p + 6);
+    // It must be a response (QR) to our standard query
+    if (qFromBigEndian<quint16>(p) != id || !(flags & 0x8000) || (flags & 0x7800)
+            || questions != 1) {
+        return Invalid;
+    }
+
+    size_t pos = HeaderSize;
+    std::string qname;
+    if (!readName(data, pos, qname) || pos + 4 > data.size()
+            || normalise(qname) != name
+            || qFromBigEndian<quint16>(p + pos) != type
+            || qFromBigEndian<quint16>(p + pos + 2) != ClassIN) {
+        return Invalid;
+    }
+    pos += 4;
+
+    if (flags & 0x0200) {
+        return Truncated;
+    }
+    switch (flags & 0x000F) {
+    case 0:
+        break;
+    case 3:
+        return NameError;
+    default:
+        return ServerFailure;
+    }
+
+    addresses.clear();
+    ttl = 0;
+    for (uint16_t i = 0; i < answers; ++i) {
+        std::string owner;
+        if (!readName(data, pos, owner) || pos + 10 > data.size()) {
+            return Invalid;
+        }
+        const uint16_t rrType = qFromBigEndian<quint16>(p + pos);
+        const uint16_t rrClass = qFromBigEndian<quint16>(p + pos + 2);
+        const quint32 rrTtl = qFromBigEndian<quint32>(p + pos + 4);
+        const size_t length = qFromBigEndian<quint16>(p + pos + 8);
+        pos += 10;
+        if (pos + length > data.size()) {
+            return Invalid;
+        }
+        // Records of a CNAME chain are taken as they are, like other stubs do
+        if (rrClass == ClassIN && rrType == type) {
+            if (type == A && length == 4) {
+                addresses.push_back(QHostAddress(qFromBigEndian<quint32>(p + pos)));
+            } else if (type == AAAA && length == 16) {
+                addresses.push_back(QHostAddress(p + pos));
+            } else {
+                return Invalid;
+            }
+            ttl = addresses.size() == 1 ? rrTtl : std::min(ttl, rrTtl);
+        }
+        pos += length;
+    }
+    return Ok;
+}
+
+bool DnsResolver::hasGlobalIPv6()
+{
+    for (const QHostAddress &address : QNetworkInterface::allAddresses()) {
+        if (address.protocol() != QAbstractSocket::IPv6Protocol || address.isLoopback()) {
+            continue;
+        }
+        const Q_IPV6ADDR ip = address.toIPv6Address();
+        // Link-local addresses (fe80::/10) can't reach other networks
+        if (ip[0] == 0xfe && (ip[1] & 0xc0) == 0x80) {
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+}  // namespace QSS
@@ -0,0 +1,152 @@
+/*
+ * dnsresolver.h - the header file of DnsResolver class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DNSRESOLVER_H
+#define DNSRESOLVER_H
+
+#include <QHostAddress>
+#include <QObject>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUdpSocket>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "types/address.h"
+
+namespace QSS {
+
+/**
+ * A non-blocking DNS stub resolver driven by the event loop.
+ *
+ * Names are looked up in the hosts file first. Otherwise the A and AAAA
+ * queries are sent in parallel over UDP (from a random port each try) to
+ * the name servers in turn, and repeated over TCP if the answer was
+ * truncated. AAAA is only queried if this host has a global IPv6 address.
+ * Search domains aren't used, names are always absolute.
+ */
+class QSS_EXPORT DnsResolver : public QObject
+{
+    Q_OBJECT
+public:
+    /*
+     * addresses is empty if the lookup failed. ttl is the smallest TTL (in
+     * seconds) of the records, or 0 if it's unknown
+     */
+    typedef std::function<void(const std::vector<QHostAddress> &addresses, int ttl)> Callback;
+
+    // Uses the name servers and options of /etc/resolv.conf
+    explicit DnsResolver(QObject *parent = nullptr);
+    ~DnsResolver();
+
+    DnsResolver(const DnsResolver &) = delete;
+
+    // The resolver of the calling thread, or nullptr if no name server is
+    // configured. It's deleted when the thread exits
+    static DnsResolver *forCurrentThread();
+
+    void setServers(const std::vector<Address> &servers);
+    const std::vector<Address> &servers() const;
+    // Time to wait for an answer before the next try (msec)
+    void setTimeout(int msec);
+    // How many times each server is tried
+    void setAttempts(int attempts);
+    void setHosts(const std::map<std::string, std::vector<QHostAddress> > &hosts);
+    void setIPv6Enabled(bool enabled);
+
+    // Looks up hostname. callback is always invoked from the event loop
+    void resolve(const std::string &hostname, Callback callback);
+
+    // Parses the nameserver and options (timeout, attempts) lines
+    static void readResolvConf(const QString &path,
+                               std::vector<Address> &servers,
+                               int &timeout,
+                               int &attempts);
+    static std::map<std::string, std::vector<QHostAddress> > readHosts(const QString &path);
+
+    enum RecordType { A = 1, AAAA = 28 };
+    enum Status { Ok, NameError, ServerFailure, Truncated, Invalid };
+
+    // Returns an empty string if name isn't a valid domain name
+    static std::string buildQuery(uint16_t id, const std::string &name, RecordType type);
+    /*
+     * Parses the answer to the query of id for name. addresses gets the
+     * records of type, ttl gets their smallest TTL. A valid answer without
+     * such records is Ok with no addresses.
+     */
+    static Status parseResponse(const std::string &data,
+                                uint16_t id,
+                                const std::string &name,
+                                RecordType type,
+                                std::vector<QHostAddress> &addresses,
+                                quint32 &ttl);
+
+private:
+    static const int DefaultTimeout = 2000;
+    static const int DefaultAttempts = 2;
+    static const int MaxMessageSize = 65535;
+
+    struct Request;
+    struct Query {
+        Request *request = nullptr;
+        RecordType type = A;
+        uint16_t id = 0;
+        std::string name;
+        int tries = 0;
+        Address server;
+        std::unique_ptr<QUdpSocket> udp;
+        std::unique_ptr<QTcpSocket> tcp;
+        std::string tcpBuffer;
+        std::unique_ptr<QTimer> timer;
+        bool done = false;
+        Status status = ServerFailure;
+        std::vector<QHostAddress> addresses;
+        quint32 ttl = 0;
+    };
+    struct Request {
+        Callback callback;
+        std::vector<std::unique_ptr<Query> > queries;
+    };
+
+    std::vector<Address> m_servers;
+    int timeout = DefaultTimeout;
+    int attempts = DefaultAttempts;
+    bool ipv6Enabled;
+    std::map<std::string, std::vector<QHostAddress> > hosts;
+    std::vector<std::unique_ptr<Request> > requests;
+
+    void send(Query &query);
+    void sendTcp(Query &query);
+    void onUdpReadyRead(Query &query);
+    void onTcpReadyRead(Query &query);
+    bool handleResponse(Query &query, const std::string &data);
+    void retry(Query &query);
+    void finish(Query &query, Status status);
+    void release(Query &query);
+    static bool hasGlobalIPv6();
+};
+
+}
+
+#endif // DNSRESOLVER_H
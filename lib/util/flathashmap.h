@@ -0,0 +1,175 @@
+/*
+ * flathashmap.h - an open-addressing hash table
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FLATHASHMAP_H
+#define FLATHASHMAP_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace QSS {
+
+/**
+ * A hash table with linear probing over a single array.
+ *
+ * It's meant for small keys that are looked up far more often than they're
+ * inserted (e.g. UDP associations). Erasing shifts the following entries
+ * back rather than leaving tombstones, so lookups stay short after churn.
+ *
+ * Inserting and erasing move other values around: pointers returned by
+ * find() or insert() are only valid until the next insert() or erase().
+ * Value must be default-constructible and move-assignable.
+ */
+template<typename Key, typename Value, typename Hash>
+class FlatHashMap
+{
+public:
+    FlatHashMap() = default;
+
+    Value *find(const Key &key)
+    {
+        if (buckets.empty()) {
+            return nullptr;
+        }
+        for (size_t i = indexOf(key); buckets[i].used; i = next(i)) {
+            if (buckets[i].key == key) {
+                return &buckets[i].value;
+            }
+        }
+        return nullptr;
+    }
+
+    // Returns the value for key, and whether it was inserted. An existing
+    // value isn't replaced
+    std::pair<Value *, bool> insert(const Key &key, Value value)
+    {
+        // Keep the load factor at 3/4 at most
+        if ((count + 1) * 4 > buckets.size() * 3) {
+            rehash(buckets.empty() ? MinCapacity : buckets.size() * 2);
+        }
+        size_t i = indexOf(key);
+        for (; buckets[i].used; i = next(i)) {
+            if (buckets[i].key == key) {
+                return std::make_pair(&buckets[i].value, false);
+            }
+        }
+        buckets[i].used = true;
+        buckets[i].key = key;
+        buckets[i].value = std::move(value);
+        ++count;
+        return std::make_pair(&buckets[i].value, true);
+    }
+
+    bool erase(const Key &key)
+    {
+        if (buckets.empty()) {
+            return false;
+        }
+        size_t hole = indexOf(key);
+        for (; buckets[hole].used; hole = next(hole)) {
+            if (buckets[hole].key == key) {
+                break;
+            }
+        }
+        if (!buckets[hole].used) {
+            return false;
+        }
+        // Move back every following entry that may be placed in the hole
+        for (size_t i = next(hole); buckets[i].used; i = next(i)) {
+            const size_t home = indexOf(buckets[i].key);
+            // Whether home is cyclically outside (hole, i]
+            if ((i > hole && (home <= hole || home > i))
+                    || (i < hole && home <= hole && home > i)) {
+                buckets[hole].key = std::move(buckets[i].key);
+                buckets[hole].value = std::move(buckets[i].value);
+                hole = i;
+            }
+        }
+        buckets[hole].used = false;
+        buckets[hole].value = Value();
+        --count;
+        return true;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    void clear()
+    {
+        buckets.clear();
+        count = 0;
+    }
+
+private:
+    static const size_t MinCapacity = 16;
+
+    struct Bucket {
+        bool used = false;
+        Key key;
+        Value value;
+    };
+
+    // The size is always a power of two
+    std::vector<Bucket> buckets;
+    size_t count = 0;
+    Hash hash;
+
+    size_t indexOf(const Key &key) const
+    {
+        return hash(key) & (buckets.size() - 1);
+    }
+
+    size_t next(size_t i) const
+    {
+        return (i + 1) & (buckets.size() - 1);
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<Bucket> old(capacity);
+        old.swap(buckets);
+        for (Bucket &bucket : old) {
+            if (!bucket.used) {
+                continue;
+            }
+            size_t i = indexOf(bucket.key);
+            while (buckets[i].used) {
+                i = next(i);
+            }
+            buckets[i].used = true;
+            buckets[i].key = std::move(bucket.key);
+            buckets[i].value = std::move(bucket.value);
+        }
+    }
+};
+
+}
+
+#endif // FLATHASHMAP_H
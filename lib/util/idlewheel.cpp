@@ -0,0 +1,90 @@
+/*
+ * idlewheel.cpp - the source file of IdleWheel class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "idlewheel.h"
+
+namespace {
+
+thread_local std::weak_ptr<QSS::IdleWheel> threadWheel;
+
+}  // namespace
+
+namespace QSS {
+
+IdleWheel::IdleWheel() :
+    wheel(Tick, Slots, Levels)
+{
+    clock.start();
+    ticker.setInterval(static_cast<int>(Tick));
+    ticker.setTimerType(Qt::CoarseTimer);
+    QObject::connect(&ticker, &QTimer::timeout, &ticker, [this]() {
+        onTick();
+    });
+}
+
+std::shared_ptr<IdleWheel> IdleWheel::forThread()
+{
+    std::shared_ptr<IdleWheel> idleWheel = threadWheel.lock();
+    if (!idleWheel) {
+        idleWheel.reset(new IdleWheel());
+        threadWheel = idleWheel;
+    }
+    return idleWheel;
+}
+
+int64_t IdleWheel::now() const
+{
+    return current;
+}
+
+TimerWheel::TimerId IdleWheel::schedule(int64_t delay, TimerWheel::Callback callback)
+{
+    if (!ticker.isActive()) {
+        // now() stood still while nothing was pending
+        current = clock.elapsed();
+        ticker.start();
+    }
+    return wheel.schedule(current, delay, std::move(callback));
+}
+
+bool IdleWheel::cancel(TimerWheel::TimerId id)
+{
+    return wheel.cancel(id);
+}
+
+size_t IdleWheel::size() const
+{
+    return wheel.size();
+}
+
+void IdleWheel::onTick()
+{
+    // A callback may close the last connection holding the wheel
+    const std::shared_ptr<IdleWheel> guard = threadWheel.lock();
+    current = clock.elapsed();
+    wheel.advance(current);
+    if (wheel.size() == 0) {
+        ticker.stop();
+    }
+}
+
+}  // namespace QSS
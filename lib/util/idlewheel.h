@@ -0,0 +1,76 @@
+/*
+ * idlewheel.h - the header file of IdleWheel class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDLEWHEEL_H
+#define IDLEWHEEL_H
+
+#include <QElapsedTimer>
+#include <QTimer>
+#include <memory>
+#include "timerwheel.h"
+
+namespace QSS {
+
+/**
+ * The idle timeouts of all connections running in a thread, on one
+ * hierarchical TimerWheel turned by one coarse QTimer.
+ *
+ * Connections stamp their activity with now(), which is only a read of the
+ * time of the last tick, and keep a single timer on the wheel that checks
+ * the stamp when it expires. The QTimer only runs while timers are pending.
+ */
+class QSS_EXPORT IdleWheel
+{
+public:
+    static const int64_t Tick = 1000;
+    static const size_t Slots = 64;
+    // 64 s, 68 min and 3 days
+    static const size_t Levels = 3;
+
+    IdleWheel(const IdleWheel &) = delete;
+
+    // Returns the wheel shared by everything running in the calling thread
+    static std::shared_ptr<IdleWheel> forThread();
+
+    // Coarse monotonic time in msec, as of the last tick
+    int64_t now() const;
+
+    // Runs callback once delay msec passed, rounded up to the next tick
+    TimerWheel::TimerId schedule(int64_t delay, TimerWheel::Callback callback);
+    bool cancel(TimerWheel::TimerId id);
+
+    size_t size() const;
+
+private:
+    IdleWheel();
+
+    QElapsedTimer clock;
+    QTimer ticker;
+    TimerWheel wheel;
+    int64_t current = 0;
+
+    void onTick();
+};
+
+}
+
+#endif // IDLEWHEEL_H
@@ -0,0 +1,434 @@
+/*
+ * iouring.cpp - the source file of IoUring class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "iouring.h"
+#include <QDebug>
+#include <QTimer>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef __NR_io_uring_setup
+// Shared by all architectures except alpha
+#define __NR_io_uring_setup 425
+#define __NR_io_uring_enter 426
+#define __NR_io_uring_register 427
+#endif
+
+namespace {
+
+int sysSetup(unsigned entries, io_uring_params *params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sysRegister(int fd, unsigned opcode, const void *arg, unsigned nrArgs)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+thread_local std::weak_ptr<QSS::IoUring> threadRing;
+// Don't probe the kernel again for every listener if it failed once
+thread_local bool threadRingUnsupported = false;
+
+}  // namespace
+
+namespace QSS {
+
+IoUring::IoUring() :
+    ringFd(-1),
+    eventFd(-1),
+    extArg(false),
+    sqRing(nullptr),
+    sqRingSize(0),
+    cqRing(nullptr),
+    cqRingSize(0),
+    sqes(nullptr),
+    sqesSize(0),
+    sqHead(nullptr),
+    sqTail(nullptr),
+    sqFlags(nullptr),
+    sqArray(nullptr),
+    sqMask(0),
+    sqEntries(0),
+    sqLocalTail(0),
+    toSubmit(0),
+    cqHead(nullptr),
+    cqTail(nullptr),
+    cqMask(0),
+    cqes(nullptr),
+    pool(BufferSize, BufferCount),
+    bufRing(nullptr),
+    bufRingSize(0),
+    bufRingTail(0),
+    submitScheduled(false),
+    reaping(false),
+    m_multishotRecv(true)
+{
+}
+
+IoUring::~IoUring()
+{
+    notifier.reset();
+    // Closing the ring cancels whatever is still in flight
+    if (ringFd != -1) {
+        ::close(ringFd);
+    }
+    if (eventFd != -1) {
+        ::close(eventFd);
+    }
+    if (bufRing != nullptr) {
+        ::munmap(bufRing, bufRingSize);
+    }
+    if (sqes != nullptr) {
+        ::munmap(sqes, sqesSize);
+    }
+    if (cqRing != nullptr && cqRing != sqRing) {
+        ::munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != nullptr) {
+        ::munmap(sqRing, sqRingSize);
+    }
+}
+
+std::shared_ptr<IoUring> IoUring::forThread()
+{
+    std::shared_ptr<IoUring> ring = threadRing.lock();
+    if (ring || threadRingUnsupported) {
+        return ring;
+    }
+    ring.reset(new IoUring());
+    if (!ring->setup()) {
+        threadRingUnsupported = true;
+        return nullptr;
+    }
+    threadRing = ring;
+    return ring;
+}
+
+bool IoUring::setup()
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    // Relay traffic completes in bursts, give the completion queue more room
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    params.cq_entries = Entries * 4;
+    ringFd = sysSetup(Entries, &params);
+    if (ringFd < 0) {
+        qDebug("io_uring is unavailable: %s", strerror(errno));
+        ringFd = -1;
+        return false;
+    }
+    extArg = params.features & IORING_FEAT_EXT_ARG;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+    void *ptr = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    sqRing = ptr;
+    if (singleMmap) {
+        cqRing = sqRing;
+    } else {
+        ptr = ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        cqRing = ptr;
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    ptr = ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe *>(ptr);
+
+    auto *sq = static_cast<uint8_t *>(sqRing);
+    sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqFlags = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqLocalTail = *sqTail;
+
+    auto *cq = static_cast<uint8_t *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // Make sure all the operations the relays use are there
+    const size_t probeSize = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    std::vector<uint8_t> probeBuffer(probeSize, 0);
+    auto *probe = reinterpret_cast<io_uring_probe *>(probeBuffer.data());
+    if (sysRegister(ringFd, IORING_REGISTER_PROBE, probe, 256) != 0) {
+        qDebug("io_uring probe failed: %s", strerror(errno));
+        return false;
+    }
+    for (uint8_t op : { IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_RECV,
+                        IORING_OP_RECVMSG, IORING_OP_SENDMSG,
+                        IORING_OP_ASYNC_CANCEL }) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            qDebug("io_uring operation %d is not supported", op);
+            return false;
+        }
+    }
+
+    if (!setupBufferRing()) {
+        return false;
+    }
+
+    eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd == -1
+            || sysRegister(ringFd, IORING_REGISTER_EVENTFD, &eventFd, 1) != 0) {
+        qDebug("Failed to register the io_uring eventfd: %s", strerror(errno));
+        return false;
+    }
+    notifier = std::make_unique<QSocketNotifier>(eventFd, QSocketNotifier::Read);
+    connect(notifier.get(), &QSocketNotifier::activated,
+            this, &IoUring::onEventFd);
+    return true;
+}
+
+bool IoUring::setupBufferRing()
+{
+    bufRingSize = BufferCount * sizeof(io_uring_buf);
+    void *ptr = ::mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    bufRing = static_cast<io_uring_buf_ring *>(ptr);
+
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uintptr_t>(bufRing);
+    reg.ring_entries = BufferCount;
+    reg.bgid = BufferGroup;
+    if (sysRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        // Linux 5.19 or later
+        qDebug("io_uring provided buffer rings are unsupported: %s", strerror(errno));
+        return false;
+    }
+
+    // Every block belongs to the kernel until a completion returns it
+    for (unsigned i = 0; i < BufferCount; ++i) {
+        recycleBuffer(static_cast<uint16_t>(pool.acquire()));
+    }
+    return true;
+}
+
+int IoUring::enter(unsigned submit, unsigned minComplete, unsigned flags,
+                   const void *arg, size_t argSize)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, ringFd, submit,
+                                      minComplete, flags, arg, argSize));
+}
+
+io_uring_sqe *IoUring::prepare(Target *target, unsigned op)
+{
+    Q_ASSERT(op <= MaxOp);
+    if (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        // The submission queue is full, flush it right away
+        submit();
+    }
+    const unsigned index = sqLocalTail & sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    // Zero user_data marks internal operations whose results are ignored
+    sqe->user_data = target == nullptr ? 0 : reinterpret_cast<uintptr_t>(target) | op;
+    sqArray[index] = index;
+    ++sqLocalTail;
+    ++toSubmit;
+
+    // Within reap() the submission happens after all completions are handled
+    if (!reaping && !submitScheduled) {
+        submitScheduled = true;
+        QTimer::singleShot(0, this, &IoUring::submit);
+    }
+    return sqe;
+}
+
+void IoUring::cancel(Target *target, unsigned op)
+{
+    io_uring_sqe *sqe = prepare(nullptr, 0);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uintptr_t>(target) | op;
+}
+
+void IoUring::cancelFd(int fd)
+{
+    io_uring_sqe *sqe = prepare(nullptr, 0);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+}
+
+void IoUring::submit()
+{
+    submitScheduled = false;
+    if (toSubmit == 0) {
+        return;
+    }
+    // SQEs are filled in by the callers after prepare(), publish them now
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    while (toSubmit > 0) {
+        const int ret = enter(toSubmit, 0, 0);
+        if (ret >= 0) {
+            toSubmit -= std::min<unsigned>(ret, toSubmit);
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EBUSY) {
+            // Out of resources or the completion queue overflowed. Completions
+            // are going to be reaped, then try again
+            if (!submitScheduled) {
+                submitScheduled = true;
+                QTimer::singleShot(0, this, &IoUring::submit);
+            }
+            return;
+        } else {
+            qWarning("io_uring_enter failed: %s", strerror(errno));
+            toSubmit = 0;
+        }
+    }
+}
+
+bool IoUring::waitFor(const std::function<bool()> &done, int timeoutMsec)
+{
+    const auto deadline = std::chrono::steady_clock::now()
+            + std::chrono::milliseconds(timeoutMsec);
+    submit();
+    while (!done()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        if (extArg) {
+            __kernel_timespec ts;
+            ts.tv_sec = 0;
+            ts.tv_nsec = 10 * 1000 * 1000;
+            io_uring_getevents_arg arg;
+            std::memset(&arg, 0, sizeof(arg));
+            arg.ts = reinterpret_cast<uintptr_t>(&ts);
+            enter(0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                  &arg, sizeof(arg));
+        } else {
+            enter(0, 1, IORING_ENTER_GETEVENTS);
+        }
+        reap();
+    }
+    return true;
+}
+
+uint8_t *IoUring::buffer(uint16_t id)
+{
+    return pool.block(id);
+}
+
+size_t IoUring::bufferSize() const
+{
+    return pool.blockSize();
+}
+
+void IoUring::recycleBuffer(uint16_t id)
+{
+    // The entries start at the ring itself. bufRing->bufs can't be used in
+    // C++ since __DECLARE_FLEX_ARRAY moves it behind an empty struct member.
+    // bufs[0].resv overlaps the tail, so don't assign the whole entry either
+    io_uring_buf &buf = reinterpret_cast<io_uring_buf *>(bufRing)[bufRingTail & (BufferCount - 1)];
+    buf.addr = reinterpret_cast<uintptr_t>(pool.block(id));
+    buf.len = static_cast<uint32_t>(pool.blockSize());
+    buf.bid = id;
+    ++bufRingTail;
+    __atomic_store_n(&bufRing->tail, bufRingTail, __ATOMIC_RELEASE);
+}
+
+bool IoUring::multishotRecv() const
+{
+    return m_multishotRecv;
+}
+
+void IoUring::disableMultishotRecv()
+{
+    if (m_multishotRecv) {
+        qDebug("Multishot receive is unsupported, using single-shot receive");
+        m_multishotRecv = false;
+    }
+}
+
+void IoUring::onEventFd()
+{
+    uint64_t count;
+    while (::read(eventFd, &count, sizeof(count)) == -1 && errno == EINTR) {}
+    reap();
+}
+
+void IoUring::reap()
+{
+    if (reaping) {
+        return;
+    }
+    reaping = true;
+    unsigned head = *cqHead;
+    for (;;) {
+        const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (__atomic_load_n(sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) {
+                // Let the kernel flush the completions it had to hold back
+                enter(0, 0, IORING_ENTER_GETEVENTS);
+                continue;
+            }
+            break;
+        }
+        const io_uring_cqe &cqe = cqes[head & cqMask];
+        const uint64_t userData = cqe.user_data;
+        const int32_t res = cqe.res;
+        const uint32_t flags = cqe.flags;
+        ++head;
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+        if (userData == 0) {
+            continue;
+        }
+        auto *target = reinterpret_cast<Target *>(userData & ~static_cast<uint64_t>(MaxOp));
+        target->complete(static_cast<unsigned>(userData & MaxOp), res, flags);
+    }
+    reaping = false;
+    // One io_uring_enter() for everything the completions triggered
+    submit();
+}
+
+}  // namespace QSS
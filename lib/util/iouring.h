@@ -0,0 +1,150 @@
+/*
+ * iouring.h - the header file of IoUring class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <QObject>
+#include <QSocketNotifier>
+#include <functional>
+#include <memory>
+#include <linux/io_uring.h>
+#include "bufferpool.h"
+#include "export.h"
+
+namespace QSS {
+
+/**
+ * A minimal io_uring instance driven by the Qt event loop.
+ *
+ * Submissions prepared during an event loop iteration are pushed to the
+ * kernel together, either after the completions are reaped or from a
+ * zero-timeout timer, so a single io_uring_enter() covers all the relay
+ * traffic of that iteration. Completions are signalled through an eventfd
+ * watched by a QSocketNotifier.
+ *
+ * Receives select their buffers from a provided buffer ring whose memory is
+ * owned by a BufferPool. A buffer has to be recycled after its data is
+ * processed.
+ */
+class QSS_EXPORT IoUring : public QObject
+{
+    Q_OBJECT
+public:
+    /*
+     * Receives the completions of the operations it prepared. The low bits
+     * of the pointer carry the op tag, hence the alignment.
+     */
+    class alignas(8) Target
+    {
+    public:
+        virtual ~Target() = default;
+        virtual void complete(unsigned op, int32_t res, uint32_t flags) = 0;
+    };
+
+    static const unsigned MaxOp = 7;
+    static const uint16_t BufferGroup = 0;
+
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+
+    /*
+     * Returns the ring shared by everything running in the calling thread,
+     * or nullptr if the kernel doesn't support the features we need.
+     */
+    static std::shared_ptr<IoUring> forThread();
+
+    // Returns a zeroed SQE whose completion goes to target->complete(op)
+    io_uring_sqe *prepare(Target *target, unsigned op);
+    // Cancels the operation target prepared with op
+    void cancel(Target *target, unsigned op);
+    // Cancels all the operations on fd
+    void cancelFd(int fd);
+    // Pushes the prepared SQEs to the kernel
+    void submit();
+    // Processes completions until done() returns true or timeout expires
+    bool waitFor(const std::function<bool()> &done, int timeoutMsec);
+
+    uint8_t *buffer(uint16_t id);
+    size_t bufferSize() const;
+    // Gives a provided buffer back to the kernel
+    void recycleBuffer(uint16_t id);
+
+    // Multishot recv/recvmsg need Linux 6.0. Users switch to single-shot
+    // operations once they see EINVAL
+    bool multishotRecv() const;
+    void disableMultishotRecv();
+
+private:
+    IoUring();
+
+    static const unsigned Entries = 1024;
+    static const size_t BufferSize = 32768;
+    static const unsigned BufferCount = 256;
+
+    int ringFd;
+    int eventFd;
+    bool extArg;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqFlags;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqLocalTail;
+    unsigned toSubmit;
+
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    io_uring_cqe *cqes;
+
+    BufferPool pool;
+    io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    uint16_t bufRingTail;
+
+    std::unique_ptr<QSocketNotifier> notifier;
+    bool submitScheduled;
+    bool reaping;
+    bool m_multishotRecv;
+
+    bool setup();
+    bool setupBufferRing();
+    int enter(unsigned submit, unsigned minComplete, unsigned flags,
+              const void *arg = nullptr, size_t argSize = 0);
+    void onEventFd();
+    void reap();
+};
+
+}
+
+#endif // IOURING_H
@@ -0,0 +1,233 @@
+/*
+ * nativesocket.cpp - helpers for native socket descriptors
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "nativesocket.h"
+#include <QDebug>
+#include <QtEndian>
+#include <cerrno>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#endif
+
+namespace QSS {
+
+bool NativeSocket::setNonBlocking(qintptr fd)
+{
+#ifdef Q_OS_UNIX
+    const int flags = ::fcntl(fd, F_GETFL);
+    return flags != -1 && ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+#else
+    Q_UNUSED(fd)
+    return false;
+#endif
+}
+
+bool NativeSocket::setNoDelay(qintptr fd)
+{
+#ifdef Q_OS_UNIX
+    const int on = 1;
+    return ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == 0;
+#else
+    Q_UNUSED(fd)
+    return false;
+#endif
+}
+
+bool NativeSocket::setKeepAlive(qintptr fd)
+{
+#ifdef Q_OS_UNIX
+    const int on = 1;
+    return ::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) == 0;
+#else
+    Q_UNUSED(fd)
+    return false;
+#endif
+}
+
+bool NativeSocket::setNotSentLowat(qintptr fd, int bytes)
+{
+#ifdef TCP_NOTSENT_LOWAT
+    if (bytes <= 0 || fd == -1) {
+        return false;
+    }
+    if (::setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytes, sizeof(bytes)) != 0) {
+        qDebug("Failed to set TCP_NOTSENT_LOWAT on socket %d", static_cast<int>(fd));
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(fd)
+    Q_UNUSED(bytes)
+    return false;
+#endif
+}
+
+bool NativeSocket::setFastOpen(qintptr fd, int queueLength)
+{
+#ifdef TCP_FASTOPEN
+    if (::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &queueLength, sizeof(queueLength)) != 0) {
+        qDebug("Failed to enable TCP Fast Open on socket %d", static_cast<int>(fd));
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(fd)
+    Q_UNUSED(queueLength)
+    return false;
+#endif
+}
+
+bool NativeSocket::fastOpenAccepted(qintptr fd)
+{
+#if defined(TCP_INFO) && defined(TCPI_OPT_SYN_DATA)
+    tcp_info info;
+    socklen_t len = sizeof(info);
+    if (::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+        return false;
+    }
+    return info.tcpi_options & TCPI_OPT_SYN_DATA;
+#else
+    Q_UNUSED(fd)
+    return false;
+#endif
+}
+
+#ifdef Q_OS_UNIX
+socklen_t NativeSocket::toSockaddr(const QHostAddress &addr,
+                                   uint16_t port,
+                                   sockaddr_storage *storage,
+                                   bool v4Mapped)
+{
+    std::memset(storage, 0, sizeof(sockaddr_storage));
+    if (addr.protocol() == QAbstractSocket::IPv4Protocol && v4Mapped) {
+        auto *in6 = reinterpret_cast<sockaddr_in6 *>(storage);
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = qToBigEndian(port);
+        in6->sin6_addr.s6_addr[10] = 0xff;
+        in6->sin6_addr.s6_addr[11] = 0xff;
+        const uint32_t ip4 = qToBigEndian(addr.toIPv4Address());
+        std::memcpy(in6->sin6_addr.s6_addr + 12, &ip4, 4);
+        return sizeof(sockaddr_in6);
+    }
+    if (addr.protocol() == QAbstractSocket::IPv4Protocol) {
+        auto *in = reinterpret_cast<sockaddr_in *>(storage);
+        in->sin_family = AF_INET;
+        in->sin_port = qToBigEndian(port);
+        in->sin_addr.s_addr = qToBigEndian(addr.toIPv4Address());
+        return sizeof(sockaddr_in);
+    }
+    auto *in6 = reinterpret_cast<sockaddr_in6 *>(storage);
+    in6->sin6_family = AF_INET6;
+    in6->sin6_port = qToBigEndian(port);
+    Q_IPV6ADDR ip6 = addr.toIPv6Address();
+    std::memcpy(in6->sin6_addr.s6_addr, ip6.c, 16);
+    return sizeof(sockaddr_in6);
+}
+
+QHostAddress NativeSocket::fromSockaddr(const sockaddr *addr, uint16_t *port)
+{
+    if (addr->sa_family == AF_INET) {
+        const auto *in = reinterpret_cast<const sockaddr_in *>(addr);
+        *port = qFromBigEndian(in->sin_port);
+        return QHostAddress(qFromBigEndian(in->sin_addr.s_addr));
+    } if (addr->sa_family == AF_INET6) {
+        const auto *in6 = reinterpret_cast<const sockaddr_in6 *>(addr);
+        *port = qFromBigEndian(in6->sin6_port);
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+            uint32_t ip4;
+            std::memcpy(&ip4, in6->sin6_addr.s6_addr + 12, 4);
+            return QHostAddress(qFromBigEndian(ip4));
+        }
+        return QHostAddress(in6->sin6_addr.s6_addr);
+    }
+    *port = 0;
+    return QHostAddress();
+}
+
+int NativeSocket::createTcpSocket(int family)
+{
+#ifdef SOCK_NONBLOCK
+    return ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+#else
+    const int fd = ::socket(family, SOCK_STREAM, 0);
+    if (fd != -1) {
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        setNonBlocking(fd);
+    }
+    return fd;
+#endif
+}
+
+int NativeSocket::createUdpSocket(int family, bool v6Only)
+{
+#ifdef SOCK_NONBLOCK
+    const int fd = ::socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+#else
+    const int fd = ::socket(family, SOCK_DGRAM, 0);
+    if (fd != -1) {
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        setNonBlocking(fd);
+    }
+#endif
+    if (fd != -1 && family == AF_INET6) {
+        const int on = v6Only ? 1 : 0;
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+int64_t NativeSocket::connectFastOpen(int fd, const QHostAddress &addr, uint16_t port,
+                                      const char *data, size_t length)
+{
+#ifdef MSG_FASTOPEN
+    sockaddr_storage ss;
+    const socklen_t len = toSockaddr(addr, port, &ss);
+    return ::sendto(fd, data, length, MSG_FASTOPEN | MSG_NOSIGNAL,
+                    reinterpret_cast<sockaddr *>(&ss), len);
+#else
+    Q_UNUSED(fd)
+    Q_UNUSED(addr)
+    Q_UNUSED(port)
+    Q_UNUSED(data)
+    Q_UNUSED(length)
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+int NativeSocket::takeError(qintptr fd)
+{
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) {
+        return errno;
+    }
+    return error;
+}
+#endif
+
+}  // namespace QSS
@@ -0,0 +1,83 @@
+/*
+ * nativesocket.h - helpers for native socket descriptors
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NATIVESOCKET_H
+#define NATIVESOCKET_H
+
+#include <QHostAddress>
+#include "export.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#endif
+
+namespace QSS {
+
+/*
+ * Thin wrappers around the BSD socket API for the code paths that bypass
+ * QAbstractSocket. Functions that aren't supported on the current platform
+ * are no-ops returning false.
+ */
+namespace NativeSocket {
+
+QSS_EXPORT bool setNonBlocking(qintptr fd);
+QSS_EXPORT bool setNoDelay(qintptr fd);
+QSS_EXPORT bool setKeepAlive(qintptr fd);
+// Latency mode, see TcpRelay::setNotSentLowat()
+QSS_EXPORT bool setNotSentLowat(qintptr fd, int bytes);
+// Server-side TCP Fast Open on a listening socket. queueLength bounds the
+// number of pending TFO requests
+QSS_EXPORT bool setFastOpen(qintptr fd, int queueLength);
+// Whether the peer acknowledged the data we sent in the SYN
+QSS_EXPORT bool fastOpenAccepted(qintptr fd);
+
+#ifdef Q_OS_UNIX
+// v4Mapped writes IPv4 addresses as IPv4-mapped IPv6 for dual-stack sockets
+QSS_EXPORT socklen_t toSockaddr(const QHostAddress &addr,
+                                uint16_t port,
+                                sockaddr_storage *storage,
+                                bool v4Mapped = false);
+// IPv4-mapped IPv6 addresses are converted back to IPv4
+QSS_EXPORT QHostAddress fromSockaddr(const sockaddr *addr, uint16_t *port);
+
+// Creates a non-blocking, close-on-exec TCP socket of the given family
+QSS_EXPORT int createTcpSocket(int family);
+// Same as above for UDP. AF_INET6 sockets accept IPv4 traffic unless v6Only
+QSS_EXPORT int createUdpSocket(int family, bool v6Only = false);
+
+/*
+ * Starts a non-blocking TCP Fast Open connect of fd to addr:port. data goes
+ * in the SYN if a cookie of the server is cached. Returns the number of
+ * bytes sent in the SYN, or -1 with errno set. EINPROGRESS means the SYN
+ * went without data (i.e. no cookie yet) and the connect is in progress.
+ */
+QSS_EXPORT int64_t connectFastOpen(int fd, const QHostAddress &addr, uint16_t port,
+                                   const char *data, size_t length);
+// Returns and clears the pending error of fd (SO_ERROR)
+QSS_EXPORT int takeError(qintptr fd);
+#endif
+
+}
+
+}
+
+#endif // NATIVESOCKET_H
@@ -0,0 +1,158 @@
+/*
+ * timerwheel.cpp - the source file of TimerWheel class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "timerwheel.h"
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace QSS {
+
+TimerWheel::TimerWheel(int64_t tick, size_t slotCount, size_t levelCount) :
+    tick(std::max<int64_t>(tick, 1)),
+    slotCount(std::max<size_t>(slotCount, 1))
+{
+    spans.push_back(1);
+    // Stop before the width of a slot overflows
+    while (spans.size() < levelCount
+           && spans.back() <= std::numeric_limits<uint64_t>::max() / this->slotCount) {
+        spans.push_back(spans.back() * this->slotCount);
+    }
+    levels.assign(spans.size(), std::vector<Slot>(this->slotCount));
+}
+
+TimerWheel::TimerId TimerWheel::schedule(int64_t now, int64_t delay, Callback callback)
+{
+    const int64_t due = std::max<int64_t>(now + std::max<int64_t>(delay, 0), 0);
+    const uint64_t expiry = std::max<uint64_t>((due + tick - 1) / tick, currentTick + 1);
+    const TimerId id = nextId++;
+    Slot pending;
+    pending.push_back(Timer{id, expiry, std::move(callback)});
+    place(pending, pending.begin());
+    return id;
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+    auto it = timers.find(id);
+    if (it == timers.end()) {
+        return false;
+    }
+    levels[it->second.level][it->second.index].erase(it->second.timer);
+    timers.erase(it);
+    return true;
+}
+
+void TimerWheel::advance(int64_t now)
+{
+    const uint64_t target = static_cast<uint64_t>(std::max<int64_t>(now, 0) / tick);
+    if (target <= currentTick) {
+        return;
+    }
+    std::vector<TimerId> due;
+    if (target - currentTick > slotCount) {
+        // After a long pause, sort every timer out once instead of turning
+        // the wheel tick by tick
+        Slot all;
+        for (std::vector<Slot> &level : levels) {
+            for (Slot &slot : level) {
+                all.splice(all.end(), slot);
+            }
+        }
+        currentTick = target;
+        while (!all.empty()) {
+            if (all.front().expiry <= target) {
+                due.push_back(all.front().id);
+            }
+            place(all, all.begin());
+        }
+    } else {
+        while (currentTick < target) {
+            ++currentTick;
+            cascade();
+            for (const Timer &timer : levels[0][currentTick % slotCount]) {
+                if (timer.expiry <= currentTick) {
+                    due.push_back(timer.id);
+                }
+            }
+        }
+    }
+
+    for (TimerId id : due) {
+        // An earlier callback may have cancelled it
+        auto it = timers.find(id);
+        if (it == timers.end()) {
+            continue;
+        }
+        Slot &slot = levels[it->second.level][it->second.index];
+        Callback callback = std::move(it->second.timer->callback);
+        slot.erase(it->second.timer);
+        timers.erase(it);
+        callback();
+    }
+}
+
+void TimerWheel::place(Slot &from, Slot::iterator timer)
+{
+    const uint64_t due = std::max(timer->expiry, currentTick);
+    const uint64_t delta = due - currentTick;
+    size_t level = 0;
+    while (level + 1 < levels.size() && delta >= spans[level + 1]) {
+        ++level;
+    }
+    // Timers beyond the top level come back to it when their slot turns
+    const size_t index = (due / spans[level]) % slotCount;
+    Slot &to = levels[level][index];
+    to.splice(to.end(), from, timer);
+    timers[timer->id] = Position{level, index, timer};
+}
+
+void TimerWheel::cascade()
+{
+    for (size_t level = levels.size() - 1; level > 0; --level) {
+        if (currentTick % spans[level] != 0) {
+            continue;
+        }
+        Slot moving;
+        moving.splice(moving.end(), levels[level][(currentTick / spans[level]) % slotCount]);
+        while (!moving.empty()) {
+            place(moving, moving.begin());
+        }
+    }
+}
+
+size_t TimerWheel::size() const
+{
+    return timers.size();
+}
+
+void TimerWheel::clear()
+{
+    for (std::vector<Slot> &level : levels) {
+        for (Slot &slot : level) {
+            slot.clear();
+        }
+    }
+    timers.clear();
+}
+
+}  // namespace QSS
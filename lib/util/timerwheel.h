@@ -0,0 +1,99 @@
+/*
+ * timerwheel.h - the header file of TimerWheel class
+ *
+ * Copyright (C) 2018 Symeon Huang <hzwhuang@gmail.com>
+ *
+ * This file is part of the libQtShadowsocks.
+ *
+ * libQtShadowsocks is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libQtShadowsocks is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libQtShadowsocks; see the file LICENSE. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "export.h"
+
+namespace QSS {
+
+/**
+ * A hierarchical timing wheel for many coarse timeouts (e.g. idle
+ * connections).
+ *
+ * Time is given by the caller in msec, on any monotonic clock, and rounded
+ * up to whole ticks. Level 0 has one slot per tick, and each further level
+ * has slots slotCount times as wide as the level below. A timer is kept in
+ * the lowest level that reaches its expiry and moves down a level when the
+ * wheel turns past the start of its slot, so each slot only holds timers
+ * that are (nearly) due. Scheduling and cancelling are O(1), and advance()
+ * only looks at the slots of the ticks that passed.
+ */
+class QSS_EXPORT TimerWheel
+{
+public:
+    typedef uint64_t TimerId;
+    typedef std::function<void()> Callback;
+
+    // A single level is a plain hashed wheel
+    TimerWheel(int64_t tick, size_t slotCount, size_t levelCount = 1);
+
+    TimerWheel(const TimerWheel &) = delete;
+
+    // Runs callback from the first advance() at or after now + delay
+    TimerId schedule(int64_t now, int64_t delay, Callback callback);
+    // Returns false if the timer already ran or was cancelled
+    bool cancel(TimerId id);
+    // Runs the callbacks that are due. They may schedule and cancel timers
+    void advance(int64_t now);
+
+    size_t size() const;
+    void clear();
+
+private:
+    struct Timer {
+        TimerId id;
+        uint64_t expiry;    // in ticks
+        Callback callback;
+    };
+    typedef std::list<Timer> Slot;
+    struct Position {
+        size_t level;
+        size_t index;
+        Slot::iterator timer;
+    };
+
+    const int64_t tick;
+    const size_t slotCount;
+    // Width of a slot of each level, in ticks
+    std::vector<uint64_t> spans;
+    std::vector<std::vector<Slot> > levels;
+    std::unordered_map<TimerId, Position> timers;
+    uint64_t currentTick = 0;
+    TimerId nextId = 1;
+
+    // Moves timer out of from into its slot relative to currentTick
+    void place(Slot &from, Slot::iterator timer);
+    // Moves the timers of the slots that start at currentTick down a level
+    void cascade();
+};
+
+}
+
+#endif // TIMERWHEEL_H
@@ -61,6 +61,19 @@ bool Client::readConfig(const QString &file)
     profile.setServerPort(confObj["server_port"].toInt());
     profile.setTimeout(confObj["timeout"].toInt());
     profile.setHttpProxy(confObj["http_proxy"].toBool());
+    profile.setTcpNotSentLowat(confObj["tcp_notsent_lowat"].toInt());
+    profile.setTcpWatermarks(confObj["tcp_high_watermark"].toInt(),
+                             confObj["tcp_low_watermark"].toInt());
+    profile.setIoBackend(confObj["io_backend"].toString().toStdString());
+    profile.setFastOpen(confObj["fast_open"].toBool());
+    profile.setConnectionPoolSize(confObj["connection_pool_size"].toInt());
+    profile.setMuxSessions(confObj["mux_sessions"].toInt());
+    profile.setStripePaths(confObj["stripe_paths"].toInt());
+    profile.setUdpOffload(confObj["udp_offload"].toBool());
+    profile.setUdpSharedSockets(confObj["udp_shared_sockets"].toInt());
+    profile.setTcpReadBudget(confObj["tcp_read_budget"].toInt());
+    profile.setUdpReadBudget(confObj["udp_read_budget"].toInt());
+    profile.setSocksPort(confObj["socks_port"].toInt());
     if (confObj["auth"].toBool()) {
         QDebug(QtMsgType::QtCriticalMsg) << "OTA is deprecated, please remove OTA from the configuration file.";
     }
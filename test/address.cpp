@@ -17,6 +17,8 @@ private Q_SLOTS:
     void testSetAddress();
     void testSetIPAddress();
     void testSetPort();
+    void testAddressType();
+    void testPacked();
     void testLookup();
 };
 
@@ -81,6 +83,38 @@ void Address::testSetPort()
     QCOMPARE(a.getPort(), port);
 }
 
+void Address::testAddressType()
+{
+    QSS::Address a(" 10.0.0.1\t", 80);
+    QCOMPARE(a.getAddress(), std::string("10.0.0.1"));
+    QCOMPARE(a.addressType(), QSS::Address::IPV4);
+    QCOMPARE(a.getFirstIP(), QHostAddress("10.0.0.1"));
+    QCOMPARE(QSS::Address("::1", 80).addressType(), QSS::Address::IPV6);
+    QCOMPARE(QSS::Address("example.com", 80).addressType(), QSS::Address::HOST);
+    QCOMPARE(QSS::Address("256.0.0.1", 80).addressType(), QSS::Address::HOST);
+    QCOMPARE(QSS::Address("1.2.3", 80).addressType(), QSS::Address::HOST);
+    QCOMPARE(QSS::Address("1.2.3.4.", 80).addressType(), QSS::Address::HOST);
+    QCOMPARE(QSS::Address(QHostAddress("::1"), 80).addressType(), QSS::Address::IPV6);
+}
+
+void Address::testPacked()
+{
+    QSS::Address a("127.0.0.1", 1080);
+    QVERIFY(a.packed() == std::string("\x01\x7f\x00\x00\x01\x04\x38", 7));
+    a.setPort(80);
+    QVERIFY(a.packed() == std::string("\x01\x7f\x00\x00\x01\x00\x50", 7));
+    a.setIPAddress(QHostAddress("10.1.2.3"));
+    QCOMPARE(a.getAddress(), std::string("10.1.2.3"));
+    QVERIFY(a.packed() == std::string("\x01\x0a\x01\x02\x03\x00\x50", 7));
+    a.setAddress("example.com");
+    QVERIFY(a.packed() == std::string("\x03\x0b" "example.com" "\x00\x50", 15));
+
+    const QSS::Address ipv6(QHostAddress("::1"), 53);
+    QVERIFY(ipv6.packed() == std::string("\x04", 1) + std::string(15, '\0')
+            + std::string("\x01\x00\x35", 3));
+    QVERIFY(QSS::Address(ipv6).packed() == ipv6.packed());
+}
+
 void Address::testLookup()
 {
     QSS::Address a("www.google.com", 443);
@@ -0,0 +1,103 @@
+#include "network/batchudpsocket.h"
+
+#include <QUdpSocket>
+#include <QtTest>
+
+class BatchUdpSocket : public QObject
+{
+    Q_OBJECT
+
+public:
+    BatchUdpSocket() = default;
+
+private Q_SLOTS:
+    void testEcho();
+    void testUnboundSend();
+    void testReleaseInHandler();
+};
+
+void BatchUdpSocket::testEcho()
+{
+    // Find a free port first
+    QUdpSocket probe;
+    QVERIFY(probe.bind(QHostAddress::LocalHost, 0));
+    const uint16_t port = probe.localPort();
+    probe.close();
+
+    std::shared_ptr<QSS::BatchUdpSocket> server = QSS::BatchUdpSocket::create();
+    QVERIFY(server->bind(QHostAddress::LocalHost, port));
+    size_t written = 0;
+    QSS::BatchUdpSocket *raw = server.get();
+    server->setDatagramHandler([raw](const uint8_t *data, size_t length,
+                                     const QHostAddress &addr, uint16_t port) {
+        raw->send(std::string(reinterpret_cast<const char *>(data), length), addr, port);
+    });
+    server->setWrittenHandler([&written](size_t bytes) { written += bytes; });
+
+    QUdpSocket client;
+    QVERIFY(client.bind(QHostAddress::LocalHost, 0));
+    const int count = 100;
+    for (int i = 0; i < count; ++i) {
+        const QByteArray datagram = QByteArray::number(i);
+        client.writeDatagram(datagram, QHostAddress::LocalHost, port);
+    }
+
+    std::vector<int> echoed;
+    QTRY_VERIFY_WITH_TIMEOUT([&]() {
+        while (client.hasPendingDatagrams()) {
+            QByteArray datagram(static_cast<int>(client.pendingDatagramSize()), 0);
+            client.readDatagram(datagram.data(), datagram.size());
+            echoed.push_back(datagram.toInt());
+        }
+        return echoed.size() == size_t(count);
+    }(), 5000);
+    for (int i = 0; i < count; ++i) {
+        QCOMPARE(echoed[i], i);
+    }
+    // "0" to "9" and "10" to "99"
+    QCOMPARE(written, size_t(10 + 90 * 2));
+}
+
+void BatchUdpSocket::testUnboundSend()
+{
+    QUdpSocket receiver;
+    QVERIFY(receiver.bind(QHostAddress::LocalHost, 0));
+
+    std::shared_ptr<QSS::BatchUdpSocket> socket = QSS::BatchUdpSocket::create();
+    QVERIFY(!socket->isOpen());
+    socket->send("hello", QHostAddress::LocalHost, receiver.localPort());
+    QVERIFY(socket->isOpen());
+    QTRY_VERIFY(receiver.hasPendingDatagrams());
+    QByteArray datagram(static_cast<int>(receiver.pendingDatagramSize()), 0);
+    receiver.readDatagram(datagram.data(), datagram.size());
+    QCOMPARE(datagram, QByteArray("hello"));
+}
+
+void BatchUdpSocket::testReleaseInHandler()
+{
+    QUdpSocket probe;
+    QVERIFY(probe.bind(QHostAddress::LocalHost, 0));
+    const uint16_t port = probe.localPort();
+    probe.close();
+
+    std::shared_ptr<QSS::BatchUdpSocket> server = QSS::BatchUdpSocket::create();
+    QVERIFY(server->bind(QHostAddress::LocalHost, port));
+    int received = 0;
+    server->setDatagramHandler([&server, &received](const uint8_t *, size_t,
+                                                    const QHostAddress &addr, uint16_t port) {
+        ++received;
+        server->send("bye", addr, port);
+        server.reset();
+    });
+
+    QUdpSocket client;
+    client.writeDatagram("a", 1, QHostAddress::LocalHost, port);
+    client.writeDatagram("b", 1, QHostAddress::LocalHost, port);
+    QTRY_VERIFY(!server);
+    // The rest of the batch isn't handled once the socket is released
+    QTest::qWait(100);
+    QCOMPARE(received, 1);
+}
+
+QTEST_MAIN(BatchUdpSocket)
+#include "batchudpsocket.moc"
@@ -0,0 +1,109 @@
+#include "types/address.h"
+#include "util/common.h"
+
+#include <QDir>
+#include <QFile>
+#include <QtTest>
+
+class Common : public QObject
+{
+    Q_OBJECT
+
+public:
+    Common() = default;
+
+private Q_SLOTS:
+    void testParseHeader();
+    void testParseInvalidHeader();
+    void testParseHeaderCorpus();
+    void benchmarkParseHeader();
+};
+
+void Common::testParseHeader()
+{
+    const std::string ipv4("\x01\x7f\x00\x00\x01\x00\x50" "data", 11);
+    QSS::Common::AddressHeader header = QSS::Common::parseHeader(ipv4.data(), ipv4.size());
+    QCOMPARE(header.length, size_t(7));
+    QCOMPARE(int(header.type), int(QSS::Address::IPV4));
+    QVERIFY(header.address == ipv4.data() + 1);
+    QCOMPARE(header.addressLength, size_t(4));
+    QCOMPARE(header.port, uint16_t(80));
+    QSS::Address address;
+    header.toAddress(address);
+    QCOMPARE(address.getAddress(), std::string("127.0.0.1"));
+    QCOMPARE(address.getPort(), uint16_t(80));
+
+    const std::string host("\x03\x0b" "example.com" "\x01\xbb", 15);
+    header = QSS::Common::parseHeader(host.data(), host.size());
+    QCOMPARE(header.length, host.size());
+    QCOMPARE(int(header.type), int(QSS::Address::HOST));
+    QVERIFY(std::string(header.address, header.addressLength) == "example.com");
+    QCOMPARE(header.port, uint16_t(443));
+    header.toAddress(address);
+    QCOMPARE(address.getAddress(), std::string("example.com"));
+    QVERIFY(address.packed() == host);
+
+    const std::string ipv6 = std::string("\x04", 1) + std::string(15, '\0')
+            + std::string("\x01\x00\x35", 3);
+    header = QSS::Common::parseHeader(ipv6.data(), ipv6.size());
+    QCOMPARE(header.length, size_t(19));
+    header.toAddress(address);
+    QCOMPARE(address.getFirstIP(), QHostAddress("::1"));
+    QCOMPARE(address.getPort(), uint16_t(53));
+
+    // The string version
+    int length = 0;
+    QSS::Common::parseHeader(host, address, length);
+    QCOMPARE(length, 15);
+}
+
+void Common::testParseInvalidHeader()
+{
+    QCOMPARE(QSS::Common::parseHeader(nullptr, 0).length, size_t(0));
+    // Unknown type
+    QCOMPARE(QSS::Common::parseHeader("\x02\x7f\x00\x00\x01\x00\x50", 7).length, size_t(0));
+    // Empty host name
+    QCOMPARE(QSS::Common::parseHeader("\x03\x00\x00\x50", 4).length, size_t(0));
+    // Every truncation of a valid header
+    const std::string host("\x03\x0b" "example.com" "\x01\xbb", 15);
+    for (size_t size = 0; size < host.size(); ++size) {
+        QCOMPARE(QSS::Common::parseHeader(host.data(), size).length, size_t(0));
+    }
+    const std::string ipv4("\x01\x7f\x00\x00\x01\x00\x50", 7);
+    for (size_t size = 0; size < ipv4.size(); ++size) {
+        QCOMPARE(QSS::Common::parseHeader(ipv4.data(), size).length, size_t(0));
+    }
+}
+
+void Common::testParseHeaderCorpus()
+{
+    // The seeds of the parseheader fuzz target (see fuzz/parseheader.cpp)
+    const QString path = QFINDTESTDATA("corpus/parseheader");
+    QVERIFY(!path.isEmpty());
+    const QStringList valid = { "host", "host-long", "ipv4", "ipv4-payload", "ipv6", "ota-flag" };
+    const QDir corpus(path);
+    const QStringList names = corpus.entryList(QDir::Files);
+    QVERIFY(!names.isEmpty());
+    for (const QString &name : names) {
+        QFile file(corpus.filePath(name));
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const QByteArray data = file.readAll();
+        const QSS::Common::AddressHeader header =
+                QSS::Common::parseHeader(data.constData(), static_cast<size_t>(data.size()));
+        QVERIFY(header.length <= static_cast<size_t>(data.size()));
+        QCOMPARE(header.length > 0, valid.contains(name));
+    }
+}
+
+void Common::benchmarkParseHeader()
+{
+    const std::string host("\x03\x0b" "example.com" "\x01\xbb", 15);
+    size_t total = 0;
+    QBENCHMARK {
+        total += QSS::Common::parseHeader(host.data(), host.size()).length;
+    }
+    QVERIFY(total > 0);
+}
+
+QTEST_MAIN(Common)
+#include "common.moc"
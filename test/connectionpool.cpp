@@ -0,0 +1,130 @@
+#include "network/connectionpool.h"
+
+#include <QTcpServer>
+#include <QtTest>
+
+class ConnectionPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    ConnectionPool() = default;
+
+private Q_SLOTS:
+    void testTake();
+    void testBurst();
+    void testUnusable();
+    void testExpiry();
+    void testRetry();
+
+private:
+    // Accepts all pending connections of server
+    static std::vector<QTcpSocket *> accept(QTcpServer &server);
+};
+
+std::vector<QTcpSocket *> ConnectionPool::accept(QTcpServer &server)
+{
+    std::vector<QTcpSocket *> sockets;
+    while (server.hasPendingConnections()) {
+        sockets.push_back(server.nextPendingConnection());
+    }
+    return sockets;
+}
+
+void ConnectionPool::testTake()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QSS::ConnectionPool pool(QSS::Address(QHostAddress::LocalHost, server.serverPort()), 4);
+    QCOMPARE(pool.idleCount(), 0);
+
+    // Nothing is ready at first, but the demand fills the pool
+    QVERIFY(!pool.take());
+    QTRY_COMPARE(pool.idleCount(), 1);
+    std::unique_ptr<QTcpSocket> socket = pool.take();
+    QVERIFY(socket);
+    QCOMPARE(socket->state(), QAbstractSocket::ConnectedState);
+    QVERIFY(!socket->parent());
+    // And it's refilled after a take
+    QTRY_VERIFY(pool.idleCount() > 0);
+}
+
+void ConnectionPool::testBurst()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QSS::ConnectionPool pool(QSS::Address(QHostAddress::LocalHost, server.serverPort()), 4);
+    // Within a tick, every take() counts up to the maximum size
+    for (int i = 0; i < 6; ++i) {
+        pool.take();
+    }
+    QTRY_COMPARE(pool.idleCount(), 4);
+}
+
+void ConnectionPool::testUnusable()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QSS::ConnectionPool pool(QSS::Address(QHostAddress::LocalHost, server.serverPort()), 1);
+    pool.take();
+    QTRY_COMPARE(pool.idleCount(), 1);
+    QTRY_VERIFY(server.hasPendingConnections());
+    std::vector<QTcpSocket *> peers = accept(server);
+    QCOMPARE(peers.size(), size_t(1));
+
+    // The server sent something before the client did
+    peers.front()->write("x");
+    QTest::qWait(200);
+    QVERIFY(!pool.take());
+
+    // Closed by the server
+    QTRY_COMPARE(pool.idleCount(), 1);
+    QTRY_VERIFY(server.hasPendingConnections());
+    peers = accept(server);
+    peers.back()->disconnectFromHost();
+    QTRY_COMPARE(pool.idleCount(), 0);
+}
+
+void ConnectionPool::testExpiry()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QSS::ConnectionPool pool(QSS::Address(QHostAddress::LocalHost, server.serverPort()), 1);
+    pool.setMaxIdleTime(500);
+    pool.take();
+    QTRY_COMPARE(pool.idleCount(), 1);
+    QTRY_VERIFY(server.hasPendingConnections());
+    QTcpSocket *first = accept(server).front();
+    QTRY_COMPARE_WITH_TIMEOUT(first->state(), QAbstractSocket::UnconnectedState, 3000);
+
+    // Without demand, the pool drains and isn't refilled anymore
+    QTRY_COMPARE_WITH_TIMEOUT(pool.idleCount(), 0, 10000);
+    QTest::qWait(4500);
+    accept(server);
+    QTest::qWait(1500);
+    QCOMPARE(pool.idleCount(), 0);
+    QVERIFY(!server.hasPendingConnections());
+}
+
+void ConnectionPool::testRetry()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    const quint16 port = server.serverPort();
+    server.close();
+
+    QSS::ConnectionPool pool(QSS::Address(QHostAddress::LocalHost, port), 1);
+    // Refused
+    QVERIFY(!pool.take());
+    QTest::qWait(200);
+
+    // No other attempt for a while, even with demand
+    QVERIFY(server.listen(QHostAddress::LocalHost, port));
+    QVERIFY(!pool.take());
+    QTest::qWait(500);
+    QVERIFY(!server.hasPendingConnections());
+    QCOMPARE(pool.idleCount(), 0);
+}
+
+QTEST_MAIN(ConnectionPool)
+#include "connectionpool.moc"
@@ -0,0 +1,97 @@
+#include "util/dnscache.h"
+
+#include <QtTest>
+
+class DnsCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    DnsCache() = default;
+
+private Q_SLOTS:
+    void init();
+    void testHit();
+    void testNegative();
+    void testCoalescing();
+    void testDeletedContext();
+};
+
+void DnsCache::init()
+{
+    QSS::DnsCache::instance().clear();
+}
+
+void DnsCache::testHit()
+{
+    QSS::DnsCache &cache = QSS::DnsCache::instance();
+    const std::vector<QHostAddress> addresses = { QHostAddress("192.0.2.1"),
+                                                  QHostAddress("2001:db8::1") };
+    cache.insert("cached.example", addresses);
+
+    const QSS::DnsCache::Stats before = cache.stats();
+    bool called = false;
+    cache.lookUp("cached.example", this, [&](const std::vector<QHostAddress> &result) {
+        called = true;
+        QVERIFY(result == addresses);
+    });
+    // Hits are answered right away
+    QVERIFY(called);
+    QCOMPARE(cache.stats().hits, before.hits + 1);
+    QCOMPARE(cache.stats().lookups, before.lookups);
+}
+
+void DnsCache::testNegative()
+{
+    QSS::DnsCache &cache = QSS::DnsCache::instance();
+    cache.insert("failed.example", {});
+
+    bool called = false;
+    cache.lookUp("failed.example", this, [&](const std::vector<QHostAddress> &result) {
+        called = true;
+        QVERIFY(result.empty());
+    });
+    QVERIFY(called);
+}
+
+void DnsCache::testCoalescing()
+{
+    QSS::DnsCache &cache = QSS::DnsCache::instance();
+    const QSS::DnsCache::Stats before = cache.stats();
+    int called = 0;
+    auto callback = [&called](const std::vector<QHostAddress> &result) {
+        ++called;
+        QVERIFY(!result.empty());
+    };
+    cache.lookUp("localhost", this, callback);
+    cache.lookUp("localhost", this, callback);
+    QTRY_COMPARE(called, 2);
+
+    const QSS::DnsCache::Stats after = cache.stats();
+    QCOMPARE(after.lookups, before.lookups + 1);
+    QCOMPARE(after.coalesced, before.coalesced + 1);
+
+    // The result is cached now
+    cache.lookUp("localhost", this, callback);
+    QCOMPARE(called, 3);
+}
+
+void DnsCache::testDeletedContext()
+{
+    QSS::DnsCache &cache = QSS::DnsCache::instance();
+    bool called = false;
+    bool done = false;
+    auto *context = new QObject();
+    cache.lookUp("localhost", context, [&called](const std::vector<QHostAddress> &) {
+        called = true;
+    });
+    cache.lookUp("localhost", this, [&done](const std::vector<QHostAddress> &) {
+        done = true;
+    });
+    delete context;
+    QTRY_VERIFY(done);
+    QVERIFY(!called);
+}
+
+QTEST_MAIN(DnsCache)
+#include "dnscache.moc"
@@ -0,0 +1,246 @@
+#include "util/dnsresolver.h"
+
+#include <QTcpServer>
+#include <QUdpSocket>
+#include <QtEndian>
+#include <QtTest>
+
+class DnsResolver : public QObject
+{
+    Q_OBJECT
+
+public:
+    DnsResolver() = default;
+
+private Q_SLOTS:
+    void testQuery();
+    void testParse();
+    void testResolve();
+    void testRetry();
+    void testTruncated();
+    void testHosts();
+
+private:
+    // Answers query with a record of 192.0.2.1 (or 2001:db8::1)
+    static std::string answer(const std::string &query, bool truncated = false);
+    static quint16 id(const std::string &message);
+};
+
+std::string DnsResolver::answer(const std::string &query, bool truncated)
+{
+    std::string response = query;
+    response[2] = truncated ? '\x83' : '\x81';
+    response[3] = '\x80';
+    if (truncated) {
+        return response;
+    }
+    response[7] = 1;   // ANCOUNT
+    const quint16 type = qFromBigEndian<quint16>(
+                reinterpret_cast<const uchar *>(query.data() + query.size() - 4));
+    // The name is a pointer to the question
+    response.append("\xc0\x0c", 2);
+    response.append(query, query.size() - 4, 4);
+    response.append("\x00\x00\x01\x2c", 4);   // TTL 300
+    if (type == QSS::DnsResolver::A) {
+        response.append("\x00\x04\xc0\x00\x02\x01", 6);
+    } else {
+        response.append("\x00\x10\x20\x01\x0d\xb8", 6);
+        response.append(std::string(11, '\0') + '\x01');
+    }
+    return response;
+}
+
+quint16 DnsResolver::id(const std::string &message)
+{
+    return qFromBigEndian<quint16>(reinterpret_cast<const uchar *>(message.data()));
+}
+
+void DnsResolver::testQuery()
+{
+    const std::string query = QSS::DnsResolver::buildQuery(0x1234, "www.example.com",
+                                                           QSS::DnsResolver::A);
+    QCOMPARE(query, std::string("\x12\x34\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00"
+                                "\x03www\x07" "example\x03" "com\x00\x00\x01\x00\x01", 33));
+    QVERIFY(QSS::DnsResolver::buildQuery(1, "bad..name", QSS::DnsResolver::A).empty());
+    QVERIFY(QSS::DnsResolver::buildQuery(1, std::string(64, 'a'), QSS::DnsResolver::A).empty());
+}
+
+void DnsResolver::testParse()
+{
+    const std::string query = QSS::DnsResolver::buildQuery(7, "example.com", QSS::DnsResolver::A);
+    std::vector<QHostAddress> addresses;
+    quint32 ttl = 0;
+    QCOMPARE(QSS::DnsResolver::parseResponse(answer(query), 7, "example.com",
+                                             QSS::DnsResolver::A, addresses, ttl),
+             QSS::DnsResolver::Ok);
+    QVERIFY(addresses == std::vector<QHostAddress>({ QHostAddress("192.0.2.1") }));
+    QCOMPARE(ttl, quint32(300));
+
+    // Wrong id, wrong name, the query itself and garbage
+    QCOMPARE(QSS::DnsResolver::parseResponse(answer(query), 8, "example.com",
+                                             QSS::DnsResolver::A, addresses, ttl),
+             QSS::DnsResolver::Invalid);
+    QCOMPARE(QSS::DnsResolver::parseResponse(answer(query), 7, "example.org",
+                                             QSS::DnsResolver::A, addresses, ttl),
+             QSS::DnsResolver::Invalid);
+    QCOMPARE(QSS::DnsResolver::parseResponse(query, 7, "example.com",
+                                             QSS::DnsResolver::A, addresses, ttl),
+             QSS::DnsResolver::Invalid);
+    QCOMPARE(QSS::DnsResolver::parseResponse(answer(query).substr(0, 40), 7, "example.com",
+                                             QSS::DnsResolver::A, addresses, ttl),
+             QSS::DnsResolver::Invalid);
+
+    std::string nxdomain = query;
+    nxdomain[2] = '\x81';
+    nxdomain[3] = '\x83';
+    QCOMPARE(QSS::DnsResolver::parseResponse(nxdomain, 7, "example.com",
+                                             QSS::DnsResolver::A, addresses, ttl),
+             QSS::DnsResolver::NameError);
+    QCOMPARE(QSS::DnsResolver::parseResponse(answer(query, true), 7, "example.com",
+                                             QSS::DnsResolver::A, addresses, ttl),
+             QSS::DnsResolver::Truncated);
+}
+
+void DnsResolver::testResolve()
+{
+    QUdpSocket server;
+    QVERIFY(server.bind(QHostAddress::LocalHost));
+    connect(&server, &QUdpSocket::readyRead, this, [&server]() {
+        while (server.hasPendingDatagrams()) {
+            std::string query(static_cast<size_t>(server.pendingDatagramSize()), '\0');
+            QHostAddress sender;
+            quint16 port = 0;
+            server.readDatagram(&query[0], query.size(), &sender, &port);
+            const std::string response = answer(query);
+            server.writeDatagram(response.data(), response.size(), sender, port);
+        }
+    });
+
+    QSS::DnsResolver resolver;
+    resolver.setServers({ QSS::Address(QHostAddress::LocalHost, server.localPort()) });
+    resolver.setIPv6Enabled(true);
+    bool done = false;
+    resolver.resolve("Example.COM.", [&done](const std::vector<QHostAddress> &addresses, int ttl) {
+        done = true;
+        // AAAA goes first
+        QVERIFY(addresses == std::vector<QHostAddress>({ QHostAddress("2001:db8::1"),
+                                                         QHostAddress("192.0.2.1") }));
+        QCOMPARE(ttl, 300);
+    });
+    QTRY_VERIFY(done);
+}
+
+void DnsResolver::testRetry()
+{
+    QUdpSocket silent;
+    QVERIFY(silent.bind(QHostAddress::LocalHost));
+    QUdpSocket server;
+    QVERIFY(server.bind(QHostAddress::LocalHost));
+    int dropped = 0;
+    connect(&silent, &QUdpSocket::readyRead, this, [&silent, &dropped]() {
+        char buf[512];
+        while (silent.hasPendingDatagrams()) {
+            silent.readDatagram(buf, sizeof(buf));
+            ++dropped;
+        }
+    });
+    connect(&server, &QUdpSocket::readyRead, this, [&server]() {
+        while (server.hasPendingDatagrams()) {
+            std::string query(static_cast<size_t>(server.pendingDatagramSize()), '\0');
+            QHostAddress sender;
+            quint16 port = 0;
+            server.readDatagram(&query[0], query.size(), &sender, &port);
+            const std::string response = answer(query);
+            server.writeDatagram(response.data(), response.size(), sender, port);
+        }
+    });
+
+    QSS::DnsResolver resolver;
+    resolver.setServers({ QSS::Address(QHostAddress::LocalHost, silent.localPort()),
+                          QSS::Address(QHostAddress::LocalHost, server.localPort()) });
+    resolver.setIPv6Enabled(false);
+    resolver.setTimeout(100);
+    std::vector<QHostAddress> result;
+    bool done = false;
+    resolver.resolve("example.com", [&](const std::vector<QHostAddress> &addresses, int) {
+        done = true;
+        result = addresses;
+    });
+    QTRY_VERIFY(done);
+    QCOMPARE(dropped, 1);
+    QVERIFY(result == std::vector<QHostAddress>({ QHostAddress("192.0.2.1") }));
+
+    // Every server times out
+    resolver.setServers({ QSS::Address(QHostAddress::LocalHost, silent.localPort()) });
+    resolver.setAttempts(2);
+    done = false;
+    resolver.resolve("example.com", [&](const std::vector<QHostAddress> &addresses, int) {
+        done = true;
+        result = addresses;
+    });
+    QTRY_VERIFY(done);
+    QVERIFY(result.empty());
+    QCOMPARE(dropped, 3);
+}
+
+void DnsResolver::testTruncated()
+{
+    // The stand-in listens on the same port for UDP and TCP
+    QTcpServer tcpServer;
+    QVERIFY(tcpServer.listen(QHostAddress::LocalHost));
+    QUdpSocket udpServer;
+    QVERIFY(udpServer.bind(QHostAddress::LocalHost, tcpServer.serverPort()));
+    connect(&udpServer, &QUdpSocket::readyRead, this, [&udpServer]() {
+        while (udpServer.hasPendingDatagrams()) {
+            std::string query(static_cast<size_t>(udpServer.pendingDatagramSize()), '\0');
+            QHostAddress sender;
+            quint16 port = 0;
+            udpServer.readDatagram(&query[0], query.size(), &sender, &port);
+            const std::string response = answer(query, true);
+            udpServer.writeDatagram(response.data(), response.size(), sender, port);
+        }
+    });
+    connect(&tcpServer, &QTcpServer::newConnection, this, [&tcpServer]() {
+        QTcpSocket *socket = tcpServer.nextPendingConnection();
+        connect(socket, &QTcpSocket::readyRead, socket, [socket]() {
+            const QByteArray data = socket->readAll();
+            const std::string query(data.constData() + 2, data.size() - 2);
+            const std::string response = answer(query);
+            uchar length[2];
+            qToBigEndian(static_cast<quint16>(response.size()), length);
+            socket->write(reinterpret_cast<const char *>(length), 2);
+            socket->write(response.data(), response.size());
+        });
+    });
+
+    QSS::DnsResolver resolver;
+    resolver.setServers({ QSS::Address(QHostAddress::LocalHost, tcpServer.serverPort()) });
+    resolver.setIPv6Enabled(false);
+    std::vector<QHostAddress> result;
+    bool done = false;
+    resolver.resolve("example.com", [&](const std::vector<QHostAddress> &addresses, int) {
+        done = true;
+        result = addresses;
+    });
+    QTRY_VERIFY(done);
+    QVERIFY(result == std::vector<QHostAddress>({ QHostAddress("192.0.2.1") }));
+}
+
+void DnsResolver::testHosts()
+{
+    QSS::DnsResolver resolver;
+    resolver.setHosts({ { "router.lan", { QHostAddress("192.168.1.1") } } });
+    std::vector<QHostAddress> result;
+    bool done = false;
+    resolver.resolve("ROUTER.lan", [&](const std::vector<QHostAddress> &addresses, int) {
+        done = true;
+        result = addresses;
+    });
+    // Answered from the event loop, not in resolve()
+    QVERIFY(!done);
+    QTRY_VERIFY(done);
+    QVERIFY(result == std::vector<QHostAddress>({ QHostAddress("192.168.1.1") }));
+}
+
+QTEST_MAIN(DnsResolver)
+#include "dnsresolver.moc"
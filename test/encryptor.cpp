@@ -13,11 +13,13 @@ public:
 
 private Q_SLOTS:
     void selfTestEncryptDecrypt();
+    void testEncryptAppend();
 #ifdef USE_BOTAN2
     void testAesGcm();
     void testAesGcmUdp();
     void testAesGcmMultiChunks();
     void testAesGcmIncompleteChunks();
+    void testAesGcmAppendLarge();
 #endif
 };
 
@@ -31,6 +33,21 @@ void Encryptor::selfTestEncryptDecrypt()
     QCOMPARE(decryptor.decrypt(encryptor.encrypt(testData)), testData);
 }
 
+void Encryptor::testEncryptAppend()
+{
+    std::string method("chacha20");
+    std::string password("test");
+    QSS::Encryptor encryptor(method, password);
+    QSS::Encryptor decryptor(method, password);
+
+    // Appended after what's in out already
+    std::string out("prefix");
+    encryptor.encrypt(reinterpret_cast<const uint8_t *>(testData.data()), testData.size(), out);
+    encryptor.encrypt(reinterpret_cast<const uint8_t *>(testData.data()), testData.size(), out);
+    QCOMPARE(out.substr(0, 6), std::string("prefix"));
+    QCOMPARE(decryptor.decrypt(out.substr(6)), testData + testData);
+}
+
 #ifdef USE_BOTAN2
 void Encryptor::testAesGcm()
 {
@@ -114,6 +131,25 @@ void Encryptor::testAesGcmIncompleteChunks()
     decrypted += decryptor.decrypt(encrypted.substr(2));
     QCOMPARE(decrypted, testData);
 }
+
+void Encryptor::testAesGcmAppendLarge()
+{
+    const std::string method("aes-256-gcm");
+    const std::string password("test");
+    const auto cInfo = QSS::Cipher::cipherInfoMap.at(method);
+    QSS::Encryptor encryptor(method, password);
+    QSS::Encryptor decryptor(method, password);
+
+    // Split into chunks of at most 0x3FFF bytes
+    std::string data(0x3FFF * 2 + 100, 'x');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i);
+    }
+    std::string out;
+    encryptor.encrypt(reinterpret_cast<const uint8_t *>(data.data()), data.size(), out);
+    QCOMPARE(out.length(), cInfo.saltLen + data.length() + 3 * (2 + 2 * cInfo.tagLen));
+    QCOMPARE(decryptor.decrypt(out), data);
+}
 #endif
 
 QTEST_MAIN(Encryptor)
@@ -0,0 +1,66 @@
+#include "types/endpoint.h"
+#include <QHostAddress>
+#include <QtTest>
+
+class Endpoint : public QObject
+{
+    Q_OBJECT
+
+public:
+    Endpoint() = default;
+
+private Q_SLOTS:
+    void testIPv4();
+    void testIPv6();
+    void testInvalid();
+    void testHash();
+};
+
+void Endpoint::testIPv4()
+{
+    QHostAddress ip("192.168.1.20");
+    QSS::Endpoint e(ip, 1080);
+    QCOMPARE(e.family, QSS::Endpoint::IPv4);
+    QCOMPARE(e.port, uint16_t(1080));
+    QCOMPARE(int(e.ip[0]), 192);
+    QCOMPARE(int(e.ip[3]), 20);
+    QCOMPARE(int(e.ip[4]), 0);
+    QCOMPARE(e.address(), ip);
+    QCOMPARE(e.toString(), std::string("192.168.1.20:1080"));
+}
+
+void Endpoint::testIPv6()
+{
+    QHostAddress ip("2001:db8::1");
+    QSS::Endpoint e(ip, 53);
+    QCOMPARE(e.family, QSS::Endpoint::IPv6);
+    QCOMPARE(int(e.ip[0]), 0x20);
+    QCOMPARE(int(e.ip[15]), 1);
+    QCOMPARE(e.address(), ip);
+    QCOMPARE(e.toString(), std::string("[2001:db8::1]:53"));
+}
+
+void Endpoint::testInvalid()
+{
+    QSS::Endpoint e(QHostAddress(), 53);
+    QCOMPARE(e.family, QSS::Endpoint::None);
+    QVERIFY(e.address().isNull());
+    QVERIFY(e == QSS::Endpoint(QHostAddress(), 53));
+}
+
+void Endpoint::testHash()
+{
+    QSS::EndpointHash hash;
+    QSS::Endpoint a(QHostAddress("127.0.0.1"), 1080);
+    QSS::Endpoint b(QHostAddress("127.0.0.1"), 1081);
+    QSS::Endpoint c(QHostAddress("::ffff:127.0.0.1"), 1080);
+    QVERIFY(a == QSS::Endpoint(QHostAddress("127.0.0.1"), 1080));
+    QCOMPARE(hash(a), hash(QSS::Endpoint(QHostAddress("127.0.0.1"), 1080)));
+    QVERIFY(a != b);
+    QVERIFY(hash(a) != hash(b));
+    // Families are distinct even for a mapped IPv4 address
+    QVERIFY(a != c);
+}
+
+QTEST_MAIN(Endpoint)
+#include "endpoint.moc"
@@ -0,0 +1,156 @@
+#include "crypto/encryptor.h"
+#include "network/tcpserver.h"
+#include "util/common.h"
+
+#include <QTcpServer>
+#include <QtTest>
+#include <functional>
+#include <sys/socket.h>
+
+namespace {
+
+const char Method[] = "aes-256-gcm";
+const char Password[] = "test";
+
+std::string pattern(size_t size)
+{
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = static_cast<char>('a' + i % 26);
+    }
+    return data;
+}
+
+}  // namespace
+
+// Relays through TcpServer with the epoll backend
+class EpollEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    EpollEngine() = default;
+
+private Q_SLOTS:
+    void initTestCase();
+    void testServer();
+    void testLocal();
+
+private:
+    // Echoes everything back, and closes once the peer finished sending
+    QTcpServer echo;
+
+    std::unique_ptr<QSS::TcpServer> startServer();
+    // Sends data, shuts the sending side down and waits for the echo and
+    // the end of the connection
+    static void sendAndShutdown(QTcpSocket &client, const std::string &data,
+                                const std::function<std::string(const std::string&)> &encode,
+                                std::string &received);
+};
+
+void EpollEngine::initTestCase()
+{
+    QVERIFY(echo.listen(QHostAddress::LocalHost));
+    connect(&echo, &QTcpServer::newConnection, this, [this]() {
+        while (echo.hasPendingConnections()) {
+            QTcpSocket *socket = echo.nextPendingConnection();
+            connect(socket, &QTcpSocket::readyRead, socket, [socket]() {
+                socket->write(socket->readAll());
+            });
+            connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+        }
+    });
+}
+
+std::unique_ptr<QSS::TcpServer> EpollEngine::startServer()
+{
+    std::unique_ptr<QSS::TcpServer> server(
+                new QSS::TcpServer(Method, Password, 60, false, false,
+                                   QSS::Address(QHostAddress::LocalHost, 0)));
+    server->setBackend(QSS::TcpServer::EpollBackend);
+    if (!server->listen(QHostAddress::LocalHost, 0)) {
+        return nullptr;
+    }
+    return server;
+}
+
+void EpollEngine::sendAndShutdown(QTcpSocket &client, const std::string &data,
+                                  const std::function<std::string(const std::string&)> &encode,
+                                  std::string &received)
+{
+    // In pieces, so that the relay reads in several rounds
+    const size_t piece = 65536;
+    for (size_t pos = 0; pos < data.size(); pos += piece) {
+        const std::string out = encode(data.substr(pos, piece));
+        client.write(out.data(), out.size());
+    }
+    QTRY_COMPARE_WITH_TIMEOUT(client.bytesToWrite(), qint64(0), 20000);
+    // The echo of what is still on the way must arrive nevertheless
+    QCOMPARE(::shutdown(client.socketDescriptor(), SHUT_WR), 0);
+    QTRY_COMPARE_WITH_TIMEOUT(received.size(), data.size(), 20000);
+    QVERIFY(received == data);
+    // Both sides finished, so the relay closes the connection
+    QTRY_COMPARE_WITH_TIMEOUT(client.state(), QAbstractSocket::UnconnectedState, 5000);
+}
+
+void EpollEngine::testServer()
+{
+    std::unique_ptr<QSS::TcpServer> server = startServer();
+    QVERIFY(server);
+
+    QSS::Encryptor encryptor(Method, Password);
+    QTcpSocket client;
+    std::string received;
+    connect(&client, &QTcpSocket::readyRead, this, [&]() {
+        const QByteArray buf = client.readAll();
+        received += encryptor.decrypt(std::string(buf.constData(), buf.size()));
+    });
+    client.connectToHost(QHostAddress::LocalHost, server->serverPort());
+    QVERIFY(client.waitForConnected(3000));
+
+    // The address header goes with the first piece of data
+    bool first = true;
+    const std::string header = QSS::Common::packAddress(
+                QSS::Address(QHostAddress::LocalHost, echo.serverPort()));
+    sendAndShutdown(client, pattern(8 * 1024 * 1024), [&](const std::string &data) {
+        const std::string plain = first ? header + data : data;
+        first = false;
+        return encryptor.encrypt(plain);
+    }, received);
+}
+
+void EpollEngine::testLocal()
+{
+    std::unique_ptr<QSS::TcpServer> server = startServer();
+    QVERIFY(server);
+    QSS::TcpServer local(Method, Password, 60, true, false,
+                         QSS::Address(QHostAddress::LocalHost, server->serverPort()));
+    local.setBackend(QSS::TcpServer::EpollBackend);
+    QVERIFY(local.listen(QHostAddress::LocalHost, 0));
+
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, local.serverPort());
+    QVERIFY(client.waitForConnected(3000));
+    client.write(QByteArray("\x05\x01\x00", 3));
+    QTRY_COMPARE(client.bytesAvailable(), qint64(2));
+    QCOMPARE(client.readAll(), QByteArray("\x05\x00", 2));
+
+    const std::string request = std::string("\x05\x01\x00", 3) + QSS::Common::packAddress(
+                QSS::Address(QHostAddress::LocalHost, echo.serverPort()));
+    client.write(request.data(), request.size());
+    QTRY_COMPARE(client.bytesAvailable(), qint64(10));
+    QCOMPARE(client.read(2), QByteArray("\x05\x00", 2));
+    client.readAll();
+
+    std::string received;
+    connect(&client, &QTcpSocket::readyRead, this, [&]() {
+        const QByteArray buf = client.readAll();
+        received.append(buf.constData(), buf.size());
+    });
+    sendAndShutdown(client, pattern(4 * 1024 * 1024), [](const std::string &data) {
+        return data;
+    }, received);
+}
+
+QTEST_MAIN(EpollEngine)
+#include "epollengine.moc"
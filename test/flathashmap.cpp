@@ -0,0 +1,104 @@
+#include "util/flathashmap.h"
+#include <QtTest>
+#include <map>
+#include <memory>
+
+namespace {
+// Clusters keys on purpose, so erasing has to shift entries back
+struct PoorHash {
+    size_t operator()(int key) const { return static_cast<size_t>(key % 4); }
+};
+}
+
+class FlatHashMap : public QObject
+{
+    Q_OBJECT
+
+public:
+    FlatHashMap() = default;
+
+private Q_SLOTS:
+    void testInsert();
+    void testErase();
+    void testChurn();
+    void testMoveOnly();
+};
+
+void FlatHashMap::testInsert()
+{
+    QSS::FlatHashMap<int, int, std::hash<int>> map;
+    QVERIFY(map.empty());
+    QVERIFY(map.find(1) == nullptr);
+    auto inserted = map.insert(1, 10);
+    QVERIFY(inserted.second);
+    QCOMPARE(*inserted.first, 10);
+    inserted = map.insert(1, 20);
+    QVERIFY(!inserted.second);
+    QCOMPARE(*inserted.first, 10);
+    // Grows past the initial capacity
+    for (int i = 2; i <= 100; ++i) {
+        map.insert(i, i * 10);
+    }
+    QCOMPARE(map.size(), size_t(100));
+    for (int i = 1; i <= 100; ++i) {
+        QVERIFY(map.find(i) != nullptr);
+        QCOMPARE(*map.find(i), i * 10);
+    }
+    map.clear();
+    QVERIFY(map.empty());
+    QVERIFY(map.find(1) == nullptr);
+}
+
+void FlatHashMap::testErase()
+{
+    QSS::FlatHashMap<int, int, PoorHash> map;
+    for (int i = 0; i < 10; ++i) {
+        map.insert(i, i);
+    }
+    QVERIFY(map.erase(4));
+    QVERIFY(!map.erase(4));
+    QVERIFY(!map.erase(42));
+    QCOMPARE(map.size(), size_t(9));
+    for (int i = 0; i < 10; ++i) {
+        QCOMPARE(map.find(i) != nullptr, i != 4);
+    }
+}
+
+void FlatHashMap::testChurn()
+{
+    QSS::FlatHashMap<int, int, PoorHash> map;
+    std::map<int, int> expected;
+    uint32_t seed = 1;
+    for (int round = 0; round < 20000; ++round) {
+        seed = seed * 1103515245 + 12345;
+        const int key = (seed >> 16) % 200;
+        if ((seed >> 8) % 2 == 0) {
+            map.insert(key, round);
+            expected.insert(std::make_pair(key, round));
+        } else {
+            QCOMPARE(map.erase(key), expected.erase(key) == 1);
+        }
+    }
+    QCOMPARE(map.size(), expected.size());
+    for (int key = 0; key < 200; ++key) {
+        auto it = expected.find(key);
+        int *value = map.find(key);
+        QCOMPARE(value != nullptr, it != expected.end());
+        if (value) {
+            QCOMPARE(*value, it->second);
+        }
+    }
+}
+
+void FlatHashMap::testMoveOnly()
+{
+    QSS::FlatHashMap<int, std::unique_ptr<int>, std::hash<int>> map;
+    for (int i = 0; i < 50; ++i) {
+        map.insert(i, std::unique_ptr<int>(new int(i)));
+    }
+    QVERIFY(map.erase(7));
+    QCOMPARE(**map.find(49), 49);
+}
+
+QTEST_MAIN(FlatHashMap)
+#include "flathashmap.moc"
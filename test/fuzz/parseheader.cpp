@@ -0,0 +1,19 @@
+// libFuzzer target of Common::parseHeader, seeded by ../corpus/parseheader
+#include "types/address.h"
+#include "util/common.h"
+
+#include <cstdlib>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    const QSS::Common::AddressHeader header =
+            QSS::Common::parseHeader(reinterpret_cast<const char *>(data), size);
+    if (header.length > size) {
+        abort();
+    }
+    if (header.length > 0) {
+        QSS::Address address;
+        header.toAddress(address);
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "network/happyeyeballs.h"
+
+#include <QTcpServer>
+#include <QtTest>
+
+class HappyEyeballs : public QObject
+{
+    Q_OBJECT
+
+public:
+    HappyEyeballs() = default;
+
+private Q_SLOTS:
+    void testInterleave();
+    void testFallback();
+    void testFailure();
+};
+
+void HappyEyeballs::testInterleave()
+{
+    const QHostAddress v6a("2001:db8::1"), v6b("2001:db8::2"), v6c("2001:db8::3");
+    const QHostAddress v4a("192.0.2.1"), v4b("192.0.2.2");
+
+    std::vector<QHostAddress> ordered = QSS::HappyEyeballs::interleave({v6a, v6b, v6c, v4a, v4b});
+    QVERIFY(ordered == std::vector<QHostAddress>({v6a, v4a, v6b, v4b, v6c}));
+
+    // The family of the first address goes first
+    ordered = QSS::HappyEyeballs::interleave({v4a, v6a, v6b, v4b});
+    QVERIFY(ordered == std::vector<QHostAddress>({v4a, v6a, v4b, v6b}));
+
+    ordered = QSS::HappyEyeballs::interleave({v4a, v4b});
+    QVERIFY(ordered == std::vector<QHostAddress>({v4a, v4b}));
+    QVERIFY(QSS::HappyEyeballs::interleave({}).empty());
+}
+
+void HappyEyeballs::testFallback()
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    // Nothing listens on the IPv6 loopback address with this port
+    QSS::HappyEyeballs eyeballs({QHostAddress::LocalHostIPv6, QHostAddress::LocalHost},
+                                server.serverPort());
+    bool connected = false;
+    connect(&eyeballs, &QSS::HappyEyeballs::connected, this, [&connected]() {
+        connected = true;
+    });
+    eyeballs.start();
+    QTRY_VERIFY(connected);
+
+    std::unique_ptr<QTcpSocket> socket = eyeballs.takeSocket();
+    QVERIFY(socket);
+    QCOMPARE(socket->peerAddress(), QHostAddress(QHostAddress::LocalHost));
+    QVERIFY(!eyeballs.takeSocket());
+}
+
+void HappyEyeballs::testFailure()
+{
+    // Reserves a port and closes it, so that connecting to it is refused
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    const quint16 port = server.serverPort();
+    server.close();
+
+    QSS::HappyEyeballs eyeballs({QHostAddress::LocalHost, QHostAddress::LocalHostIPv6}, port);
+    eyeballs.setAttemptDelay(5000);
+    bool failed = false;
+    connect(&eyeballs, &QSS::HappyEyeballs::failed, this, [&failed]() {
+        failed = true;
+    });
+    eyeballs.start();
+    // A refused attempt starts the next one without waiting for the delay
+    QTRY_VERIFY_WITH_TIMEOUT(failed, 2000);
+    QVERIFY(!eyeballs.takeSocket());
+}
+
+QTEST_MAIN(HappyEyeballs)
+#include "happyeyeballs.moc"
@@ -0,0 +1,216 @@
+#include "network/httpconnection.h"
+#include "network/httporiginpool.h"
+#include "network/streamchannel.h"
+
+#include <QTcpServer>
+#include <QtTest>
+
+namespace {
+
+class FakeChannel : public QSS::StreamChannel
+{
+public:
+    void write(const std::string &) override {}
+    void close() override { closed = true; }
+    void abort() override { closed = true; }
+    void consumed(uint64_t) override {}
+    int64_t pending() const override { return 0; }
+    bool isClosed() const override { return closed; }
+
+    bool closed = false;
+};
+
+}
+
+class HttpOriginPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    HttpOriginPool() = default;
+
+private Q_SLOTS:
+    void testReuse();
+    void testPerHostLimit();
+    void testTotalLimit();
+    void testServerClose();
+    void testIdleTime();
+    void testActiveLimit();
+    void testClientGone();
+
+private:
+    int opened = 0;
+    std::shared_ptr<FakeChannel> last;
+
+    QSS::HttpOriginPool::Opener opener();
+};
+
+QSS::HttpOriginPool::Opener HttpOriginPool::opener()
+{
+    return [this](const QSS::Address &) {
+        ++opened;
+        last = std::make_shared<FakeChannel>();
+        return last;
+    };
+}
+
+void HttpOriginPool::testReuse()
+{
+    opened = 0;
+    QSS::HttpOriginPool pool(opener());
+    const QSS::Address destination("example.com", 80);
+    std::shared_ptr<QSS::StreamChannel> first = pool.acquire("example.com:80", destination);
+    QVERIFY(first);
+    QCOMPARE(opened, 1);
+    pool.release("example.com:80", first);
+    QCOMPARE(pool.idleCount(), 1);
+
+    // Another host doesn't get it
+    pool.acquire("example.org:80", QSS::Address("example.org", 80));
+    QCOMPARE(opened, 2);
+    QCOMPARE(pool.idleCount(), 1);
+
+    std::shared_ptr<QSS::StreamChannel> second = pool.acquire("example.com:80", destination);
+    QVERIFY(second == first);
+    QCOMPARE(opened, 2);
+    QCOMPARE(pool.idleCount(), 0);
+    QCOMPARE(pool.reuseCount(), quint64(1));
+}
+
+void HttpOriginPool::testPerHostLimit()
+{
+    QSS::HttpOriginPool pool(opener());
+    pool.setMaxIdlePerHost(2);
+    const QSS::Address destination("example.com", 80);
+    std::vector<std::shared_ptr<QSS::StreamChannel>> streams;
+    for (int i = 0; i < 3; ++i) {
+        streams.push_back(pool.acquire("example.com:80", destination));
+    }
+    for (const auto &stream : streams) {
+        pool.release("example.com:80", stream);
+    }
+    QCOMPARE(pool.idleCount(), 2);
+    // The oldest one is closed
+    QVERIFY(streams[0]->isClosed());
+    QVERIFY(!streams[1]->isClosed());
+    // Newest first
+    QVERIFY(pool.acquire("example.com:80", destination) == streams[2]);
+}
+
+void HttpOriginPool::testTotalLimit()
+{
+    QSS::HttpOriginPool pool(opener());
+    pool.setMaxIdle(2);
+    std::vector<std::shared_ptr<QSS::StreamChannel>> streams;
+    for (int i = 0; i < 3; ++i) {
+        const QByteArray host = "host" + QByteArray::number(i);
+        streams.push_back(pool.acquire(host + ":80", QSS::Address(host.constData(), 80)));
+        pool.release(host + ":80", streams.back());
+    }
+    QCOMPARE(pool.idleCount(), 2);
+    QVERIFY(streams[0]->isClosed());
+    QVERIFY(!streams[2]->isClosed());
+}
+
+void HttpOriginPool::testServerClose()
+{
+    opened = 0;
+    QSS::HttpOriginPool pool(opener());
+    const QSS::Address destination("example.com", 80);
+    std::shared_ptr<QSS::StreamChannel> first = pool.acquire("example.com:80", destination);
+    std::shared_ptr<QSS::StreamChannel> second = pool.acquire("example.com:80", destination);
+    pool.release("example.com:80", first);
+    pool.release("example.com:80", second);
+    QCOMPARE(pool.idleCount(), 2);
+
+    emit first->finished();
+    QCOMPARE(pool.idleCount(), 1);
+    // Anything sent on an idle stream means it's about to be closed
+    emit second->dataReceived(std::string("HTTP/1.1 408 Request Timeout\r\n"));
+    QCOMPARE(pool.idleCount(), 0);
+
+    pool.acquire("example.com:80", destination);
+    QCOMPARE(opened, 3);
+
+    // A closed stream isn't taken back
+    pool.release("example.com:80", first);
+    QCOMPARE(pool.idleCount(), 0);
+}
+
+void HttpOriginPool::testIdleTime()
+{
+    QSS::HttpOriginPool pool(opener());
+    pool.setMaxIdleTime(0);
+    std::shared_ptr<QSS::StreamChannel> stream =
+            pool.acquire("example.com:80", QSS::Address("example.com", 80));
+    pool.release("example.com:80", stream);
+    QCOMPARE(pool.idleCount(), 1);
+    QTRY_COMPARE_WITH_TIMEOUT(pool.idleCount(), 0, 3000);
+    QVERIFY(stream->isClosed());
+}
+
+void HttpOriginPool::testActiveLimit()
+{
+    opened = 0;
+    QSS::HttpOriginPool pool(opener());
+    pool.setMaxActivePerHost(2);
+    const QSS::Address destination("example.com", 80);
+    std::shared_ptr<QSS::StreamChannel> first = pool.acquire("example.com:80", destination);
+    std::shared_ptr<QSS::StreamChannel> second = pool.acquire("example.com:80", destination);
+    QVERIFY(!pool.acquire("example.com:80", destination));
+    QCOMPARE(pool.activeCount("example.com:80"), 2);
+    // Other hosts aren't affected
+    QVERIFY(pool.acquire("example.org:80", QSS::Address("example.org", 80)));
+
+    std::shared_ptr<QSS::StreamChannel> third;
+    QObject context;
+    pool.wait("example.com:80", &context, [&]() {
+        third = pool.acquire("example.com:80", destination);
+    });
+    QTest::qWait(10);
+    QVERIFY(!third);
+
+    // The waiter gets the stream given back
+    pool.release("example.com:80", first);
+    QTRY_VERIFY(third == first);
+    QCOMPARE(opened, 3);
+
+    // or a new one once a stream is dropped
+    third.reset();
+    pool.wait("example.com:80", &context, [&]() {
+        third = pool.acquire("example.com:80", destination);
+    });
+    pool.drop("example.com:80", second, false);
+    QVERIFY(second->isClosed());
+    QTRY_VERIFY(third);
+    QCOMPARE(opened, 4);
+    QCOMPARE(pool.activeCount("example.com:80"), 2);
+}
+
+void HttpOriginPool::testClientGone()
+{
+    QSS::HttpOriginPool pool(opener());
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QTRY_VERIFY(server.hasPendingConnections());
+    QTcpSocket *socket = server.nextPendingConnection();
+    new QSS::HttpConnection(socket, &pool);
+    // Like HttpProxy does
+    connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+
+    client.write("GET / HTTP/1.1\r\nHost: example.com\r\n\r\n");
+    QTRY_COMPARE(pool.activeCount("example.com:80"), 1);
+    std::shared_ptr<FakeChannel> stream = last;
+    QVERIFY(!stream->isClosed());
+
+    // The client goes away before the response
+    client.disconnectFromHost();
+    QTRY_COMPARE(pool.activeCount("example.com:80"), 0);
+    QVERIFY(stream->isClosed());
+    QCOMPARE(pool.idleCount(), 0);
+}
+
+QTEST_MAIN(HttpOriginPool)
+#include "httporiginpool.moc"
@@ -0,0 +1,210 @@
+#include "network/httpparser.h"
+
+#include <QtTest>
+
+class HttpParser : public QObject
+{
+    Q_OBJECT
+
+public:
+    HttpParser() = default;
+
+private Q_SLOTS:
+    void testIncrementalHead();
+    void testPipelining();
+    void testChunked();
+    void testInvalid();
+    void testResponseFraming();
+    void testOriginForm();
+    void testSplitAuthority();
+
+private:
+    static QByteArray field(const QByteArray &data, QSS::HttpParser::Span span)
+    {
+        return data.mid(static_cast<int>(span.offset), static_cast<int>(span.length));
+    }
+};
+
+void HttpParser::testIncrementalHead()
+{
+    const QByteArray request = "GET http://example.com:8080/a?b HTTP/1.1\r\n"
+                               "Host: example.com\r\n"
+                               "Proxy-Connection: keep-alive\r\n\r\n";
+    QSS::HttpParser parser(QSS::HttpParser::Request);
+    for (int i = 1; i < request.size(); ++i) {
+        QCOMPARE(parser.parseHead(request.constData(), i), 0);
+    }
+    QCOMPARE(parser.parseHead(request.constData(), request.size()), request.size());
+    QCOMPARE(field(request, parser.method()), QByteArray("GET"));
+    QCOMPARE(field(request, parser.target()), QByteArray("http://example.com:8080/a?b"));
+    QCOMPARE(field(request, parser.host()), QByteArray("example.com"));
+    QCOMPARE(parser.headers().size(), size_t(2));
+    QCOMPARE(parser.framing(), QSS::HttpParser::NoBody);
+    QVERIFY(parser.keepAlive());
+    QVERIFY(parser.complete());
+    QVERIFY(!parser.isConnect());
+    QVERIFY(!parser.upgrade());
+}
+
+void HttpParser::testPipelining()
+{
+    const QByteArray data = "POST /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+                            "GET /b HTTP/1.0\r\nConnection: Upgrade\r\n\r\n"
+                            "CONNECT example.com:443 HTTP/1.1\r\n\r\ntunnel";
+    QSS::HttpParser parser(QSS::HttpParser::Request);
+    const char *pos = data.constData();
+    const char *end = pos + data.size();
+
+    int head = parser.parseHead(pos, end - pos);
+    QVERIFY(head > 0);
+    QCOMPARE(parser.framing(), QSS::HttpParser::ContentLength);
+    pos += head;
+    QCOMPARE(parser.parseBody(pos, end - pos), size_t(3));
+    QVERIFY(parser.complete());
+    pos += 3;
+
+    parser.reset();
+    head = parser.parseHead(pos, end - pos);
+    QVERIFY(head > 0);
+    QCOMPARE(parser.versionMinor(), 0);
+    QVERIFY(!parser.keepAlive());
+    QVERIFY(parser.upgrade());
+    QVERIFY(parser.complete());
+    pos += head;
+
+    parser.reset();
+    head = parser.parseHead(pos, end - pos);
+    QVERIFY(head > 0);
+    QVERIFY(parser.isConnect());
+    QCOMPARE(parser.framing(), QSS::HttpParser::Tunnel);
+    QCOMPARE(QByteArray(pos + head, static_cast<int>(end - pos - head)), QByteArray("tunnel"));
+}
+
+void HttpParser::testChunked()
+{
+    const QByteArray data = "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n"
+                            "5;ext=1\r\nhello\r\nA\r\n0123456789\r\n0\r\nTrailer: 1\r\n\r\nNEXT";
+    // Every split of the body must give the same boundary
+    for (int step = 1; step < 8; ++step) {
+        QSS::HttpParser parser(QSS::HttpParser::Request);
+        const int head = parser.parseHead(data.constData(), data.size());
+        QVERIFY(head > 0);
+        QCOMPARE(parser.framing(), QSS::HttpParser::Chunked);
+        int pos = head;
+        while (!parser.complete()) {
+            const int size = std::min(step, data.size() - pos);
+            QVERIFY(size > 0);
+            pos += static_cast<int>(parser.parseBody(data.constData() + pos, size));
+            QVERIFY(!parser.failed());
+        }
+        QCOMPARE(data.mid(pos), QByteArray("NEXT"));
+    }
+
+    QSS::HttpParser parser(QSS::HttpParser::Request);
+    const QByteArray invalid = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n";
+    const int head = parser.parseHead(invalid.constData(), invalid.size());
+    parser.parseBody(invalid.constData() + head, invalid.size() - head);
+    QVERIFY(parser.failed());
+}
+
+void HttpParser::testInvalid()
+{
+    const QList<QByteArray> heads = {
+        "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 4\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n",
+        "GET / HTTP/1.1\r\nA: b\r\n folded\r\n\r\n",
+        "GET / HTTP/1.1\r\nBad Name: x\r\n\r\n",
+        "GET  / HTTP/1.1\r\n\r\n",
+        "GET / HTTP/2.0\r\n\r\n"
+    };
+    for (const QByteArray &head : heads) {
+        QSS::HttpParser parser(QSS::HttpParser::Request);
+        QCOMPARE(parser.parseHead(head.constData(), head.size()), -1);
+    }
+
+    const QByteArray tooLong = "GET / HTTP/1.1\r\nX: " + QByteArray(QSS::HttpParser::MaxHeadSize, 'a');
+    QSS::HttpParser parser(QSS::HttpParser::Request);
+    QCOMPARE(parser.parseHead(tooLong.constData(), tooLong.size()), -1);
+}
+
+void HttpParser::testResponseFraming()
+{
+    QSS::HttpParser parser(QSS::HttpParser::Response);
+    const QByteArray head = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n";
+    parser.setHeadRequest(true);
+    QVERIFY(parser.parseHead(head.constData(), head.size()) > 0);
+    QCOMPARE(parser.framing(), QSS::HttpParser::NoBody);
+    QVERIFY(parser.complete());
+    QVERIFY(parser.keepAlive());
+
+    parser.reset();
+    const QByteArray untilClose = "HTTP/1.0 200 OK\r\n\r\nbody";
+    const int length = parser.parseHead(untilClose.constData(), untilClose.size());
+    QCOMPARE(parser.framing(), QSS::HttpParser::UntilClose);
+    QVERIFY(!parser.keepAlive());
+    QCOMPARE(parser.parseBody(untilClose.constData() + length, 4), size_t(4));
+    QVERIFY(!parser.complete());
+
+    parser.reset();
+    const QByteArray interim = "HTTP/1.1 100 Continue\r\n\r\n";
+    QVERIFY(parser.parseHead(interim.constData(), interim.size()) > 0);
+    QCOMPARE(parser.statusCode(), 100);
+    QVERIFY(parser.complete());
+
+    parser.reset();
+    const QByteArray noContent = "HTTP/1.1 204\r\n\r\n";
+    QVERIFY(parser.parseHead(noContent.constData(), noContent.size()) > 0);
+    QCOMPARE(parser.statusCode(), 204);
+    QVERIFY(parser.complete());
+}
+
+void HttpParser::testOriginForm()
+{
+    QByteArray request = "GET http://example.com/a?b HTTP/1.1\r\nHost: example.com\r\n\r\n";
+    QSS::HttpParser parser(QSS::HttpParser::Request);
+    const int length = parser.parseHead(request.constData(), request.size());
+    const int begin = parser.toOriginForm(request.data());
+    QVERIFY(begin > 0);
+    QCOMPARE(request.mid(begin, length - begin),
+             QByteArray("GET /a?b HTTP/1.1\r\nHost: example.com\r\n\r\n"));
+    QCOMPARE(field(request, parser.target()), QByteArray("/a?b"));
+
+    QByteArray noPath = "OPTIONS http://example.com HTTP/1.1\r\n\r\n";
+    parser.reset();
+    QVERIFY(parser.parseHead(noPath.constData(), noPath.size()) > 0);
+    QCOMPARE(noPath.mid(parser.toOriginForm(noPath.data())),
+             QByteArray("OPTIONS / HTTP/1.1\r\n\r\n"));
+
+    QByteArray originForm = "GET /a HTTP/1.1\r\n\r\n";
+    parser.reset();
+    QVERIFY(parser.parseHead(originForm.constData(), originForm.size()) > 0);
+    QCOMPARE(parser.toOriginForm(originForm.data()), -1);
+}
+
+void HttpParser::testSplitAuthority()
+{
+    QSS::HttpParser::Span host;
+    uint16_t port = 0;
+    const QByteArray ipv6 = "user:password@[::1]:8080";
+    QVERIFY(QSS::HttpParser::splitAuthority(ipv6.constData(), ipv6.size(), host, port, 80));
+    QCOMPARE(field(ipv6, host), QByteArray("::1"));
+    QCOMPARE(port, uint16_t(8080));
+
+    const QByteArray name = "example.com";
+    QVERIFY(QSS::HttpParser::splitAuthority(name.constData(), name.size(), host, port, 80));
+    QCOMPARE(field(name, host), QByteArray("example.com"));
+    QCOMPARE(port, uint16_t(80));
+
+    const QByteArray emptyPort = "example.com:";
+    QVERIFY(QSS::HttpParser::splitAuthority(emptyPort.constData(), emptyPort.size(), host, port, 443));
+    QCOMPARE(port, uint16_t(443));
+
+    const QByteArray badPort = "example.com:65536";
+    QVERIFY(!QSS::HttpParser::splitAuthority(badPort.constData(), badPort.size(), host, port, 80));
+    const QByteArray bareIpv6 = "::1";
+    QVERIFY(!QSS::HttpParser::splitAuthority(bareIpv6.constData(), bareIpv6.size(), host, port, 80));
+}
+
+QTEST_MAIN(HttpParser)
+#include "httpparser.moc"
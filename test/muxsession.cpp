@@ -0,0 +1,197 @@
+#include "network/muxsession.h"
+
+#include <QtTest>
+
+class MuxSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    MuxSession() = default;
+
+private Q_SLOTS:
+    void testHandshake();
+    void testStream();
+    void testFlowControl();
+    void testFairness();
+    void testClose();
+    void testProtocolError();
+    void testStreamLimit();
+
+private:
+    std::shared_ptr<QSS::MuxStream> accepted;
+    std::string acceptedHeader;
+
+    // Moves all the pending frames of from to to
+    static bool pump(QSS::MuxSession &from, QSS::MuxSession &to);
+    void connectPair(QSS::MuxSession &client, QSS::MuxSession &server);
+};
+
+bool MuxSession::pump(QSS::MuxSession &from, QSS::MuxSession &to)
+{
+    const std::string frames = from.takeFrames(1 << 24);
+    return frames.empty() || to.feed(frames);
+}
+
+void MuxSession::connectPair(QSS::MuxSession &client, QSS::MuxSession &server)
+{
+    accepted.reset();
+    acceptedHeader.clear();
+    connect(&server, &QSS::MuxSession::newStream, this,
+            [this](std::shared_ptr<QSS::MuxStream> stream, const std::string &header) {
+        accepted = stream;
+        acceptedHeader = header;
+    });
+    pump(server, client);
+}
+
+void MuxSession::testHandshake()
+{
+    QSS::MuxSession client(QSS::MuxSession::Client);
+    QSS::MuxSession server(QSS::MuxSession::Server);
+    QVERIFY(!client.isEstablished());
+    QVERIFY(client.openStream("header") == nullptr);
+    QVERIFY(pump(server, client));
+    QVERIFY(client.isEstablished());
+}
+
+void MuxSession::testStream()
+{
+    QSS::MuxSession client(QSS::MuxSession::Client);
+    QSS::MuxSession server(QSS::MuxSession::Server);
+    connectPair(client, server);
+
+    auto stream = client.openStream("header");
+    QVERIFY(stream);
+    stream->write("hello");
+    QVERIFY(pump(client, server));
+    QVERIFY(accepted);
+    QCOMPARE(acceptedHeader, std::string("header"));
+    QCOMPARE(server.streamCount(), size_t(1));
+
+    std::string received;
+    connect(stream.get(), &QSS::MuxStream::dataReceived, this, [&received](const std::string &d) {
+        received += d;
+    });
+    accepted->write("world");
+    QVERIFY(pump(server, client));
+    QCOMPARE(received, std::string("world"));
+}
+
+void MuxSession::testFlowControl()
+{
+    QSS::MuxSession client(QSS::MuxSession::Client);
+    QSS::MuxSession server(QSS::MuxSession::Server);
+    connectPair(client, server);
+    auto stream = client.openStream("header");
+    QVERIFY(pump(client, server));
+
+    size_t received = 0;
+    connect(stream.get(), &QSS::MuxStream::dataReceived, this, [&received](const std::string &d) {
+        received += d.size();
+    });
+    const int64_t total = 4 * QSS::MuxSession::InitialWindow;
+    accepted->write(std::string(total, 'x'));
+    QVERIFY(pump(server, client));
+    QCOMPARE(int64_t(received), QSS::MuxSession::InitialWindow);
+    QCOMPARE(accepted->pending(), total - QSS::MuxSession::InitialWindow);
+
+    // Nothing more until the receiver consumed the data
+    QVERIFY(pump(server, client));
+    QCOMPARE(int64_t(received), QSS::MuxSession::InitialWindow);
+    stream->consumed(received);
+    QVERIFY(pump(client, server));
+    QVERIFY(pump(server, client));
+    QCOMPARE(int64_t(received), 2 * QSS::MuxSession::InitialWindow);
+}
+
+void MuxSession::testFairness()
+{
+    QSS::MuxSession client(QSS::MuxSession::Client);
+    QSS::MuxSession server(QSS::MuxSession::Server);
+    connectPair(client, server);
+    auto bulk = client.openStream("bulk");
+    auto small = client.openStream("small");
+    QVERIFY(pump(client, server));
+
+    bulk->write(std::string(QSS::MuxSession::InitialWindow, 'b'));
+    small->write("s");
+    // The small stream gets its turn right after the first frame of bulk
+    const std::string frames = client.takeFrames(2 * QSS::MuxSession::MaxFramePayload);
+    QVERIFY(frames.size() <= 2 * QSS::MuxSession::MaxFramePayload);
+    QVERIFY(frames.find('s') != std::string::npos);
+    QVERIFY(bulk->pending() > 0);
+}
+
+void MuxSession::testClose()
+{
+    QSS::MuxSession client(QSS::MuxSession::Client);
+    QSS::MuxSession server(QSS::MuxSession::Server);
+    connectPair(client, server);
+    auto stream = client.openStream("header");
+    stream->write("data");
+    stream->close();
+    QVERIFY(pump(client, server));
+
+    // FIN arrived along with the data, the server side is still open
+    QVERIFY(stream->isClosed());
+    QVERIFY(!accepted->isClosed());
+    QCOMPARE(server.streamCount(), size_t(1));
+
+    accepted->close();
+    QVERIFY(pump(server, client));
+    QCOMPARE(client.streamCount(), size_t(0));
+    QCOMPARE(server.streamCount(), size_t(0));
+
+    auto other = client.openStream("other");
+    bool aborted = false;
+    connect(other.get(), &QSS::MuxStream::aborted, this, [&aborted]() {
+        aborted = true;
+    });
+    QVERIFY(pump(client, server));
+    accepted->abort();
+    QVERIFY(pump(server, client));
+    QVERIFY(aborted);
+    QCOMPARE(client.streamCount(), size_t(0));
+}
+
+void MuxSession::testProtocolError()
+{
+    QSS::MuxSession server(QSS::MuxSession::Server);
+    // Unknown frame type
+    QVERIFY(!server.feed(std::string("\x09\x00\x00\x00\x01\x00\x00", 7)));
+
+    QSS::MuxSession client(QSS::MuxSession::Client);
+    // A server never opens streams
+    QVERIFY(!client.feed(std::string("\x01\x00\x00\x00\x01\x00\x00", 7)));
+}
+
+void MuxSession::testStreamLimit()
+{
+    // A frame without payload
+    const auto frame = [](char type, uint32_t id) {
+        const char f[] = { type, char(id >> 24), char(id >> 16), char(id >> 8), char(id), 0, 0 };
+        return std::string(f, sizeof(f));
+    };
+    QSS::MuxSession server(QSS::MuxSession::Server);
+    server.takeFrames(1 << 24);
+    const uint32_t last = QSS::MuxSession::MaxStreams + 1;
+    std::string syn;
+    for (uint32_t id = 1; id <= last; ++id) {
+        syn += frame(1, id);
+    }
+    QVERIFY(server.feed(syn));
+    QCOMPARE(server.streamCount(), size_t(QSS::MuxSession::MaxStreams));
+    // The one above the limit is reset
+    QCOMPARE(server.takeFrames(1 << 24), frame(4, last));
+
+    // Resets that are never taken pile up until the session is dropped
+    bool ok = true;
+    for (uint32_t id = last + 1; ok && id < last + 65536; ++id) {
+        ok = server.feed(frame(1, id));
+    }
+    QVERIFY(!ok);
+}
+
+QTEST_MAIN(MuxSession)
+#include "muxsession.moc"
@@ -30,6 +30,18 @@ void Profile::testConstructorEmpty()
     QCOMPARE(600, p.timeout());
     QVERIFY(!p.debug());
     QVERIFY(!p.httpProxy());
+    QCOMPARE(0, p.tcpNotSentLowat());
+    QCOMPARE(0, p.tcpHighWatermark());
+    QCOMPARE(0, p.tcpLowWatermark());
+    QVERIFY(!p.fastOpen());
+    QCOMPARE(0, p.connectionPoolSize());
+    QCOMPARE(0, p.muxSessions());
+    QCOMPARE(0, p.stripePaths());
+    QVERIFY(!p.udpOffload());
+    QCOMPARE(0, p.udpSharedSockets());
+    QCOMPARE(0, p.tcpReadBudget());
+    QCOMPARE(0, p.udpReadBudget());
+    QCOMPARE(0, p.socksPort());
 }
 
 void Profile::testFromUri()
@@ -0,0 +1,81 @@
+#include "network/stripegroup.h"
+
+#include <QtTest>
+
+class StripeGroup : public QObject
+{
+    Q_OBJECT
+
+public:
+    StripeGroup() = default;
+
+private Q_SLOTS:
+    void testHello();
+    void testInvalidHello();
+    void testRegistry();
+};
+
+void StripeGroup::testHello()
+{
+    const std::string groupId("\x01\x02\x03\x04\x05\x06\x07\x08", 8);
+    const std::string header("\x01\x7f\x00\x00\x01\x00\x50", 7);
+    const std::string hello = QSS::StripeGroup::hello(groupId, 2, 4, header);
+
+    std::string id;
+    std::string parsedHeader;
+    int index = 0;
+    int count = 0;
+    QCOMPARE(QSS::StripeGroup::parseHello(hello + "rest", id, index, count, parsedHeader),
+             hello.size());
+    QVERIFY(id == groupId);
+    QCOMPARE(index, 2);
+    QCOMPARE(count, 4);
+    QVERIFY(parsedHeader == header);
+
+    // Incomplete
+    QCOMPARE(QSS::StripeGroup::parseHello(hello.substr(0, hello.size() - 1),
+                                          id, index, count, parsedHeader),
+             size_t(0));
+}
+
+void StripeGroup::testInvalidHello()
+{
+    const std::string groupId(8, 'g');
+    const std::string header("\x01\x7f\x00\x00\x01\x00\x50", 7);
+    std::string id;
+    std::string parsedHeader;
+    int index = 0;
+    int count = 0;
+    // index out of range
+    QCOMPARE(QSS::StripeGroup::parseHello(QSS::StripeGroup::hello(groupId, 4, 4, header),
+                                          id, index, count, parsedHeader),
+             size_t(0));
+    // Too many paths
+    QCOMPARE(QSS::StripeGroup::parseHello(QSS::StripeGroup::hello(groupId, 0, 17, header),
+                                          id, index, count, parsedHeader),
+             size_t(0));
+    // No address header
+    QCOMPARE(QSS::StripeGroup::parseHello(QSS::StripeGroup::hello(groupId, 0, 2, std::string()),
+                                          id, index, count, parsedHeader),
+             size_t(0));
+}
+
+void StripeGroup::testRegistry()
+{
+    QSS::StripeRegistry registry;
+    bool created = false;
+    auto group = registry.join("aaaaaaaa", 2, created);
+    QVERIFY(created);
+    QVERIFY(registry.join("aaaaaaaa", 2, created) == group);
+    QVERIFY(!created);
+    QVERIFY(registry.join("bbbbbbbb", 2, created) != group);
+    QVERIFY(created);
+
+    // Groups are forgotten once all their paths are gone
+    group.reset();
+    registry.join("aaaaaaaa", 2, created);
+    QVERIFY(created);
+}
+
+QTEST_MAIN(StripeGroup)
+#include "stripegroup.moc"
@@ -0,0 +1,95 @@
+#include "network/tcprelay.h"
+
+#include <QTcpServer>
+#include <QtTest>
+
+namespace {
+
+// Passes the bytes through unchanged, only the backpressure is under test
+class PlainRelay : public QSS::TcpRelay
+{
+public:
+    static const int64_t High = 256 * 1024;
+    static const int64_t Low = 64 * 1024;
+
+    PlainRelay(QTcpSocket *localSocket, std::unique_ptr<QTcpSocket> remoteSocket) :
+        QSS::TcpRelay(localSocket, 60000, QSS::Address(), "aes-256-gcm", "test", true)
+    {
+        plainRemote = true;
+        setWatermarks(High, Low);
+        adoptRemote(std::move(remoteSocket));
+    }
+
+    bool localPaused() const
+    {
+        return localReadPaused;
+    }
+
+    int64_t pending() const
+    {
+        return pendingToRemote();
+    }
+
+protected:
+    void openRemote(const std::string &, std::string) override {}
+};
+
+}  // namespace
+
+class TcpRelay : public QObject
+{
+    Q_OBJECT
+
+public:
+    TcpRelay() = default;
+
+private Q_SLOTS:
+    void testBackpressure();
+};
+
+void TcpRelay::testBackpressure()
+{
+    // client -> local [PlainRelay] remote -> origin
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QTRY_VERIFY(server.hasPendingConnections());
+    QTcpSocket *local = server.nextPendingConnection();
+    local->setParent(nullptr);
+
+    std::unique_ptr<QTcpSocket> remote(new QTcpSocket());
+    remote->connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QTRY_VERIFY(server.hasPendingConnections());
+    std::unique_ptr<QTcpSocket> origin(server.nextPendingConnection());
+    origin->setParent(nullptr);
+    QTRY_COMPARE(remote->state(), QAbstractSocket::ConnectedState);
+
+    // The origin is a slow reader: once its small buffer and the kernel's
+    // are full, the relay's writes to it back up
+    origin->setReadBufferSize(65536);
+    PlainRelay relay(local, std::move(remote));
+
+    const int total = 32 * 1024 * 1024;
+    client.write(QByteArray(total, 'x'));
+    QTRY_VERIFY_WITH_TIMEOUT(relay.localPaused(), 20000);
+    // A read only starts below the high watermark, so it's overshot by one
+    // read at most. Paused reads don't resume until the low watermark
+    QVERIFY(relay.pending() > PlainRelay::Low);
+    QVERIFY(relay.pending() <= PlainRelay::High + 65536);
+    QTest::qWait(200);
+    QVERIFY(relay.localPaused());
+    QVERIFY(relay.pending() <= PlainRelay::High + 65536);
+
+    qint64 received = 0;
+    connect(origin.get(), &QTcpSocket::readyRead, this, [&origin, &received]() {
+        received += origin->readAll().size();
+    });
+    origin->setReadBufferSize(0);
+    received += origin->readAll().size();
+    QTRY_COMPARE_WITH_TIMEOUT(received, qint64(total), 20000);
+    QVERIFY(!relay.localPaused());
+}
+
+QTEST_MAIN(TcpRelay)
+#include "tcprelay.moc"
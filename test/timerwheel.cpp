@@ -0,0 +1,124 @@
+#include "util/timerwheel.h"
+
+#include <QtTest>
+
+class TimerWheel : public QObject
+{
+    Q_OBJECT
+
+public:
+    TimerWheel() = default;
+
+private Q_SLOTS:
+    void testSchedule();
+    void testCancel();
+    void testLongPause();
+    void testReentrancy();
+    void testCascade();
+    void testBeyondTopLevel();
+};
+
+void TimerWheel::testSchedule()
+{
+    QSS::TimerWheel wheel(1000, 8);
+    std::vector<int> fired;
+    wheel.schedule(0, 1500, [&fired]() { fired.push_back(1); });
+    wheel.schedule(0, 500, [&fired]() { fired.push_back(2); });
+    // More than one round away
+    wheel.schedule(0, 20000, [&fired]() { fired.push_back(3); });
+    QCOMPARE(wheel.size(), size_t(3));
+
+    wheel.advance(999);
+    QVERIFY(fired.empty());
+    wheel.advance(1000);
+    QVERIFY(fired == std::vector<int>({ 2 }));
+    wheel.advance(2000);
+    QVERIFY(fired == std::vector<int>({ 2, 1 }));
+    wheel.advance(19999);
+    QCOMPARE(fired.size(), size_t(2));
+    wheel.advance(20000);
+    QVERIFY(fired == std::vector<int>({ 2, 1, 3 }));
+    QCOMPARE(wheel.size(), size_t(0));
+}
+
+void TimerWheel::testCancel()
+{
+    QSS::TimerWheel wheel(1000, 8);
+    bool fired = false;
+    const QSS::TimerWheel::TimerId id = wheel.schedule(0, 1000, [&fired]() { fired = true; });
+    QVERIFY(wheel.cancel(id));
+    QVERIFY(!wheel.cancel(id));
+    wheel.advance(5000);
+    QVERIFY(!fired);
+}
+
+void TimerWheel::testLongPause()
+{
+    QSS::TimerWheel wheel(1000, 8);
+    int fired = 0;
+    wheel.schedule(0, 3000, [&fired]() { ++fired; });
+    wheel.schedule(0, 100000, [&fired]() { ++fired; });
+    wheel.advance(90000);
+    QCOMPARE(fired, 1);
+    wheel.advance(100000);
+    QCOMPARE(fired, 2);
+}
+
+void TimerWheel::testReentrancy()
+{
+    QSS::TimerWheel wheel(1000, 8);
+    std::vector<int> fired;
+    QSS::TimerWheel::TimerId other = 0;
+    wheel.schedule(0, 1000, [&]() {
+        fired.push_back(1);
+        wheel.cancel(other);
+        wheel.schedule(1000, 0, [&fired]() { fired.push_back(3); });
+    });
+    other = wheel.schedule(0, 1000, [&fired]() { fired.push_back(2); });
+    wheel.advance(1000);
+    QVERIFY(fired == std::vector<int>({ 1 }));
+    // Due timers run on the next tick at the earliest
+    wheel.advance(2000);
+    QVERIFY(fired == std::vector<int>({ 1, 3 }));
+}
+
+void TimerWheel::testCascade()
+{
+    // Levels of 1, 4 and 16 ticks per slot
+    QSS::TimerWheel wheel(1000, 4, 3);
+    std::vector<int> fired;
+    wheel.schedule(0, 3000, [&fired]() { fired.push_back(1); });
+    wheel.schedule(0, 9000, [&fired]() { fired.push_back(2); });
+    wheel.schedule(0, 37000, [&fired]() { fired.push_back(3); });
+    for (int64_t now = 1000; now <= 40000; now += 1000) {
+        wheel.advance(now);
+        if (now == 3000) {
+            QVERIFY(fired == std::vector<int>({ 1 }));
+        } else if (now == 8000 || now == 36000) {
+            QCOMPARE(fired.size(), size_t(now == 8000 ? 1 : 2));
+        } else if (now == 9000) {
+            QVERIFY(fired == std::vector<int>({ 1, 2 }));
+        } else if (now == 37000) {
+            QVERIFY(fired == std::vector<int>({ 1, 2, 3 }));
+        }
+    }
+    QCOMPARE(wheel.size(), size_t(0));
+}
+
+void TimerWheel::testBeyondTopLevel()
+{
+    // The top level spans 8 ticks, the timer goes around it several times
+    QSS::TimerWheel wheel(1000, 2, 3);
+    bool fired = false;
+    const QSS::TimerWheel::TimerId id = wheel.schedule(500, 30000, [&fired]() { fired = true; });
+    for (int64_t now = 1000; now < 31000; now += 1000) {
+        wheel.advance(now);
+        QVERIFY(!fired);
+    }
+    wheel.advance(31000);
+    QVERIFY(fired);
+    QVERIFY(!wheel.cancel(id));
+}
+
+QTEST_MAIN(TimerWheel)
+#include "timerwheel.moc"
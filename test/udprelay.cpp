@@ -0,0 +1,179 @@
+#include "crypto/encryptor.h"
+#include "network/udprelay.h"
+#include "util/common.h"
+
+#include <QUdpSocket>
+#include <QtTest>
+
+namespace {
+
+const char Method[] = "aes-256-gcm";
+const char Password[] = "test";
+
+}  // namespace
+
+// A server with shared outbound sockets (see UdpRelay::setSharedOutboundSockets())
+class UdpRelay : public QObject
+{
+    Q_OBJECT
+
+public:
+    UdpRelay() = default;
+
+private Q_SLOTS:
+    void init();
+    void testSharedSocket();
+    void testConflict();
+    void testReuse();
+
+private:
+    quint16 relayPort = 0;
+    std::unique_ptr<QSS::UdpRelay> relay;
+    // Clients, and the destinations they send to
+    QUdpSocket a, b, d1, d2;
+
+    void startRelay(int sockets);
+    // Sends payload from client to destination through the relay
+    void send(QUdpSocket &client, const QUdpSocket &destination, const std::string &payload);
+    // A datagram that is known to be pending
+    static std::string read(QUdpSocket &socket, quint16 *port = nullptr);
+    // What a client gets when destination sends payload
+    static std::string reply(const QUdpSocket &destination, const std::string &payload);
+};
+
+void UdpRelay::init()
+{
+    relay.reset();
+    for (QUdpSocket *socket : { &a, &b, &d1, &d2 }) {
+        socket->close();
+        QVERIFY(socket->bind(QHostAddress::LocalHost, 0));
+    }
+}
+
+void UdpRelay::startRelay(int sockets)
+{
+    QUdpSocket probe;
+    QVERIFY(probe.bind(QHostAddress::LocalHost, 0));
+    relayPort = probe.localPort();
+    probe.close();
+
+    relay.reset(new QSS::UdpRelay(Method, Password, false, false, QSS::Address()));
+    relay->setSharedOutboundSockets(sockets);
+    QVERIFY(relay->listen(QHostAddress::LocalHost, relayPort));
+}
+
+void UdpRelay::send(QUdpSocket &client, const QUdpSocket &destination, const std::string &payload)
+{
+    QSS::Encryptor encryptor(Method, Password);
+    const std::string data = encryptor.encryptAll(
+                QSS::Common::packAddress(QHostAddress::LocalHost, destination.localPort()) + payload);
+    client.writeDatagram(data.data(), data.size(), QHostAddress::LocalHost, relayPort);
+}
+
+std::string UdpRelay::read(QUdpSocket &socket, quint16 *port)
+{
+    std::string data(static_cast<size_t>(socket.pendingDatagramSize()), '\0');
+    quint16 from = 0;
+    socket.readDatagram(&data[0], data.size(), nullptr, &from);
+    if (port) {
+        *port = from;
+    }
+    return data;
+}
+
+std::string UdpRelay::reply(const QUdpSocket &destination, const std::string &payload)
+{
+    return QSS::Common::packAddress(QHostAddress::LocalHost, destination.localPort()) + payload;
+}
+
+void UdpRelay::testSharedSocket()
+{
+    startRelay(1);
+    send(a, d1, "a1");
+    send(b, d2, "b2");
+
+    quint16 p1 = 0, p2 = 0;
+    QTRY_VERIFY(d1.hasPendingDatagrams());
+    QCOMPARE(read(d1, &p1), std::string("a1"));
+    QTRY_VERIFY(d2.hasPendingDatagrams());
+    QCOMPARE(read(d2, &p2), std::string("b2"));
+    // Both clients went out through the one socket
+    QCOMPARE(p1, p2);
+    QCOMPARE(relay->associationCount(), size_t(2));
+
+    // And the replies go back to the right client
+    d1.writeDatagram("r1", 2, QHostAddress::LocalHost, p1);
+    d2.writeDatagram("r2", 2, QHostAddress::LocalHost, p2);
+    QSS::Encryptor encryptor(Method, Password);
+    QTRY_VERIFY(a.hasPendingDatagrams());
+    QCOMPARE(encryptor.decryptAll(read(a)), reply(d1, "r1"));
+    QTRY_VERIFY(b.hasPendingDatagrams());
+    QCOMPARE(encryptor.decryptAll(read(b)), reply(d2, "r2"));
+    QTest::qWait(100);
+    QVERIFY(!a.hasPendingDatagrams());
+    QVERIFY(!b.hasPendingDatagrams());
+}
+
+void UdpRelay::testConflict()
+{
+    startRelay(1);
+    send(a, d1, "a1");
+    QTRY_VERIFY(d1.hasPendingDatagrams());
+    quint16 bound = 0;
+    read(d1, &bound);
+
+    // The replies of d1 to the only socket belong to a
+    send(b, d1, "b1");
+    QTRY_COMPARE(relay->droppedDatagrams(), quint64(1));
+    QTest::qWait(100);
+    QVERIFY(!d1.hasPendingDatagrams());
+
+    // a itself keeps its binding
+    send(a, d1, "a2");
+    quint16 port = 0;
+    QTRY_VERIFY(d1.hasPendingDatagrams());
+    QCOMPARE(read(d1, &port), std::string("a2"));
+    QCOMPARE(port, bound);
+
+    // With another socket, b goes out through that one
+    init();
+    startRelay(2);
+    send(a, d1, "a1");
+    QTRY_VERIFY(d1.hasPendingDatagrams());
+    read(d1, &bound);
+    send(b, d1, "b1");
+    QTRY_VERIFY(d1.hasPendingDatagrams());
+    QCOMPARE(read(d1, &port), std::string("b1"));
+    QVERIFY(port != bound);
+    QCOMPARE(relay->droppedDatagrams(), quint64(0));
+}
+
+void UdpRelay::testReuse()
+{
+    startRelay(1);
+    relay->setNatReuseDelay(200);
+    send(a, d1, "a1");
+    quint16 bound = 0;
+    QTRY_VERIFY(d1.hasPendingDatagrams());
+    read(d1, &bound);
+
+    // Once a has been quiet for the delay, b takes the binding over
+    QTest::qWait(300);
+    send(b, d1, "b1");
+    quint16 port = 0;
+    QTRY_VERIFY(d1.hasPendingDatagrams());
+    QCOMPARE(read(d1, &port), std::string("b1"));
+    QCOMPARE(port, bound);
+    QCOMPARE(relay->droppedDatagrams(), quint64(0));
+
+    // The replies go to b from now on
+    d1.writeDatagram("r1", 2, QHostAddress::LocalHost, port);
+    QSS::Encryptor encryptor(Method, Password);
+    QTRY_VERIFY(b.hasPendingDatagrams());
+    QCOMPARE(encryptor.decryptAll(read(b)), reply(d1, "r1"));
+    QTest::qWait(100);
+    QVERIFY(!a.hasPendingDatagrams());
+}
+
+QTEST_MAIN(UdpRelay)
+#include "udprelay.moc"